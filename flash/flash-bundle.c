@@ -0,0 +1,519 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "flash-common.h"
+#include "flash-bundle.h"
+
+/* The layout, all numbers little endian:
+ *
+ *   header   magic, version, file count, size of the names, CRC-32 of the
+ *            entries and names, payload offset and size, file size
+ *   entries  per file: name offset and length (into the names), data
+ *            offset (into the payload) and size; sorted by name
+ *   names    NUL terminated
+ *   payload  starts on a page boundary, each file's data on a
+ *            BUNDLE_ALIGN boundary; files with the same contents share
+ *            their data
+ */
+#define BUNDLE_MAGIC       "FLBUNDLE"
+#define BUNDLE_VERSION     1
+#define BUNDLE_HEADER_SIZE 48
+#define BUNDLE_ENTRY_SIZE  24
+#define BUNDLE_PAGE_SIZE   4096
+#define BUNDLE_ALIGN       16
+
+#define GET_UINT32(p) \
+  ((guint32) (p)[0] | ((guint32) (p)[1] << 8) | \
+   ((guint32) (p)[2] << 16) | ((guint32) (p)[3] << 24))
+#define GET_UINT64(p) \
+  ((guint64) GET_UINT32 (p) | ((guint64) GET_UINT32 ((p) + 4) << 32))
+
+#define ENTRY(b, i) ((b)->entries + (gsize) (i) * BUNDLE_ENTRY_SIZE)
+
+struct _FlashBundle {
+  guint refs;
+  gchar *path;
+  guint8 *map;
+  gsize map_size;
+
+  guint n_files;
+  const guint8 *entries;
+  const gchar *names;
+  const guint8 *payload;
+};
+
+/* --- Reading --- */
+
+static gboolean
+flash_bundle_check (FlashBundle *bundle, GError **error)
+{
+  const guint8 *header;
+  const guint8 *entry;
+  const gchar *prev;
+  const gchar *name;
+  guint32 names_size;
+  guint32 name_offset;
+  guint32 name_len;
+  guint64 payload_offset;
+  guint64 payload_size;
+  guint64 offset;
+  guint64 size;
+  gsize index_size;
+  guint i;
+
+  header = bundle->map;
+  if (bundle->map_size < BUNDLE_HEADER_SIZE ||
+      memcmp (header, BUNDLE_MAGIC, 8) != 0)
+    goto invalid;
+  if (GET_UINT32 (header + 8) != BUNDLE_VERSION)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                 "'%s' is a version %u bundle, only version %u is supported",
+                 bundle->path, GET_UINT32 (header + 8), BUNDLE_VERSION);
+    return FALSE;
+  }
+
+  bundle->n_files = GET_UINT32 (header + 12);
+  names_size = GET_UINT32 (header + 16);
+  payload_offset = GET_UINT64 (header + 24);
+  payload_size = GET_UINT64 (header + 32);
+  if (GET_UINT64 (header + 40) != bundle->map_size)
+    goto invalid;
+
+  /* All sizes are checked against the file's before any is added up */
+  if (bundle->n_files > bundle->map_size / BUNDLE_ENTRY_SIZE ||
+      names_size > bundle->map_size ||
+      payload_offset > bundle->map_size ||
+      payload_size > bundle->map_size - payload_offset)
+    goto invalid;
+  index_size = (gsize) bundle->n_files * BUNDLE_ENTRY_SIZE + names_size;
+  if (BUNDLE_HEADER_SIZE + index_size > payload_offset)
+    goto invalid;
+  if (crc32 (0, header + BUNDLE_HEADER_SIZE, index_size) !=
+      GET_UINT32 (header + 20))
+    goto invalid;
+
+  bundle->entries = bundle->map + BUNDLE_HEADER_SIZE;
+  bundle->names = (const gchar *) bundle->entries +
+                  (gsize) bundle->n_files * BUNDLE_ENTRY_SIZE;
+  bundle->payload = bundle->map + payload_offset;
+
+  prev = NULL;
+  for (i = 0; i < bundle->n_files; i++)
+  {
+    entry = ENTRY (bundle, i);
+    name_offset = GET_UINT32 (entry);
+    name_len = GET_UINT32 (entry + 4);
+    offset = GET_UINT64 (entry + 8);
+    size = GET_UINT64 (entry + 16);
+    if (name_offset >= names_size || name_len >= names_size - name_offset ||
+        offset > payload_size || size > payload_size - offset)
+      goto invalid;
+    name = bundle->names + name_offset;
+    if (name_len == 0 || name[name_len] != '\0' ||
+        strlen (name) != name_len)
+      goto invalid;
+    /* Lookups rely on the order */
+    if (prev && strcmp (prev, name) >= 0)
+      goto invalid;
+    prev = name;
+  }
+  return TRUE;
+
+invalid:
+  g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+               "'%s' is not a valid bundle", bundle->path);
+  return FALSE;
+}
+
+FlashBundle *
+flash_bundle_open (const gchar *path, GError **error)
+{
+  FlashBundle *bundle;
+  struct stat sb;
+  void *map;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to open() '%s': %s", path, strerror(errno));
+    return NULL;
+  }
+  if (fstat (fd, &sb) == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to stat '%s': %s", path, strerror(errno));
+    close (fd);
+    return NULL;
+  }
+  map = sb.st_size > 0 ? mmap (0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                       : MAP_FAILED;
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to mmap() '%s': %s", path,
+                 sb.st_size > 0 ? strerror(errno) : "empty file");
+    return NULL;
+  }
+
+  bundle = g_new0 (FlashBundle, 1);
+  bundle->refs = 1;
+  bundle->path = g_strdup (path);
+  bundle->map = map;
+  bundle->map_size = sb.st_size;
+  if (!flash_bundle_check (bundle, error))
+  {
+    flash_bundle_unref (bundle);
+    return NULL;
+  }
+  DEBUG ("opened bundle '%s', %u files", path, bundle->n_files);
+  return bundle;
+}
+
+FlashBundle *
+flash_bundle_ref (FlashBundle *bundle)
+{
+  bundle->refs++;
+  return bundle;
+}
+
+void
+flash_bundle_unref (FlashBundle *bundle)
+{
+  if (--bundle->refs > 0)
+    return;
+  munmap (bundle->map, bundle->map_size);
+  g_free (bundle->path);
+  g_free (bundle);
+}
+
+const gchar *
+flash_bundle_get_path (FlashBundle *bundle)
+{
+  return bundle->path;
+}
+
+guint
+flash_bundle_get_n_files (FlashBundle *bundle)
+{
+  return bundle->n_files;
+}
+
+const gchar *
+flash_bundle_get_name (FlashBundle *bundle, guint i)
+{
+  g_return_val_if_fail (i < bundle->n_files, NULL);
+  return bundle->names + GET_UINT32 (ENTRY (bundle, i));
+}
+
+gboolean
+flash_bundle_lookup (FlashBundle *bundle, const gchar *name,
+                     const guint8 **data, gsize *size)
+{
+  const guint8 *entry;
+  guint lo;
+  guint hi;
+  guint mid;
+  gint cmp;
+
+  while (*name == '/')
+    name++;
+  lo = 0;
+  hi = bundle->n_files;
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    entry = ENTRY (bundle, mid);
+    cmp = strcmp (name, bundle->names + GET_UINT32 (entry));
+    if (cmp == 0)
+    {
+      *data = bundle->payload + GET_UINT64 (entry + 8);
+      *size = GET_UINT64 (entry + 16);
+      return TRUE;
+    }
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return FALSE;
+}
+
+/* --- Writing --- */
+
+typedef struct {
+  const gchar *name;
+  const gchar *source;
+  void *map;
+  gsize size;
+  guint32 crc;
+  /* The entry whose data this one shares, or itself */
+  gint blob;
+  guint64 offset;
+} BundleInput;
+
+static void
+put_uint32 (guint8 *p, guint32 value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+static void
+put_uint64 (guint8 *p, guint64 value)
+{
+  put_uint32 (p, (guint32) value);
+  put_uint32 (p + 4, (guint32) (value >> 32));
+}
+
+static void
+flash_bundle_free_blob_list (gpointer key, gpointer value, gpointer data)
+{
+  g_list_free (value);
+}
+
+static int
+flash_bundle_compare_inputs (const void *a, const void *b)
+{
+  return strcmp (((const BundleInput *) a)->name,
+                 ((const BundleInput *) b)->name);
+}
+
+static gboolean
+flash_bundle_map_input (BundleInput *input, GError **error)
+{
+  struct stat sb;
+  int fd;
+
+  fd = open (input->source, O_RDONLY);
+  if (fd == -1 || fstat (fd, &sb) == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to open() '%s': %s", input->source, strerror(errno));
+    if (fd != -1)
+      close (fd);
+    return FALSE;
+  }
+  input->size = sb.st_size;
+  input->map = NULL;
+  if (input->size > 0)
+  {
+    input->map = mmap (0, input->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (input->map == MAP_FAILED)
+    {
+      input->map = NULL;
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                   "Failed to mmap() '%s': %s", input->source,
+                   strerror(errno));
+      close (fd);
+      return FALSE;
+    }
+  }
+  close (fd);
+  input->crc = crc32 (0, input->map, input->size);
+  return TRUE;
+}
+
+gboolean
+flash_bundle_write (const gchar *path, gchar **names, gchar **sources,
+                    GError **error)
+{
+  static const guint8 zeros[BUNDLE_PAGE_SIZE];
+  BundleInput *inputs;
+  BundleInput *input;
+  GHashTable *blobs;
+  GList *same;
+  GList *l;
+  gchar *key;
+  gchar *tmp_path;
+  guint8 *index;
+  gsize index_size;
+  gsize names_size;
+  guint64 payload_offset;
+  guint64 payload_size;
+  guint64 pos;
+  guint n;
+  guint i;
+  FILE *out;
+  gboolean failed;
+  gboolean ret;
+
+  for (n = 0; names[n]; n++)
+    g_return_val_if_fail (sources[n] != NULL, FALSE);
+
+  ret = FALSE;
+  out = NULL;
+  index = NULL;
+  tmp_path = NULL;
+  blobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  inputs = g_new0 (BundleInput, MAX (n, 1));
+  names_size = 0;
+  for (i = 0; i < n; i++)
+  {
+    inputs[i].name = names[i];
+    while (*inputs[i].name == '/')
+      inputs[i].name++;
+    inputs[i].source = sources[i];
+    names_size += strlen (inputs[i].name) + 1;
+    if (*inputs[i].name == '\0')
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                   "Empty name for '%s'", sources[i]);
+      goto out;
+    }
+  }
+  qsort (inputs, n, sizeof(BundleInput), flash_bundle_compare_inputs);
+
+  /* Map every input, and find the ones with the same contents */
+  payload_size = 0;
+  for (i = 0; i < n; i++)
+  {
+    input = &inputs[i];
+    if (i > 0 && strcmp (inputs[i - 1].name, input->name) == 0)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                   "'%s' is in the bundle twice", input->name);
+      goto out;
+    }
+    if (!flash_bundle_map_input (input, error))
+      goto out;
+
+    key = g_strdup_printf ("%08x-%lu", input->crc, (gulong) input->size);
+    same = g_hash_table_lookup (blobs, key);
+    input->blob = i;
+    for (l = same; l; l = l->next)
+    {
+      if (input->size == 0 ||
+          memcmp (inputs[GPOINTER_TO_INT (l->data)].map, input->map,
+                  input->size) == 0)
+      {
+        input->blob = GPOINTER_TO_INT (l->data);
+        break;
+      }
+    }
+    if (input->blob == (gint) i)
+    {
+      payload_size = (payload_size + BUNDLE_ALIGN - 1) & ~(guint64) (BUNDLE_ALIGN - 1);
+      input->offset = payload_size;
+      payload_size += input->size;
+      g_hash_table_insert (blobs, key,
+                           g_list_append (same, GINT_TO_POINTER (i)));
+    }
+    else
+    {
+      input->offset = inputs[input->blob].offset;
+      g_free (key);
+    }
+  }
+
+  /* Header, entries and names */
+  index_size = BUNDLE_HEADER_SIZE + (gsize) n * BUNDLE_ENTRY_SIZE +
+               names_size;
+  payload_offset = (index_size + BUNDLE_PAGE_SIZE - 1) &
+                   ~(guint64) (BUNDLE_PAGE_SIZE - 1);
+  index = g_malloc0 (index_size);
+  pos = 0;
+  for (i = 0; i < n; i++)
+  {
+    input = &inputs[i];
+    put_uint32 (index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE, pos);
+    put_uint32 (index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE + 4,
+                strlen (input->name));
+    put_uint64 (index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE + 8,
+                input->offset);
+    put_uint64 (index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE + 16,
+                input->size);
+    strcpy ((gchar *) index + BUNDLE_HEADER_SIZE + n * BUNDLE_ENTRY_SIZE +
+            pos, input->name);
+    pos += strlen (input->name) + 1;
+  }
+  memcpy (index, BUNDLE_MAGIC, 8);
+  put_uint32 (index + 8, BUNDLE_VERSION);
+  put_uint32 (index + 12, n);
+  put_uint32 (index + 16, names_size);
+  put_uint32 (index + 20, crc32 (0, index + BUNDLE_HEADER_SIZE,
+                                 index_size - BUNDLE_HEADER_SIZE));
+  put_uint64 (index + 24, payload_offset);
+  put_uint64 (index + 32, payload_size);
+  put_uint64 (index + 40, payload_offset + payload_size);
+
+  /* Written next to the bundle and renamed over it, so a bundle being
+   * replaced is never seen half written */
+  tmp_path = g_strdup_printf ("%s.tmp", path);
+  out = fopen (tmp_path, "wb");
+  if (!out)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to open '%s': %s", tmp_path, strerror(errno));
+    goto out;
+  }
+  fwrite (index, 1, index_size, out);
+  fwrite (zeros, 1, payload_offset - index_size, out);
+  pos = 0;
+  for (i = 0; i < n; i++)
+  {
+    input = &inputs[i];
+    if (input->blob != (gint) i)
+      continue;
+    fwrite (zeros, 1, input->offset - pos, out);
+    fwrite (input->map, 1, input->size, out);
+    pos = input->offset + input->size;
+  }
+  failed = ferror (out);
+  if (fclose (out) != 0)
+    failed = TRUE;
+  out = NULL;
+  if (failed)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to write '%s': %s", tmp_path, strerror(errno));
+    unlink (tmp_path);
+    goto out;
+  }
+  if (rename (tmp_path, path) == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to rename '%s' to '%s': %s", tmp_path, path,
+                 strerror(errno));
+    unlink (tmp_path);
+    goto out;
+  }
+  ret = TRUE;
+
+out:
+  if (out)
+  {
+    fclose (out);
+    unlink (tmp_path);
+  }
+  for (i = 0; i < n; i++)
+  {
+    if (inputs[i].map)
+      munmap (inputs[i].map, inputs[i].size);
+  }
+  g_hash_table_foreach (blobs, (GHFunc) flash_bundle_free_blob_list, NULL);
+  g_hash_table_destroy (blobs);
+  g_free (inputs);
+  g_free (index);
+  g_free (tmp_path);
+  return ret;
+}
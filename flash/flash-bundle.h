@@ -0,0 +1,41 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_BUNDLE_H__
+#define __FLASH_BUNDLE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Many files packed into one: an index of names sorted for binary search,
+ * and their contents, identical ones stored once. A bundle is checked
+ * once when it's opened and mapped whole; every lookup is then a slice of
+ * that one mapping, with no further system calls. Names are relative
+ * paths, e.g. "movies/intro.swf". */
+typedef struct _FlashBundle FlashBundle;
+
+FlashBundle *flash_bundle_open        (const gchar *path, GError **error);
+FlashBundle *flash_bundle_ref         (FlashBundle *bundle);
+void         flash_bundle_unref       (FlashBundle *bundle);
+
+const gchar *flash_bundle_get_path    (FlashBundle *bundle);
+guint        flash_bundle_get_n_files (FlashBundle *bundle);
+/* Names in sorted order, for 0 <= i < flash_bundle_get_n_files() */
+const gchar *flash_bundle_get_name    (FlashBundle *bundle, guint i);
+/* Points *data into the mapping, which lasts as long as the bundle. A
+ * leading '/' on name is ignored. */
+gboolean     flash_bundle_lookup      (FlashBundle *bundle, const gchar *name,
+                                       const guint8 **data, gsize *size);
+
+/* Writes a bundle to path holding, under names[i], the contents of the
+ * file sources[i]; both arrays are NULL terminated and the same length */
+gboolean     flash_bundle_write       (const gchar *path, gchar **names,
+                                       gchar **sources, GError **error);
+
+G_END_DECLS
+
+#endif
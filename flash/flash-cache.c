@@ -0,0 +1,841 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "flash-common.h"
+#include "flash-cache.h"
+
+#define CACHE_INDEX         "index"
+/* Held while the index is read or replaced, as several processes may
+ * share the directory */
+#define CACHE_LOCK          "lock"
+#define CACHE_INDEX_HEADER  "flash-cache 1"
+#define CACHE_INDEX_FIELDS  10
+/* The index is written out this long after the first change */
+#define CACHE_SAVE_DELAY_MS 2000
+/* Without an explicit lifetime, a response stays fresh for a tenth of its
+ * age at the time (as most browsers do), up to a day */
+#define CACHE_HEURISTIC_MAX (24 * 60 * 60)
+/* Files no entry refers to are only removed once they're this old, since
+ * another process may still be writing them or yet to save its index */
+#define CACHE_ORPHAN_AGE    (60 * 60)
+
+typedef struct {
+  guint refs;
+  guint64 size;
+} CacheBody;
+
+struct _FlashCache {
+  gchar *dir;
+  guint64 budget;
+  /* URL to FlashCacheEntry, keyed by the entry's url */
+  GHashTable *entries;
+  /* Body file name to CacheBody */
+  GHashTable *bodies;
+  guint64 size;
+  /* The entries, most recently used first; each one's lru_link */
+  GList *lru;
+  GList *lru_tail;
+  gboolean dirty;
+  /* Only lookups since the last save, which alone don't warrant one */
+  gboolean touched;
+  guint save_id;
+};
+
+struct _FlashCacheWriter {
+  FlashCache *cache;
+  FlashCacheEntry *entry;
+  gchar *tmp_path;
+  int fd;
+  guint64 hash;
+};
+
+static void flash_cache_trim (FlashCache *cache);
+
+static gchar *
+flash_cache_path (FlashCache *cache, const gchar *name)
+{
+  return g_build_filename (cache->dir, name, NULL);
+}
+
+static void
+flash_cache_entry_free (FlashCacheEntry *entry)
+{
+  g_free (entry->url);
+  g_free (entry->name);
+  g_free (entry->content_type);
+  g_free (entry->etag);
+  g_free (entry->last_modified);
+  g_free (entry);
+}
+
+/* --- Recency --- */
+
+static void
+flash_cache_lru_unlink (FlashCache *cache, GList *link)
+{
+  if (link->prev)
+    link->prev->next = link->next;
+  else
+    cache->lru = link->next;
+  if (link->next)
+    link->next->prev = link->prev;
+  else
+    cache->lru_tail = link->prev;
+  link->prev = NULL;
+  link->next = NULL;
+}
+
+static void
+flash_cache_lru_push (FlashCache *cache, GList *link)
+{
+  link->next = cache->lru;
+  if (cache->lru)
+    cache->lru->prev = link;
+  else
+    cache->lru_tail = link;
+  cache->lru = link;
+}
+
+/* Most recently used first */
+static gint
+flash_cache_compare_used (gconstpointer a, gconstpointer b)
+{
+  const FlashCacheEntry *ea;
+  const FlashCacheEntry *eb;
+
+  ea = a;
+  eb = b;
+  if (ea->last_used == eb->last_used)
+    return 0;
+  return ea->last_used > eb->last_used ? -1 : 1;
+}
+
+/* --- Bodies --- */
+
+static void
+flash_cache_ref_body (FlashCache *cache, const gchar *name, guint64 size)
+{
+  CacheBody *body;
+
+  body = g_hash_table_lookup (cache->bodies, name);
+  if (!body)
+  {
+    body = g_new0 (CacheBody, 1);
+    body->size = size;
+    g_hash_table_insert (cache->bodies, g_strdup (name), body);
+    cache->size += size;
+  }
+  body->refs++;
+}
+
+static void
+flash_cache_unref_body (FlashCache *cache, const gchar *name)
+{
+  CacheBody *body;
+  gchar *path;
+
+  body = g_hash_table_lookup (cache->bodies, name);
+  if (!body || --body->refs > 0)
+    return;
+  path = flash_cache_path (cache, name);
+  unlink (path);
+  g_free (path);
+  cache->size -= body->size;
+  g_hash_table_remove (cache->bodies, name);
+}
+
+/* --- The index --- */
+
+/* Returns the locked descriptor to close, or -1; the cache carries on
+ * unlocked if it can't be had */
+static int
+flash_cache_lock (FlashCache *cache)
+{
+  gchar *path;
+  int fd;
+
+  path = flash_cache_path (cache, CACHE_LOCK);
+  fd = open (path, O_RDWR | O_CREAT, 0600);
+  g_free (path);
+  if (fd == -1)
+    return -1;
+  while (flock (fd, LOCK_EX) == -1)
+  {
+    if (errno != EINTR)
+    {
+      close (fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+static void
+flash_cache_unlock (int fd)
+{
+  if (fd != -1)
+    close (fd);
+}
+
+static void
+flash_cache_format_entry (gpointer key, gpointer value, gpointer data)
+{
+  FlashCacheEntry *entry;
+  gchar *fields[4];
+  gint i;
+
+  entry = value;
+  fields[0] = g_strescape (entry->url, NULL);
+  fields[1] = g_strescape (entry->etag ? entry->etag : "", NULL);
+  fields[2] = g_strescape (entry->last_modified ? entry->last_modified : "",
+                           NULL);
+  fields[3] = g_strescape (entry->content_type ? entry->content_type : "",
+                           NULL);
+  g_string_append_printf ((GString *) data,
+                          "%s\t%s\t%" G_GUINT64_FORMAT "\t%ld\t%ld\t%d\t%ld"
+                          "\t%s\t%s\t%s\n",
+                          fields[0], entry->name, entry->size, entry->stored,
+                          entry->max_age, entry->must_revalidate,
+                          entry->last_used, fields[1], fields[2], fields[3]);
+  for (i = 0; i < 4; i++)
+    g_free (fields[i]);
+}
+
+/* Written to a temporary file of this process's own and renamed over
+ * the old one, so a crash leaves one or the other */
+static gboolean
+flash_cache_save (FlashCache *cache)
+{
+  GString *index;
+  gchar *path;
+  gchar *tmp_path;
+  gsize written;
+  ssize_t n;
+  gboolean ret;
+  int lock_fd;
+  int fd;
+
+  ret = FALSE;
+  index = g_string_new (CACHE_INDEX_HEADER "\n");
+  g_hash_table_foreach (cache->entries, flash_cache_format_entry, index);
+
+  path = flash_cache_path (cache, CACHE_INDEX);
+  tmp_path = g_strconcat (path, ".tmp-XXXXXX", NULL);
+  lock_fd = flash_cache_lock (cache);
+  fd = mkstemp (tmp_path);
+  if (fd == -1)
+    goto out;
+  written = 0;
+  while (written < index->len)
+  {
+    n = write (fd, index->str + written, index->len - written);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+      break;
+    written += n;
+  }
+  close (fd);
+  if (written < index->len || rename (tmp_path, path) == -1)
+  {
+    unlink (tmp_path);
+    goto out;
+  }
+  cache->dirty = FALSE;
+  cache->touched = FALSE;
+  ret = TRUE;
+
+out:
+  if (!ret)
+    DEBUG ("failed to write HTTP cache index %s: %s", path, strerror (errno));
+  flash_cache_unlock (lock_fd);
+  g_string_free (index, TRUE);
+  g_free (tmp_path);
+  g_free (path);
+  return ret;
+}
+
+static gboolean
+flash_cache_save_timeout (gpointer data)
+{
+  FlashCache *cache;
+
+  cache = data;
+  cache->save_id = 0;
+  flash_cache_save (cache);
+  return FALSE;
+}
+
+static void
+flash_cache_changed (FlashCache *cache)
+{
+  cache->dirty = TRUE;
+  if (!cache->save_id)
+    cache->save_id = g_timeout_add (CACHE_SAVE_DELAY_MS,
+                                    flash_cache_save_timeout, cache);
+}
+
+static gchar *
+flash_cache_unescape (const gchar *field)
+{
+  if (*field == '\0')
+    return NULL;
+  return g_strcompress (field);
+}
+
+static void
+flash_cache_load (FlashCache *cache)
+{
+  FlashCacheEntry *entry;
+  struct stat sb;
+  gchar *contents;
+  gchar **lines;
+  gchar **fields;
+  gchar *path;
+  GList *l;
+  gint i;
+  gint n;
+
+  path = flash_cache_path (cache, CACHE_INDEX);
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+  {
+    g_free (path);
+    return;
+  }
+  g_free (path);
+
+  lines = g_strsplit (contents, "\n", 0);
+  g_free (contents);
+  if (!lines[0] || strcmp (lines[0], CACHE_INDEX_HEADER) != 0)
+  {
+    DEBUG ("ignoring HTTP cache index in %s, unknown format", cache->dir);
+    g_strfreev (lines);
+    return;
+  }
+
+  for (i = 1; lines[i]; i++)
+  {
+    fields = g_strsplit (lines[i], "\t", CACHE_INDEX_FIELDS);
+    for (n = 0; fields[n]; n++)
+      ;
+    if (n != CACHE_INDEX_FIELDS)
+    {
+      g_strfreev (fields);
+      continue;
+    }
+
+    entry = g_new0 (FlashCacheEntry, 1);
+    entry->url = g_strcompress (fields[0]);
+    entry->name = g_strdup (fields[1]);
+    entry->size = g_ascii_strtoull (fields[2], NULL, 10);
+    entry->stored = atol (fields[3]);
+    entry->max_age = atol (fields[4]);
+    entry->must_revalidate = atoi (fields[5]);
+    entry->last_used = atol (fields[6]);
+    entry->etag = flash_cache_unescape (fields[7]);
+    entry->last_modified = flash_cache_unescape (fields[8]);
+    entry->content_type = flash_cache_unescape (fields[9]);
+    g_strfreev (fields);
+
+    /* Bodies are only named after their contents, so don't trust one
+     * that isn't the size it should be */
+    path = flash_cache_path (cache, entry->name);
+    if (strchr (entry->name, '/') || stat (path, &sb) == -1 ||
+        (guint64) sb.st_size != entry->size ||
+        g_hash_table_lookup (cache->entries, entry->url))
+    {
+      g_free (path);
+      flash_cache_entry_free (entry);
+      continue;
+    }
+    g_free (path);
+    flash_cache_ref_body (cache, entry->name, entry->size);
+    g_hash_table_insert (cache->entries, entry->url, entry);
+    cache->lru = g_list_prepend (cache->lru, entry);
+  }
+  g_strfreev (lines);
+
+  cache->lru = g_list_sort (cache->lru, flash_cache_compare_used);
+  for (l = cache->lru; l; l = l->next)
+  {
+    entry = l->data;
+    entry->lru_link = l;
+    cache->lru_tail = l;
+  }
+}
+
+/* Removes old files no entry refers to: bodies left behind by a crash
+ * between writing a body and the index, and unfinished downloads */
+static void
+flash_cache_remove_orphans (FlashCache *cache)
+{
+  const gchar *name;
+  struct stat sb;
+  gchar *path;
+  time_t now;
+  GDir *dir;
+
+  dir = g_dir_open (cache->dir, 0, NULL);
+  if (!dir)
+    return;
+  now = time (NULL);
+  while ((name = g_dir_read_name (dir)))
+  {
+    if (strcmp (name, CACHE_INDEX) == 0 || strcmp (name, CACHE_LOCK) == 0 ||
+        g_hash_table_lookup (cache->bodies, name))
+      continue;
+    path = flash_cache_path (cache, name);
+    if (lstat (path, &sb) == 0 && S_ISREG (sb.st_mode) &&
+        now - sb.st_mtime >= CACHE_ORPHAN_AGE)
+      unlink (path);
+    g_free (path);
+  }
+  g_dir_close (dir);
+}
+
+/* --- The cache --- */
+
+FlashCache *
+flash_cache_new (const gchar *dir, guint64 budget)
+{
+  FlashCache *cache;
+  int lock_fd;
+
+  if (mkdir (dir, 0700) == -1 && errno != EEXIST)
+  {
+    DEBUG ("can't create HTTP cache %s: %s", dir, strerror (errno));
+    return NULL;
+  }
+
+  cache = g_new0 (FlashCache, 1);
+  cache->dir = g_strdup (dir);
+  cache->budget = budget;
+  cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) flash_cache_entry_free);
+  cache->bodies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         g_free);
+  lock_fd = flash_cache_lock (cache);
+  flash_cache_load (cache);
+  flash_cache_remove_orphans (cache);
+  flash_cache_unlock (lock_fd);
+  flash_cache_trim (cache);
+  DEBUG ("HTTP cache %s: %u entries, %" G_GUINT64_FORMAT " bytes", dir,
+         g_hash_table_size (cache->entries), cache->size);
+  return cache;
+}
+
+void
+flash_cache_free (FlashCache *cache)
+{
+  if (cache->save_id)
+    g_source_remove (cache->save_id);
+  if (cache->dirty || cache->touched)
+    flash_cache_save (cache);
+  g_list_free (cache->lru);
+  g_hash_table_destroy (cache->entries);
+  g_hash_table_destroy (cache->bodies);
+  g_free (cache->dir);
+  g_free (cache);
+}
+
+static void
+flash_cache_remove (FlashCache *cache, FlashCacheEntry *entry)
+{
+  gchar *name;
+
+  name = g_strdup (entry->name);
+  flash_cache_lru_unlink (cache, entry->lru_link);
+  g_list_free_1 (entry->lru_link);
+  g_hash_table_remove (cache->entries, entry->url);
+  flash_cache_unref_body (cache, name);
+  g_free (name);
+  flash_cache_changed (cache);
+}
+
+static void
+flash_cache_trim (FlashCache *cache)
+{
+  FlashCacheEntry *oldest;
+
+  while (cache->size > cache->budget && cache->lru_tail)
+  {
+    oldest = cache->lru_tail->data;
+    DEBUG ("HTTP cache: evicting '%s'", oldest->url);
+    flash_cache_remove (cache, oldest);
+  }
+}
+
+void
+flash_cache_set_budget (FlashCache *cache, guint64 budget)
+{
+  cache->budget = budget;
+  flash_cache_trim (cache);
+}
+
+FlashCacheEntry *
+flash_cache_lookup (FlashCache *cache, const gchar *url)
+{
+  FlashCacheEntry *entry;
+
+  entry = g_hash_table_lookup (cache->entries, url);
+  if (entry)
+  {
+    entry->last_used = time (NULL);
+    flash_cache_lru_unlink (cache, entry->lru_link);
+    flash_cache_lru_push (cache, entry->lru_link);
+    cache->touched = TRUE;
+  }
+  return entry;
+}
+
+gboolean
+flash_cache_is_fresh (FlashCacheEntry *entry)
+{
+  return time (NULL) < entry->stored + entry->max_age;
+}
+
+gboolean
+flash_cache_map (FlashCache *cache, FlashCacheEntry *entry, void **map,
+                 gsize *size)
+{
+  gchar *path;
+  int fd;
+
+  *map = NULL;
+  *size = 0;
+  if (entry->size == 0)
+    return TRUE;
+
+  path = flash_cache_path (cache, entry->name);
+  fd = open (path, O_RDONLY);
+  if (fd != -1)
+  {
+    *map = mmap (0, entry->size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+  }
+  if (fd == -1 || *map == MAP_FAILED)
+  {
+    DEBUG ("failed to map HTTP cache body %s: %s", path, strerror (errno));
+    g_free (path);
+    *map = NULL;
+    /* Not much use keeping it */
+    flash_cache_remove (cache, entry);
+    return FALSE;
+  }
+  g_free (path);
+  *size = entry->size;
+  return TRUE;
+}
+
+gchar *
+flash_cache_conditional_headers (FlashCacheEntry *entry)
+{
+  GString *headers;
+
+  if (!entry->etag && !entry->last_modified)
+    return NULL;
+  headers = g_string_new (NULL);
+  if (entry->etag)
+    g_string_append_printf (headers, "If-None-Match: %s\r\n", entry->etag);
+  if (entry->last_modified)
+    g_string_append_printf (headers, "If-Modified-Since: %s\r\n",
+                            entry->last_modified);
+  return g_string_free (headers, FALSE);
+}
+
+/* --- Freshness --- */
+
+static glong
+flash_cache_parse_date (const gchar *date)
+{
+  struct tm tm;
+
+  if (!date)
+    return -1;
+  memset (&tm, 0, sizeof(tm));
+  if (!strptime (date, "%a, %d %b %Y %H:%M:%S", &tm))
+    return -1;
+  return (glong) timegm (&tm);
+}
+
+/* How long the response to request stays fresh, from Cache-Control,
+ * Expires or Last-Modified. Returns FALSE if it mustn't be stored. */
+static gboolean
+flash_cache_get_lifetime (FlashHttpRequest *request, glong *max_age,
+                          gboolean *must_revalidate)
+{
+  const gchar *cache_control;
+  const gchar *pragma;
+  gchar **directives;
+  gboolean no_cache;
+  glong date;
+  glong expires;
+  glong modified;
+  gint i;
+
+  *max_age = -1;
+  *must_revalidate = FALSE;
+  no_cache = FALSE;
+
+  cache_control = flash_http_request_get_header (request, "Cache-Control");
+  if (cache_control)
+  {
+    directives = g_strsplit (cache_control, ",", 0);
+    for (i = 0; directives[i]; i++)
+    {
+      g_strstrip (directives[i]);
+      if (g_ascii_strcasecmp (directives[i], "no-store") == 0)
+      {
+        g_strfreev (directives);
+        return FALSE;
+      }
+      else if (g_ascii_strcasecmp (directives[i], "no-cache") == 0)
+        no_cache = TRUE;
+      else if (g_ascii_strcasecmp (directives[i], "must-revalidate") == 0)
+        *must_revalidate = TRUE;
+      else if (g_ascii_strncasecmp (directives[i], "max-age=", 8) == 0)
+        *max_age = atol (directives[i] + 8);
+    }
+    g_strfreev (directives);
+  }
+  pragma = flash_http_request_get_header (request, "Pragma");
+  if (!cache_control && pragma && strstr (pragma, "no-cache"))
+    no_cache = TRUE;
+
+  if (no_cache)
+    *max_age = 0;
+  if (*max_age >= 0)
+    return TRUE;
+
+  date = flash_cache_parse_date (flash_http_request_get_header (request,
+                                                                "Date"));
+  if (date < 0)
+    date = time (NULL);
+  expires = flash_cache_parse_date (flash_http_request_get_header (request,
+                                                                   "Expires"));
+  modified = flash_cache_parse_date (flash_http_request_get_header (request,
+                                                     "Last-Modified"));
+  if (flash_http_request_get_header (request, "Expires"))
+    *max_age = expires > date ? expires - date : 0;
+  else if (modified >= 0 && modified < date)
+    *max_age = MIN ((date - modified) / 10, CACHE_HEURISTIC_MAX);
+  else
+    *max_age = 0;
+  return TRUE;
+}
+
+static void
+flash_cache_set_validators (FlashCacheEntry *entry,
+                            FlashHttpRequest *request)
+{
+  const gchar *etag;
+  const gchar *last_modified;
+
+  etag = flash_http_request_get_header (request, "ETag");
+  last_modified = flash_http_request_get_header (request, "Last-Modified");
+  if (etag)
+  {
+    g_free (entry->etag);
+    entry->etag = g_strdup (etag);
+  }
+  if (last_modified)
+  {
+    g_free (entry->last_modified);
+    entry->last_modified = g_strdup (last_modified);
+  }
+}
+
+void
+flash_cache_revalidated (FlashCache *cache, const gchar *url,
+                         FlashHttpRequest *request)
+{
+  FlashCacheEntry *entry;
+
+  entry = g_hash_table_lookup (cache->entries, url);
+  if (!entry)
+    return;
+  if (!flash_cache_get_lifetime (request, &entry->max_age,
+                                 &entry->must_revalidate))
+  {
+    flash_cache_remove (cache, entry);
+    return;
+  }
+  flash_cache_set_validators (entry, request);
+  entry->stored = time (NULL);
+  flash_cache_changed (cache);
+}
+
+/* --- Writing --- */
+
+FlashCacheWriter *
+flash_cache_begin (FlashCache *cache, const gchar *url,
+                   FlashHttpRequest *request)
+{
+  FlashCacheWriter *writer;
+  FlashCacheEntry *entry;
+  const gchar *content_type;
+  const gchar *length;
+  gboolean must_revalidate;
+  glong max_age;
+  gchar *tmp_path;
+  int fd;
+
+  if (!flash_cache_get_lifetime (request, &max_age, &must_revalidate))
+    return NULL;
+  entry = g_new0 (FlashCacheEntry, 1);
+  flash_cache_set_validators (entry, request);
+  /* Nothing to be gained from a copy that can be neither reused nor
+   * revalidated */
+  if (max_age == 0 && !entry->etag && !entry->last_modified)
+  {
+    flash_cache_entry_free (entry);
+    return NULL;
+  }
+  length = flash_http_request_get_header (request, "Content-Length");
+  if (length && g_ascii_strtoull (length, NULL, 10) > cache->budget)
+  {
+    flash_cache_entry_free (entry);
+    return NULL;
+  }
+
+  tmp_path = flash_cache_path (cache, ".tmp-XXXXXX");
+  fd = mkstemp (tmp_path);
+  if (fd == -1)
+  {
+    DEBUG ("can't write to HTTP cache %s: %s", cache->dir, strerror (errno));
+    g_free (tmp_path);
+    flash_cache_entry_free (entry);
+    return NULL;
+  }
+
+  content_type = flash_http_request_get_header (request, "Content-Type");
+  entry->url = g_strdup (url);
+  entry->content_type = g_strdup (content_type);
+  entry->max_age = max_age;
+  entry->must_revalidate = must_revalidate;
+
+  writer = g_new0 (FlashCacheWriter, 1);
+  writer->cache = cache;
+  writer->entry = entry;
+  writer->tmp_path = tmp_path;
+  writer->fd = fd;
+  writer->hash = G_GINT64_CONSTANT (0xcbf29ce484222325U);
+  return writer;
+}
+
+gboolean
+flash_cache_write (FlashCacheWriter *writer, const guint8 *data, gsize len)
+{
+  const guint8 *p;
+  gsize remaining;
+  ssize_t n;
+  gsize i;
+
+  if (writer->entry->size + len > writer->cache->budget)
+    return FALSE;
+
+  for (i = 0; i < len; i++)
+  {
+    writer->hash ^= data[i];
+    writer->hash *= G_GINT64_CONSTANT (0x100000001b3U);
+  }
+  writer->entry->size += len;
+
+  p = data;
+  remaining = len;
+  while (remaining > 0)
+  {
+    n = write (writer->fd, p, remaining);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+    {
+      DEBUG ("failed to write to HTTP cache: %s", strerror (errno));
+      return FALSE;
+    }
+    p += n;
+    remaining -= n;
+  }
+  return TRUE;
+}
+
+void
+flash_cache_abort (FlashCacheWriter *writer)
+{
+  close (writer->fd);
+  unlink (writer->tmp_path);
+  g_free (writer->tmp_path);
+  flash_cache_entry_free (writer->entry);
+  g_free (writer);
+}
+
+/* Bodies are named after a 64 bit FNV-1a hash of their contents and
+ * their size */
+void
+flash_cache_commit (FlashCacheWriter *writer)
+{
+  FlashCache *cache;
+  FlashCacheEntry *entry;
+  FlashCacheEntry *old;
+  gchar *path;
+
+  cache = writer->cache;
+  entry = writer->entry;
+  entry->name = g_strdup_printf ("%08x%08x-%" G_GUINT64_FORMAT,
+                                 (guint32) (writer->hash >> 32),
+                                 (guint32) writer->hash, entry->size);
+  close (writer->fd);
+
+  if (g_hash_table_lookup (cache->bodies, entry->name))
+    unlink (writer->tmp_path);
+  else
+  {
+    path = flash_cache_path (cache, entry->name);
+    if (rename (writer->tmp_path, path) == -1)
+    {
+      DEBUG ("failed to rename() %s: %s", writer->tmp_path, strerror (errno));
+      unlink (writer->tmp_path);
+      g_free (path);
+      g_free (writer->tmp_path);
+      flash_cache_entry_free (entry);
+      g_free (writer);
+      return;
+    }
+    g_free (path);
+  }
+  g_free (writer->tmp_path);
+  g_free (writer);
+
+  /* The new body is referenced before the old one is let go, in case
+   * they're the same */
+  flash_cache_ref_body (cache, entry->name, entry->size);
+  old = g_hash_table_lookup (cache->entries, entry->url);
+  if (old)
+    flash_cache_remove (cache, old);
+  entry->stored = time (NULL);
+  entry->last_used = entry->stored;
+  g_hash_table_insert (cache->entries, entry->url, entry);
+  entry->lru_link = g_list_alloc ();
+  entry->lru_link->data = entry;
+  flash_cache_lru_push (cache, entry->lru_link);
+  DEBUG ("HTTP cache: stored '%s' as %s", entry->url, entry->name);
+  flash_cache_changed (cache);
+  flash_cache_trim (cache);
+}
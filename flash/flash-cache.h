@@ -0,0 +1,76 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_CACHE_H__
+#define __FLASH_CACHE_H__
+
+#include <glib.h>
+#include "flash-http.h"
+
+G_BEGIN_DECLS
+
+/* A disk cache of HTTP responses. Bodies are stored under a hash of their
+ * contents, so URLs serving the same data share one file; an index maps
+ * URLs to bodies and the headers needed to revalidate them. The least
+ * recently used URLs are dropped once the bodies go over the budget.
+ * Processes may share a directory; the last to save its index wins, and
+ * bodies only it knew about are cleared out later by the others. */
+typedef struct _FlashCache       FlashCache;
+typedef struct _FlashCacheWriter FlashCacheWriter;
+
+typedef struct {
+  gchar *url;
+  gchar *name;             /* body file in the cache directory */
+  guint64 size;
+  gchar *content_type;
+  gchar *etag;
+  gchar *last_modified;
+  glong stored;            /* when last fetched or revalidated */
+  glong max_age;           /* seconds it stays fresh after that */
+  gboolean must_revalidate;
+  glong last_used;         /* saved with the index, not on every lookup */
+  GList *lru_link;         /* private */
+} FlashCacheEntry;
+
+/* Returns NULL if dir can't be created */
+FlashCache      *flash_cache_new        (const gchar *dir, guint64 budget);
+/* Writes the index out if it has changed */
+void             flash_cache_free       (FlashCache *cache);
+void             flash_cache_set_budget (FlashCache *cache, guint64 budget);
+
+/* The entry for url, marked as used, or NULL. Entries may go away when
+ * the cache changes, so don't hang on to them. */
+FlashCacheEntry *flash_cache_lookup     (FlashCache *cache, const gchar *url);
+gboolean         flash_cache_is_fresh   (FlashCacheEntry *entry);
+/* Maps the body read only; the mapping stays good even if the entry is
+ * evicted. An empty body maps to NULL. */
+gboolean         flash_cache_map        (FlashCache *cache,
+                                         FlashCacheEntry *entry,
+                                         void **map, gsize *size);
+/* If-None-Match and If-Modified-Since lines for revalidating entry, or
+ * NULL if it has no validators */
+gchar           *flash_cache_conditional_headers (FlashCacheEntry *entry);
+/* The server said 304 Not Modified to a conditional request for url */
+void             flash_cache_revalidated (FlashCache *cache,
+                                          const gchar *url,
+                                          FlashHttpRequest *request);
+
+/* Starts storing the response to request, called from its headers
+ * function; NULL if the response can't be cached. url is the one asked
+ * for, which is what the entry goes under even if the request was
+ * redirected. */
+FlashCacheWriter *flash_cache_begin     (FlashCache *cache,
+                                         const gchar *url,
+                                         FlashHttpRequest *request);
+gboolean          flash_cache_write     (FlashCacheWriter *writer,
+                                         const guint8 *data, gsize len);
+/* Adds the body to the cache, and frees the writer */
+void              flash_cache_commit    (FlashCacheWriter *writer);
+void              flash_cache_abort     (FlashCacheWriter *writer);
+
+G_END_DECLS
+
+#endif
@@ -16,6 +16,7 @@
 #include <gtk/gtk.h>
 
 #include "flash-common.h"
+#include "gtk2xtbin.h"
 
 gboolean
 flash_init (int *argc, char ***argv)
@@ -28,6 +29,15 @@ flash_init (int *argc, char ***argv)
   return TRUE;
 }
 
+/* Run the plugin's X event processing and timers on a separate thread per
+ * display, so a busy GTK main loop doesn't stall playback. Must be called
+ * after flash_init() and before any file is played. */
+void
+flash_set_event_thread (gboolean enabled)
+{
+  gtk_xtbin_set_event_thread (enabled);
+}
+
 gchar *
 flash_canonicalize_path (const gchar *path)
 {
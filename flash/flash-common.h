@@ -22,6 +22,13 @@ enum
 
   FLASH_ERROR_FILE_ACCESS           = 3000,
   FLASH_ERROR_FILE_PLAY             = 3001,
+  FLASH_ERROR_FILE_CAPTURE          = 3002,
+  FLASH_ERROR_FILE_CANCELLED        = 3003,
+  FLASH_ERROR_FILE_FORMAT           = 3004,
+
+  FLASH_ERROR_HOST                  = 4000,
+
+  FLASH_ERROR_HTTP                  = 5000,
 };
 
 #define FLASH_DEBUG 1
@@ -32,6 +39,7 @@ enum
 #endif
 
 gboolean flash_init(int *argc, char ***argv);
+void     flash_set_event_thread (gboolean enabled);
 
 gchar   *flash_canonicalize_path (const gchar *path);
 gboolean flash_is_valid_file     (const gchar *path, const gchar **allowed_exts,
@@ -0,0 +1,221 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <gtk/gtk.h>
+
+#include "flash-common.h"
+#include "flash-export.h"
+#include "flash-npapi.h"
+#include "flash-file-internal.h"
+#include "flash-pixel.h"
+#include "gtk2xtbin.h"
+
+struct _FlashExport {
+  FlashFile *file;
+  int fd;
+  FlashExportFormat format;
+  gint fps;
+
+  gint width;
+  gint height;
+  guint8 *frame;
+  gsize frame_size;
+
+  guint frames;
+  GTimer *timer;
+  gdouble busy;
+};
+
+static gboolean flash_export_write (FlashExport *export, const void *buf,
+                                    gsize size, GError **error);
+
+FlashExport *
+flash_export_new (FlashFile *file, int fd, FlashExportFormat format,
+                  gint fps)
+{
+  FlashExport *export;
+
+  export = g_new0 (FlashExport, 1);
+  export->file = g_object_ref (file);
+  export->fd = fd;
+  export->format = format;
+  export->fps = fps;
+  export->timer = g_timer_new ();
+  return export;
+}
+
+gboolean
+flash_export_write_frame (FlashExport *export, GError **error)
+{
+  GtkXtBin *xt_bin;
+  XImage *image;
+  gchar *header;
+  gsize plane;
+  gboolean ret;
+
+  xt_bin = (GtkXtBin *) flash_file_get_xt_bin (export->file);
+  if (!xt_bin)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "File is not playing");
+    return FALSE;
+  }
+
+  g_timer_start (export->timer);
+  if (!export->frame)
+  {
+    /* Chroma is subsampled 2x2, so frames are cropped to even sizes */
+    if (xt_bin->width < 2 || xt_bin->height < 2)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE,
+                   "Plugin window of %dx%d is too small to export",
+                   xt_bin->width, xt_bin->height);
+      return FALSE;
+    }
+    export->width = xt_bin->width & ~1;
+    export->height = xt_bin->height & ~1;
+    export->frame_size = export->width * export->height * 3 / 2;
+    export->frame = g_malloc (export->frame_size);
+  }
+  if (xt_bin->width < export->width || xt_bin->height < export->height)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "Plugin window has shrunk since the first frame");
+    return FALSE;
+  }
+
+  /* The plugin draws through its own connection, so read back through it
+   * too; this way we see everything it has drawn so far. A window that
+   * went away or shrank under us is an error, not a crash. */
+  gtk_xtbin_plugin_lock ();
+  gdk_error_trap_push ();
+  image = XGetImage (xt_bin->xtdisplay, xt_bin->xtwindow, 0, 0,
+                     export->width, export->height, AllPlanes, ZPixmap);
+  XSync (xt_bin->xtdisplay, False);
+  if (gdk_error_trap_pop () && image)
+  {
+    XDestroyImage (image);
+    image = NULL;
+  }
+  gtk_xtbin_plugin_unlock ();
+  if (!image)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "Failed to read back plugin window");
+    return FALSE;
+  }
+
+  ret = FALSE;
+  if (image->bits_per_pixel != 32 || image->byte_order != LSBFirst ||
+      image->red_mask != 0xff0000 || image->green_mask != 0xff00 ||
+      image->blue_mask != 0xff)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "Only 24/32 bit BGRA visuals can be exported");
+    goto out;
+  }
+
+  plane = export->width * export->height;
+  if (export->format == FLASH_EXPORT_NV12)
+    flash_pixel_bgra_to_nv12 ((guint8 *) image->data, image->bytes_per_line,
+                              export->width, export->height,
+                              export->frame, export->width,
+                              export->frame + plane, export->width);
+  else
+    flash_pixel_bgra_to_i420 ((guint8 *) image->data, image->bytes_per_line,
+                              export->width, export->height,
+                              export->frame, export->width,
+                              export->frame + plane, export->width / 2,
+                              export->frame + plane * 5 / 4,
+                              export->width / 2);
+
+  if (export->format == FLASH_EXPORT_Y4M)
+  {
+    if (export->frames == 0)
+    {
+      /* 2x2 averaged chroma is centre sited, i.e. 420jpeg */
+      header = g_strdup_printf ("YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg "
+                                "XCOLORRANGE=LIMITED\n", export->width,
+                                export->height, export->fps);
+      ret = flash_export_write (export, header, strlen (header), error);
+      g_free (header);
+      if (!ret)
+        goto out;
+    }
+    if (!flash_export_write (export, "FRAME\n", 6, error))
+    {
+      ret = FALSE;
+      goto out;
+    }
+  }
+  ret = flash_export_write (export, export->frame, export->frame_size, error);
+  if (ret)
+    export->frames++;
+
+out:
+  XDestroyImage (image);
+  export->busy += g_timer_elapsed (export->timer, NULL);
+  return ret;
+}
+
+guint
+flash_export_get_frames (FlashExport *export)
+{
+  return export->frames;
+}
+
+gdouble
+flash_export_get_throughput (FlashExport *export)
+{
+  if (export->busy <= 0)
+    return 0;
+  return export->frames / export->busy;
+}
+
+void
+flash_export_free (FlashExport *export)
+{
+  DEBUG ("exported %u frames at %.1f frames/s (%s)", export->frames,
+         flash_export_get_throughput (export),
+         flash_pixel_kernel_name (flash_pixel_get_kernel ()));
+  g_object_unref (export->file);
+  g_timer_destroy (export->timer);
+  if (export->frame)
+    g_free (export->frame);
+  g_free (export);
+}
+
+static gboolean
+flash_export_write (FlashExport *export, const void *buf, gsize size,
+                    GError **error)
+{
+  const guint8 *p;
+  ssize_t n;
+
+  p = buf;
+  while (size > 0)
+  {
+    n = write (export->fd, p, size);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE,
+                   "Failed to write frame: %s", strerror (errno));
+      return FALSE;
+    }
+    p += n;
+    size -= n;
+  }
+  return TRUE;
+}
@@ -0,0 +1,40 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_EXPORT_H__
+#define __FLASH_EXPORT_H__
+
+#include <glib.h>
+#include <flash/flash-file.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FlashExport FlashExport;
+
+typedef enum
+{
+  FLASH_EXPORT_Y4M,   /* YUV4MPEG2 stream, 4:2:0 */
+  FLASH_EXPORT_I420,  /* raw Y, U and V planes per frame */
+  FLASH_EXPORT_NV12   /* raw Y plane and interleaved UV plane per frame */
+} FlashExportFormat;
+
+/* Grabs frames from a playing file's plugin window, converts them to YUV
+ * and writes them to fd, e.g. a pipe to an encoder. The frame size is
+ * taken from the plugin window at the first frame, rounded down to even
+ * numbers. fps only ends up in the Y4M header; frames are written when
+ * flash_export_write_frame() is called. */
+FlashExport *flash_export_new         (FlashFile *file, int fd,
+                                       FlashExportFormat format, gint fps);
+gboolean     flash_export_write_frame (FlashExport *export, GError **error);
+guint        flash_export_get_frames  (FlashExport *export);
+/* Frames per second the capture, conversion and write have managed,
+   not counting the time in between calls */
+gdouble      flash_export_get_throughput (FlashExport *export);
+void         flash_export_free        (FlashExport *export);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,415 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/mman.h>
+#include <string.h>
+
+#include "flash-common.h"
+#include "flash-cache.h"
+#include "flash-fetch.h"
+#include "flash-http.h"
+#include "flash-stream.h"
+#include "flash-library-internal.h"
+#include "gtk2xtbin.h"
+
+/* Most of a cached body handed to the plugin per main loop iteration, and
+ * how long to wait when it says it can't take any more */
+#define FETCH_DISPATCH_BYTES (256 * 1024)
+#define FETCH_RETRY_MS       10
+
+struct _FlashFetch {
+  FlashLibrary *library;
+  NPP instance;
+  gchar *url;
+  void *notify_data;
+  FlashStreamStats *totals;
+
+  FlashHttpRequest *request;
+  FlashStream *stream;
+
+  /* The cached copy of the response, if there is one; it's used when it
+   * is fresh, when the server says it hasn't changed, and (unless the
+   * server said not to) when the server can't be reached. For fetches
+   * from a bundle, map is a slice of the bundle's mapping. */
+  FlashBundle *bundle;
+  FlashCache *cache;
+  FlashCacheWriter *writer;
+  void *map;
+  gsize map_size;
+  gboolean have_cached;
+  gboolean use_cached;
+  gboolean must_revalidate;
+  gchar *cached_type;
+  gsize offset;
+  guint source_id;
+
+  FlashFetchDoneFunc done;
+  gpointer done_data;
+};
+
+/* Closes the stream, if it got that far, and tells the plugin how the
+ * request went if it asked to know */
+static void
+flash_fetch_end (FlashFetch *fetch, NPReason reason)
+{
+  gtk_xtbin_plugin_lock ();
+  if (fetch->stream)
+  {
+    flash_stream_close (fetch->stream, reason);
+    fetch->stream = NULL;
+  }
+  if (fetch->notify_data)
+    PLUGIN_CALL (fetch, urlnotify, fetch->instance, fetch->url, reason,
+                 fetch->notify_data);
+  gtk_xtbin_plugin_unlock ();
+}
+
+static void
+flash_fetch_unmap (FlashFetch *fetch)
+{
+  if (fetch->bundle)
+    flash_bundle_unref (fetch->bundle);
+  else if (fetch->map)
+    munmap (fetch->map, fetch->map_size);
+  fetch->bundle = NULL;
+  fetch->map = NULL;
+  fetch->map_size = 0;
+  fetch->have_cached = FALSE;
+}
+
+static void
+flash_fetch_free (FlashFetch *fetch)
+{
+  if (fetch->source_id)
+    g_source_remove (fetch->source_id);
+  if (fetch->writer)
+    flash_cache_abort (fetch->writer);
+  flash_fetch_unmap (fetch);
+  g_free (fetch->cached_type);
+  g_free (fetch->url);
+  g_free (fetch);
+}
+
+static void
+flash_fetch_finish (FlashFetch *fetch, NPReason reason)
+{
+  flash_fetch_end (fetch, reason);
+  if (fetch->done)
+    fetch->done (fetch, fetch->done_data);
+  flash_fetch_free (fetch);
+}
+
+static gboolean
+flash_fetch_open_stream (FlashFetch *fetch, const gchar *content_type,
+                         guint64 length)
+{
+  NPError nperr;
+  uint16 stype;
+
+  stype = NP_NORMAL;
+  gtk_xtbin_plugin_lock ();
+  fetch->stream = flash_stream_open (fetch->library, fetch->instance,
+                                     fetch->url,
+                                     content_type ? content_type
+                                                  : "application/octet-stream",
+                                     length, &stype, fetch->notify_data,
+                                     fetch->totals, &nperr);
+  gtk_xtbin_plugin_unlock ();
+  return fetch->stream != NULL;
+}
+
+/* Streams the mapped cached body or bundled file to the plugin, straight
+ * from the page cache */
+static gboolean
+flash_fetch_serve (gpointer data)
+{
+  FlashFetch *fetch;
+  gsize budget;
+  int32 nwritten;
+  gboolean blocked;
+
+  fetch = data;
+  fetch->source_id = 0;
+
+  if (!fetch->stream &&
+      !flash_fetch_open_stream (fetch, fetch->cached_type, fetch->map_size))
+  {
+    flash_fetch_finish (fetch, NPRES_NETWORK_ERR);
+    return FALSE;
+  }
+
+  blocked = FALSE;
+  budget = FETCH_DISPATCH_BYTES;
+  gtk_xtbin_plugin_lock ();
+  while (fetch->offset < fetch->map_size && budget > 0)
+  {
+    nwritten = flash_stream_write (fetch->stream,
+                                   (guint8 *) fetch->map + fetch->offset,
+                                   MIN (fetch->map_size - fetch->offset,
+                                        budget));
+    if (nwritten < 0)
+    {
+      gtk_xtbin_plugin_unlock ();
+      flash_fetch_finish (fetch, NPRES_NETWORK_ERR);
+      return FALSE;
+    }
+    if (nwritten == 0)
+    {
+      blocked = TRUE;
+      break;
+    }
+    fetch->offset += nwritten;
+    budget -= MIN ((gsize) nwritten, budget);
+  }
+  gtk_xtbin_plugin_unlock ();
+
+  if (fetch->offset >= fetch->map_size)
+    flash_fetch_finish (fetch, NPRES_DONE);
+  else if (blocked)
+    fetch->source_id = g_timeout_add (FETCH_RETRY_MS, flash_fetch_serve,
+                                      fetch);
+  else
+    fetch->source_id = g_idle_add (flash_fetch_serve, fetch);
+  return FALSE;
+}
+
+static gboolean
+flash_fetch_headers (FlashHttpRequest *request, gint status,
+                     const gchar *content_type, gint64 length,
+                     gpointer user_data)
+{
+  FlashFetch *fetch;
+
+  fetch = user_data;
+  if (status == 304 && fetch->have_cached)
+  {
+    DEBUG ("GET '%s': not modified, using the cached copy", fetch->url);
+    flash_cache_revalidated (fetch->cache, fetch->url, request);
+    fetch->use_cached = TRUE;
+    return TRUE;
+  }
+  if (status < 200 || status >= 300)
+  {
+    DEBUG ("GET '%s': HTTP status %d", fetch->url, status);
+    return FALSE;
+  }
+
+  flash_fetch_unmap (fetch);
+  if (!flash_fetch_open_stream (fetch, content_type,
+                                length > 0 ? length : 0))
+    return FALSE;
+  if (fetch->cache)
+    fetch->writer = flash_cache_begin (fetch->cache, fetch->url, request);
+  return TRUE;
+}
+
+static gssize
+flash_fetch_body (FlashHttpRequest *request, const guint8 *data, gsize len,
+                  gpointer user_data)
+{
+  FlashFetch *fetch;
+  int32 nwritten;
+
+  fetch = user_data;
+  gtk_xtbin_plugin_lock ();
+  nwritten = flash_stream_write (fetch->stream, data,
+                                 MIN (len, (gsize) G_MAXINT32));
+  gtk_xtbin_plugin_unlock ();
+
+  /* Only what the plugin took, so the copy is written in order */
+  if (nwritten > 0 && fetch->writer &&
+      !flash_cache_write (fetch->writer, data, nwritten))
+  {
+    flash_cache_abort (fetch->writer);
+    fetch->writer = NULL;
+  }
+  return nwritten;
+}
+
+static void
+flash_fetch_done (FlashHttpRequest *request, const GError *error,
+                  gpointer user_data)
+{
+  FlashFetch *fetch;
+
+  fetch = user_data;
+  fetch->request = NULL;
+
+  if (fetch->writer)
+  {
+    if (error)
+      flash_cache_abort (fetch->writer);
+    else
+      flash_cache_commit (fetch->writer);
+    fetch->writer = NULL;
+  }
+
+  /* A stale copy is better than nothing, as long as nothing of the
+   * response has reached the plugin */
+  if (error && fetch->have_cached && !fetch->must_revalidate &&
+      !fetch->stream)
+  {
+    DEBUG ("GET '%s': using the stale cached copy", fetch->url);
+    fetch->use_cached = TRUE;
+  }
+  if (fetch->use_cached)
+  {
+    fetch->source_id = g_idle_add (flash_fetch_serve, fetch);
+    return;
+  }
+  flash_fetch_finish (fetch, error ? NPRES_NETWORK_ERR : NPRES_DONE);
+}
+
+/* Maps the cached copy of the response, if there is one. Returns headers
+ * to make the request conditional on it having changed, or NULL. */
+static gchar *
+flash_fetch_lookup_cached (FlashFetch *fetch)
+{
+  FlashCacheEntry *entry;
+
+  entry = flash_cache_lookup (fetch->cache, fetch->url);
+  if (!entry ||
+      !flash_cache_map (fetch->cache, entry, &fetch->map, &fetch->map_size))
+    return NULL;
+  fetch->have_cached = TRUE;
+  fetch->must_revalidate = entry->must_revalidate;
+  fetch->cached_type = g_strdup (entry->content_type);
+  if (flash_cache_is_fresh (entry))
+  {
+    fetch->use_cached = TRUE;
+    return NULL;
+  }
+  return flash_cache_conditional_headers (entry);
+}
+
+FlashFetch *
+flash_fetch_new (FlashLibrary *library, NPP instance, const gchar *url,
+                 void *notify_data, FlashStreamStats *totals,
+                 FlashFetchDoneFunc done, gpointer done_data, NPError *nperr)
+{
+  FlashFetch *fetch;
+  GError *error;
+  gchar *headers;
+
+  fetch = g_new0 (FlashFetch, 1);
+  fetch->library = library;
+  fetch->instance = instance;
+  fetch->url = g_strdup (url);
+  fetch->notify_data = notify_data;
+  fetch->totals = totals;
+  fetch->done = done;
+  fetch->done_data = done_data;
+  fetch->cache = flash_library_get_http_cache (library);
+  *nperr = NPERR_NO_ERROR;
+
+  headers = NULL;
+  if (fetch->cache)
+    headers = flash_fetch_lookup_cached (fetch);
+  if (fetch->use_cached)
+  {
+    DEBUG ("GET '%s': fresh in the cache", url);
+    fetch->source_id = g_idle_add (flash_fetch_serve, fetch);
+    return fetch;
+  }
+
+  error = NULL;
+  fetch->request = flash_http_get (flash_library_get_http_pool (library),
+                                   url, headers, flash_fetch_headers,
+                                   flash_fetch_body, flash_fetch_done,
+                                   fetch, &error);
+  g_free (headers);
+  if (!fetch->request)
+  {
+    DEBUG ("GET '%s': %s", url, error->message);
+    g_error_free (error);
+    if (fetch->have_cached && !fetch->must_revalidate)
+    {
+      fetch->use_cached = TRUE;
+      fetch->source_id = g_idle_add (flash_fetch_serve, fetch);
+      return fetch;
+    }
+    flash_fetch_free (fetch);
+    *nperr = NPERR_GENERIC_ERROR;
+    return NULL;
+  }
+  return fetch;
+}
+
+/* What the plugin is told bundled files are, by extension */
+static const gchar *
+flash_fetch_guess_type (const gchar *name)
+{
+  static const struct {
+    const gchar *ext;
+    const gchar *type;
+  } types[] = {
+    { ".swf",  "application/x-shockwave-flash" },
+    { ".flv",  "video/x-flv" },
+    { ".mp3",  "audio/mpeg" },
+    { ".xml",  "text/xml" },
+    { ".txt",  "text/plain" },
+    { ".jpg",  "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".png",  "image/png" },
+    { ".gif",  "image/gif" },
+  };
+  const gchar *ext;
+  guint i;
+
+  ext = strrchr (name, '.');
+  for (i = 0; ext && i < G_N_ELEMENTS (types); i++)
+  {
+    if (g_ascii_strcasecmp (ext, types[i].ext) == 0)
+      return types[i].type;
+  }
+  return "application/octet-stream";
+}
+
+FlashFetch *
+flash_fetch_new_from_bundle (FlashLibrary *library, NPP instance,
+                             FlashBundle *bundle, const gchar *url,
+                             const gchar *name, void *notify_data,
+                             FlashStreamStats *totals,
+                             FlashFetchDoneFunc done, gpointer done_data,
+                             NPError *nperr)
+{
+  FlashFetch *fetch;
+  const guint8 *data;
+  gsize size;
+
+  if (!flash_bundle_lookup (bundle, name, &data, &size))
+  {
+    DEBUG ("GET '%s': not in '%s'", url, flash_bundle_get_path (bundle));
+    *nperr = NPERR_GENERIC_ERROR;
+    return NULL;
+  }
+
+  fetch = g_new0 (FlashFetch, 1);
+  fetch->library = library;
+  fetch->instance = instance;
+  fetch->url = g_strdup (url);
+  fetch->notify_data = notify_data;
+  fetch->totals = totals;
+  fetch->done = done;
+  fetch->done_data = done_data;
+  fetch->bundle = flash_bundle_ref (bundle);
+  fetch->map = (void *) data;
+  fetch->map_size = size;
+  fetch->cached_type = g_strdup (flash_fetch_guess_type (name));
+  fetch->use_cached = TRUE;
+  fetch->source_id = g_idle_add (flash_fetch_serve, fetch);
+  *nperr = NPERR_NO_ERROR;
+  return fetch;
+}
+
+void
+flash_fetch_cancel (FlashFetch *fetch)
+{
+  if (fetch->request)
+    flash_http_cancel (fetch->request);
+  flash_fetch_end (fetch, NPRES_USER_BREAK);
+  flash_fetch_free (fetch);
+}
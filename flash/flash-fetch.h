@@ -0,0 +1,47 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_FETCH_H__
+#define __FLASH_FETCH_H__
+
+#include <glib.h>
+#include "flash-npapi.h"
+#include "flash-bundle.h"
+#include "flash-library.h"
+
+G_BEGIN_DECLS
+
+/* An NPN_GetURL(Notify) of an http:// URL. The response body is written
+ * to the plugin as it arrives from the server, and is only read from the
+ * server as fast as the plugin takes it. Fetches from a bundle are
+ * written straight from its mapping. */
+typedef struct _FlashFetch FlashFetch;
+
+/* Called once the fetch is over, just before it is freed */
+typedef void (*FlashFetchDoneFunc) (FlashFetch *fetch, gpointer user_data);
+
+/* Returns NULL, with *nperr set, if the request can't be made */
+FlashFetch *flash_fetch_new    (FlashLibrary *library, NPP instance,
+                                const gchar *url, void *notify_data,
+                                FlashStreamStats *totals,
+                                FlashFetchDoneFunc done, gpointer done_data,
+                                NPError *nperr);
+/* name in bundle, sent to the plugin as url. Returns NULL, with *nperr
+ * set, if the bundle doesn't have it. */
+FlashFetch *flash_fetch_new_from_bundle (FlashLibrary *library,
+                                         NPP instance, FlashBundle *bundle,
+                                         const gchar *url, const gchar *name,
+                                         void *notify_data,
+                                         FlashStreamStats *totals,
+                                         FlashFetchDoneFunc done,
+                                         gpointer done_data, NPError *nperr);
+/* Drops the request and breaks off the stream (NPRES_USER_BREAK),
+ * without calling the done function. The instance must still exist. */
+void        flash_fetch_cancel (FlashFetch *fetch);
+
+G_END_DECLS
+
+#endif
@@ -15,6 +15,31 @@ G_BEGIN_DECLS
 
 void flash_file_set_notify (FlashFile *file, const gchar *notify_url, void *notify_data);
 
+/* NPN_GetURL(Notify) of an http:// URL, or for a file from a bundle, a
+ * bundle: or relative one; see flash-fetch.h */
+gboolean flash_file_serves_url (FlashFile *file, const gchar *url);
+NPError  flash_file_get_url     (FlashFile *file, const gchar *url,
+                                 void *notify_data);
+
+/* NPN_PostURL(Notify) for the file's instance; see flash-post.h */
+NPError flash_file_post_url (FlashFile *file, const gchar *url,
+                             const gchar *target, uint32 len,
+                             const char *buf, NPBool is_file,
+                             void *notify_data);
+
+/* NPN_NewStream, NPN_Write and NPN_DestroyStream for the file's
+ * instance, into the sink the file's sink function picks */
+NPError flash_file_new_sink_stream     (FlashFile *file, const gchar *mime_type,
+                                        const gchar *target,
+                                        NPStream **stream);
+int32   flash_file_write_sink_stream   (FlashFile *file, NPStream *stream,
+                                        int32 len, void *buf);
+NPError flash_file_destroy_sink_stream (FlashFile *file, NPStream *stream,
+                                        NPReason reason);
+
+/* The plugin's GtkXtBin, or NULL when not playing */
+GtkWidget *flash_file_get_xt_bin (FlashFile *file);
+
 G_END_DECLS
 
 #endif
@@ -5,12 +5,15 @@
  */
 
 #include <gdk/gdkx.h>
+#include <X11/extensions/Xdamage.h>
 
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/fcntl.h>
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -18,32 +21,219 @@
 
 #include "flash-common.h"
 #include "flash-npapi.h"
+#include "flash-fetch.h"
 #include "flash-file.h"
 #include "flash-file-internal.h"
 #include "flash-library-internal.h"
+#include "flash-pixel.h"
+#include "flash-post.h"
+#include "flash-prefetch.h"
+#include "flash-sink-internal.h"
+#include "flash-stream.h"
+#include "flash-swf.h"
 #include "gtk2xtbin.h"
 
 #define MIME_TYPE "application/x-shockwave-flash"
-#define PLUGIN_CALL(x, func, args...) (flash_library_get_plugin_vtable((x)->library)->func(args))
+/* Minimum time between two plugin window updates, roughly one frame */
+#define RESIZE_INTERVAL 16
+#define THUMBNAIL_OVERSAMPLE 2
+/* Gaps between frames longer than this are a still movie, not drops */
+#define FRAME_IDLE_MS 1000
+/* Files up to MAP_WHOLE_MAX are mapped whole. Bigger ones only have their
+ * first MAP_WINDOW bytes kept mapped, and the rest is mapped a window at
+ * a time as it's streamed; MAP_WINDOW is a multiple of the page size. */
+#define MAP_WHOLE_MAX (64 * 1024 * 1024)
+#define MAP_WINDOW    (16 * 1024 * 1024)
+/* Whatever of the movie the plugin doesn't take while playback starts is
+ * fed to it from the main loop, up to FEED_DISPATCH_BYTES per iteration,
+ * checking back every FEED_RETRY_MS while it isn't ready for more */
+#define FEED_DISPATCH_BYTES (256 * 1024)
+#define FEED_RETRY_MS       10
+/* The adaptive quality controller looks every QUALITY_CHECK_MS. It steps
+ * down after QUALITY_DOWN_CHECKS checks in a row of dropping more than
+ * QUALITY_DROP_HIGH of the frames or of CPU load over QUALITY_LOAD_HIGH,
+ * and up after QUALITY_UP_CHECKS in a row under QUALITY_DROP_LOW and
+ * QUALITY_LOAD_LOW */
+#define QUALITY_CHECK_MS    1000
+#define QUALITY_DOWN_CHECKS 2
+#define QUALITY_UP_CHECKS   10
+#define QUALITY_DROP_HIGH   0.10
+#define QUALITY_DROP_LOW    0.02
+#define QUALITY_LOAD_HIGH   0.90
+#define QUALITY_LOAD_LOW    0.60
+
+typedef enum {
+  PLAY_INSTANTIATE,
+  PLAY_CREATE_WINDOW,
+  PLAY_SET_WINDOW,
+  PLAY_STREAM,
+  PLAY_DONE
+} FlashFilePlayPhase;
+
+/* A flash_file_play() in progress */
+typedef struct {
+  FlashFile *file;
+  GtkWindow *window;
+  gboolean loop;
+  FlashFilePlayPhase phase;
+  gboolean cancelled;
+
+  gint width;
+  gint height;
+  gchar *file_url;
+  GtkWidget *xt_bin;
+  gboolean npp_window_set;
+
+  GTimer *timer;
+  GError *error;
+  FlashFilePlayCallback callback;
+  gpointer callback_data;
+} FlashFilePlayOp;
+
+/* An NPN_GetURLNotify or NPN_PostURLNotify made on the Xt event thread,
+ * or a GET waiting for the prefetch of its URL, to be started from the
+ * main loop */
+typedef struct {
+  gboolean post;
+  gchar *url;
+  gchar *target;
+  char *buf;
+  uint32 len;
+  NPBool is_file;
+  void *notify_data;
+} FlashFileRequest;
+
+/* The movie's stream while the rest of it is fed from the main loop. Past
+ * the file's own mapping, one window of it is mapped at a time. */
+typedef struct {
+  FlashStream *stream;
+  guint64 offset;
+  guint source_id;
+  int fd;
+  void *window;
+  guint64 window_offset;
+  gsize window_len;
+  /* The plugin hadn't asked for the ancillary notification stream before
+   * the feed started, so it's sent once the movie is all there */
+  gboolean notify_pending;
+} FlashFileFeed;
 
 struct _FlashFile {
   GObject parent;
 
   gchar *path;
+  int fd;
+  /* For files from a bundle, path is the name in it and map a slice of
+   * its mapping */
+  FlashBundle *bundle;
   FlashLibrary *library;
   NPP instance;
   gboolean npp_instantiated;
   GtkWidget *xt_bin;
+  void *map;
+  gsize map_size;
+  /* The whole file's size, which is more than map_size for those too big
+   * to map whole */
+  guint64 data_size;
+  FlashFileFeed *feed;
+  FlashFileIoPolicy io_policy;
+  gboolean io_prepared;
+  gboolean map_locked;
+
+  /* The plugin may hold on to these between setwindow calls */
+  NPWindow npwin;
+  NPSetWindowCallbackStruct npws;
+
+  gint resize_width;
+  gint resize_height;
+  gboolean resize_pending;
+  guint resize_id;
 
   char *notify_url;
   void *notify_data; 
 
+  /* FlashPosts still being answered and FlashFetches still streaming;
+   * they go with the instance. Both, and the HTTP pool and cache, are
+   * only touched from the main loop: requests the plugin makes on the Xt
+   * event thread are queued in requests, guarded by the plugin lock, and
+   * started from an idle. */
+  GList *posts;
+  GList *fetches;
+  GList *requests;
+  guint requests_id;
+  /* Warming the caches with what the movie's scripts refer to, and the
+   * plugin's GETs (FlashFileRequests) of URLs it was already fetching,
+   * which wait for it rather than fetch them again */
+  FlashPrefetch *prefetch;
+  GList *prefetch_waiting;
+
+  /* Streams from the plugin, each NPStream's ndata being its FlashSink */
+  FlashFileSinkFunc sink_func;
+  gpointer sink_data;
+  GList *sink_streams;
+
   gboolean is_playing;
+  gboolean loop;
+  guint timer_id;
+
+  FlashFilePlayOp *play_op;
+  FlashFilePlayOp *play_result;
+  FlashFilePlayTimings play_timings;
+
+  /* Frame metrics; frames are detected with XDamage on the plugin
+   * window */
+  Display *damage_display;
+  Damage damage;
+  int damage_event_base;
+  gdouble nominal_frame_rate;
+  GTimeVal last_frame;
+  gboolean have_last_frame;
+  guint frames_presented;
+  guint frames_dropped;
+  guint frame_times[FLASH_FILE_FRAME_TIME_BUCKETS];
+  GTimer *metrics_timer;
+  guint metrics_frames;
+  gdouble frame_rate;
+  guint metrics_interval;
+  guint metrics_id;
+
+  /* Set with flash_file_set_attribute(), or NULL if none have been */
+  GPtrArray *attr_names;
+  GPtrArray *attr_values;
+
+  /* Adaptive quality: the highest level to go back up to, the frame
+   * counts and CPU times at the last check, and how many checks in a row
+   * have called for a step down (> 0) or up (< 0) */
+  gboolean adaptive_quality;
+  FlashFileQuality quality_ceiling;
+  guint quality_id;
+  guint quality_presented;
+  guint quality_dropped;
+  guint64 cpu_busy;
+  guint64 cpu_total;
+  gint quality_trend;
+
+  /* Totals over every stream sent to this file's instances */
+  FlashStreamStats stream_stats;
 
   FlashFileEventCallback callback;
   gpointer callback_data;
 };
 
+enum
+{
+  PROPERTY_FRAMES_PRESENTED = 1,
+  PROPERTY_FRAMES_DROPPED,
+  PROPERTY_FRAME_RATE,
+  PROPERTY_NOMINAL_FRAME_RATE,
+  PROPERTY_METRICS_INTERVAL,
+};
+
+/* Upper bounds of all but the last frame time bucket, in ms */
+static const gdouble frame_time_bounds[FLASH_FILE_FRAME_TIME_BUCKETS - 1] = {
+  8, 16, 33, 50, 100, 250, FRAME_IDLE_MS
+};
+
 struct _FlashFileClass {
   GObjectClass parent;
 };
@@ -51,15 +241,78 @@ struct _FlashFileClass {
 static void     flash_file_class_init          (FlashFileClass *);
 static void     flash_file_init                (FlashFile *);
 static void     flash_file_finalize            (GObject *);
+static void     flash_file_set_property        (GObject *object,
+                                                guint param_id,
+                                                const GValue *value,
+                                                GParamSpec *pspec);
+static void     flash_file_get_property        (GObject *object,
+                                                guint param_id,
+                                                GValue *value,
+                                                GParamSpec *pspec);
+static gboolean flash_file_instantiate         (FlashFile *file,
+                                                const gchar *file_url,
+                                                gint width, gint height,
+                                                gboolean loop,
+                                                GError **error);
+static void     flash_file_destroy_instance    (FlashFile *file);
+static void     flash_file_end_feed            (FlashFile *file,
+                                                NPReason reason);
+static gboolean flash_file_map                 (FlashFile *file,
+                                                GError **error);
+static void     flash_file_unlock_map          (FlashFile *file);
 static gboolean flash_file_new_attrs           (int *argcp, char ***argnp,
                                                 char ***argvp, ...);
 static void     flash_file_free_attrs          (int argc, char **argn, char **argv);
-static gchar *  flash_file_make_file_url       (const gchar *path);
+static gchar *  flash_file_make_file_url       (FlashFile *file);
 static gboolean flash_file_send_to_plugin      (FlashFile *file, const gchar *url,
                                                GError **error);
+static FlashFilePlayOp *
+                flash_file_play_op_new         (FlashFile *file,
+                                                GtkWindow *window,
+                                                gboolean loop,
+                                                FlashFilePlayCallback callback,
+                                                gpointer user_data);
+static gboolean flash_file_play_op_finish      (FlashFile *file,
+                                                FlashFilePlayOp *op,
+                                                GError **error);
+static void     flash_file_play_step           (FlashFile *file,
+                                                FlashFilePlayOp *op);
+static gboolean flash_file_play_idle           (gpointer data);
+static void     flash_file_prefetch_done       (FlashPrefetch *prefetch,
+                                                gpointer user_data);
+static void     flash_file_play_instantiate    (FlashFile *file,
+                                                FlashFilePlayOp *op);
+static void     flash_file_play_create_window  (FlashFile *file,
+                                                FlashFilePlayOp *op);
+static void     flash_file_play_set_window     (FlashFile *file,
+                                                FlashFilePlayOp *op);
+static void     flash_file_play_started        (FlashFile *file,
+                                                FlashFilePlayOp *op);
+static void     flash_file_play_abort          (FlashFile *file,
+                                                FlashFilePlayOp *op);
 static gboolean flash_file_timer_callback      (gpointer data);
+static gboolean flash_file_resize_callback     (gpointer data);
+static void     flash_file_set_window_size     (FlashFile *file, gint width,
+                                                gint height);
 static void *   flash_file_get_script_peer     (FlashFile *file);
 static void     flash_file_release_script_peer (FlashFile *file, void *peer);
+static gchar *  flash_file_thumbnail_path      (FlashFile *file, gint width,
+                                                gint height, gint frame,
+                                                guint delay_ms);
+static gboolean flash_file_thumbnail_timeout   (gpointer data);
+static void     flash_file_start_metrics       (FlashFile *file);
+static void     flash_file_stop_metrics        (FlashFile *file);
+static void     flash_file_schedule_metrics    (FlashFile *file);
+static gboolean flash_file_reinstantiate       (FlashFile *file,
+                                                GError **error);
+static void     flash_file_schedule_quality    (FlashFile *file);
+static gboolean flash_file_quality_callback    (gpointer data);
+static GdkFilterReturn
+                flash_file_damage_filter       (GdkXEvent *xevent,
+                                                GdkEvent *event,
+                                                gpointer data);
+static void     flash_file_frame_presented     (FlashFile *file);
+static gboolean flash_file_metrics_callback    (gpointer data);
 
 GType
 flash_file_get_type (void)
@@ -123,175 +376,409 @@ flash_file_new (FlashLibrary *library, const gchar *path,
   return file;
 }
 
+FlashFile *
+flash_file_new_from_bundle (FlashLibrary *library, FlashBundle *bundle,
+                            const gchar *name,
+                            FlashFileEventCallback callback,
+                            gpointer callback_user_data,
+                            GError **error)
+{
+  FlashFile *file;
+  const guint8 *data;
+  gsize size;
+
+  while (*name == '/')
+    name++;
+  if (!flash_bundle_lookup (bundle, name, &data, &size))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "'%s' is not in '%s'", name, flash_bundle_get_path (bundle));
+    return NULL;
+  }
+
+  /* Nothing to open, stat or map: the bundle was checked when it was
+   * opened, and the data is already mapped */
+  file = g_object_new (FLASH_TYPE_FILE, NULL);
+  file->path = g_strdup (name);
+  file->bundle = flash_bundle_ref (bundle);
+  file->map = (void *) data;
+  file->map_size = size;
+  file->data_size = size;
+  file->library = g_object_ref (library);
+  file->instance = g_new (NPP_t, 1);
+
+  memset (file->instance, 0, sizeof(NPP_t));
+  file->instance->ndata = file;
+
+  file->callback = callback;
+  file->callback_data = callback_user_data;
+
+  return file;
+}
+
+FlashFile *
+flash_file_new_from_fd (FlashLibrary *library, int fd, const gchar *name,
+                        FlashFileEventCallback callback,
+                        gpointer callback_user_data,
+                        GError **error)
+{
+  FlashFile *file;
+  struct stat sb;
+  int file_fd;
+
+  if (fstat (fd, &sb) == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "%s", strerror(errno));
+    return NULL;
+  }
+  if (!S_ISREG (sb.st_mode))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Not a file: %s", name);
+    return NULL;
+  }
+
+  /* Keep our own descriptor, the caller is free to close theirs */
+  file_fd = dup (fd);
+  if (file_fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to dup() '%s': %s", name, strerror(errno));
+    return NULL;
+  }
+
+  file = g_object_new (FLASH_TYPE_FILE, NULL);
+  file->path = g_strdup (name);
+  file->fd = file_fd;
+  file->library = g_object_ref (library);
+  file->instance = g_new (NPP_t, 1);
+
+  memset (file->instance, 0, sizeof(NPP_t));
+  file->instance->ndata = file;
+
+  file->callback = callback;
+  file->callback_data = callback_user_data;
+
+  return file;
+}
+
 gboolean
 flash_file_play (FlashFile *file, GtkWindow *gtk_window, gboolean loop,
                  GError **error)
 {
-  int argc;
-  char **argn;
-  char **argv;
-  gint width;
-  gint height;
-  gint depth;
-#define MAX_DIGITS 20
-  char width_str[MAX_DIGITS+1];
-  char height_str[MAX_DIGITS+1];
-  gchar *file_url;
-  gboolean ret;
-  GtkWidget *xt_bin;
-  GdkWindow *window;
-  NPError nperr;
-  NPWindow npwin;
-  NPSetWindowCallbackStruct npws;
-  gboolean npp_window_set;
+  FlashFilePlayOp *op;
 
-  if (file->is_playing)
+  if (file->is_playing || file->play_op)
     return FALSE;
 
-  argc = -1;
-  argn = argv = NULL;
-  width = height = depth = -1;
-  memset (width_str, 0, sizeof(width_str));
-  memset (height_str, 0, sizeof(height_str));
-  file_url = NULL;
-  ret = FALSE;
-  xt_bin = NULL;
-  window = NULL;
-  nperr = NPERR_GENERIC_ERROR;
-  memset (&npwin, 0, sizeof(npwin));
-  memset (&npws, 0, sizeof(npws));
-  npp_window_set = FALSE;
-
-  window = GTK_WIDGET(gtk_window)->window;
-  g_assert (window != NULL);
-  gdk_window_get_geometry (window, NULL, NULL, &width, &height, &depth);
+  op = flash_file_play_op_new (file, gtk_window, loop, NULL, NULL);
+  while (op->phase != PLAY_DONE)
+    flash_file_play_step (file, op);
+  return flash_file_play_op_finish (file, op, error);
+}
 
-  file_url = flash_file_make_file_url (file->path);
+void
+flash_file_play_async (FlashFile *file, GtkWindow *window, gboolean loop,
+                       FlashFilePlayCallback callback, gpointer user_data)
+{
+  FlashFilePlayOp *op;
 
-  argc = -1;
-  argn = argv = NULL;
-  snprintf (width_str, sizeof(width_str), "%d", width);
-  snprintf (height_str, sizeof(height_str), "%d", height);
-  if (loop) 
+  op = flash_file_play_op_new (file, window, loop, callback, user_data);
+  if (file->is_playing || file->play_op)
   {
-    flash_file_new_attrs (&argc, &argn, &argv, 
-      "SRC", file_url,
-      "TYPE", MIME_TYPE,
-      "WIDTH", width_str,
-      "HEIGHT", height_str,
-      "LOOP", "true",
-      NULL);
+    g_set_error (&op->error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "File is already playing");
+    op->phase = PLAY_DONE;
   }
   else
   {
-    flash_file_new_attrs (&argc, &argn, &argv, 
-      "SRC", file_url,
-      "TYPE", MIME_TYPE,
-      "WIDTH", width_str,
-      "HEIGHT", height_str,
-      "LOOP", "false",
-      NULL);
+    file->play_op = op;
   }
 
-  nperr = PLUGIN_CALL(file, newp,
-    MIME_TYPE,
-    file->instance,
-    NP_EMBED,
-    argc,
-    argn,
-    argv,
-    NULL);
+  /* Keep the file around until the caller has had its result */
+  g_object_ref (file);
+  g_idle_add (flash_file_play_idle, op);
+}
 
-  if (nperr != NPERR_NO_ERROR)
+gboolean
+flash_file_play_finish (FlashFile *file, GError **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (file->play_result != NULL, FALSE);
+
+  ret = flash_file_play_op_finish (file, file->play_result, error);
+  file->play_result = NULL;
+  return ret;
+}
+
+void
+flash_file_play_cancel (FlashFile *file)
+{
+  /* Takes effect at the next step, the callback still gets called */
+  if (file->play_op)
+    file->play_op->cancelled = TRUE;
+}
+
+void
+flash_file_get_play_timings (FlashFile *file, FlashFilePlayTimings *timings)
+{
+  *timings = file->play_timings;
+}
+
+static FlashFilePlayOp *
+flash_file_play_op_new (FlashFile *file, GtkWindow *window, gboolean loop,
+                        FlashFilePlayCallback callback, gpointer user_data)
+{
+  FlashFilePlayOp *op;
+
+  op = g_new0 (FlashFilePlayOp, 1);
+  op->file = file;
+  op->window = g_object_ref (window);
+  op->loop = loop;
+  op->phase = PLAY_INSTANTIATE;
+  op->timer = g_timer_new ();
+  op->callback = callback;
+  op->callback_data = user_data;
+  return op;
+}
+
+static gboolean
+flash_file_play_op_finish (FlashFile *file, FlashFilePlayOp *op,
+                           GError **error)
+{
+  gboolean ret;
+
+  ret = TRUE;
+  if (op->error)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
-                 "Failed to create playback instance");
-    file->npp_instantiated = FALSE;
-    goto err_out;
+    g_propagate_error (error, op->error);
+    op->error = NULL;
+    ret = FALSE;
+  }
+  if (op->file_url)
+    g_free (op->file_url);
+  g_object_unref (op->window);
+  g_timer_destroy (op->timer);
+  g_free (op);
+  return ret;
+}
+
+/* Runs one phase of starting playback. The phases are split at the points
+ * where we'd otherwise block on the X server or the plugin, so several
+ * files being started asynchronously take turns on the main loop. */
+static void
+flash_file_play_step (FlashFile *file, FlashFilePlayOp *op)
+{
+  struct rusage before;
+  struct rusage after;
+  gdouble started;
+  gint phase;
+
+  started = g_timer_elapsed (op->timer, NULL);
+  getrusage (RUSAGE_SELF, &before);
+  phase = op->phase;
+
+  gtk_xtbin_plugin_lock ();
+  if (op->cancelled)
+  {
+    g_set_error (&op->error, FLASH_ERROR, FLASH_ERROR_FILE_CANCELLED, "%s",
+                 "Playback start was cancelled");
   }
   else
   {
-    file->npp_instantiated = TRUE;
+    switch (op->phase)
+    {
+      case PLAY_INSTANTIATE:
+        flash_file_play_instantiate (file, op);
+        file->play_timings.instantiate = g_timer_elapsed (op->timer, NULL) - started;
+        break;
+      case PLAY_CREATE_WINDOW:
+        flash_file_play_create_window (file, op);
+        file->play_timings.create_window = g_timer_elapsed (op->timer, NULL) - started;
+        break;
+      case PLAY_SET_WINDOW:
+        flash_file_play_set_window (file, op);
+        file->play_timings.set_window = g_timer_elapsed (op->timer, NULL) - started;
+        break;
+      case PLAY_STREAM:
+        flash_file_send_to_plugin (file, op->file_url, &op->error);
+        file->play_timings.stream = g_timer_elapsed (op->timer, NULL) - started;
+        break;
+      default:
+        g_assert_not_reached ();
+    }
   }
 
-  /* Create plugin window */
+  if (op->error)
+  {
+    flash_file_play_abort (file, op);
+    op->phase = PLAY_DONE;
+  }
+  else if (++op->phase == PLAY_DONE)
+  {
+    flash_file_play_started (file, op);
+  }
+  gtk_xtbin_plugin_unlock ();
 
-  xt_bin = gtk_xtbin_new (window, NULL);
-  if (!xt_bin)
+  getrusage (RUSAGE_SELF, &after);
+  file->play_timings.major_faults += after.ru_majflt - before.ru_majflt;
+  file->play_timings.minor_faults += after.ru_minflt - before.ru_minflt;
+  if (phase == PLAY_STREAM)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+    file->play_timings.stream_major_faults += after.ru_majflt -
+                                              before.ru_majflt;
+    file->play_timings.stream_minor_faults += after.ru_minflt -
+                                              before.ru_minflt;
+  }
+
+  if (op->phase == PLAY_DONE)
+    file->play_timings.total = g_timer_elapsed (op->timer, NULL);
+}
+
+static gboolean
+flash_file_play_idle (gpointer data)
+{
+  FlashFilePlayOp *op;
+  FlashFile *file;
+
+  op = (FlashFilePlayOp *) data;
+  file = op->file;
+
+  if (op->phase != PLAY_DONE)
+  {
+    flash_file_play_step (file, op);
+    if (op->phase != PLAY_DONE)
+      return TRUE;
+  }
+
+  if (file->play_op == op)
+    file->play_op = NULL;
+  file->play_result = op;
+  if (op->callback)
+    op->callback (file, op->callback_data);
+
+  /* Nobody asked for the result */
+  if (file->play_result == op)
+    flash_file_play_finish (file, NULL);
+  g_object_unref (file);
+  return FALSE;
+}
+
+static void
+flash_file_play_instantiate (FlashFile *file, FlashFilePlayOp *op)
+{
+  gboolean mapped;
+  gint depth;
+
+  memset (&file->play_timings, 0, sizeof(file->play_timings));
+  memset (&file->npwin, 0, sizeof(file->npwin));
+  memset (&file->npws, 0, sizeof(file->npws));
+
+  g_assert (GTK_WIDGET(op->window)->window != NULL);
+  gdk_window_get_geometry (GTK_WIDGET(op->window)->window, NULL, NULL,
+                           &op->width, &op->height, &depth);
+
+  /* Mapping starts the data being read in while the plugin is set up;
+   * errors are reported when it's streamed */
+  mapped = flash_file_map (file, NULL);
+
+  op->file_url = flash_file_make_file_url (file);
+  if (!flash_file_instantiate (file, op->file_url, op->width, op->height,
+                               op->loop, &op->error))
+    return;
+
+  /* Get the requests for what the movie loads going before the plugin
+   * has even seen it */
+  if (!file->prefetch && mapped)
+    file->prefetch = flash_prefetch_new (file->library, op->file_url,
+                                         file->map, file->map_size,
+                                         flash_file_prefetch_done, file);
+}
+
+static void
+flash_file_play_create_window (FlashFile *file, FlashFilePlayOp *op)
+{
+  op->xt_bin = gtk_xtbin_new (GTK_WIDGET(op->window)->window, NULL);
+  if (!op->xt_bin)
+  {
+    g_set_error (&op->error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
                  "Failed to create playback container");
-    goto err_out;
+    return;
   }
-  gtk_widget_show (xt_bin);
+  gtk_widget_show (op->xt_bin);
   gdk_flush ();
+}
+
+static void
+flash_file_play_set_window (FlashFile *file, FlashFilePlayOp *op)
+{
+  GdkWindow *window;
+  NPError nperr;
+
+  window = GTK_WIDGET(op->window)->window;
 
-  npwin.window = (void *)GTK_XTBIN (xt_bin)->xtwindow;
-  npwin.x = 0;
-  npwin.y = 0;
-  npwin.width = width;
-  npwin.height = height;
-  npwin.type = NPWindowTypeWindow;
+  file->npwin.window = (void *)GTK_XTBIN (op->xt_bin)->xtwindow;
+  file->npwin.x = 0;
+  file->npwin.y = 0;
+  file->npwin.width = op->width;
+  file->npwin.height = op->height;
+  file->npwin.type = NPWindowTypeWindow;
 
-  npws.type = NP_SETWINDOW;
-  npws.depth = gdk_window_get_visual (window)->depth;
-  npws.display = GTK_XTBIN (xt_bin)->xtdisplay;
-  npws.visual = GDK_VISUAL_XVISUAL (gdk_window_get_visual (window));
-  npws.colormap = GDK_COLORMAP_XCOLORMAP (gdk_window_get_colormap (window));
+  file->npws.type = NP_SETWINDOW;
+  file->npws.depth = gdk_window_get_visual (window)->depth;
+  file->npws.display = GTK_XTBIN (op->xt_bin)->xtdisplay;
+  file->npws.visual = GDK_VISUAL_XVISUAL (gdk_window_get_visual (window));
+  file->npws.colormap = GDK_COLORMAP_XCOLORMAP (gdk_window_get_colormap (window));
 
-  npwin.ws_info = (void *)&npws;
+  file->npwin.ws_info = (void *)&file->npws;
 
-  XFlush (npws.display);
+  XFlush (file->npws.display);
 
-  gtk_xtbin_resize (xt_bin, width, height);
+  gtk_xtbin_resize (op->xt_bin, op->width, op->height);
 
   /* Plugin, show thyself */
 
-  nperr = PLUGIN_CALL (file, setwindow, file->instance, &npwin);
+  nperr = PLUGIN_CALL (file, setwindow, file->instance, &file->npwin);
   if (nperr != NPERR_NO_ERROR)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+    g_set_error (&op->error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
                  "Failed to set plugin window");
-    goto err_out;
+    return;
   }
-  npp_window_set = TRUE;
-
-  /* Stream data to plugin */
-
-  if (!flash_file_send_to_plugin (file, file_url, error))
-    goto err_out;
+  op->npp_window_set = TRUE;
+}
 
+static void
+flash_file_play_started (FlashFile *file, FlashFilePlayOp *op)
+{
   /* Avoid unexpected surprises when we try to release the ref later */
-  g_object_ref (xt_bin);
+  g_object_ref (op->xt_bin);
 
-  file->xt_bin = xt_bin;
+  file->xt_bin = op->xt_bin;
   file->is_playing = TRUE;
+  file->loop = op->loop;
+  flash_file_start_metrics (file);
 
-  if (!loop && file->callback)
+  if (!op->loop && file->callback)
   {
     /* Ugly, but the Flash plugin has no means for us to register a callback
      * to be called when it finishes playback. */
-    g_timeout_add (25, flash_file_timer_callback, file);
+    file->timer_id = g_timeout_add (25, flash_file_timer_callback, file);
   }
+}
 
-  goto out;
-err_out:
-  ret = FALSE;
-  if (npp_window_set)
+static void
+flash_file_play_abort (FlashFile *file, FlashFilePlayOp *op)
+{
+  if (op->npp_window_set)
     PLUGIN_CALL (file, setwindow, file->instance, NULL);
-  if (xt_bin)
-    gtk_widget_destroy (xt_bin);
-  if (file->npp_instantiated)
-  {
-    PLUGIN_CALL(file, destroy, file->instance, NULL);
-    file->npp_instantiated = FALSE;
-  }
-out:
-  if (argc > 0)
-    flash_file_free_attrs (argc, argn, argv);
-  if (file_url)
-    g_free (file_url);
-  return ret;
+  if (op->xt_bin)
+    gtk_widget_destroy (op->xt_bin);
+  flash_file_destroy_instance (file);
+  op->npp_window_set = FALSE;
+  op->xt_bin = NULL;
 }
 
 gboolean
@@ -302,13 +789,18 @@ flash_file_is_playing (FlashFile *file)
 
   if (!file->library->spf_is_playing)
     return file->is_playing;
+  gtk_xtbin_plugin_lock ();
   peer = flash_file_get_script_peer (file);
   if (!peer)
+  {
+    gtk_xtbin_plugin_unlock ();
     return file->is_playing;
+  }
   playing = 0xdeadbabe;
   file->library->spf_is_playing (peer, &playing);
 	g_assert (playing != 0xdeadbabe);
   flash_file_release_script_peer (file, peer);
+  gtk_xtbin_plugin_unlock ();
   return (gboolean) playing;
 }
 
@@ -319,12 +811,23 @@ flash_file_pause (FlashFile *file)
 
   if (!file->library->spf_stop_play)
     return FALSE;
+  /* A paused file isn't playing, don't report that as the end */
+  if (file->timer_id)
+  {
+    g_source_remove (file->timer_id);
+    file->timer_id = 0;
+  }
+  /* Nor is the time spent paused a dropped frame */
+  file->have_last_frame = FALSE;
+  gtk_xtbin_plugin_lock ();
   peer = flash_file_get_script_peer (file);
-  if (!peer)
-    return FALSE;
-  file->library->spf_stop_play (peer);
-  flash_file_release_script_peer (file, peer);
-  return TRUE;
+  if (peer)
+  {
+    file->library->spf_stop_play (peer);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return peer != NULL;
 }
 
 gboolean
@@ -334,73 +837,1111 @@ flash_file_resume (FlashFile *file)
 
   if (!file->library->spf_play)
     return FALSE;
+  gtk_xtbin_plugin_lock ();
   peer = flash_file_get_script_peer (file);
-  if (!peer)
-    return FALSE;
-  file->library->spf_play (peer);
-  flash_file_release_script_peer (file, peer);
-  return TRUE;
+  if (peer)
+  {
+    file->library->spf_play (peer);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  if (peer && !file->loop && file->callback && !file->timer_id)
+    file->timer_id = g_timeout_add (25, flash_file_timer_callback, file);
+  file->have_last_frame = FALSE;
+  return peer != NULL;
 }
 
 gboolean
 flash_file_stop (FlashFile *file)
 {
+  flash_file_play_cancel (file);
   if (!file->is_playing)
     return FALSE;
   file->is_playing = FALSE;
+  if (file->timer_id)
+  {
+    g_source_remove (file->timer_id);
+    file->timer_id = 0;
+  }
+  if (file->resize_id)
+  {
+    g_source_remove (file->resize_id);
+    file->resize_id = 0;
+  }
+  flash_file_stop_metrics (file);
+  gtk_xtbin_plugin_lock ();
   if (file->xt_bin)
   {
     gtk_widget_destroy (file->xt_bin);
     file->xt_bin = NULL;
   }
   PLUGIN_CALL (file, setwindow, file->instance, NULL);
-  if (file->npp_instantiated)
-  {
-    PLUGIN_CALL(file, destroy, file->instance, NULL);
-    file->npp_instantiated = FALSE;
-  }
+  flash_file_destroy_instance (file);
+  gtk_xtbin_plugin_unlock ();
   return TRUE;
 }
 
 gboolean
-flash_file_resize (FlashFile *file, gint width, gint height, GError **error)
+flash_file_restart (FlashFile *file, GError **error)
 {
-  /* FIXME */
-  return TRUE;
-}
+  void *peer;
+  gboolean ret;
 
-void
-flash_file_set_notify (FlashFile *file, const gchar *notify_url, void *notify_data)
-{
+  if (!file->is_playing || !file->xt_bin)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "File is not playing");
+    return FALSE;
+  }
 
-  if (file->notify_url)
-    g_free (file->notify_url);
-  file->notify_url = g_strdup (notify_url);
-  file->notify_data = notify_data;
+  gtk_xtbin_plugin_lock ();
+
+  /* Cheapest: rewind the running instance */
+  peer = NULL;
+  if (file->library->spf_rewind && file->library->spf_play)
+    peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    file->library->spf_rewind (peer);
+    file->library->spf_play (peer);
+    flash_file_release_script_peer (file, peer);
+    ret = TRUE;
+  }
+  else
+    ret = flash_file_reinstantiate (file, error);
+
+  gtk_xtbin_plugin_unlock ();
+
+  /* The end of the previous run may already have been reported */
+  if (ret && !file->loop && file->callback && !file->timer_id)
+    file->timer_id = g_timeout_add (25, flash_file_timer_callback, file);
+  return ret;
+}
+
+/* Starts a fresh instance in the same window, and streams it the data we
+ * still have mapped; stops the file if that fails */
+static gboolean
+flash_file_reinstantiate (FlashFile *file, GError **error)
+{
+  gchar *file_url;
+  gboolean ret;
+
+  gtk_xtbin_plugin_lock ();
+  PLUGIN_CALL (file, setwindow, file->instance, NULL);
+  flash_file_destroy_instance (file);
+
+  file_url = flash_file_make_file_url (file);
+  ret = flash_file_instantiate (file, file_url, file->npwin.width,
+                                file->npwin.height, file->loop, error) &&
+        PLUGIN_CALL (file, setwindow, file->instance,
+                     &file->npwin) == NPERR_NO_ERROR &&
+        flash_file_send_to_plugin (file, file_url, error);
+  g_free (file_url);
+  if (!ret)
+  {
+    if (error && !*error)
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                   "Failed to set plugin window");
+    flash_file_stop (file);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return ret;
+}
+
+gboolean
+flash_file_seek (FlashFile *file, gint frame, GError **error)
+{
+  void *peer;
+  gint total;
+
+  if (!file->library->spf_goto_frame)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Plugin doesn't support seeking");
+    return FALSE;
+  }
+  total = flash_file_get_total_frames (file);
+  if (frame < 0 || (total != -1 && frame >= total))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY,
+                 "Frame %d is out of range", frame);
+    return FALSE;
+  }
+  gtk_xtbin_plugin_lock ();
+  peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    file->library->spf_goto_frame (peer, frame);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  if (!peer)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "File is not playing");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+gint
+flash_file_get_frame (FlashFile *file)
+{
+  void *peer;
+  int frame;
+
+  if (!file->library->spf_tcurrent_frame)
+    return -1;
+  frame = -1;
+  gtk_xtbin_plugin_lock ();
+  peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    /* "/" is the root timeline */
+    file->library->spf_tcurrent_frame (peer, "/", &frame);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return frame;
+}
+
+gint
+flash_file_get_total_frames (FlashFile *file)
+{
+  void *peer;
+  int total;
+
+  if (!file->library->spf_total_frames)
+    return -1;
+  total = -1;
+  gtk_xtbin_plugin_lock ();
+  peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    file->library->spf_total_frames (peer, &total);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return total;
+}
+
+gboolean
+flash_file_set_variable (FlashFile *file, const gchar *name,
+                         const gchar *value)
+{
+  void *peer;
+
+  if (!file->library->spf_set_variable)
+    return FALSE;
+  gtk_xtbin_plugin_lock ();
+  peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    file->library->spf_set_variable (peer, name, value);
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return peer != NULL;
+}
+
+gchar *
+flash_file_get_variable (FlashFile *file, const gchar *name)
+{
+  void *peer;
+  char *value;
+  gchar *ret;
+
+  if (!file->library->spf_get_variable)
+    return NULL;
+  value = NULL;
+  ret = NULL;
+  gtk_xtbin_plugin_lock ();
+  peer = flash_file_get_script_peer (file);
+  if (peer)
+  {
+    /* An XPCOM out string: it's the caller's to free */
+    file->library->spf_get_variable (peer, name, &value);
+    if (value)
+    {
+      ret = g_strdup (value);
+      g_free (value);
+    }
+    flash_file_release_script_peer (file, peer);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return ret;
+}
+
+static const gchar *quality_names[] = { "low", "medium", "high", "best" };
+
+/* Where name is in attr_names, or -1 */
+static gint
+flash_file_find_attribute (FlashFile *file, const gchar *name)
+{
+  guint i;
+
+  if (!file->attr_names)
+    return -1;
+  for (i = 0; i < file->attr_names->len; i++)
+  {
+    if (g_ascii_strcasecmp (g_ptr_array_index (file->attr_names, i),
+                            name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+gboolean
+flash_file_set_attribute (FlashFile *file, const gchar *name,
+                          const gchar *value)
+{
+  const gchar *reserved[] = { "SRC", "TYPE", "WIDTH", "HEIGHT", "LOOP",
+                              NULL };
+  gint i;
+
+  for (i = 0; reserved[i]; i++)
+  {
+    if (g_ascii_strcasecmp (name, reserved[i]) == 0)
+      return FALSE;
+  }
+
+  if (!file->attr_names)
+  {
+    file->attr_names = g_ptr_array_new ();
+    file->attr_values = g_ptr_array_new ();
+  }
+  i = flash_file_find_attribute (file, name);
+  if (i != -1)
+  {
+    g_free (g_ptr_array_remove_index (file->attr_names, i));
+    g_free (g_ptr_array_remove_index (file->attr_values, i));
+  }
+  if (value)
+  {
+    g_ptr_array_add (file->attr_names, g_strdup (name));
+    g_ptr_array_add (file->attr_values, g_strdup (value));
+  }
+  return TRUE;
+}
+
+const gchar *
+flash_file_get_attribute (FlashFile *file, const gchar *name)
+{
+  gint i;
+
+  i = flash_file_find_attribute (file, name);
+  return i != -1 ? g_ptr_array_index (file->attr_values, i) : NULL;
+}
+
+FlashFileQuality
+flash_file_get_quality (FlashFile *file)
+{
+  const gchar *value;
+  gint i;
+
+  value = flash_file_get_attribute (file, "QUALITY");
+  if (value)
+  {
+    for (i = 0; i < (gint) G_N_ELEMENTS (quality_names); i++)
+    {
+      if (g_ascii_strcasecmp (value, quality_names[i]) == 0)
+        return i;
+    }
+  }
+  return FLASH_FILE_QUALITY_HIGH;
+}
+
+/* Sets the attribute, and changes the running instance to match */
+static gboolean
+flash_file_apply_quality (FlashFile *file, FlashFileQuality quality,
+                          GError **error)
+{
+  gboolean ret;
+
+  flash_file_set_attribute (file, "QUALITY", quality_names[quality]);
+  if (!file->is_playing || !file->xt_bin)
+    return TRUE;
+
+  /* _quality is a global property, so setting it anywhere sets it for the
+   * whole movie. Whether the plugin took the value can't be told, so this
+   * only falls back when there's no ScriptablePeer. */
+  if (flash_file_set_variable (file, "_quality", quality_names[quality]))
+    return TRUE;
+
+  ret = flash_file_reinstantiate (file, error);
+  if (ret && !file->loop && file->callback && !file->timer_id)
+    file->timer_id = g_timeout_add (25, flash_file_timer_callback, file);
+  return ret;
+}
+
+gboolean
+flash_file_set_quality (FlashFile *file, FlashFileQuality quality,
+                        GError **error)
+{
+  g_return_val_if_fail (quality <= FLASH_FILE_QUALITY_BEST, FALSE);
+
+  file->quality_ceiling = quality;
+  file->quality_trend = 0;
+  return flash_file_apply_quality (file, quality, error);
+}
+
+void
+flash_file_set_adaptive_quality (FlashFile *file, gboolean enabled)
+{
+  if (file->adaptive_quality == enabled)
+    return;
+  file->adaptive_quality = enabled;
+  file->quality_ceiling = flash_file_get_quality (file);
+  flash_file_schedule_quality (file);
+}
+
+gboolean
+flash_file_resize (FlashFile *file, gint width, gint height, GError **error)
+{
+  g_return_val_if_fail (width > 0 && height > 0, FALSE);
+
+  if (!file->is_playing || !file->xt_bin)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "File is not playing");
+    return FALSE;
+  }
+
+  /* Window drags and animated layouts resize on every motion event. The
+   * first resize is applied right away, any others arriving within the
+   * same frame interval are folded into a single update at its end. */
+  file->resize_width = width;
+  file->resize_height = height;
+  if (file->resize_id)
+  {
+    file->resize_pending = TRUE;
+    return TRUE;
+  }
+  flash_file_set_window_size (file, width, height);
+  file->resize_pending = FALSE;
+  file->resize_id = g_timeout_add (RESIZE_INTERVAL,
+                                   flash_file_resize_callback, file);
+  return TRUE;
+}
+
+gboolean
+flash_file_reparent (FlashFile *file, GtkWindow *window, GError **error)
+{
+  if (!file->is_playing || !file->xt_bin)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "File is not playing");
+    return FALSE;
+  }
+  if (GTK_BIN (window)->child)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Window is already in use");
+    return FALSE;
+  }
+
+  /* The plugin instance and its window survive, only the X window
+   * hierarchy changes */
+  gtk_xtbin_plugin_lock ();
+  gtk_xtbin_reparent (file->xt_bin, GTK_WIDGET (window)->window);
+  gtk_xtbin_plugin_unlock ();
+  return TRUE;
+}
+
+GdkPixbuf *
+flash_file_capture (FlashFile *file, GError **error)
+{
+  GdkWindow *window;
+  GdkPixbuf *pixbuf;
+  GtkXtBin *xt_bin;
+  XImage *image;
+  guint8 *pixels;
+  gint stride;
+  gint width;
+  gint height;
+  gint y;
+
+  if (!file->is_playing || !file->xt_bin)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "File is not playing");
+    return NULL;
+  }
+
+  /* The plugin draws through its own Xt connection; reading back through
+   * it too sees everything it has queued so far. The window can go away
+   * or be resized under us, which mustn't take the process down; the GDK
+   * path below is tried instead. */
+  xt_bin = GTK_XTBIN (file->xt_bin);
+  gtk_xtbin_plugin_lock ();
+  gdk_error_trap_push ();
+  image = XGetImage (xt_bin->xtdisplay, xt_bin->xtwindow, 0, 0,
+                     xt_bin->width, xt_bin->height, AllPlanes, ZPixmap);
+  XSync (xt_bin->xtdisplay, False);
+  if (gdk_error_trap_pop () && image)
+  {
+    XDestroyImage (image);
+    image = NULL;
+  }
+  gtk_xtbin_plugin_unlock ();
+
+  /* The common 24/32 bit visual only needs its red and blue swapped, which
+   * is a lot cheaper than the generic GdkPixbuf conversion */
+  if (image && image->bits_per_pixel == 32 && image->byte_order == LSBFirst &&
+      image->red_mask == 0xff0000 && image->green_mask == 0xff00 &&
+      image->blue_mask == 0xff)
+  {
+    pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, image->width,
+                             image->height);
+    pixels = gdk_pixbuf_get_pixels (pixbuf);
+    stride = gdk_pixbuf_get_rowstride (pixbuf);
+    for (y = 0; y < image->height; y++)
+      flash_pixel_swizzle ((guint8 *) image->data + y * image->bytes_per_line,
+                           pixels + y * stride, image->width, TRUE);
+    XDestroyImage (image);
+    return pixbuf;
+  }
+  if (image)
+    XDestroyImage (image);
+
+  gdk_flush ();
+  window = GTK_WIDGET (file->xt_bin)->window;
+  gdk_window_get_geometry (window, NULL, NULL, &width, &height, NULL);
+  pixbuf = gdk_pixbuf_get_from_drawable (NULL, window, NULL, 0, 0, 0, 0,
+                                         width, height);
+  if (!pixbuf)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CAPTURE, "%s",
+                 "Failed to read back plugin window");
+    return NULL;
+  }
+  return pixbuf;
+}
+
+GdkPixbuf *
+flash_file_render_thumbnail (FlashLibrary *library, const gchar *path,
+                             gint width, gint height, gint frame,
+                             guint delay_ms, GError **error)
+{
+  FlashFile *file;
+  GtkWidget *window;
+  GdkPixbuf *capture;
+  GdkPixbuf *thumbnail;
+  GMainLoop *loop;
+  GError *save_error;
+  gchar *cache_path;
+  gchar *tmp_path;
+
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  window = NULL;
+  capture = NULL;
+  thumbnail = NULL;
+  cache_path = NULL;
+
+  file = flash_file_new (library, path, NULL, NULL, error);
+  if (!file || !flash_file_map (file, error))
+    goto out;
+
+  cache_path = flash_file_thumbnail_path (file, width, height, frame,
+                                          delay_ms);
+  if (cache_path)
+  {
+    thumbnail = gdk_pixbuf_new_from_file (cache_path, NULL);
+    if (thumbnail)
+    {
+      DEBUG ("thumbnail cache hit for %s: %s", path, cache_path);
+      goto out;
+    }
+  }
+
+  /* Render at twice the size and box filter it down; that's enough to
+   * smooth out the plugin's aliased vector edges. The window goes in the
+   * top left corner, as the contents of off screen windows can't be read
+   * back; run under Xvfb (see flash-farm) to keep it off the desktop. */
+  window = gtk_window_new (GTK_WINDOW_POPUP);
+  gtk_window_set_default_size (GTK_WINDOW (window),
+                               width * THUMBNAIL_OVERSAMPLE,
+                               height * THUMBNAIL_OVERSAMPLE);
+  gtk_window_move (GTK_WINDOW (window), 0, 0);
+  gtk_widget_show (window);
+  gdk_flush ();
+
+  if (!flash_file_play (file, GTK_WINDOW (window), FALSE, error))
+    goto out;
+  if (frame >= 0 && !flash_file_seek (file, frame, error))
+    goto out;
+  if (delay_ms > 0)
+  {
+    loop = g_main_loop_new (NULL, FALSE);
+    g_timeout_add (delay_ms, flash_file_thumbnail_timeout, loop);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+  }
+
+  capture = flash_file_capture (file, error);
+  if (!capture)
+    goto out;
+  if (gdk_pixbuf_get_n_channels (capture) == 4 &&
+      gdk_pixbuf_get_width (capture) >= width * THUMBNAIL_OVERSAMPLE &&
+      gdk_pixbuf_get_height (capture) >= height * THUMBNAIL_OVERSAMPLE)
+  {
+    thumbnail = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+    flash_pixel_downscale_box (gdk_pixbuf_get_pixels (capture),
+                               gdk_pixbuf_get_rowstride (capture),
+                               width * THUMBNAIL_OVERSAMPLE,
+                               height * THUMBNAIL_OVERSAMPLE,
+                               THUMBNAIL_OVERSAMPLE,
+                               gdk_pixbuf_get_pixels (thumbnail),
+                               gdk_pixbuf_get_rowstride (thumbnail));
+  }
+  else
+  {
+    /* Odd visual, or the window didn't get the size we asked for */
+    thumbnail = gdk_pixbuf_scale_simple (capture, width, height,
+                                         GDK_INTERP_BILINEAR);
+  }
+
+  /* Write to a temporary name first so concurrent renderers never see a
+   * partial file; failing to cache isn't an error */
+  if (cache_path)
+  {
+    tmp_path = g_strdup_printf ("%s.%d.tmp", cache_path, (int) getpid ());
+    save_error = NULL;
+    if (gdk_pixbuf_save (thumbnail, tmp_path, "png", &save_error, NULL))
+      rename (tmp_path, cache_path);
+    else
+    {
+      DEBUG ("failed to cache thumbnail: %s", save_error->message);
+      g_error_free (save_error);
+      unlink (tmp_path);
+    }
+    g_free (tmp_path);
+  }
+
+out:
+  if (capture)
+    g_object_unref (capture);
+  if (file)
+  {
+    flash_file_stop (file);
+    g_object_unref (file);
+  }
+  if (window)
+    gtk_widget_destroy (window);
+  g_free (cache_path);
+  return thumbnail;
+}
+
+/* Cache entries are named after a 64 bit FNV-1a hash of the file contents
+ * and the render parameters, so renamed or re-uploaded copies of a file
+ * share one entry. Returns NULL if there's nowhere to cache. */
+static gchar *
+flash_file_thumbnail_path (FlashFile *file, gint width, gint height,
+                           gint frame, guint delay_ms)
+{
+  const guint8 *p;
+  const gchar *dir;
+  gchar *default_dir;
+  gchar *path;
+  guint64 hash;
+  gsize i;
+
+  default_dir = NULL;
+  dir = g_getenv ("FLASH_THUMBNAIL_CACHE");
+  if (!dir)
+  {
+    default_dir = g_build_filename (g_get_home_dir (), ".flash-thumbnails",
+                                    NULL);
+    dir = default_dir;
+  }
+  if (mkdir (dir, 0700) == -1 && errno != EEXIST)
+  {
+    DEBUG ("can't create thumbnail cache %s: %s", dir, strerror (errno));
+    g_free (default_dir);
+    return NULL;
+  }
+
+  /* Only the mapped start of a big file is hashed, so its size is too */
+  hash = G_GINT64_CONSTANT (0xcbf29ce484222325U) ^ file->data_size;
+  p = file->map;
+  for (i = 0; i < file->map_size; i++)
+  {
+    hash ^= p[i];
+    hash *= G_GINT64_CONSTANT (0x100000001b3U);
+  }
+
+  path = g_strdup_printf ("%s/%08x%08x-%dx%d-%d-%u.png", dir,
+                          (guint32) (hash >> 32), (guint32) hash,
+                          width, height, frame, delay_ms);
+  g_free (default_dir);
+  return path;
+}
+
+static gboolean
+flash_file_thumbnail_timeout (gpointer data)
+{
+  g_main_loop_quit ((GMainLoop *) data);
+  return FALSE;
+}
+
+void
+flash_file_get_frame_stats (FlashFile *file, FlashFileFrameStats *stats)
+{
+  gdouble elapsed;
+
+  stats->presented = file->frames_presented;
+  stats->dropped = file->frames_dropped;
+  stats->nominal_frame_rate = file->nominal_frame_rate;
+  memcpy (stats->frame_times, file->frame_times, sizeof(file->frame_times));
+
+  /* With periodic reports the rate is per report, otherwise overall */
+  stats->frame_rate = file->frame_rate;
+  if (!file->metrics_interval && file->metrics_timer)
+  {
+    elapsed = g_timer_elapsed (file->metrics_timer, NULL);
+    stats->frame_rate = elapsed > 0 ? file->frames_presented / elapsed : 0;
+  }
+}
+
+void
+flash_file_get_stream_stats (FlashFile *file, FlashStreamStats *stats)
+{
+  *stats = file->stream_stats;
+}
+
+static void
+flash_file_free_request (FlashFileRequest *request)
+{
+  g_free (request->url);
+  g_free (request->target);
+  g_free (request->buf);
+  g_free (request);
+}
+
+/* Drops the requests still waiting for the main loop */
+static void
+flash_file_drop_requests (FlashFile *file)
+{
+  gtk_xtbin_plugin_lock ();
+  if (file->requests_id)
+  {
+    g_source_remove (file->requests_id);
+    file->requests_id = 0;
+  }
+  while (file->requests)
+  {
+    flash_file_free_request (file->requests->data);
+    file->requests = g_list_delete_link (file->requests, file->requests);
+  }
+  gtk_xtbin_plugin_unlock ();
+}
+
+static gboolean
+flash_file_run_requests (gpointer data)
+{
+  FlashFile *file;
+  FlashFileRequest *request;
+  NPError nperr;
+
+  file = FLASH_FILE (data);
+  gtk_xtbin_plugin_lock ();
+  file->requests_id = 0;
+  while (file->requests)
+  {
+    request = file->requests->data;
+    file->requests = g_list_delete_link (file->requests, file->requests);
+    if (request->post)
+      nperr = flash_file_post_url (file, request->url, request->target,
+                                   request->len, request->buf,
+                                   request->is_file, request->notify_data);
+    else
+      nperr = flash_file_get_url (file, request->url, request->notify_data);
+    /* The plugin was told the request was accepted, so it can only hear
+     * otherwise through the notification */
+    if (nperr != NPERR_NO_ERROR && request->notify_data)
+      PLUGIN_CALL (file, urlnotify, file->instance, request->url,
+                   NPRES_NETWORK_ERR, request->notify_data);
+    flash_file_free_request (request);
+  }
+  gtk_xtbin_plugin_unlock ();
+  return FALSE;
+}
+
+/* Called on the Xt event thread, with the plugin lock held */
+static NPError
+flash_file_queue_request (FlashFile *file, gboolean post, const gchar *url,
+                          const gchar *target, uint32 len, const char *buf,
+                          NPBool is_file, void *notify_data)
+{
+  FlashFileRequest *request;
+
+  request = g_new0 (FlashFileRequest, 1);
+  request->post = post;
+  request->url = g_strdup (url);
+  request->target = g_strdup (target);
+  /* The plugin's buffer is only good for the duration of the call; a
+   * file name isn't necessarily terminated */
+  request->buf = g_malloc (len + 1);
+  if (len > 0)
+    memcpy (request->buf, buf, len);
+  request->buf[len] = '\0';
+  request->len = len;
+  request->is_file = is_file;
+  request->notify_data = notify_data;
+
+  file->requests = g_list_append (file->requests, request);
+  if (!file->requests_id)
+    file->requests_id = g_idle_add (flash_file_run_requests, file);
+  return NPERR_NO_ERROR;
+}
+
+static void
+flash_file_post_done (FlashPost *post, gpointer user_data)
+{
+  FlashFile *file;
+
+  file = user_data;
+  file->posts = g_list_remove (file->posts, post);
+}
+
+NPError
+flash_file_post_url (FlashFile *file, const gchar *url, const gchar *target,
+                     uint32 len, const char *buf, NPBool is_file,
+                     void *notify_data)
+{
+  FlashPost *post;
+  NPError nperr;
+
+  if (gtk_xtbin_in_event_thread ())
+    return flash_file_queue_request (file, TRUE, url, target, len, buf,
+                                     is_file, notify_data);
+
+  post = flash_post_new (file->library, file->instance, url, target, len,
+                         buf, is_file, notify_data, &file->stream_stats,
+                         flash_file_post_done, file, &nperr);
+  if (post)
+    file->posts = g_list_prepend (file->posts, post);
+  return nperr;
+}
+
+static void
+flash_file_prefetch_done (FlashPrefetch *prefetch, gpointer user_data)
+{
+  FlashFile *file;
+
+  file = user_data;
+  file->prefetch = NULL;
+}
+
+/* The prefetch of url is over, so the GETs waiting for it can go ahead,
+ * from the cache if it could keep the response */
+static void
+flash_file_prefetched (const gchar *url, gpointer user_data)
+{
+  FlashFile *file;
+  FlashFileRequest *request;
+  NPError nperr;
+  GList *l;
+  GList *next;
+
+  file = user_data;
+  gtk_xtbin_plugin_lock ();
+  for (l = file->prefetch_waiting; l; l = next)
+  {
+    next = l->next;
+    request = l->data;
+    if (strcmp (request->url, url) != 0)
+      continue;
+    file->prefetch_waiting = g_list_delete_link (file->prefetch_waiting, l);
+    nperr = flash_file_get_url (file, request->url, request->notify_data);
+    if (nperr != NPERR_NO_ERROR && request->notify_data)
+      PLUGIN_CALL (file, urlnotify, file->instance, request->url,
+                   NPRES_NETWORK_ERR, request->notify_data);
+    flash_file_free_request (request);
+    /* The list may have changed meanwhile */
+    next = file->prefetch_waiting;
+  }
+  gtk_xtbin_plugin_unlock ();
+}
+
+static void
+flash_file_fetch_done (FlashFetch *fetch, gpointer user_data)
+{
+  FlashFile *file;
+
+  file = user_data;
+  file->fetches = g_list_remove (file->fetches, fetch);
+}
+
+gboolean
+flash_file_serves_url (FlashFile *file, const gchar *url)
+{
+  if (g_ascii_strncasecmp (url, "http://", 7) == 0 ||
+      g_ascii_strncasecmp (url, "https://", 8) == 0)
+    return TRUE;
+  if (!file->bundle)
+    return FALSE;
+  /* bundle: URLs, and ones without a scheme */
+  return g_ascii_strncasecmp (url, "bundle:", 7) == 0 ||
+         url[strcspn (url, ":/?#")] != ':';
+}
+
+static FlashFetch *
+flash_file_get_bundle_url (FlashFile *file, const gchar *url,
+                           void *notify_data, NPError *nperr)
+{
+  FlashFetch *fetch;
+  gchar *file_url;
+  gchar *full_url;
+  gchar *name;
+
+  file_url = flash_file_make_file_url (file);
+  full_url = flash_prefetch_resolve_url (file_url, url);
+  if (g_ascii_strncasecmp (full_url, "bundle:", 7) != 0)
+  {
+    g_free (full_url);
+    g_free (file_url);
+    *nperr = NPERR_INVALID_URL;
+    return NULL;
+  }
+  name = g_strndup (full_url + 7, strcspn (full_url + 7, "?#"));
+  fetch = flash_fetch_new_from_bundle (file->library, file->instance,
+                                       file->bundle, full_url, name,
+                                       notify_data, &file->stream_stats,
+                                       flash_file_fetch_done, file, nperr);
+  g_free (name);
+  g_free (full_url);
+  g_free (file_url);
+  return fetch;
+}
+
+NPError
+flash_file_get_url (FlashFile *file, const gchar *url, void *notify_data)
+{
+  FlashFileRequest *request;
+  FlashFetch *fetch;
+  NPError nperr;
+
+  if (gtk_xtbin_in_event_thread ())
+    return flash_file_queue_request (file, FALSE, url, NULL, 0, NULL, FALSE,
+                                     notify_data);
+
+  if (file->bundle && g_ascii_strncasecmp (url, "http://", 7) != 0 &&
+      g_ascii_strncasecmp (url, "https://", 8) != 0)
+    fetch = flash_file_get_bundle_url (file, url, notify_data, &nperr);
+  else if (file->prefetch &&
+           flash_prefetch_wait (file->prefetch, url, flash_file_prefetched,
+                                file))
+  {
+    request = g_new0 (FlashFileRequest, 1);
+    request->url = g_strdup (url);
+    request->notify_data = notify_data;
+    file->prefetch_waiting = g_list_append (file->prefetch_waiting, request);
+    return NPERR_NO_ERROR;
+  }
+  else
+    fetch = flash_fetch_new (file->library, file->instance, url, notify_data,
+                             &file->stream_stats, flash_file_fetch_done, file,
+                             &nperr);
+  if (fetch)
+    file->fetches = g_list_prepend (file->fetches, fetch);
+  return nperr;
+}
+
+void
+flash_file_set_sink_func (FlashFile *file, FlashFileSinkFunc func,
+                          gpointer user_data)
+{
+  file->sink_func = func;
+  file->sink_data = user_data;
+}
+
+NPError
+flash_file_new_sink_stream (FlashFile *file, const gchar *mime_type,
+                            const gchar *target, NPStream **stream)
+{
+  FlashSink *sink;
+  NPStream *npstream;
+
+  if (!file->sink_func)
+    return NPERR_GENERIC_ERROR;
+  sink = file->sink_func (file, mime_type, target, file->sink_data);
+  if (!sink)
+    return NPERR_GENERIC_ERROR;
+
+  flash_sink_open (sink, mime_type);
+  npstream = g_new0 (NPStream, 1);
+  npstream->ndata = sink;
+  npstream->url = g_strdup (target ? target : "");
+  file->sink_streams = g_list_prepend (file->sink_streams, npstream);
+  *stream = npstream;
+  return NPERR_NO_ERROR;
+}
+
+int32
+flash_file_write_sink_stream (FlashFile *file, NPStream *stream, int32 len,
+                              void *buf)
+{
+  if (!g_list_find (file->sink_streams, stream))
+    return -1;
+  return flash_sink_write (stream->ndata, buf, len);
+}
+
+NPError
+flash_file_destroy_sink_stream (FlashFile *file, NPStream *stream,
+                                NPReason reason)
+{
+  if (!g_list_find (file->sink_streams, stream))
+    return NPERR_INVALID_PARAM;
+
+  file->sink_streams = g_list_remove (file->sink_streams, stream);
+  flash_sink_close (stream->ndata, reason);
+  flash_sink_unref (stream->ndata);
+  g_free ((gchar *) stream->url);
+  g_free (stream);
+  return NPERR_NO_ERROR;
+}
+
+GtkWidget *
+flash_file_get_xt_bin (FlashFile *file)
+{
+  if (!file->is_playing)
+    return NULL;
+  return file->xt_bin;
+}
+
+void
+flash_file_set_notify (FlashFile *file, const gchar *notify_url, void *notify_data)
+{
+
+  if (file->notify_url)
+    g_free (file->notify_url);
+  file->notify_url = g_strdup (notify_url);
+  file->notify_data = notify_data;
 }
 
 static void
 flash_file_class_init (FlashFileClass *klass)
 {
+  GParamSpec *frames_presented_param;
+  GParamSpec *frames_dropped_param;
+  GParamSpec *frame_rate_param;
+  GParamSpec *nominal_frame_rate_param;
+  GParamSpec *metrics_interval_param;
   GObjectClass *object_class;
 
   object_class = G_OBJECT_CLASS (klass);
+  frames_presented_param = g_param_spec_uint ("frames-presented",
+                                              "frames presented",
+                                              "frames drawn since playback started",
+                                              0, G_MAXUINT, 0,
+                                              G_PARAM_READABLE);
+  frames_dropped_param = g_param_spec_uint ("frames-dropped",
+                                            "frames dropped",
+                                            "frames skipped relative to the nominal frame rate",
+                                            0, G_MAXUINT, 0,
+                                            G_PARAM_READABLE);
+  frame_rate_param = g_param_spec_double ("frame-rate",
+                                          "frame rate",
+                                          "measured frames per second",
+                                          0, G_MAXDOUBLE, 0,
+                                          G_PARAM_READABLE);
+  nominal_frame_rate_param = g_param_spec_double ("nominal-frame-rate",
+                                                  "nominal frame rate",
+                                                  "frames per second given in the SWF header",
+                                                  0, G_MAXDOUBLE, 0,
+                                                  G_PARAM_READABLE);
+  metrics_interval_param = g_param_spec_uint ("metrics-interval",
+                                              "metrics interval",
+                                              "ms between FLASH_FILE_FRAME_STATS events, 0 for none",
+                                              0, G_MAXUINT, 0,
+                                              G_PARAM_READWRITE);
+
+  object_class->set_property = flash_file_set_property;
+  object_class->get_property = flash_file_get_property;
   object_class->finalize = flash_file_finalize;
+
+  g_object_class_install_property (object_class, PROPERTY_FRAMES_PRESENTED, frames_presented_param);
+  g_object_class_install_property (object_class, PROPERTY_FRAMES_DROPPED, frames_dropped_param);
+  g_object_class_install_property (object_class, PROPERTY_FRAME_RATE, frame_rate_param);
+  g_object_class_install_property (object_class, PROPERTY_NOMINAL_FRAME_RATE, nominal_frame_rate_param);
+  g_object_class_install_property (object_class, PROPERTY_METRICS_INTERVAL, metrics_interval_param);
 }
 
 static void
 flash_file_reset (FlashFile *file)
 {
   file->path = NULL;
+  file->fd = -1;
+  file->bundle = NULL;
   file->library = NULL;
   file->instance = NULL;
   file->npp_instantiated = FALSE;
   file->xt_bin = NULL;
+  file->map = NULL;
+  file->map_size = 0;
+  file->data_size = 0;
+  file->feed = NULL;
+  file->io_policy = FLASH_FILE_IO_READAHEAD;
+  file->io_prepared = FALSE;
+  file->map_locked = FALSE;
+
+  memset (&file->npwin, 0, sizeof(file->npwin));
+  memset (&file->npws, 0, sizeof(file->npws));
+
+  file->resize_width = 0;
+  file->resize_height = 0;
+  file->resize_pending = FALSE;
+  file->resize_id = 0;
 
   file->notify_url = NULL;
   file->notify_data = NULL;
+  file->posts = NULL;
+  file->fetches = NULL;
+  file->requests = NULL;
+  file->requests_id = 0;
+  file->prefetch = NULL;
+  file->prefetch_waiting = NULL;
+  file->sink_func = NULL;
+  file->sink_data = NULL;
+  file->sink_streams = NULL;
 
   file->is_playing = FALSE;
+  file->loop = FALSE;
+  file->timer_id = 0;
+
+  file->play_op = NULL;
+  file->play_result = NULL;
+  memset (&file->play_timings, 0, sizeof(file->play_timings));
+
+  file->damage_display = NULL;
+  file->damage = None;
+  file->damage_event_base = 0;
+  file->nominal_frame_rate = 0;
+  file->have_last_frame = FALSE;
+  file->frames_presented = 0;
+  file->frames_dropped = 0;
+  memset (file->frame_times, 0, sizeof(file->frame_times));
+  file->metrics_timer = NULL;
+  file->metrics_frames = 0;
+  file->frame_rate = 0;
+  file->metrics_interval = 0;
+  file->metrics_id = 0;
+
+  file->attr_names = NULL;
+  file->attr_values = NULL;
+
+  file->adaptive_quality = FALSE;
+  file->quality_ceiling = FLASH_FILE_QUALITY_HIGH;
+  file->quality_id = 0;
+  file->quality_presented = 0;
+  file->quality_dropped = 0;
+  file->cpu_busy = 0;
+  file->cpu_total = 0;
+  file->quality_trend = 0;
+
+  memset (&file->stream_stats, 0, sizeof(file->stream_stats));
 
   file->callback = NULL;
   file->callback_data = NULL;
@@ -412,10 +1953,66 @@ flash_file_init (FlashFile *file)
   flash_file_reset(file);
 }
 
+static void
+flash_file_set_property (GObject *object,
+                         guint param_id,
+                         const GValue *value,
+                         GParamSpec *pspec)
+{
+  FlashFile *file;
+
+  file = FLASH_FILE (object);
+  switch (param_id)
+  {
+    case PROPERTY_METRICS_INTERVAL:
+      file->metrics_interval = g_value_get_uint (value);
+      flash_file_schedule_metrics (file);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+      break;
+  }
+}
+
+static void
+flash_file_get_property (GObject *object,
+                         guint param_id,
+                         GValue *value,
+                         GParamSpec *pspec)
+{
+  FlashFileFrameStats stats;
+  FlashFile *file;
+
+  file = FLASH_FILE (object);
+  flash_file_get_frame_stats (file, &stats);
+  switch (param_id)
+  {
+    case PROPERTY_FRAMES_PRESENTED:
+      g_value_set_uint (value, stats.presented);
+      break;
+    case PROPERTY_FRAMES_DROPPED:
+      g_value_set_uint (value, stats.dropped);
+      break;
+    case PROPERTY_FRAME_RATE:
+      g_value_set_double (value, stats.frame_rate);
+      break;
+    case PROPERTY_NOMINAL_FRAME_RATE:
+      g_value_set_double (value, stats.nominal_frame_rate);
+      break;
+    case PROPERTY_METRICS_INTERVAL:
+      g_value_set_uint (value, file->metrics_interval);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
+      break;
+  }
+}
+
 static void
 flash_file_finalize (GObject *object)
 {
   FlashFile *file;
+  guint i;
 
   file = FLASH_FILE (object);
   if (file->notify_url)
@@ -435,212 +2032,706 @@ flash_file_finalize (GObject *object)
   if (file->path)
     g_free (file->path);
 
+  /* munmap() unlocks, but a bundle's mapping outlives the file */
+  if (file->map_locked && file->bundle)
+    flash_file_unlock_map (file);
+  if (file->bundle)
+    flash_bundle_unref (file->bundle);
+  else if (file->map)
+    munmap (file->map, file->map_size);
+
+  if (file->fd != -1)
+    close (file->fd);
+
+  if (file->metrics_timer)
+    g_timer_destroy (file->metrics_timer);
+
+  if (file->attr_names)
+  {
+    for (i = 0; i < file->attr_names->len; i++)
+    {
+      g_free (g_ptr_array_index (file->attr_names, i));
+      g_free (g_ptr_array_index (file->attr_values, i));
+    }
+    g_ptr_array_free (file->attr_names, TRUE);
+    g_ptr_array_free (file->attr_values, TRUE);
+  }
+
   flash_file_reset(file);
 }
 
 static gboolean
-flash_file_new_attrs(int *argcp, char ***argnp, char ***argvp, ...)
+flash_file_instantiate (FlashFile *file, const gchar *file_url, gint width,
+                        gint height, gboolean loop, GError **error)
+{
+  int argc;
+  char **argn;
+  char **argv;
+#define MAX_DIGITS 20
+  char width_str[MAX_DIGITS+1];
+  char height_str[MAX_DIGITS+1];
+  NPSavedData *saved;
+  NPError nperr;
+  guint i;
+
+  memset (width_str, 0, sizeof(width_str));
+  memset (height_str, 0, sizeof(height_str));
+
+  argc = -1;
+  argn = argv = NULL;
+  snprintf (width_str, sizeof(width_str), "%d", width);
+  snprintf (height_str, sizeof(height_str), "%d", height);
+  if (loop) 
+  {
+    flash_file_new_attrs (&argc, &argn, &argv, 
+      "SRC", file_url,
+      "TYPE", MIME_TYPE,
+      "WIDTH", width_str,
+      "HEIGHT", height_str,
+      "LOOP", "true",
+      NULL);
+  }
+  else
+  {
+    flash_file_new_attrs (&argc, &argn, &argv, 
+      "SRC", file_url,
+      "TYPE", MIME_TYPE,
+      "WIDTH", width_str,
+      "HEIGHT", height_str,
+      "LOOP", "false",
+      NULL);
+  }
+
+  /* Then the ones set with flash_file_set_attribute() */
+  if (file->attr_names && file->attr_names->len > 0)
+  {
+    argn = g_renew (char *, argn, argc + file->attr_names->len);
+    argv = g_renew (char *, argv, argc + file->attr_names->len);
+    for (i = 0; i < file->attr_names->len; i++, argc++)
+    {
+      argn[argc] = g_strdup (g_ptr_array_index (file->attr_names, i));
+      argv[argc] = g_strdup (g_ptr_array_index (file->attr_values, i));
+    }
+  }
+
+  /* Whatever the plugin left behind the last time it played this URL.
+   * NPP_New takes ownership of it, and frees it with NPN_MemFree, whether
+   * it succeeds or not. */
+  saved = flash_library_take_saved_data (file->library, file_url);
+
+  nperr = PLUGIN_CALL(file, newp,
+    MIME_TYPE,
+    file->instance,
+    NP_EMBED,
+    argc,
+    argn,
+    argv,
+    saved);
+
+  if (argc > 0)
+    flash_file_free_attrs (argc, argn, argv);
+
+  if (nperr != NPERR_NO_ERROR)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Failed to create playback instance");
+    file->npp_instantiated = FALSE;
+    return FALSE;
+  }
+  file->npp_instantiated = TRUE;
+  return TRUE;
+}
+
+static void
+flash_file_destroy_instance (FlashFile *file)
+{
+  NPSavedData *saved;
+  gchar *file_url;
+
+  if (!file->npp_instantiated)
+    return;
+  flash_file_drop_requests (file);
+  flash_file_end_feed (file, NPRES_USER_BREAK);
+  while (file->posts)
+  {
+    flash_post_cancel (file->posts->data);
+    file->posts = g_list_delete_link (file->posts, file->posts);
+  }
+  while (file->fetches)
+  {
+    flash_fetch_cancel (file->fetches->data);
+    file->fetches = g_list_delete_link (file->fetches, file->fetches);
+  }
+  if (file->prefetch)
+  {
+    flash_prefetch_cancel (file->prefetch);
+    file->prefetch = NULL;
+  }
+  while (file->prefetch_waiting)
+  {
+    flash_file_free_request (file->prefetch_waiting->data);
+    file->prefetch_waiting = g_list_delete_link (file->prefetch_waiting,
+                                                 file->prefetch_waiting);
+  }
+  while (file->sink_streams)
+    flash_file_destroy_sink_stream (file, file->sink_streams->data,
+                                    NPRES_USER_BREAK);
+  saved = NULL;
+  PLUGIN_CALL(file, destroy, file->instance, &saved);
+  file->npp_instantiated = FALSE;
+
+  if (saved && (saved->len <= 0 || !saved->buf))
+  {
+    flash_library_free_saved_data (saved);
+    saved = NULL;
+  }
+  if (saved)
+  {
+    file_url = flash_file_make_file_url (file);
+    flash_library_store_saved_data (file->library, file_url, saved);
+    g_free (file_url);
+  }
+}
+
+static gboolean
+flash_file_new_attrs(int *argcp, char ***argnp, char ***argvp, ...)
+{
+  va_list ap;
+  int va_argc;
+  int argc;
+  char **argn;
+  char **argv;
+  int i;
+  int j;
+
+  va_argc = 0;
+  va_start (ap, argvp);
+  while (va_arg (ap, char *) != NULL)
+    va_argc++;
+  va_end (ap);
+
+  if (va_argc % 2 != 0)
+    return FALSE;
+
+  argc = va_argc / 2;
+  argn = g_malloc (sizeof(char *) * argc);
+  argv = g_malloc (sizeof(char *) * argc);
+
+  va_start (ap, argvp);
+  i = 1;
+  j = 0;
+  while (j < argc)
+  {
+    if (i % 2 != 0)
+    {
+      argn[j] = g_strdup (va_arg (ap, char *));
+      argv[j] = g_strdup (va_arg (ap, char *));
+      j++;
+    }
+    i++;
+  }
+  va_end (ap);
+
+  *argcp = argc;
+  *argnp = argn;
+  *argvp = argv;
+  return TRUE;
+}
+
+static void
+flash_file_free_attrs (int argc, char **argn, char **argv)
+{
+  int i;
+  for (i = 0; i < argc; i++)
+  {
+    g_free (argv[i]);
+    g_free (argn[i]);
+  }
+  g_free (argv);
+  g_free (argn);
+}
+
+static gchar *
+flash_file_make_file_url (FlashFile *file)
+{
+#define MAX_URL 2048
+  char buf[MAX_URL+1];
+
+  memset (buf, 0, sizeof(buf));
+  if (file->bundle)
+    snprintf (buf, sizeof(buf), "bundle:/%s", file->path);
+  else
+    snprintf (buf, sizeof(buf), "file:%s", file->path);
+
+  return g_strdup (buf);
+}
+
+/* Returns FALSE if the plugin aborted the stream. Only used for the few
+ * bytes of the notification stream, so it waits out a plugin that isn't
+ * ready rather than going back to the main loop. */
+static gboolean
+flash_file_write_buf (FlashStream *stream, const guint8 *buf, gsize len)
+{
+  int32 nwritten;
+
+  while (len > 0)
+  {
+    nwritten = flash_stream_write (stream, buf, MIN (len, (gsize) G_MAXINT32));
+    if (nwritten < 0)
+      return FALSE;
+    if (nwritten == 0)
+      g_usleep (FEED_RETRY_MS * 1000);
+    len -= nwritten;
+    buf += nwritten;
+  }
+  return TRUE;
+}
+
+static gboolean
+flash_file_stream_buf_to_plugin (FlashFile *file, const gchar *url,
+                                 const gchar *mime_type, uint16 stype,
+                                 const void *buf, gsize buf_size,
+                                 void *notify_data, GError **error)
+{
+  FlashStream *stream;
+  NPError nperr;
+
+  stream = flash_stream_open (file->library, file->instance, url, mime_type,
+                              buf_size, &stype, notify_data,
+                              &file->stream_stats, &nperr);
+  if (!stream)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Failed to create new stream");
+    return FALSE;
+  }
+
+  if (!flash_file_write_buf (stream, buf, buf_size))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY,
+                 "Plugin aborted stream '%s'", url);
+    flash_stream_close (stream, NPRES_NETWORK_ERR);
+    return FALSE;
+  }
+
+  if (notify_data)
+    PLUGIN_CALL (file, urlnotify, file->instance, stream->npstream.url,
+                 NPRES_DONE, notify_data);
+
+  flash_stream_close (stream, NPRES_DONE);
+  return TRUE;
+}
+
+/* Answers the plugin's request for the ancillary notification stream,
+ * which it makes while the movie loads */
+static gboolean
+flash_file_send_notify (FlashFile *file, GError **error)
+{
+  const gchar *js_buf;
+
+  if (!file->notify_url)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Failed to receive ancillary notification request");
+    return FALSE;
+  }
+  js_buf = "null";
+  return flash_file_stream_buf_to_plugin (file, file->notify_url,
+                                          "text/plain", NP_NORMAL, js_buf,
+                                          strlen (js_buf)+1,
+                                          file->notify_data, error);
+}
+
+static void
+flash_file_feed_unmap (FlashFileFeed *feed)
+{
+  if (feed->window)
+    munmap (feed->window, feed->window_len);
+  feed->window = NULL;
+  feed->window_len = 0;
+}
+
+/* Closes the movie's stream if it's still being fed */
+static void
+flash_file_end_feed (FlashFile *file, NPReason reason)
+{
+  FlashFileFeed *feed;
+
+  feed = file->feed;
+  if (!feed)
+    return;
+  file->feed = NULL;
+  if (feed->source_id)
+    g_source_remove (feed->source_id);
+  gtk_xtbin_plugin_lock ();
+  flash_stream_close (feed->stream, reason);
+  gtk_xtbin_plugin_unlock ();
+  flash_file_feed_unmap (feed);
+  if (feed->fd != -1 && feed->fd != file->fd)
+    close (feed->fd);
+  g_free (feed);
+}
+
+static void
+flash_file_finish_feed (FlashFile *file, NPReason reason)
+{
+  GError *error;
+  gboolean notify;
+
+  notify = file->feed->notify_pending;
+  if (reason != NPRES_DONE)
+    DEBUG ("failed to stream '%s' to the plugin", file->path);
+  flash_file_end_feed (file, reason);
+
+  error = NULL;
+  gtk_xtbin_plugin_lock ();
+  if (notify && reason == NPRES_DONE && !flash_file_send_notify (file, &error))
+  {
+    DEBUG ("%s", error->message);
+    g_error_free (error);
+  }
+  gtk_xtbin_plugin_unlock ();
+}
+
+/* Maps the window of the file holding the feed's offset, which is past
+ * the part kept mapped */
+static gboolean
+flash_file_feed_map (FlashFile *file, FlashFileFeed *feed)
 {
-  va_list ap;
-  int va_argc;
-  int argc;
-  char **argn;
-  char **argv;
-  int i;
-  int j;
-
-  va_argc = 0;
-  va_start (ap, argvp);
-  while (va_arg (ap, char *) != NULL)
-    va_argc++;
-  va_end (ap);
+  void *window;
 
-  if (va_argc % 2 != 0)
+  flash_file_feed_unmap (feed);
+  if (feed->fd == -1)
+    feed->fd = file->fd != -1 ? file->fd : open (file->path, O_RDONLY);
+  if (feed->fd == -1)
+  {
+    DEBUG ("failed to open() '%s': %s", file->path, strerror(errno));
     return FALSE;
+  }
 
-  argc = va_argc / 2;
-  argn = g_malloc (sizeof(char *) * argc);
-  argv = g_malloc (sizeof(char *) * argc);
-
-  va_start (ap, argvp);
-  i = 1;
-  j = 0;
-  while (j < argc)
+  feed->window_offset = feed->offset - feed->offset % MAP_WINDOW;
+  feed->window_len = MIN (file->data_size - feed->window_offset, MAP_WINDOW);
+  window = mmap (0, feed->window_len, PROT_READ, MAP_SHARED, feed->fd,
+                 feed->window_offset);
+  if (window == MAP_FAILED)
   {
-    if (i % 2 != 0)
-    {
-      argn[j] = g_strdup (va_arg (ap, char *));
-      argv[j] = g_strdup (va_arg (ap, char *));
-      j++;
-    }
-    i++;
+    DEBUG ("failed to mmap() '%s' at %" G_GUINT64_FORMAT ": %s",
+           file->path, feed->window_offset, strerror(errno));
+    feed->window_len = 0;
+    return FALSE;
   }
-  va_end (ap);
-
-  *argcp = argc;
-  *argnp = argn;
-  *argvp = argv;
+  feed->window = window;
+  /* Have the next window read in while this one is sent */
+  madvise (window, feed->window_len, MADV_SEQUENTIAL);
+  posix_fadvise (feed->fd, feed->window_offset + feed->window_len,
+                 MAP_WINDOW, POSIX_FADV_WILLNEED);
   return TRUE;
 }
 
-static void
-flash_file_free_attrs (int argc, char **argn, char **argv)
+static gboolean
+flash_file_feed_plugin (gpointer data)
 {
-  int i;
-  for (i = 0; i < argc; i++)
+  FlashFile *file;
+  FlashFileFeed *feed;
+  const guint8 *buf;
+  gsize len;
+  gsize budget;
+  int32 nwritten;
+  gboolean blocked;
+  NPReason reason;
+
+  file = data;
+  feed = file->feed;
+  feed->source_id = 0;
+
+  blocked = FALSE;
+  reason = NPRES_DONE;
+  budget = FEED_DISPATCH_BYTES;
+  gtk_xtbin_plugin_lock ();
+  while (feed->offset < file->data_size && budget > 0)
   {
-    g_free (argv[i]);
-    g_free (argn[i]);
+    if (feed->offset < file->map_size)
+    {
+      buf = (guint8 *) file->map + feed->offset;
+      len = file->map_size - feed->offset;
+    }
+    else
+    {
+      if (feed->offset >= feed->window_offset + feed->window_len &&
+          !flash_file_feed_map (file, feed))
+      {
+        reason = NPRES_NETWORK_ERR;
+        break;
+      }
+      buf = (guint8 *) feed->window + (feed->offset - feed->window_offset);
+      len = feed->window_offset + feed->window_len - feed->offset;
+    }
+    nwritten = flash_stream_write (feed->stream, buf, MIN (len, budget));
+    if (nwritten < 0)
+    {
+      reason = NPRES_NETWORK_ERR;
+      break;
+    }
+    if (nwritten == 0)
+    {
+      blocked = TRUE;
+      break;
+    }
+    feed->offset += nwritten;
+    budget -= MIN ((gsize) nwritten, budget);
   }
-  g_free (argv);
-  g_free (argn);
-}
-
-static gchar *
-flash_file_make_file_url (const gchar *path)
-{
-#define MAX_URL 2048
-  char buf[MAX_URL+1];
-
-  memset (buf, 0, sizeof(buf));
-  snprintf (buf, sizeof(buf), "file:%s", path);
+  gtk_xtbin_plugin_unlock ();
 
-  return g_strdup (buf);
+  if (reason != NPRES_DONE || feed->offset >= file->data_size)
+    flash_file_finish_feed (file, reason);
+  else if (blocked)
+    feed->source_id = g_timeout_add (FEED_RETRY_MS, flash_file_feed_plugin,
+                                     file);
+  else
+    feed->source_id = g_idle_add (flash_file_feed_plugin, file);
+  return FALSE;
 }
 
+/* Opens the movie's stream and writes as much of the mapped data as the
+ * plugin takes straight away, which for most movies is all of it; the
+ * rest, and whatever is past the mapping, is fed from the main loop */
 static gboolean
-flash_file_stream_buf_to_plugin (FlashFile *file, const gchar *url,
-                                 const gchar *mime_type, uint16 stype,
-                                 void *buf, int buf_size, void *notify_data,
-                                 GError **error)
+flash_file_start_feed (FlashFile *file, const gchar *url, GError **error)
 {
-  NPStream *npstream;
+  FlashStream *stream;
+  FlashFileFeed *feed;
   NPError nperr;
-  int buf_remaining;
-  off_t buf_offset;
-  char *cbuf;
-  int32 plugin_maxwrite;
-  int32 plugin_nwrite;
-  int32 plugin_nwritten;
-
-  npstream = g_new (NPStream, 1);
-  npstream->ndata = file;
-  npstream->url = g_strdup (url);
-  npstream->end = 0;
-  npstream->pdata = NULL;
-  npstream->lastmodified = 0;
-  npstream->notifyData = notify_data;
-
-  nperr = PLUGIN_CALL (file, newstream,
-    file->instance,
-    (char *)mime_type,
-    npstream,
-    0, /* default to non-seekable for all */
-    &stype);
+  uint16 stype;
+  guint64 offset;
+  int32 nwritten;
 
-  if (nperr != NPERR_NO_ERROR)
+  flash_file_end_feed (file, NPRES_USER_BREAK);
+
+  stype = NP_ASFILE;
+  stream = flash_stream_open (file->library, file->instance, url, MIME_TYPE,
+                              file->data_size, &stype, NULL,
+                              &file->stream_stats, &nperr);
+  if (!stream)
   {
     g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
                  "Failed to create new stream");
-    g_free ((gchar *)npstream->url);
-    g_free (npstream);
     return FALSE;
   }
 
-  buf_remaining = buf_size;
-  buf_offset = 0;
-  cbuf = (char *)buf;
-  while (buf_remaining > 0)
+  offset = 0;
+  while (offset < file->map_size)
+  {
+    nwritten = flash_stream_write (stream, (guint8 *) file->map + offset,
+                                   MIN (file->map_size - offset,
+                                        (gsize) G_MAXINT32));
+    if (nwritten < 0)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY,
+                   "Plugin aborted stream '%s'", url);
+      flash_stream_close (stream, NPRES_NETWORK_ERR);
+      return FALSE;
+    }
+    if (nwritten == 0)
+      break;
+    offset += nwritten;
+  }
+  if (offset >= file->data_size)
   {
-    plugin_maxwrite = PLUGIN_CALL (file, writeready, file->instance, npstream);
-    plugin_nwrite = plugin_maxwrite > buf_remaining ? buf_remaining : plugin_maxwrite;
-    plugin_nwritten = PLUGIN_CALL (file, write, file->instance, npstream, buf_offset,
-                                   plugin_nwrite, (void *)cbuf);
+    flash_stream_close (stream, NPRES_DONE);
+    return TRUE;
+  }
+
+  feed = g_new0 (FlashFileFeed, 1);
+  feed->stream = stream;
+  feed->offset = offset;
+  feed->fd = -1;
+  file->feed = feed;
+  if (offset < file->map_size)
+    feed->source_id = g_timeout_add (FEED_RETRY_MS, flash_file_feed_plugin,
+                                     file);
+  else
+    feed->source_id = g_idle_add (flash_file_feed_plugin, file);
+  DEBUG ("streamed %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+         " bytes of '%s', feeding the rest", offset, file->data_size, url);
+  return TRUE;
+}
 
-    DEBUG ("%s: %d bytes streamed to plugin", url, plugin_nwritten);
+/* The page aligned span of the file's data; bundled files start part way
+ * into a page */
+static void
+flash_file_map_pages (FlashFile *file, guint8 **start, gsize *len)
+{
+  gsize page;
+  gsize skip;
 
-    buf_remaining -= plugin_nwritten;
-    buf_offset += plugin_nwritten;
-    cbuf += plugin_nwritten;
-  }
+  page = sysconf (_SC_PAGESIZE);
+  skip = (gsize) file->map % page;
+  *start = (guint8 *) file->map - skip;
+  *len = file->map_size + skip;
+}
 
-  if (notify_data)
-    PLUGIN_CALL (file, urlnotify, file->instance, npstream->url, NPRES_DONE,
-                 notify_data);
+/* Undoes the mlock() of the file's data. The pages at either end of a
+ * bundled file may hold parts of its neighbours, which can be locked by
+ * files of their own, so only the pages wholly inside it are unlocked. */
+static void
+flash_file_unlock_map (FlashFile *file)
+{
+  guint8 *start;
+  guint8 *end;
+  gsize len;
+  gsize page;
 
-  PLUGIN_CALL (file, destroystream, file->instance, npstream, NPRES_DONE);
-  g_free ((gchar *)npstream->url);
-  g_free (npstream);
+  flash_file_map_pages (file, &start, &len);
+  if (file->bundle)
+  {
+    page = sysconf (_SC_PAGESIZE);
+    start = (guint8 *) (((gsize) file->map + page - 1) / page * page);
+    end = (guint8 *) (((gsize) file->map + file->map_size) / page * page);
+    len = end > start ? end - start : 0;
+  }
+  if (len > 0)
+    munlock (start, len);
+  file->map_locked = FALSE;
+}
 
-  return TRUE;
+/* Carries out the I/O policy on the mapped data */
+static void
+flash_file_prepare_io (FlashFile *file)
+{
+  volatile guint8 sum;
+  guint8 *start;
+  gsize len;
+  gsize page;
+  gsize i;
+
+  if (file->io_prepared || file->map_size == 0)
+    return;
+  file->io_prepared = TRUE;
+  flash_file_map_pages (file, &start, &len);
+
+  madvise (start, len, MADV_SEQUENTIAL);
+  madvise (start, len, MADV_WILLNEED);
+  if (file->io_policy == FLASH_FILE_IO_LOCK && !file->map_locked)
+  {
+    if (mlock (start, len) == 0)
+      file->map_locked = TRUE;
+    else
+      DEBUG ("can't lock %s in memory: %s", file->path, strerror (errno));
+  }
+  if (file->io_policy != FLASH_FILE_IO_READAHEAD && !file->map_locked)
+  {
+    /* Fault in whatever MAP_POPULATE didn't, e.g. for bundled files */
+    page = sysconf (_SC_PAGESIZE);
+    sum = 0;
+    for (i = 0; i < len; i += page)
+      sum += start[i];
+  }
+}
+
+void
+flash_file_set_io_policy (FlashFile *file, FlashFileIoPolicy policy)
+{
+  if (file->io_policy == policy)
+    return;
+  file->io_policy = policy;
+  if (!file->map)
+    return;
+  if (file->map_locked && policy != FLASH_FILE_IO_LOCK)
+    flash_file_unlock_map (file);
+  file->io_prepared = FALSE;
+  flash_file_prepare_io (file);
 }
 
+/* Maps the file's data, once; the mapping is kept for the lifetime of the
+ * file so that restarts can stream straight from it */
 static gboolean
-flash_file_send_to_plugin (FlashFile *file, const gchar *url, GError **error)
+flash_file_map (FlashFile *file, GError **error)
 {
   int map_fd;
+  int flags;
   void *map;
+  gsize map_size;
   struct stat sb;
-  gchar *js_buf;
-  gboolean ret;
-
-  map_fd = -1;
-  map = NULL;
-  js_buf = NULL;
-  ret = FALSE;
 
-  if (stat (file->path, &sb) == -1)
+  if (file->map)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
-                 "Failed to stat '%s': %s", file->path, strerror(errno));
-    goto out;
+    flash_file_prepare_io (file);
+    return TRUE;
   }
 
-  map_fd = open (file->path, O_RDONLY);
-  if (map_fd == -1)
+  map_fd = -1;
+  if (file->fd != -1)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
-                 "Failed to open() '%s': %s", file->path, strerror(errno));
-    goto out;
+    /* Descriptor-backed files (e.g. shared memory handed to us by another
+     * process) are mapped directly, so the data is never copied */
+    if (fstat (file->fd, &sb) == -1)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                   "Failed to stat '%s': %s", file->path, strerror(errno));
+      return FALSE;
+    }
+  }
+  else
+  {
+    if (stat (file->path, &sb) == -1)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                   "Failed to stat '%s': %s", file->path, strerror(errno));
+      return FALSE;
+    }
+
+    map_fd = open (file->path, O_RDONLY);
+    if (map_fd == -1)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                   "Failed to open() '%s': %s", file->path, strerror(errno));
+      return FALSE;
+    }
   }
-  map = mmap (0, sb.st_size, PROT_READ, MAP_SHARED, map_fd, 0);
+  flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (file->io_policy != FLASH_FILE_IO_READAHEAD)
+    flags |= MAP_POPULATE;
+#endif
+  map_size = sb.st_size > MAP_WHOLE_MAX ? MAP_WINDOW : sb.st_size;
+  map = mmap (0, map_size, PROT_READ, flags,
+               map_fd != -1 ? map_fd : file->fd, 0);
+  if (map_fd != -1)
+    close (map_fd);
   if (map == MAP_FAILED)
   {
     g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
                  "Failed to mmap() '%s': %s", file->path, strerror(errno));
-    goto out;
+    return FALSE;
   }
+  file->map = map;
+  file->map_size = map_size;
+  file->data_size = sb.st_size;
+  flash_file_prepare_io (file);
+  return TRUE;
+}
 
-  if (!flash_file_stream_buf_to_plugin (file, url, MIME_TYPE, NP_ASFILE,
-                                        map, sb.st_size, NULL, error))
-  {
-    goto out;
-  }
+static gboolean
+flash_file_send_to_plugin (FlashFile *file, const gchar *url, GError **error)
+{
+  if (!flash_file_map (file, error))
+    return FALSE;
 
-  if (!file->notify_url)
+  if (file->notify_url)
   {
-    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
-                 "Failed to receive ancillary notification request");
-    goto out;
+    g_free (file->notify_url);
+    file->notify_url = NULL;
   }
 
-  js_buf = g_strdup ("null");
-  if (!flash_file_stream_buf_to_plugin (file, file->notify_url, "text/plain",
-                                        NP_NORMAL, js_buf, strlen (js_buf)+1,
-                                        file->notify_data, error))
+  if (!flash_file_start_feed (file, url, error))
+    return FALSE;
+
+  if (file->feed && !file->notify_url)
   {
-    goto out;
+    file->feed->notify_pending = TRUE;
+    return TRUE;
   }
-  ret = TRUE;
-
-out:
-  if (js_buf)
-    g_free (js_buf);
-  if (map)
-    munmap (map, sb.st_size);
-  if (map_fd != -1)
-    close (map_fd);
-  return ret;
+  return flash_file_send_notify (file, error);
 }
 
 static void *
@@ -671,9 +2762,324 @@ flash_file_timer_callback (gpointer data)
   file = (FlashFile *) data;
   if (!flash_file_is_playing (file))
   {
+    /* The callback may well stop or unref the file */
+    file->timer_id = 0;
     if (file->callback)
       file->callback (file, FLASH_FILE_PLAYBACK_STOPPED, file->callback_data);
     return FALSE;
   }
   return TRUE;
 }
+
+static gboolean
+flash_file_resize_callback (gpointer data)
+{
+  FlashFile *file;
+
+  file = (FlashFile *) data;
+  if (!file->resize_pending)
+  {
+    /* Quiet for a whole interval, the next resize can go straight out */
+    file->resize_id = 0;
+    return FALSE;
+  }
+  file->resize_pending = FALSE;
+  flash_file_set_window_size (file, file->resize_width, file->resize_height);
+  return TRUE;
+}
+
+static void
+flash_file_set_window_size (FlashFile *file, gint width, gint height)
+{
+  if ((gint) file->npwin.width == width && (gint) file->npwin.height == height)
+    return;
+
+  gtk_xtbin_plugin_lock ();
+  gtk_xtbin_resize (file->xt_bin, width, height);
+  file->npwin.width = width;
+  file->npwin.height = height;
+  PLUGIN_CALL (file, setwindow, file->instance, &file->npwin);
+  gtk_xtbin_plugin_unlock ();
+}
+
+static void
+flash_file_start_metrics (FlashFile *file)
+{
+  FlashSwfHeader header;
+  GError *error;
+  int error_base;
+
+  file->have_last_frame = FALSE;
+  file->frames_presented = 0;
+  file->frames_dropped = 0;
+  memset (file->frame_times, 0, sizeof(file->frame_times));
+  file->metrics_frames = 0;
+  file->frame_rate = 0;
+  if (!file->metrics_timer)
+    file->metrics_timer = g_timer_new ();
+  g_timer_start (file->metrics_timer);
+
+  file->nominal_frame_rate = 0;
+  error = NULL;
+  if (flash_file_map (file, &error) &&
+      flash_swf_parse_header (file->map, file->map_size, &header, &error))
+    file->nominal_frame_rate = header.frame_rate;
+  else
+  {
+    DEBUG ("no nominal frame rate for %s: %s", file->path, error->message);
+    g_error_free (error);
+  }
+
+  /* The plugin window is a plain X window as far as the server is
+   * concerned, so it can be watched through our own connection */
+  file->damage_display =
+    GDK_DISPLAY_XDISPLAY (gtk_widget_get_display (file->xt_bin));
+  if (!XDamageQueryExtension (file->damage_display, &file->damage_event_base,
+                              &error_base))
+  {
+    DEBUG ("%s", "no DAMAGE extension, frames won't be counted");
+    file->damage_display = NULL;
+  }
+  else
+  {
+    file->damage = XDamageCreate (file->damage_display,
+                                  GTK_XTBIN (file->xt_bin)->xtwindow,
+                                  XDamageReportNonEmpty);
+    gdk_window_add_filter (NULL, flash_file_damage_filter, file);
+  }
+
+  flash_file_schedule_metrics (file);
+  flash_file_schedule_quality (file);
+}
+
+static void
+flash_file_stop_metrics (FlashFile *file)
+{
+  if (file->metrics_id)
+  {
+    g_source_remove (file->metrics_id);
+    file->metrics_id = 0;
+  }
+  if (file->quality_id)
+  {
+    g_source_remove (file->quality_id);
+    file->quality_id = 0;
+  }
+  if (file->damage != None)
+  {
+    gdk_window_remove_filter (NULL, flash_file_damage_filter, file);
+    XDamageDestroy (file->damage_display, file->damage);
+    file->damage = None;
+  }
+  file->damage_display = NULL;
+}
+
+static void
+flash_file_schedule_metrics (FlashFile *file)
+{
+  if (file->metrics_id)
+  {
+    g_source_remove (file->metrics_id);
+    file->metrics_id = 0;
+  }
+  if (file->is_playing && file->metrics_interval)
+  {
+    file->metrics_frames = 0;
+    g_timer_start (file->metrics_timer);
+    file->metrics_id = g_timeout_add (file->metrics_interval,
+                                      flash_file_metrics_callback, file);
+  }
+}
+
+static GdkFilterReturn
+flash_file_damage_filter (GdkXEvent *xevent, GdkEvent *event, gpointer data)
+{
+  XDamageNotifyEvent *notify;
+  FlashFile *file;
+
+  file = (FlashFile *) data;
+  if (((XEvent *) xevent)->type != file->damage_event_base + XDamageNotify)
+    return GDK_FILTER_CONTINUE;
+  notify = (XDamageNotifyEvent *) xevent;
+  if (notify->damage != file->damage)
+    return GDK_FILTER_CONTINUE;
+
+  /* Emptying the damage re-arms the notify, so everything the plugin draws
+   * until we get here makes up one frame */
+  XDamageSubtract (file->damage_display, file->damage, None, None);
+  flash_file_frame_presented (file);
+  return GDK_FILTER_REMOVE;
+}
+
+static void
+flash_file_frame_presented (FlashFile *file)
+{
+  GTimeVal now;
+  gdouble ms;
+  gdouble periods;
+  gint i;
+
+  g_get_current_time (&now);
+  file->frames_presented++;
+  file->metrics_frames++;
+
+  if (file->have_last_frame)
+  {
+    ms = (now.tv_sec - file->last_frame.tv_sec) * 1000.0 +
+         (now.tv_usec - file->last_frame.tv_usec) / 1000.0;
+    for (i = 0; i < FLASH_FILE_FRAME_TIME_BUCKETS - 1; i++)
+    {
+      if (ms <= frame_time_bounds[i])
+        break;
+    }
+    file->frame_times[i]++;
+
+    periods = ms * file->nominal_frame_rate / 1000.0;
+    if (ms < FRAME_IDLE_MS && periods >= 1.5)
+      file->frames_dropped += (guint) (periods + 0.5) - 1;
+  }
+  file->last_frame = now;
+  file->have_last_frame = TRUE;
+}
+
+static gboolean
+flash_file_metrics_callback (gpointer data)
+{
+  FlashFile *file;
+  gdouble elapsed;
+
+  file = (FlashFile *) data;
+  elapsed = g_timer_elapsed (file->metrics_timer, NULL);
+  file->frame_rate = elapsed > 0 ? file->metrics_frames / elapsed : 0;
+  file->metrics_frames = 0;
+  g_timer_start (file->metrics_timer);
+
+  if (file->callback)
+    file->callback (file, FLASH_FILE_FRAME_STATS, file->callback_data);
+  return TRUE;
+}
+
+/* Reads the time all CPUs have spent busy and in total, in clock ticks,
+ * from the first line of /proc/stat */
+static gboolean
+flash_file_read_cpu_times (guint64 *busy, guint64 *total)
+{
+  guint64 times[8];
+  gchar line[256];
+  FILE *f;
+  gint n;
+  gint i;
+
+  f = fopen ("/proc/stat", "r");
+  if (!f)
+    return FALSE;
+  memset (times, 0, sizeof(times));
+  n = 0;
+  if (fgets (line, sizeof(line), f))
+    n = sscanf (line, "cpu %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+                &times[0], &times[1], &times[2], &times[3], &times[4],
+                &times[5], &times[6], &times[7]);
+  fclose (f);
+  if (n < 4)
+    return FALSE;
+
+  /* user, nice, system, idle, then iowait and the rest on newer kernels;
+   * waiting on I/O counts as idle */
+  *total = 0;
+  for (i = 0; i < n; i++)
+    *total += times[i];
+  *busy = *total - times[3] - times[4];
+  return TRUE;
+}
+
+/* Takes the starting point for the next check, if the controller should
+ * be running */
+static void
+flash_file_schedule_quality (FlashFile *file)
+{
+  if (file->quality_id)
+  {
+    g_source_remove (file->quality_id);
+    file->quality_id = 0;
+  }
+  if (!file->is_playing || !file->adaptive_quality)
+    return;
+
+  file->quality_presented = file->frames_presented;
+  file->quality_dropped = file->frames_dropped;
+  file->cpu_busy = 0;
+  file->cpu_total = 0;
+  flash_file_read_cpu_times (&file->cpu_busy, &file->cpu_total);
+  file->quality_trend = 0;
+  file->quality_id = g_timeout_add (QUALITY_CHECK_MS,
+                                    flash_file_quality_callback, file);
+}
+
+static gboolean
+flash_file_quality_callback (gpointer data)
+{
+  FlashFile *file;
+  FlashFileQuality quality;
+  GError *error;
+  guint presented;
+  guint dropped;
+  guint64 busy;
+  guint64 total;
+  gdouble drop_ratio;
+  gdouble load;
+
+  file = (FlashFile *) data;
+
+  /* Frames dropped out of those due, and the CPU load, since last time */
+  presented = file->frames_presented - file->quality_presented;
+  dropped = file->frames_dropped - file->quality_dropped;
+  file->quality_presented = file->frames_presented;
+  file->quality_dropped = file->frames_dropped;
+  drop_ratio = presented + dropped > 0 ?
+               (gdouble) dropped / (presented + dropped) : 0;
+
+  load = 0;
+  if (flash_file_read_cpu_times (&busy, &total))
+  {
+    if (total > file->cpu_total)
+      load = (gdouble) (busy - file->cpu_busy) / (total - file->cpu_total);
+    file->cpu_busy = busy;
+    file->cpu_total = total;
+  }
+
+  if (drop_ratio > QUALITY_DROP_HIGH || load > QUALITY_LOAD_HIGH)
+    file->quality_trend = MAX (file->quality_trend, 0) + 1;
+  else if (drop_ratio < QUALITY_DROP_LOW && load < QUALITY_LOAD_LOW)
+    file->quality_trend = MIN (file->quality_trend, 0) - 1;
+  else
+    file->quality_trend = 0;
+
+  quality = flash_file_get_quality (file);
+  if (file->quality_trend >= QUALITY_DOWN_CHECKS &&
+      quality > FLASH_FILE_QUALITY_LOW)
+    quality--;
+  else if (file->quality_trend <= -QUALITY_UP_CHECKS &&
+           quality < file->quality_ceiling)
+    quality++;
+  else
+    return TRUE;
+
+  DEBUG ("%s: %.0f%% of frames dropped, %.0f%% CPU load, quality now %s",
+         file->path, drop_ratio * 100, load * 100, quality_names[quality]);
+  file->quality_trend = 0;
+  error = NULL;
+  if (!flash_file_apply_quality (file, quality, &error))
+  {
+    DEBUG ("failed to change quality of %s: %s", file->path, error->message);
+    g_error_free (error);
+    /* A failed re-instantiate stops the file, which removes this source */
+    return file->quality_id != 0;
+  }
+
+  if (file->callback)
+    file->callback (file, FLASH_FILE_QUALITY_CHANGED, file->callback_data);
+  return TRUE;
+}
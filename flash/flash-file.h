@@ -9,7 +9,9 @@
 
 #include <glib-object.h>
 #include <gtk/gtk.h>
+#include <flash/flash-bundle.h>
 #include <flash/flash-library.h>
+#include <flash/flash-sink.h>
 
 G_BEGIN_DECLS
 
@@ -17,12 +19,87 @@ typedef struct _FlashFile      FlashFile;
 typedef struct _FlashFileClass FlashFileClass;
 
 typedef enum {
-  FLASH_FILE_PLAYBACK_STOPPED
+  FLASH_FILE_PLAYBACK_STOPPED,
+  FLASH_FILE_FRAME_STATS,    /* every "metrics-interval" ms while playing */
+  FLASH_FILE_QUALITY_CHANGED /* by the adaptive quality controller */
 } FlashFileEvent;
 
 typedef void (*FlashFileEventCallback)(FlashFile *file, FlashFileEvent event,
                                        gpointer user_data);
 
+typedef void (*FlashFilePlayCallback)(FlashFile *file, gpointer user_data);
+
+/* Picks the sink for a stream the plugin opens to the host; target is the
+   window it names, if any. Return a new reference, which the file drops
+   when the stream ends, or NULL to refuse the stream. With
+   flash_set_event_thread() on, called from the Xt event thread with the
+   plugin lock held. */
+typedef FlashSink *(*FlashFileSinkFunc)(FlashFile *file,
+                                        const gchar *mime_type,
+                                        const gchar *target,
+                                        gpointer user_data);
+
+/* How long each phase of starting playback took, in seconds, and the
+ * page faults taken meanwhile. Faults are counted for the whole process,
+ * so other threads' count too; major faults are the ones that waited on
+ * the disk. */
+typedef struct {
+  gdouble instantiate;    /* NPP_New */
+  gdouble create_window;  /* plugin container and Xt shell */
+  gdouble set_window;     /* NPP_SetWindow */
+  gdouble stream;         /* streaming what the plugin takes at once;
+                             the rest follows from the main loop */
+  gdouble total;          /* from the call until playback started */
+  glong major_faults;
+  glong minor_faults;
+  glong stream_major_faults;  /* of those, while streaming */
+  glong stream_minor_faults;
+} FlashFilePlayTimings;
+
+/* How a file's data is brought into memory. It's mapped as playback
+ * starts, and by default the kernel is asked to read it ahead while the
+ * plugin is set up. POPULATE also faults it all in before it's streamed,
+ * so streaming never waits on the disk, and LOCK keeps it resident until
+ * the file is freed, so it can't be evicted and read again on a restart
+ * (within RLIMIT_MEMLOCK; past that it acts as POPULATE). Files too big
+ * to map whole only have their start kept mapped, and the policy applies
+ * to that; the rest is streamed a window at a time, from the main loop
+ * once playback has started. */
+typedef enum
+{
+  FLASH_FILE_IO_READAHEAD,
+  FLASH_FILE_IO_POPULATE,
+  FLASH_FILE_IO_LOCK
+} FlashFileIoPolicy;
+
+/* The plugin's rendering quality, its QUALITY attribute; the plugin
+ * defaults to HIGH */
+typedef enum
+{
+  FLASH_FILE_QUALITY_LOW,
+  FLASH_FILE_QUALITY_MEDIUM,
+  FLASH_FILE_QUALITY_HIGH,
+  FLASH_FILE_QUALITY_BEST
+} FlashFileQuality;
+
+/* Frame times are counted in buckets of up to 8, 16, 33, 50, 100, 250 and
+ * 1000 ms, and over 1000 ms */
+#define FLASH_FILE_FRAME_TIME_BUCKETS 8
+
+/* Frames are what reaches the screen: each burst of drawing by the plugin
+ * counts as one. A frame that takes more than one and a half frame periods
+ * of the nominal (SWF header) rate counts the frames it skipped as
+ * dropped; gaps of a second or more are taken as the movie standing still
+ * rather than dropping frames. */
+typedef struct {
+  guint presented;
+  guint dropped;
+  gdouble frame_rate;          /* over the last "metrics-interval", or
+                                  since playback started */
+  gdouble nominal_frame_rate;  /* 0 if unknown */
+  guint frame_times[FLASH_FILE_FRAME_TIME_BUCKETS];
+} FlashFileFrameStats;
+
 #define FLASH_TYPE_FILE \
   (flash_file_get_type())
 
@@ -47,14 +124,119 @@ FlashFile *flash_file_new        (FlashLibrary *library, const gchar *path,
                                   FlashFileEventCallback callback,
                                   gpointer callback_user_data,
                                   GError **error);
+FlashFile *flash_file_new_from_fd (FlashLibrary *library, int fd,
+                                   const gchar *name,
+                                   FlashFileEventCallback callback,
+                                   gpointer callback_user_data,
+                                   GError **error);
+/* The file name in bundle, played straight from the bundle's mapping.
+   Its URL is bundle:/name, and what the movie loads from bundle: or
+   relative URLs is served from the bundle too. */
+FlashFile *flash_file_new_from_bundle (FlashLibrary *library,
+                                       FlashBundle *bundle,
+                                       const gchar *name,
+                                       FlashFileEventCallback callback,
+                                       gpointer callback_user_data,
+                                       GError **error);
 gboolean   flash_file_play       (FlashFile *file, GtkWindow *window,
                                   gboolean loop, GError **error);
+
+/* Starts playback in steps on the main loop, and calls callback when done;
+   the callback should call flash_file_play_finish() for the result. A
+   start in progress can be aborted with flash_file_play_cancel(). */
+void       flash_file_play_async  (FlashFile *file, GtkWindow *window,
+                                   gboolean loop,
+                                   FlashFilePlayCallback callback,
+                                   gpointer user_data);
+gboolean   flash_file_play_finish (FlashFile *file, GError **error);
+void       flash_file_play_cancel (FlashFile *file);
+void       flash_file_get_play_timings (FlashFile *file,
+                                        FlashFilePlayTimings *timings);
+/* Applies to the data already mapped, too */
+void       flash_file_set_io_policy    (FlashFile *file,
+                                        FlashFileIoPolicy policy);
+
 gboolean   flash_file_is_playing (FlashFile *file);
 gboolean   flash_file_pause      (FlashFile *file);
 gboolean   flash_file_resume     (FlashFile *file);
 gboolean   flash_file_stop       (FlashFile *file);
 
+/* Plays a file again from the start, keeping its window (and, if the
+   plugin can rewind, its instance) */
+gboolean   flash_file_restart    (FlashFile *file, GError **error);
+
+/* Embed attributes (e.g. "SCALE", "WMODE", "BGCOLOR") passed to the plugin
+   when it's next instantiated, i.e. on play or restart; a NULL value
+   removes one. SRC, TYPE, WIDTH, HEIGHT and LOOP are set by the file, and
+   can't be. Names are case insensitive. */
+gboolean   flash_file_set_attribute    (FlashFile *file, const gchar *name,
+                                        const gchar *value);
+const gchar *flash_file_get_attribute  (FlashFile *file, const gchar *name);
+
+/* Sets the QUALITY attribute and, while playing, changes the running
+   instance: through the ScriptablePeer if the plugin has one, otherwise
+   by instantiating it again, which starts the movie over. A plugin that
+   ignores the new _quality isn't noticed, and keeps its old quality. */
+gboolean   flash_file_set_quality      (FlashFile *file,
+                                        FlashFileQuality quality,
+                                        GError **error);
+FlashFileQuality flash_file_get_quality (FlashFile *file);
+/* While playing, steps the quality down a level at a time when frames are
+   being dropped or the host's CPUs are saturated, and back up, no higher
+   than the quality set when it's enabled (or later), once there has been
+   headroom for a while. Each change is reported with
+   FLASH_FILE_QUALITY_CHANGED. Frame drops need the X DAMAGE extension;
+   without it only the CPU load is watched. Disabling it leaves the
+   quality where it is. */
+void       flash_file_set_adaptive_quality (FlashFile *file,
+                                            gboolean enabled);
+
+/* Frames are numbered from 0. These need the matching ScriptablePeer
+   exports in the plugin; the getters return -1 (or NULL) without them. */
+gboolean   flash_file_seek             (FlashFile *file, gint frame,
+                                        GError **error);
+gint       flash_file_get_frame        (FlashFile *file);
+gint       flash_file_get_total_frames (FlashFile *file);
+/* SetVariable reports nothing back, so TRUE only means the plugin was
+   asked, not that the variable changed */
+gboolean   flash_file_set_variable     (FlashFile *file, const gchar *name,
+                                        const gchar *value);
+gchar     *flash_file_get_variable     (FlashFile *file, const gchar *name);
+
 gboolean   flash_file_resize     (FlashFile *file, gint width, gint height, GError **error);
+
+/* Moves a playing file into another (realized, empty) window without
+   restarting it */
+gboolean   flash_file_reparent   (FlashFile *file, GtkWindow *window,
+                                  GError **error);
+
+/* Reads back what the plugin has drawn. On 24/32 bit visuals the pixbuf
+   has an (opaque) alpha channel, elsewhere it is plain RGB. */
+GdkPixbuf *flash_file_capture    (FlashFile *file, GError **error);
+
+/* Counts since playback last started. Needs the X DAMAGE extension; without
+   it no frames are seen. Also available as the "frames-presented",
+   "frames-dropped", "frame-rate" and "nominal-frame-rate" properties. */
+void       flash_file_get_frame_stats (FlashFile *file,
+                                       FlashFileFrameStats *stats);
+/* Totals over all streams sent to the plugin for this file, restarts
+   included; see also flash_library_get_stream_stats() */
+void       flash_file_get_stream_stats (FlashFile *file,
+                                        FlashStreamStats *stats);
+
+/* Without a sink function, streams from the plugin are refused */
+void       flash_file_set_sink_func (FlashFile *file, FlashFileSinkFunc func,
+                                     gpointer user_data);
+
+/* Plays path in a window of its own and returns a width x height still,
+   taken delay_ms after playback started, or after seeking to frame if
+   frame isn't -1. Stills are cached on disk by file contents and
+   parameters, in $FLASH_THUMBNAIL_CACHE or ~/.flash-thumbnails. */
+GdkPixbuf *flash_file_render_thumbnail (FlashLibrary *library,
+                                        const gchar *path,
+                                        gint width, gint height,
+                                        gint frame, guint delay_ms,
+                                        GError **error);
  
 G_END_DECLS
 
@@ -0,0 +1,46 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_HOST_INTERNAL_H__
+#define __FLASH_HOST_INTERNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Wire protocol between FlashHost and the flash-host process. Every
+ * message is a fixed size FlashHostMessage on a SOCK_STREAM Unix socket,
+ * optionally carrying one file descriptor (SCM_RIGHTS). Each command gets
+ * exactly one FLASH_HOST_REPLY; FLASH_HOST_EVENT messages may arrive at
+ * any time. */
+
+typedef enum {
+  FLASH_HOST_CMD_PLAY = 1,   /* fd: SWF data, args: socket id, width,
+                                height, loop; text: file name */
+  FLASH_HOST_CMD_STOP,
+  FLASH_HOST_CMD_PAUSE,
+  FLASH_HOST_CMD_RESUME,
+  FLASH_HOST_CMD_IS_PLAYING,
+  FLASH_HOST_REPLY,          /* args[0]: result; text: error message */
+  FLASH_HOST_EVENT           /* args[0]: FlashFileEvent */
+} FlashHostMessageType;
+
+#define FLASH_HOST_MAX_TEXT 256
+
+typedef struct {
+  guint32 type;
+  gint32  args[4];
+  gchar   text[FLASH_HOST_MAX_TEXT];
+} FlashHostMessage;
+
+gboolean flash_host_message_send (int sock, const FlashHostMessage *msg,
+                                  int pass_fd);
+gboolean flash_host_message_recv (int sock, FlashHostMessage *msg,
+                                  int *recv_fd);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,642 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "flash-common.h"
+#include "flash-host.h"
+#include "flash-host-internal.h"
+
+#ifndef FLASH_HOST_PATH
+#define FLASH_HOST_PATH "flash-host"
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+struct _FlashHost {
+  GObject parent;
+
+  pid_t pid;
+  int sock;
+  GIOChannel *channel;
+  guint watch_id;
+  GtkWidget *socket;
+
+  gboolean is_playing;
+  gboolean event_pending;
+
+  FlashHostEventCallback callback;
+  gpointer callback_data;
+};
+
+struct _FlashHostClass {
+  GObjectClass parent;
+};
+
+static void     flash_host_class_init     (FlashHostClass *);
+static void     flash_host_init           (FlashHost *);
+static void     flash_host_finalize       (GObject *);
+static gboolean flash_host_spawn          (FlashHost *host,
+                                           const gchar *plugin_path,
+                                           gsize memory_limit, gint cpu,
+                                           GError **error);
+static gboolean flash_host_call           (FlashHost *host,
+                                           FlashHostMessage *msg,
+                                           int pass_fd, GError **error);
+static gboolean flash_host_wait_reply     (FlashHost *host,
+                                           FlashHostMessage *reply,
+                                           GError **error);
+static gboolean flash_host_play_fd        (FlashHost *host, GtkWindow *window,
+                                           const gchar *name, int fd,
+                                           gboolean loop, GError **error);
+static int      flash_host_create_shm     (const gchar *name,
+                                           gconstpointer data, gsize size,
+                                           GError **error);
+static void     flash_host_queue_event    (FlashHost *host);
+static gboolean flash_host_event_callback (gpointer data);
+static gboolean flash_host_io_callback    (GIOChannel *channel,
+                                           GIOCondition condition,
+                                           gpointer data);
+static void     flash_host_destroy_socket (FlashHost *host);
+
+GType
+flash_host_get_type (void)
+{
+  static GType type = 0;
+
+  if (!type) {
+    static const GTypeInfo info = {
+      sizeof (FlashHostClass),
+      NULL,
+      NULL,
+      (GClassInitFunc) flash_host_class_init,
+      NULL,
+      NULL,
+      sizeof (FlashHost),
+      0,
+      (GInstanceInitFunc) flash_host_init,
+      NULL
+    };
+
+    type = g_type_register_static (G_TYPE_OBJECT, "FlashHost", &info, 0);
+  }
+
+  return type;
+}
+
+FlashHost *
+flash_host_new (const gchar *plugin_path, gsize memory_limit, gint cpu,
+                FlashHostEventCallback callback, gpointer callback_user_data,
+                GError **error)
+{
+  FlashHost *host;
+  FlashHostMessage reply;
+
+  host = g_object_new (FLASH_TYPE_HOST, NULL);
+  host->callback = callback;
+  host->callback_data = callback_user_data;
+
+  if (!flash_host_spawn (host, plugin_path, memory_limit, cpu, error))
+  {
+    g_object_unref (host);
+    return NULL;
+  }
+
+  /* The host process replies once it has loaded the library */
+  if (!flash_host_wait_reply (host, &reply, error))
+  {
+    g_object_unref (host);
+    return NULL;
+  }
+
+  host->channel = g_io_channel_unix_new (host->sock);
+  host->watch_id = g_io_add_watch (host->channel,
+                                   G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                   flash_host_io_callback, host);
+  return host;
+}
+
+gboolean
+flash_host_play (FlashHost *host, GtkWindow *window, const gchar *path,
+                 gboolean loop, GError **error)
+{
+  gchar *canon_path;
+  const gchar *exts[] = { ".swf", NULL };
+  int fd;
+  gboolean ret;
+
+  canon_path = flash_canonicalize_path (path);
+  if (!canon_path)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS, "%s",
+                 "Invalid Flash file");
+    return FALSE;
+  }
+  if (!flash_is_valid_file (canon_path, exts, error))
+  {
+    g_free (canon_path);
+    return FALSE;
+  }
+
+  fd = open (canon_path, O_RDONLY);
+  if (fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to open() '%s': %s", canon_path, strerror(errno));
+    g_free (canon_path);
+    return FALSE;
+  }
+
+  /* The host maps the descriptor itself, no data goes over the socket */
+  ret = flash_host_play_fd (host, window, canon_path, fd, loop, error);
+  close (fd);
+  g_free (canon_path);
+  return ret;
+}
+
+gboolean
+flash_host_play_data (FlashHost *host, GtkWindow *window, const gchar *name,
+                      gconstpointer data, gsize size, gboolean loop,
+                      GError **error)
+{
+  int fd;
+  gboolean ret;
+
+  fd = flash_host_create_shm (name, data, size, error);
+  if (fd == -1)
+    return FALSE;
+  ret = flash_host_play_fd (host, window, name, fd, loop, error);
+  close (fd);
+  return ret;
+}
+
+gboolean
+flash_host_is_playing (FlashHost *host)
+{
+  FlashHostMessage msg;
+
+  if (!host->is_playing)
+    return FALSE;
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_CMD_IS_PLAYING;
+  return flash_host_call (host, &msg, -1, NULL);
+}
+
+gboolean
+flash_host_pause (FlashHost *host)
+{
+  FlashHostMessage msg;
+
+  if (!host->is_playing)
+    return FALSE;
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_CMD_PAUSE;
+  return flash_host_call (host, &msg, -1, NULL);
+}
+
+gboolean
+flash_host_resume (FlashHost *host)
+{
+  FlashHostMessage msg;
+
+  if (!host->is_playing)
+    return FALSE;
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_CMD_RESUME;
+  return flash_host_call (host, &msg, -1, NULL);
+}
+
+gboolean
+flash_host_stop (FlashHost *host)
+{
+  FlashHostMessage msg;
+
+  /* A movie that ended by itself, or a host that died, leaves its socket
+   * in the window until here */
+  if (!host->is_playing)
+  {
+    flash_host_destroy_socket (host);
+    return FALSE;
+  }
+  host->is_playing = FALSE;
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_CMD_STOP;
+  flash_host_call (host, &msg, -1, NULL);
+  flash_host_destroy_socket (host);
+  return TRUE;
+}
+
+gboolean
+flash_host_message_send (int sock, const FlashHostMessage *msg, int pass_fd)
+{
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  gsize sent;
+  ssize_t n;
+
+  sent = 0;
+  while (sent < sizeof(*msg))
+  {
+    memset (&mh, 0, sizeof(mh));
+    iov.iov_base = (char *)msg + sent;
+    iov.iov_len = sizeof(*msg) - sent;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+
+    /* The descriptor travels with the first chunk only */
+    if (pass_fd != -1 && sent == 0)
+    {
+      mh.msg_control = cbuf;
+      mh.msg_controllen = sizeof(cbuf);
+      cmsg = CMSG_FIRSTHDR (&mh);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN (sizeof(int));
+      memcpy (CMSG_DATA (cmsg), &pass_fd, sizeof(int));
+    }
+
+    n = sendmsg (sock, &mh, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    sent += n;
+  }
+  return TRUE;
+}
+
+gboolean
+flash_host_message_recv (int sock, FlashHostMessage *msg, int *recv_fd)
+{
+  struct msghdr mh;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  gsize received;
+  ssize_t n;
+  int fd;
+
+  if (recv_fd)
+    *recv_fd = -1;
+
+  received = 0;
+  while (received < sizeof(*msg))
+  {
+    memset (&mh, 0, sizeof(mh));
+    iov.iov_base = (char *)msg + received;
+    iov.iov_len = sizeof(*msg) - received;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    n = recvmsg (sock, &mh, 0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+
+    for (cmsg = CMSG_FIRSTHDR (&mh); cmsg; cmsg = CMSG_NXTHDR (&mh, cmsg))
+    {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        continue;
+      memcpy (&fd, CMSG_DATA (cmsg), sizeof(int));
+      if (recv_fd && *recv_fd == -1)
+        *recv_fd = fd;
+      else
+        close (fd);
+    }
+    received += n;
+  }
+
+  msg->text[FLASH_HOST_MAX_TEXT-1] = '\0';
+  return TRUE;
+}
+
+static void
+flash_host_class_init (FlashHostClass *klass)
+{
+  GObjectClass *object_class;
+
+  object_class = G_OBJECT_CLASS (klass);
+  object_class->finalize = flash_host_finalize;
+}
+
+static void
+flash_host_init (FlashHost *host)
+{
+  host->pid = -1;
+  host->sock = -1;
+  host->channel = NULL;
+  host->watch_id = 0;
+  host->socket = NULL;
+
+  host->is_playing = FALSE;
+  host->event_pending = FALSE;
+
+  host->callback = NULL;
+  host->callback_data = NULL;
+}
+
+static void
+flash_host_finalize (GObject *object)
+{
+  FlashHost *host;
+
+  host = FLASH_HOST (object);
+
+  if (host->watch_id)
+    g_source_remove (host->watch_id);
+  if (host->channel)
+    g_io_channel_unref (host->channel);
+
+  flash_host_destroy_socket (host);
+
+  /* Closing our end of the socket tells the host process to exit */
+  if (host->sock != -1)
+    close (host->sock);
+  if (host->pid > 0)
+    waitpid (host->pid, NULL, 0);
+
+  host->watch_id = 0;
+  host->channel = NULL;
+  host->sock = -1;
+  host->pid = -1;
+}
+
+static gboolean
+flash_host_spawn (FlashHost *host, const gchar *plugin_path,
+                  gsize memory_limit, gint cpu, GError **error)
+{
+  int sv[2];
+  pid_t pid;
+  char fd_str[16];
+  const char *host_path;
+  struct rlimit rl;
+  cpu_set_t cpus;
+
+  host_path = g_getenv ("FLASH_HOST");
+  if (!host_path)
+    host_path = FLASH_HOST_PATH;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST,
+                 "Failed to create host socket: %s", strerror(errno));
+    return FALSE;
+  }
+
+  pid = fork ();
+  if (pid == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST,
+                 "Failed to fork host process: %s", strerror(errno));
+    close (sv[0]);
+    close (sv[1]);
+    return FALSE;
+  }
+
+  if (pid == 0)
+  {
+    close (sv[0]);
+    if (memory_limit > 0)
+    {
+      rl.rlim_cur = rl.rlim_max = memory_limit;
+      setrlimit (RLIMIT_AS, &rl);
+    }
+    if (cpu >= 0)
+    {
+      CPU_ZERO (&cpus);
+      CPU_SET (cpu, &cpus);
+      sched_setaffinity (0, sizeof(cpus), &cpus);
+    }
+    snprintf (fd_str, sizeof(fd_str), "%d", sv[1]);
+    execl (host_path, host_path, fd_str, plugin_path, (char *)NULL);
+    _exit (127);
+  }
+
+  close (sv[1]);
+  fcntl (sv[0], F_SETFD, FD_CLOEXEC);
+  host->pid = pid;
+  host->sock = sv[0];
+  return TRUE;
+}
+
+static gboolean
+flash_host_call (FlashHost *host, FlashHostMessage *msg, int pass_fd,
+                 GError **error)
+{
+  if (host->sock == -1 ||
+      !flash_host_message_send (host->sock, msg, pass_fd))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST, "%s",
+                 "Host process is not running");
+    return FALSE;
+  }
+  return flash_host_wait_reply (host, msg, error);
+}
+
+static gboolean
+flash_host_wait_reply (FlashHost *host, FlashHostMessage *reply,
+                       GError **error)
+{
+  for (;;)
+  {
+    if (!flash_host_message_recv (host->sock, reply, NULL))
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST, "%s",
+                   "Host process exited unexpectedly");
+      host->is_playing = FALSE;
+      return FALSE;
+    }
+    if (reply->type == FLASH_HOST_REPLY)
+      break;
+    if (reply->type == FLASH_HOST_EVENT)
+      flash_host_queue_event (host);
+  }
+
+  if (!reply->args[0] && reply->text[0] != '\0')
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST, "%s", reply->text);
+  }
+  return (gboolean) reply->args[0];
+}
+
+static gboolean
+flash_host_play_fd (FlashHost *host, GtkWindow *window, const gchar *name,
+                    int fd, gboolean loop, GError **error)
+{
+  FlashHostMessage msg;
+  GdkWindow *gdk_window;
+  gint width;
+  gint height;
+
+  if (host->is_playing)
+    return FALSE;
+  /* Left over from a movie that stopped without flash_host_stop() */
+  flash_host_destroy_socket (host);
+  if (GTK_BIN (window)->child)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST, "%s",
+                 "Window is already in use");
+    return FALSE;
+  }
+
+  gdk_window = GTK_WIDGET(window)->window;
+  g_assert (gdk_window != NULL);
+  gdk_window_get_geometry (gdk_window, NULL, NULL, &width, &height, NULL);
+
+  /* The host process plugs its own window into this socket */
+  host->socket = gtk_socket_new ();
+  gtk_container_add (GTK_CONTAINER (window), host->socket);
+  gtk_widget_realize (host->socket);
+  gtk_widget_show (host->socket);
+  g_object_ref (host->socket);
+  gdk_flush ();
+
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_CMD_PLAY;
+  msg.args[0] = (gint32) gtk_socket_get_id (GTK_SOCKET (host->socket));
+  msg.args[1] = width;
+  msg.args[2] = height;
+  msg.args[3] = loop;
+  g_strlcpy (msg.text, name, sizeof(msg.text));
+
+  if (!flash_host_call (host, &msg, fd, error))
+  {
+    flash_host_destroy_socket (host);
+    return FALSE;
+  }
+  host->is_playing = TRUE;
+  return TRUE;
+}
+
+static int
+flash_host_create_shm (const gchar *name, gconstpointer data, gsize size,
+                       GError **error)
+{
+  int fd;
+  gchar *tmp_path;
+  const char *p;
+  gsize remaining;
+  ssize_t n;
+
+  fd = -1;
+#ifdef __NR_memfd_create
+  fd = syscall (__NR_memfd_create, name, MFD_CLOEXEC);
+#endif
+  if (fd == -1)
+  {
+    /* Older kernels: an unlinked temporary file works just as well */
+    fd = g_file_open_tmp ("flash-host-XXXXXX", &tmp_path, NULL);
+    if (fd != -1)
+    {
+      unlink (tmp_path);
+      g_free (tmp_path);
+    }
+  }
+  if (fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST,
+                 "Failed to create shared memory for '%s'", name);
+    return -1;
+  }
+
+  p = data;
+  remaining = size;
+  while (remaining > 0)
+  {
+    n = write (fd, p, remaining);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_HOST,
+                   "Failed to fill shared memory for '%s': %s", name,
+                   strerror(errno));
+      close (fd);
+      return -1;
+    }
+    p += n;
+    remaining -= n;
+  }
+  return fd;
+}
+
+static void
+flash_host_queue_event (FlashHost *host)
+{
+  /* FLASH_FILE_PLAYBACK_STOPPED is the only event, dispatch it from the
+   * main loop so callers never get re-entered in the middle of a call */
+  host->is_playing = FALSE;
+  if (host->event_pending)
+    return;
+  host->event_pending = TRUE;
+  g_idle_add (flash_host_event_callback, g_object_ref (host));
+}
+
+static gboolean
+flash_host_event_callback (gpointer data)
+{
+  FlashHost *host;
+
+  host = FLASH_HOST (data);
+  host->event_pending = FALSE;
+  if (host->callback)
+    host->callback (host, FLASH_FILE_PLAYBACK_STOPPED, host->callback_data);
+  g_object_unref (host);
+  return FALSE;
+}
+
+static gboolean
+flash_host_io_callback (GIOChannel *channel, GIOCondition condition,
+                        gpointer data)
+{
+  FlashHost *host;
+  FlashHostMessage msg;
+
+  host = FLASH_HOST (data);
+  if ((condition & G_IO_IN) && flash_host_message_recv (host->sock, &msg, NULL))
+  {
+    if (msg.type == FLASH_HOST_EVENT)
+      flash_host_queue_event (host);
+    return TRUE;
+  }
+
+  DEBUG("flash-host %d went away", host->pid);
+  if (host->is_playing)
+    flash_host_queue_event (host);
+  host->watch_id = 0;
+  return FALSE;
+}
+
+static void
+flash_host_destroy_socket (FlashHost *host)
+{
+  if (host->socket)
+  {
+    gtk_widget_destroy (host->socket);
+    g_object_unref (host->socket);
+    host->socket = NULL;
+  }
+}
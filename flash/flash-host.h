@@ -0,0 +1,63 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_HOST_H__
+#define __FLASH_HOST_H__
+
+#include <glib-object.h>
+#include <gtk/gtk.h>
+#include <flash/flash-file.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FlashHost      FlashHost;
+typedef struct _FlashHostClass FlashHostClass;
+
+typedef void (*FlashHostEventCallback)(FlashHost *host, FlashFileEvent event,
+                                       gpointer user_data);
+
+#define FLASH_TYPE_HOST \
+  (flash_host_get_type())
+
+#define FLASH_HOST(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), FLASH_TYPE_HOST, FlashHost))
+
+#define FLASH_HOST_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), FLASH_TYPE_HOST, FlashHostClass))
+
+#define FLASH_IS_HOST(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), FLASH_TYPE_HOST))
+
+#define FLASH_IS_HOST_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), FLASH_TYPE_HOST))
+
+#define FLASH_HOST_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj), FLASH_TYPE_HOST, FlashHostClass))
+
+GType flash_host_get_type (void);
+
+/* Runs the Flash library in a separate flash-host process. memory_limit
+ * caps the address space of that process in bytes (0 for no limit), and
+ * cpu pins it to a single processor (-1 to let the kernel decide). */
+FlashHost *flash_host_new        (const gchar *plugin_path,
+                                  gsize memory_limit, gint cpu,
+                                  FlashHostEventCallback callback,
+                                  gpointer callback_user_data,
+                                  GError **error);
+gboolean   flash_host_play       (FlashHost *host, GtkWindow *window,
+                                  const gchar *path, gboolean loop,
+                                  GError **error);
+gboolean   flash_host_play_data  (FlashHost *host, GtkWindow *window,
+                                  const gchar *name, gconstpointer data,
+                                  gsize size, gboolean loop, GError **error);
+gboolean   flash_host_is_playing (FlashHost *host);
+gboolean   flash_host_pause      (FlashHost *host);
+gboolean   flash_host_resume     (FlashHost *host);
+gboolean   flash_host_stop       (FlashHost *host);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1073 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "flash-common.h"
+#include "flash-http.h"
+
+/* Most response bytes held per request, headers included, and how soon
+ * to offer the body again when the consumer didn't take all of it */
+#define HTTP_BUFFER_BYTES  (64 * 1024)
+#define HTTP_RETRY_MS      10
+#define HTTP_MAX_REDIRECTS 5
+
+typedef struct {
+  FlashHttpPool *pool;
+  gchar *key;
+  int fd;
+  GIOChannel *channel;
+  guint watch_id;
+  guint timeout_id;
+} HttpConnection;
+
+struct _FlashHttpPool {
+  gchar *user_agent;
+  guint max_idle;
+  guint idle_timeout;
+  /* "host:port" to a GList of idle HttpConnections */
+  GHashTable *idle;
+  FlashHttpStats stats;
+};
+
+typedef enum
+{
+  HTTP_CONNECTING,
+  HTTP_SENDING,
+  HTTP_STATUS,
+  HTTP_HEADERS,
+  HTTP_BODY,
+  HTTP_CHUNK_SIZE,
+  HTTP_CHUNK_DATA,
+  HTTP_CHUNK_END,
+  HTTP_TRAILER,
+  HTTP_DONE
+} HttpState;
+
+typedef enum
+{
+  PROCESS_NEED_INPUT,
+  PROCESS_BLOCKED,
+  PROCESS_COMPLETE,
+  PROCESS_ERROR
+} HttpProcessResult;
+
+struct _FlashHttpRequest {
+  FlashHttpPool *pool;
+  gchar *url;
+  gchar *host;
+  gint port;
+  gchar *path;
+  gchar *key;
+  gchar *extra_headers;
+  gint redirects;
+
+  HttpConnection *conn;
+  gboolean reused;
+  HttpState state;
+  GString *out;
+  gsize out_offset;
+  GByteArray *in;
+  gboolean eof;
+  gboolean got_bytes;
+  guint retry_id;
+
+  /* The response */
+  gint status;
+  gboolean keep_alive;
+  gboolean chunked;
+  gint64 length;
+  /* Body bytes left in the response or chunk, -1 to read until close */
+  gint64 remaining;
+  gchar *content_type;
+  gchar *location;
+  /* Every header, by lower case name */
+  GHashTable *headers;
+
+  FlashHttpHeadersFunc headers_func;
+  FlashHttpBodyFunc body_func;
+  FlashHttpDoneFunc done_func;
+  gpointer user_data;
+};
+
+static gboolean flash_http_start (FlashHttpRequest *request, GError **error);
+static gboolean flash_http_io    (GIOChannel *channel, GIOCondition condition,
+                                  gpointer data);
+
+/* --- URLs --- */
+
+static gboolean
+flash_http_parse_url (FlashHttpRequest *request, const gchar *url,
+                      GError **error)
+{
+  const gchar *p;
+  const gchar *end;
+  const gchar *colon;
+  const gchar *bracket;
+  gchar *host;
+  gint port;
+
+  if (g_ascii_strncasecmp (url, "http://", 7) != 0)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                 "Unsupported URL '%s'", url);
+    return FALSE;
+  }
+
+  p = url + 7;
+  end = p + strcspn (p, "/?#");
+  colon = NULL;
+  if (*p == '[')
+  {
+    bracket = memchr (p, ']', end - p);
+    if (!bracket)
+      goto bad_url;
+    host = g_strndup (p + 1, bracket - p - 1);
+    if (bracket + 1 < end && bracket[1] == ':')
+      colon = bracket + 1;
+  }
+  else
+  {
+    colon = memchr (p, ':', end - p);
+    host = g_strndup (p, (colon ? colon : end) - p);
+  }
+
+  port = 80;
+  if (colon)
+    port = atoi (colon + 1);
+  if (*host == '\0' || port <= 0 || port > 65535)
+  {
+    g_free (host);
+    goto bad_url;
+  }
+
+  g_free (request->url);
+  g_free (request->host);
+  g_free (request->path);
+  g_free (request->key);
+  request->url = g_strdup (url);
+  request->host = host;
+  request->port = port;
+  if (*end == '/')
+    request->path = g_strndup (end, strcspn (end, "#"));
+  else if (*end == '?')
+    request->path = g_strdup_printf ("/%.*s", (int) strcspn (end, "#"), end);
+  else
+    request->path = g_strdup ("/");
+  request->key = g_strdup_printf (strchr (host, ':') ? "[%s]:%d" : "%s:%d",
+                                  host, port);
+  return TRUE;
+
+bad_url:
+  g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP, "Bad URL '%s'", url);
+  return FALSE;
+}
+
+/* Location headers may be relative to the request */
+static gchar *
+flash_http_resolve (FlashHttpRequest *request, const gchar *location)
+{
+  const gchar *slash;
+
+  if (strstr (location, "://"))
+    return g_strdup (location);
+  if (*location == '/')
+    return g_strdup_printf ("http://%s%s", request->key, location);
+  slash = strrchr (request->path, '/');
+  return g_strdup_printf ("http://%s%.*s/%s", request->key,
+                          (int) (slash - request->path), request->path,
+                          location);
+}
+
+/* --- Connections --- */
+
+static void
+flash_http_connection_free (HttpConnection *conn)
+{
+  if (conn->watch_id)
+    g_source_remove (conn->watch_id);
+  if (conn->timeout_id)
+    g_source_remove (conn->timeout_id);
+  g_io_channel_unref (conn->channel);
+  close (conn->fd);
+  g_free (conn->key);
+  g_free (conn);
+}
+
+static HttpConnection *
+flash_http_connect (FlashHttpRequest *request, GError **error)
+{
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  HttpConnection *conn;
+  gchar port_str[16];
+  int saved_errno;
+  int one;
+  int fd;
+  int rc;
+
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf (port_str, sizeof(port_str), "%d", request->port);
+  rc = getaddrinfo (request->host, port_str, &hints, &res);
+  if (rc != 0)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                 "Failed to resolve '%s': %s", request->host,
+                 gai_strerror (rc));
+    return NULL;
+  }
+
+  fd = -1;
+  saved_errno = 0;
+  for (ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == -1)
+    {
+      saved_errno = errno;
+      continue;
+    }
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+      break;
+    saved_errno = errno;
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (res);
+  if (fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                 "Failed to connect to %s: %s", request->key,
+                 strerror (saved_errno));
+    return NULL;
+  }
+
+  one = 1;
+  setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  conn = g_new0 (HttpConnection, 1);
+  conn->pool = request->pool;
+  conn->key = g_strdup (request->key);
+  conn->fd = fd;
+  conn->channel = g_io_channel_unix_new (fd);
+  request->pool->stats.connections++;
+  return conn;
+}
+
+static void
+flash_http_pool_drop (HttpConnection *conn)
+{
+  GList *idle;
+
+  idle = g_hash_table_lookup (conn->pool->idle, conn->key);
+  idle = g_list_remove (idle, conn);
+  if (idle)
+    g_hash_table_insert (conn->pool->idle, g_strdup (conn->key), idle);
+  else
+    g_hash_table_remove (conn->pool->idle, conn->key);
+  flash_http_connection_free (conn);
+}
+
+/* An idle connection that becomes readable has been closed by the server
+ * (or sent something it shouldn't have); either way it's no good */
+static gboolean
+flash_http_idle_io (GIOChannel *channel, GIOCondition condition,
+                    gpointer data)
+{
+  HttpConnection *conn;
+
+  conn = data;
+  conn->watch_id = 0;
+  flash_http_pool_drop (conn);
+  return FALSE;
+}
+
+static gboolean
+flash_http_idle_timeout (gpointer data)
+{
+  HttpConnection *conn;
+
+  conn = data;
+  conn->timeout_id = 0;
+  flash_http_pool_drop (conn);
+  return FALSE;
+}
+
+static void
+flash_http_pool_release (FlashHttpPool *pool, HttpConnection *conn)
+{
+  GList *idle;
+
+  if (conn->watch_id)
+  {
+    g_source_remove (conn->watch_id);
+    conn->watch_id = 0;
+  }
+
+  idle = g_hash_table_lookup (pool->idle, conn->key);
+  if (g_list_length (idle) >= pool->max_idle)
+  {
+    flash_http_connection_free (conn);
+    return;
+  }
+  conn->watch_id = g_io_add_watch (conn->channel,
+                                   G_IO_IN | G_IO_ERR | G_IO_HUP,
+                                   flash_http_idle_io, conn);
+  conn->timeout_id = g_timeout_add (pool->idle_timeout,
+                                    flash_http_idle_timeout, conn);
+  /* Most recently used first; the oldest are the likeliest to have been
+   * closed by the server */
+  idle = g_list_prepend (idle, conn);
+  g_hash_table_insert (pool->idle, g_strdup (conn->key), idle);
+}
+
+static HttpConnection *
+flash_http_pool_take (FlashHttpPool *pool, const gchar *key)
+{
+  HttpConnection *conn;
+  GList *idle;
+
+  idle = g_hash_table_lookup (pool->idle, key);
+  if (!idle)
+    return NULL;
+  conn = idle->data;
+  idle = g_list_delete_link (idle, idle);
+  if (idle)
+    g_hash_table_insert (pool->idle, g_strdup (key), idle);
+  else
+    g_hash_table_remove (pool->idle, key);
+
+  g_source_remove (conn->watch_id);
+  g_source_remove (conn->timeout_id);
+  conn->watch_id = 0;
+  conn->timeout_id = 0;
+  return conn;
+}
+
+FlashHttpPool *
+flash_http_pool_new (const gchar *user_agent, guint max_idle,
+                     guint idle_timeout)
+{
+  FlashHttpPool *pool;
+
+  pool = g_new0 (FlashHttpPool, 1);
+  pool->user_agent = g_strdup (user_agent);
+  pool->max_idle = max_idle;
+  pool->idle_timeout = idle_timeout;
+  pool->idle = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  return pool;
+}
+
+static gboolean
+flash_http_pool_free_idle (gpointer key, gpointer value, gpointer data)
+{
+  GList *l;
+
+  for (l = value; l; l = l->next)
+    flash_http_connection_free (l->data);
+  g_list_free (value);
+  return TRUE;
+}
+
+void
+flash_http_pool_free (FlashHttpPool *pool)
+{
+  g_hash_table_foreach_remove (pool->idle, flash_http_pool_free_idle, NULL);
+  g_hash_table_destroy (pool->idle);
+  g_free (pool->user_agent);
+  g_free (pool);
+}
+
+void
+flash_http_pool_get_stats (FlashHttpPool *pool, FlashHttpStats *stats)
+{
+  *stats = pool->stats;
+}
+
+/* --- Requests --- */
+
+/* Host header, leaving out the default port */
+static gchar *
+flash_http_host_header (FlashHttpRequest *request)
+{
+  if (request->port == 80)
+    return g_strndup (request->key, strrchr (request->key, ':') - request->key);
+  return g_strdup (request->key);
+}
+
+static void
+flash_http_request_free (FlashHttpRequest *request)
+{
+  if (request->retry_id)
+    g_source_remove (request->retry_id);
+  if (request->conn)
+    flash_http_connection_free (request->conn);
+  if (request->out)
+    g_string_free (request->out, TRUE);
+  g_byte_array_free (request->in, TRUE);
+  g_hash_table_destroy (request->headers);
+  g_free (request->extra_headers);
+  g_free (request->url);
+  g_free (request->host);
+  g_free (request->path);
+  g_free (request->key);
+  g_free (request->content_type);
+  g_free (request->location);
+  g_free (request);
+}
+
+static void
+flash_http_fail (FlashHttpRequest *request, GError *error)
+{
+  DEBUG ("GET '%s' failed: %s", request->url, error->message);
+  request->done_func (request, error, request->user_data);
+  g_error_free (error);
+  flash_http_request_free (request);
+}
+
+static void
+flash_http_watch (FlashHttpRequest *request, GIOCondition condition)
+{
+  HttpConnection *conn;
+
+  conn = request->conn;
+  if (conn->watch_id)
+    g_source_remove (conn->watch_id);
+  conn->watch_id = 0;
+  if (condition)
+    conn->watch_id = g_io_add_watch (conn->channel,
+                                     condition | G_IO_ERR | G_IO_HUP,
+                                     flash_http_io, request);
+}
+
+static void
+flash_http_consume (FlashHttpRequest *request, gsize len)
+{
+  gsize left;
+
+  left = request->in->len - len;
+  memmove (request->in->data, request->in->data + len, left);
+  g_byte_array_set_size (request->in, left);
+}
+
+static gchar *
+flash_http_take_line (FlashHttpRequest *request)
+{
+  guint8 *eol;
+  gsize len;
+  gchar *line;
+
+  eol = memchr (request->in->data, '\n', request->in->len);
+  if (!eol)
+    return NULL;
+  len = eol - request->in->data;
+  line = g_strndup ((gchar *) request->in->data, len);
+  if (len > 0 && line[len - 1] == '\r')
+    line[len - 1] = '\0';
+  flash_http_consume (request, len + 1);
+  return line;
+}
+
+/* Repeated headers are joined up with commas, as HTTP allows */
+static void
+flash_http_store_header (FlashHttpRequest *request, const gchar *name,
+                         const gchar *value)
+{
+  const gchar *old;
+  gchar *key;
+
+  key = g_ascii_strdown (name, -1);
+  old = g_hash_table_lookup (request->headers, key);
+  if (old)
+    g_hash_table_insert (request->headers, key,
+                         g_strconcat (old, ", ", value, NULL));
+  else
+    g_hash_table_insert (request->headers, key, g_strdup (value));
+}
+
+static gboolean
+flash_http_clear_header (gpointer key, gpointer value, gpointer data)
+{
+  return TRUE;
+}
+
+/* Forgets the headers of the last response read */
+static void
+flash_http_clear_headers (FlashHttpRequest *request)
+{
+  request->chunked = FALSE;
+  request->length = -1;
+  g_free (request->content_type);
+  request->content_type = NULL;
+  g_free (request->location);
+  request->location = NULL;
+  g_hash_table_foreach_remove (request->headers, flash_http_clear_header,
+                               NULL);
+}
+
+static gboolean
+flash_http_end_headers (FlashHttpRequest *request, GError **error)
+{
+  gchar *url;
+
+  if (request->status >= 100 && request->status < 200)
+  {
+    /* An interim response; the real one follows */
+    flash_http_clear_headers (request);
+    request->state = HTTP_STATUS;
+    return TRUE;
+  }
+
+  if (request->location &&
+      (request->status == 301 || request->status == 302 ||
+       request->status == 303 || request->status == 307) &&
+      request->redirects < HTTP_MAX_REDIRECTS)
+  {
+    url = flash_http_resolve (request, request->location);
+    g_free (request->location);
+    request->location = url;
+  }
+  else
+  {
+    g_free (request->location);
+    request->location = NULL;
+    if (!request->headers_func (request, request->status,
+                                request->content_type, request->length,
+                                request->user_data))
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CANCELLED,
+                   "Request for '%s' aborted", request->url);
+      return FALSE;
+    }
+  }
+
+  if (request->status == 204 || request->status == 304)
+  {
+    request->remaining = 0;
+    request->state = HTTP_BODY;
+  }
+  else if (request->chunked)
+    request->state = HTTP_CHUNK_SIZE;
+  else
+  {
+    request->remaining = request->length;
+    if (request->length < 0)
+      request->keep_alive = FALSE;
+    request->state = HTTP_BODY;
+  }
+  return TRUE;
+}
+
+static gboolean
+flash_http_handle_line (FlashHttpRequest *request, gchar *line,
+                        GError **error)
+{
+  gint major;
+  gint minor;
+  gchar *value;
+  gchar *end;
+  guint64 size;
+
+  switch (request->state)
+  {
+    case HTTP_STATUS:
+      if (sscanf (line, "HTTP/%d.%d %d", &major, &minor,
+                  &request->status) != 3)
+      {
+        g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                     "Bad status line from %s", request->key);
+        return FALSE;
+      }
+      request->keep_alive = major > 1 || (major == 1 && minor >= 1);
+      request->state = HTTP_HEADERS;
+      return TRUE;
+
+    case HTTP_HEADERS:
+      if (*line == '\0')
+        return flash_http_end_headers (request, error);
+      value = strchr (line, ':');
+      if (!value)
+        return TRUE;
+      *value++ = '\0';
+      while (*value == ' ' || *value == '\t')
+        value++;
+      flash_http_store_header (request, line, value);
+      if (g_ascii_strcasecmp (line, "Content-Length") == 0)
+        request->length = g_ascii_strtoull (value, NULL, 10);
+      else if (g_ascii_strcasecmp (line, "Transfer-Encoding") == 0)
+        request->chunked = strstr (value, "chunked") != NULL;
+      else if (g_ascii_strcasecmp (line, "Connection") == 0)
+      {
+        if (g_ascii_strncasecmp (value, "close", 5) == 0)
+          request->keep_alive = FALSE;
+        else if (g_ascii_strncasecmp (value, "keep-alive", 10) == 0)
+          request->keep_alive = TRUE;
+      }
+      else if (g_ascii_strcasecmp (line, "Content-Type") == 0)
+      {
+        g_free (request->content_type);
+        request->content_type = g_strdup (value);
+      }
+      else if (g_ascii_strcasecmp (line, "Location") == 0)
+      {
+        g_free (request->location);
+        request->location = g_strdup (value);
+      }
+      return TRUE;
+
+    case HTTP_CHUNK_SIZE:
+      size = g_ascii_strtoull (line, &end, 16);
+      if (end == line || size > G_MAXINT64)
+      {
+        g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                     "Bad chunk from %s", request->key);
+        return FALSE;
+      }
+      request->remaining = size;
+      request->state = request->remaining ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+      return TRUE;
+
+    case HTTP_CHUNK_END:
+      if (*line != '\0')
+      {
+        g_set_error (error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                     "Bad chunk from %s", request->key);
+        return FALSE;
+      }
+      request->state = HTTP_CHUNK_SIZE;
+      return TRUE;
+
+    case HTTP_TRAILER:
+      if (*line == '\0')
+        request->state = HTTP_DONE;
+      return TRUE;
+
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+  }
+}
+
+static HttpProcessResult
+flash_http_process (FlashHttpRequest *request, GError **error)
+{
+  gchar *line;
+  gssize taken;
+  gsize avail;
+
+  while (TRUE)
+  {
+    switch (request->state)
+    {
+      case HTTP_STATUS:
+      case HTTP_HEADERS:
+      case HTTP_CHUNK_SIZE:
+      case HTTP_CHUNK_END:
+      case HTTP_TRAILER:
+        line = flash_http_take_line (request);
+        if (!line)
+          return PROCESS_NEED_INPUT;
+        if (!flash_http_handle_line (request, line, error))
+        {
+          g_free (line);
+          return PROCESS_ERROR;
+        }
+        g_free (line);
+        break;
+
+      case HTTP_BODY:
+      case HTTP_CHUNK_DATA:
+        if (request->remaining == 0)
+        {
+          request->state = request->state == HTTP_BODY ? HTTP_DONE
+                                                       : HTTP_CHUNK_END;
+          break;
+        }
+        avail = request->in->len;
+        if (request->remaining > 0 && (gint64) avail > request->remaining)
+          avail = request->remaining;
+        if (avail == 0)
+          return PROCESS_NEED_INPUT;
+
+        /* The body of a redirect is dropped */
+        if (request->location)
+          taken = avail;
+        else
+          taken = request->body_func (request, request->in->data, avail,
+                                      request->user_data);
+        if (taken < 0)
+        {
+          g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_CANCELLED,
+                       "Request for '%s' aborted", request->url);
+          return PROCESS_ERROR;
+        }
+        flash_http_consume (request, taken);
+        if (!request->location)
+          request->pool->stats.bytes += taken;
+        if (request->remaining > 0)
+          request->remaining -= taken;
+        if ((gsize) taken < avail)
+          return PROCESS_BLOCKED;
+        break;
+
+      case HTTP_DONE:
+        return PROCESS_COMPLETE;
+
+      default:
+        g_assert_not_reached ();
+    }
+  }
+}
+
+static void
+flash_http_complete (FlashHttpRequest *request)
+{
+  HttpConnection *conn;
+  GError *error;
+  gchar *url;
+
+  conn = request->conn;
+  request->conn = NULL;
+  if (request->keep_alive && request->in->len == 0 && !request->eof)
+    flash_http_pool_release (request->pool, conn);
+  else
+    flash_http_connection_free (conn);
+
+  if (request->location)
+  {
+    DEBUG ("GET '%s': redirected to '%s'", request->url, request->location);
+    error = NULL;
+    url = request->location;
+    request->location = NULL;
+    request->redirects++;
+    /* They were made for the URL asked for; a 304 from elsewhere would
+     * pass off the cached copy of one as the other */
+    g_free (request->extra_headers);
+    request->extra_headers = NULL;
+    if (!flash_http_parse_url (request, url, &error) ||
+        !flash_http_start (request, &error))
+    {
+      g_free (url);
+      flash_http_fail (request, error);
+      return;
+    }
+    g_free (url);
+    return;
+  }
+
+  request->done_func (request, NULL, request->user_data);
+  flash_http_request_free (request);
+}
+
+/* The server closed a connection we had reused before answering; it
+ * probably timed it out, so try again on another */
+static gboolean
+flash_http_retry_stale (FlashHttpRequest *request, GError **error)
+{
+  if (!request->reused || request->got_bytes)
+    return FALSE;
+  DEBUG ("GET '%s': idle connection to %s went away, retrying",
+         request->url, request->key);
+  flash_http_connection_free (request->conn);
+  request->conn = NULL;
+  return flash_http_start (request, error);
+}
+
+static void flash_http_pump (FlashHttpRequest *request);
+
+static gboolean
+flash_http_retry (gpointer data)
+{
+  FlashHttpRequest *request;
+
+  request = data;
+  request->retry_id = 0;
+  flash_http_pump (request);
+  return FALSE;
+}
+
+/* Runs the parser over what has been read, and works out what to wait
+ * for next */
+static void
+flash_http_pump (FlashHttpRequest *request)
+{
+  GError *error;
+
+  error = NULL;
+  switch (flash_http_process (request, &error))
+  {
+    case PROCESS_NEED_INPUT:
+      if (request->eof)
+      {
+        if (request->state == HTTP_BODY && request->remaining < 0)
+        {
+          flash_http_complete (request);
+          return;
+        }
+        if (flash_http_retry_stale (request, &error))
+          return;
+        if (!error)
+          g_set_error (&error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                       "%s closed the connection", request->key);
+        flash_http_fail (request, error);
+        return;
+      }
+      if (request->in->len >= HTTP_BUFFER_BYTES)
+      {
+        g_set_error (&error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                     "Header line from %s too long", request->key);
+        flash_http_fail (request, error);
+        return;
+      }
+      flash_http_watch (request, G_IO_IN);
+      return;
+
+    case PROCESS_BLOCKED:
+      flash_http_watch (request, 0);
+      request->retry_id = g_timeout_add (HTTP_RETRY_MS, flash_http_retry,
+                                         request);
+      return;
+
+    case PROCESS_COMPLETE:
+      flash_http_complete (request);
+      return;
+
+    case PROCESS_ERROR:
+      flash_http_fail (request, error);
+      return;
+  }
+}
+
+static void
+flash_http_read (FlashHttpRequest *request)
+{
+  GError *error;
+  gsize old_len;
+  ssize_t n;
+
+  old_len = request->in->len;
+  g_byte_array_set_size (request->in, HTTP_BUFFER_BYTES);
+  do
+    n = read (request->conn->fd, request->in->data + old_len,
+              HTTP_BUFFER_BYTES - old_len);
+  while (n == -1 && errno == EINTR);
+  g_byte_array_set_size (request->in, old_len + MAX (n, 0));
+
+  if (n > 0)
+    request->got_bytes = TRUE;
+  else if (n == 0)
+    request->eof = TRUE;
+  else if (errno != EAGAIN)
+  {
+    error = NULL;
+    if (flash_http_retry_stale (request, &error))
+      return;
+    if (!error)
+      g_set_error (&error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                   "Failed to read from %s: %s", request->key,
+                   strerror (errno));
+    flash_http_fail (request, error);
+    return;
+  }
+  flash_http_pump (request);
+}
+
+static void
+flash_http_send (FlashHttpRequest *request)
+{
+  GError *error;
+  ssize_t n;
+
+  n = send (request->conn->fd, request->out->str + request->out_offset,
+            request->out->len - request->out_offset, MSG_NOSIGNAL);
+  if (n == -1 && (errno == EAGAIN || errno == EINTR))
+  {
+    flash_http_watch (request, G_IO_OUT);
+    return;
+  }
+  if (n == -1)
+  {
+    error = NULL;
+    if (flash_http_retry_stale (request, &error))
+      return;
+    if (!error)
+      g_set_error (&error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                   "Failed to send to %s: %s", request->key,
+                   strerror (errno));
+    flash_http_fail (request, error);
+    return;
+  }
+
+  request->out_offset += n;
+  if (request->out_offset < request->out->len)
+  {
+    flash_http_watch (request, G_IO_OUT);
+    return;
+  }
+  request->state = HTTP_STATUS;
+  flash_http_watch (request, G_IO_IN);
+}
+
+static gboolean
+flash_http_io (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  FlashHttpRequest *request;
+  GError *error;
+  socklen_t len;
+  int err;
+
+  request = data;
+  request->conn->watch_id = 0;
+
+  switch (request->state)
+  {
+    case HTTP_CONNECTING:
+      err = 0;
+      len = sizeof(err);
+      getsockopt (request->conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err)
+      {
+        error = NULL;
+        g_set_error (&error, FLASH_ERROR, FLASH_ERROR_HTTP,
+                     "Failed to connect to %s: %s", request->key,
+                     strerror (err));
+        flash_http_fail (request, error);
+        return FALSE;
+      }
+      request->state = HTTP_SENDING;
+      flash_http_send (request);
+      break;
+
+    case HTTP_SENDING:
+      flash_http_send (request);
+      break;
+
+    default:
+      flash_http_read (request);
+      break;
+  }
+  return FALSE;
+}
+
+/* (Re)starts the request on a connection of its own */
+static gboolean
+flash_http_start (FlashHttpRequest *request, GError **error)
+{
+  gchar *host;
+
+  request->status = 0;
+  request->keep_alive = FALSE;
+  request->remaining = -1;
+  request->eof = FALSE;
+  request->got_bytes = FALSE;
+  g_byte_array_set_size (request->in, 0);
+  flash_http_clear_headers (request);
+
+  if (request->out)
+    g_string_free (request->out, TRUE);
+  host = flash_http_host_header (request);
+  request->out = g_string_new (NULL);
+  g_string_append_printf (request->out,
+                          "GET %s HTTP/1.1\r\n"
+                          "Host: %s\r\n"
+                          "User-Agent: %s\r\n"
+                          "Accept: */*\r\n"
+                          "Connection: keep-alive\r\n"
+                          "%s"
+                          "\r\n",
+                          request->path, host, request->pool->user_agent,
+                          request->extra_headers ? request->extra_headers
+                                                 : "");
+  g_free (host);
+  request->out_offset = 0;
+
+  request->conn = flash_http_pool_take (request->pool, request->key);
+  if (request->conn)
+  {
+    request->reused = TRUE;
+    request->pool->stats.reused++;
+    request->state = HTTP_SENDING;
+  }
+  else
+  {
+    request->reused = FALSE;
+    request->conn = flash_http_connect (request, error);
+    if (!request->conn)
+      return FALSE;
+    request->state = HTTP_CONNECTING;
+  }
+  flash_http_watch (request, G_IO_OUT);
+  return TRUE;
+}
+
+FlashHttpRequest *
+flash_http_get (FlashHttpPool *pool, const gchar *url, const gchar *headers,
+                FlashHttpHeadersFunc headers_func,
+                FlashHttpBodyFunc body_func, FlashHttpDoneFunc done_func,
+                gpointer user_data, GError **error)
+{
+  FlashHttpRequest *request;
+
+  request = g_new0 (FlashHttpRequest, 1);
+  request->pool = pool;
+  request->in = g_byte_array_new ();
+  request->headers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            g_free);
+  request->extra_headers = g_strdup (headers);
+  request->headers_func = headers_func;
+  request->body_func = body_func;
+  request->done_func = done_func;
+  request->user_data = user_data;
+
+  if (!flash_http_parse_url (request, url, error) ||
+      !flash_http_start (request, error))
+  {
+    flash_http_request_free (request);
+    return NULL;
+  }
+  pool->stats.requests++;
+  DEBUG ("GET '%s' on %s connection", url,
+         request->reused ? "an idle" : "a new");
+  return request;
+}
+
+const gchar *
+flash_http_request_get_url (FlashHttpRequest *request)
+{
+  return request->url;
+}
+
+const gchar *
+flash_http_request_get_header (FlashHttpRequest *request, const gchar *name)
+{
+  const gchar *value;
+  gchar *key;
+
+  key = g_ascii_strdown (name, -1);
+  value = g_hash_table_lookup (request->headers, key);
+  g_free (key);
+  return value;
+}
+
+void
+flash_http_cancel (FlashHttpRequest *request)
+{
+  flash_http_request_free (request);
+}
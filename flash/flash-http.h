@@ -0,0 +1,75 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_HTTP_H__
+#define __FLASH_HTTP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A small HTTP/1.1 client driven by the main loop. Requests are GETs of
+ * http:// URLs (https:// is not supported); each has its own connection,
+ * taken from the pool's idle keep-alive connections to the same host and
+ * port when there is one. Response bodies are handed over as they come in,
+ * with at most HTTP_BUFFER_BYTES held back while the consumer isn't
+ * taking them. Host names are resolved synchronously. */
+typedef struct _FlashHttpPool    FlashHttpPool;
+typedef struct _FlashHttpRequest FlashHttpRequest;
+
+typedef struct {
+  guint requests;
+  guint connections;      /* connections opened */
+  guint reused;           /* requests sent on an idle connection */
+  guint64 bytes;          /* response body bytes */
+} FlashHttpStats;
+
+/* The response headers are in; length is -1 if the server didn't say.
+ * Return FALSE to abort the request. */
+typedef gboolean (*FlashHttpHeadersFunc) (FlashHttpRequest *request,
+                                          gint status,
+                                          const gchar *content_type,
+                                          gint64 length,
+                                          gpointer user_data);
+/* Response body bytes; return how many were taken, the rest being offered
+ * again shortly, or -1 to abort the request */
+typedef gssize   (*FlashHttpBodyFunc)    (FlashHttpRequest *request,
+                                          const guint8 *data, gsize len,
+                                          gpointer user_data);
+/* Called once when the request is over, error set if it failed; the
+ * request is freed right after */
+typedef void     (*FlashHttpDoneFunc)    (FlashHttpRequest *request,
+                                          const GError *error,
+                                          gpointer user_data);
+
+/* Keeps up to max_idle idle connections per host, each for up to
+ * idle_timeout ms */
+FlashHttpPool    *flash_http_pool_new       (const gchar *user_agent,
+                                             guint max_idle,
+                                             guint idle_timeout);
+/* Outstanding requests must have finished or been cancelled */
+void              flash_http_pool_free      (FlashHttpPool *pool);
+void              flash_http_pool_get_stats (FlashHttpPool *pool,
+                                             FlashHttpStats *stats);
+
+/* headers, if not NULL, are extra request header lines, each ending in
+ * CRLF. They aren't sent again after a redirect. */
+FlashHttpRequest *flash_http_get    (FlashHttpPool *pool, const gchar *url,
+                                     const gchar *headers,
+                                     FlashHttpHeadersFunc headers_func,
+                                     FlashHttpBodyFunc body_func,
+                                     FlashHttpDoneFunc done_func,
+                                     gpointer user_data, GError **error);
+const gchar      *flash_http_request_get_url (FlashHttpRequest *request);
+/* A response header, from the headers function on; NULL if not sent */
+const gchar      *flash_http_request_get_header (FlashHttpRequest *request,
+                                                 const gchar *name);
+/* Drops the request without calling its done function */
+void              flash_http_cancel (FlashHttpRequest *request);
+
+G_END_DECLS
+
+#endif
@@ -9,6 +9,9 @@
 
 #include <glib.h>
 #include "npupp.h"
+#include "flash-library.h"
+#include "flash-cache.h"
+#include "flash-http.h"
 
 G_BEGIN_DECLS
 
@@ -18,6 +21,17 @@ typedef char*   (*NPGetMIMEDescriptionFunc)(void);
 typedef NPError (*NPGetValueFunc)(void *, NPPVariable, void *);
 typedef void    (*SPFVoidVoidPFunc)(void *);
 typedef void    (*SPFVoidVoidPIntPFunc)(void *, int *);
+typedef void    (*SPFVoidVoidPIntFunc)(void *, int);
+typedef void    (*SPFVoidVoidPStrIntPFunc)(void *, const char *, int *);
+typedef void    (*SPFVoidVoidPStrStrFunc)(void *, const char *, const char *);
+typedef void    (*SPFVoidVoidPStrStrPFunc)(void *, const char *, char **);
+
+typedef struct {
+  gchar *prefix;
+  FlashPostHandler handler;
+  gpointer user_data;
+  GDestroyNotify destroy;
+} FlashPostHandlerEntry;
 
 struct _FlashLibrary {
   GObject  parent;
@@ -36,20 +50,71 @@ struct _FlashLibrary {
   /* Gecko NPAPI dynamic vtable */
   NPPluginFuncs            npf_vtable;
 
-  /* ScriptablePeer functions */
+  /* ScriptablePeer functions, NULL where the plugin doesn't export them */
   SPFVoidVoidPFunc         spf_play;
   SPFVoidVoidPFunc         spf_stop_play;
   SPFVoidVoidPIntPFunc     spf_is_playing;
   SPFVoidVoidPFunc         spf_release;
+  SPFVoidVoidPFunc         spf_rewind;
+  SPFVoidVoidPIntFunc      spf_goto_frame;
+  SPFVoidVoidPStrIntPFunc  spf_tcurrent_frame;
+  SPFVoidVoidPIntPFunc     spf_total_frames;
+  SPFVoidVoidPIntPFunc     spf_percent_loaded;
+  SPFVoidVoidPIntFunc      spf_zoom;
+  SPFVoidVoidPStrStrFunc   spf_set_variable;
+  SPFVoidVoidPStrStrPFunc  spf_get_variable;
+
+  /* flash_library_load_custom_symbol() lookups, misses included */
+  GHashTable              *symbols;
+
+  /* NPSavedData handed back by NPP_Destroy, per URL. saved_lru holds the
+   * URLs, most recently stored first */
+  GHashTable              *saved_data;
+  GList                   *saved_lru;
+  gsize                    saved_size;
+  gsize                    saved_budget;
+
+  FlashStreamStats         stream_stats;
+
+  /* FlashPostHandlerEntry, in the order they were added */
+  GList                   *post_handlers;
+
+  /* Keep-alive connections for http:// requests, made on first use */
+  FlashHttpPool           *http_pool;
+
+  /* Responses to those requests kept on disk, opened on first use; the
+   * budget is in bytes and 0 turns the cache off */
+  FlashCache              *http_cache;
+  gboolean                 http_cache_opened;
+  guint                    http_cache_budget;
 
   /* Public object properties */
   gchar *description;
 };
 
+/* Calls an NPP_* function of the plugin behind x, anything with a
+ * library member */
+#define PLUGIN_CALL(x, func, args...) \
+  (flash_library_get_plugin_vtable ((x)->library)->func (args))
 
 NPPluginFuncs *flash_library_get_plugin_vtable  (FlashLibrary *library);
 void          *flash_library_load_custom_symbol (FlashLibrary *library,
                                                  const gchar *name);
+/* Removes the data stored for url, passing ownership to the caller */
+NPSavedData   *flash_library_take_saved_data    (FlashLibrary *library,
+                                                 const gchar *url);
+void           flash_library_store_saved_data   (FlashLibrary *library,
+                                                 const gchar *url,
+                                                 NPSavedData *saved);
+void           flash_library_free_saved_data    (NPSavedData *saved);
+gboolean       flash_library_find_post_handler  (FlashLibrary *library,
+                                                 const gchar *url,
+                                                 FlashPostHandler *handler,
+                                                 gpointer *user_data);
+FlashHttpPool *flash_library_get_http_pool      (FlashLibrary *library);
+FlashCache    *flash_library_get_http_cache     (FlashLibrary *library);
+void           flash_library_add_stream_stats   (FlashLibrary *library,
+                                                 const FlashStreamStats *stats);
 
 G_END_DECLS
 
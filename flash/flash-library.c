@@ -11,24 +11,59 @@
 #include "flash-library.h"
 #include "flash-library-internal.h"
 #include "flash-file-internal.h"
+#include "flash-stream.h"
 
 #define FLASH_LIBRARY_UA "Mozilla/5.0 (X11; U; Linux i686; en-US; rv:1.7.5) " \
                          "Gecko/20041116 Firefox/1.0" 
 
 /* _FlashLibrary is defined in flash-library-internal.h */
 
+/* The ScriptablePeer exports we know about, all resolved at load time */
+static const struct {
+  const gchar *name;
+  glong        offset;
+} peer_symbols[] = {
+  { "ScriptablePeer_Play",          G_STRUCT_OFFSET (FlashLibrary, spf_play) },
+  { "ScriptablePeer_StopPlay",      G_STRUCT_OFFSET (FlashLibrary, spf_stop_play) },
+  { "ScriptablePeer_IsPlaying",     G_STRUCT_OFFSET (FlashLibrary, spf_is_playing) },
+  { "ScriptablePeer_release",       G_STRUCT_OFFSET (FlashLibrary, spf_release) },
+  { "ScriptablePeer_Rewind",        G_STRUCT_OFFSET (FlashLibrary, spf_rewind) },
+  { "ScriptablePeer_GotoFrame",     G_STRUCT_OFFSET (FlashLibrary, spf_goto_frame) },
+  { "ScriptablePeer_TCurrentFrame", G_STRUCT_OFFSET (FlashLibrary, spf_tcurrent_frame) },
+  { "ScriptablePeer_TotalFrames",   G_STRUCT_OFFSET (FlashLibrary, spf_total_frames) },
+  { "ScriptablePeer_PercentLoaded", G_STRUCT_OFFSET (FlashLibrary, spf_percent_loaded) },
+  { "ScriptablePeer_Zoom",          G_STRUCT_OFFSET (FlashLibrary, spf_zoom) },
+  { "ScriptablePeer_SetVariable",   G_STRUCT_OFFSET (FlashLibrary, spf_set_variable) },
+  { "ScriptablePeer_GetVariable",   G_STRUCT_OFFSET (FlashLibrary, spf_get_variable) },
+};
+
 struct _FlashLibraryClass {
   GObjectClass parent;
 };
 
+#define FLASH_LIBRARY_SAVED_DATA_BUDGET (1024 * 1024)
+
+/* Idle connections kept per host for http:// requests, and for how long */
+#define FLASH_LIBRARY_HTTP_MAX_IDLE     4
+#define FLASH_LIBRARY_HTTP_IDLE_TIMEOUT 15000
+
+/* Disk space for cached http:// responses, and where they go if
+ * FLASH_HTTP_CACHE isn't set (relative to the home directory) */
+#define FLASH_LIBRARY_HTTP_CACHE_SIZE   (64 * 1024 * 1024)
+#define FLASH_LIBRARY_HTTP_CACHE_DIR    ".flash-http-cache"
+
 enum
 {
   PROPERTY_DESCRIPTION = 1,
+  PROPERTY_SAVED_DATA_BUDGET,
+  PROPERTY_HTTP_CACHE_SIZE,
 };
 
 static void flash_library_class_init (FlashLibraryClass *);
 static void flash_library_init       (FlashLibrary *);
 static void flash_library_finalize   (GObject *);
+static void flash_library_trim_saved_data (FlashLibrary *library,
+                                           gsize budget);
 
 static void flash_library_set_property (GObject *object,
                                        guint param_id,
@@ -104,6 +139,8 @@ flash_library_new (const gchar *path, GError **error)
   const char *str;
   gchar *canon_path;
   const gchar *exts[] = { ".so", NULL };
+  gpointer *sym;
+  guint i;
 
   canon_path = flash_canonicalize_path (path);
   if (!canon_path)
@@ -148,18 +185,13 @@ flash_library_new (const gchar *path, GError **error)
   /* These functions are a bit of a hack, so if they fail, no big deal, we
    * just lose some functionality 
    */
-  library->spf_play = NULL;
-  library->spf_stop_play = NULL;
-  library->spf_is_playing = NULL;
-  library->spf_release = NULL;
-  g_module_symbol (module, "ScriptablePeer_Play",
-                   (gpointer *)&library->spf_play);
-  g_module_symbol (module, "ScriptablePeer_StopPlay",
-                   (gpointer *)&library->spf_stop_play);
-  g_module_symbol (module, "ScriptablePeer_IsPlaying",
-                   (gpointer *)&library->spf_is_playing);
-  g_module_symbol (module, "ScriptablePeer_release",
-                   (gpointer *)&library->spf_release);
+  for (i = 0; i < G_N_ELEMENTS (peer_symbols); i++)
+  {
+    sym = G_STRUCT_MEMBER_P (library, peer_symbols[i].offset);
+    if (!g_module_symbol (module, peer_symbols[i].name, sym))
+      *sym = NULL;
+    DEBUG ("%s: %p", peer_symbols[i].name, *sym);
+  }
 
   exports = g_new (NPNetscapeFuncs, 1);
   memset (exports, 0, sizeof(NPNetscapeFuncs));
@@ -214,17 +246,215 @@ flash_library_get_plugin_vtable (FlashLibrary *library)
 void *
 flash_library_load_custom_symbol (FlashLibrary *library, const gchar *name)
 {
+  gpointer key;
   void *sym;
 
-  if (g_module_symbol (library->module, name, &sym))
+  if (g_hash_table_lookup_extended (library->symbols, name, &key, &sym))
     return sym;
-  return NULL;
+  if (!g_module_symbol (library->module, name, &sym))
+    sym = NULL;
+  g_hash_table_insert (library->symbols, g_strdup (name), sym);
+  return sym;
+}
+
+NPSavedData *
+flash_library_take_saved_data (FlashLibrary *library, const gchar *url)
+{
+  NPSavedData *saved;
+  GList *link;
+
+  saved = g_hash_table_lookup (library->saved_data, url);
+  if (!saved)
+    return NULL;
+
+  link = g_list_find_custom (library->saved_lru, url,
+                             (GCompareFunc) strcmp);
+  g_hash_table_remove (library->saved_data, url);
+  g_free (link->data);
+  library->saved_lru = g_list_delete_link (library->saved_lru, link);
+  library->saved_size -= saved->len;
+  DEBUG ("took %d bytes of saved data for '%s'", saved->len, url);
+  return saved;
+}
+
+void
+flash_library_store_saved_data (FlashLibrary *library, const gchar *url,
+                                NPSavedData *saved)
+{
+  NPSavedData *old;
+
+  if ((gsize) saved->len > library->saved_budget)
+  {
+    flash_library_free_saved_data (saved);
+    return;
+  }
+
+  old = flash_library_take_saved_data (library, url);
+  if (old)
+    flash_library_free_saved_data (old);
+
+  flash_library_trim_saved_data (library,
+                                 library->saved_budget - saved->len);
+  g_hash_table_insert (library->saved_data, g_strdup (url), saved);
+  library->saved_lru = g_list_prepend (library->saved_lru, g_strdup (url));
+  library->saved_size += saved->len;
+  DEBUG ("stored %d bytes of saved data for '%s' (%lu in total)", saved->len,
+         url, (gulong) library->saved_size);
+}
+
+void
+flash_library_add_post_handler (FlashLibrary *library, const gchar *prefix,
+                                FlashPostHandler handler, gpointer user_data,
+                                GDestroyNotify destroy)
+{
+  FlashPostHandlerEntry *entry;
+
+  g_return_if_fail (FLASH_IS_LIBRARY (library));
+  g_return_if_fail (prefix != NULL && handler != NULL);
+
+  flash_library_remove_post_handler (library, prefix);
+  entry = g_new0 (FlashPostHandlerEntry, 1);
+  entry->prefix = g_strdup (prefix);
+  entry->handler = handler;
+  entry->user_data = user_data;
+  entry->destroy = destroy;
+  library->post_handlers = g_list_append (library->post_handlers, entry);
+}
+
+void
+flash_library_remove_post_handler (FlashLibrary *library, const gchar *prefix)
+{
+  FlashPostHandlerEntry *entry;
+  GList *l;
+
+  g_return_if_fail (FLASH_IS_LIBRARY (library));
+
+  for (l = library->post_handlers; l; l = l->next)
+  {
+    entry = l->data;
+    if (strcmp (entry->prefix, prefix) != 0)
+      continue;
+    library->post_handlers = g_list_delete_link (library->post_handlers, l);
+    if (entry->destroy)
+      entry->destroy (entry->user_data);
+    g_free (entry->prefix);
+    g_free (entry);
+    return;
+  }
+}
+
+FlashHttpPool *
+flash_library_get_http_pool (FlashLibrary *library)
+{
+  if (!library->http_pool)
+    library->http_pool = flash_http_pool_new (FLASH_LIBRARY_UA,
+                                              FLASH_LIBRARY_HTTP_MAX_IDLE,
+                                              FLASH_LIBRARY_HTTP_IDLE_TIMEOUT);
+  return library->http_pool;
+}
+
+FlashCache *
+flash_library_get_http_cache (FlashLibrary *library)
+{
+  const gchar *dir;
+  gchar *path;
+
+  if (library->http_cache_budget == 0)
+    return NULL;
+  if (library->http_cache_opened)
+    return library->http_cache;
+  library->http_cache_opened = TRUE;
+
+  dir = g_getenv ("FLASH_HTTP_CACHE");
+  if (dir && *dir)
+    path = g_strdup (dir);
+  else
+    path = g_build_filename (g_get_home_dir (), FLASH_LIBRARY_HTTP_CACHE_DIR,
+                             NULL);
+  library->http_cache = flash_cache_new (path, library->http_cache_budget);
+  if (!library->http_cache)
+    DEBUG ("can't use '%s' for the HTTP cache", path);
+  g_free (path);
+  return library->http_cache;
+}
+
+gboolean
+flash_library_find_post_handler (FlashLibrary *library, const gchar *url,
+                                 FlashPostHandler *handler,
+                                 gpointer *user_data)
+{
+  FlashPostHandlerEntry *entry;
+  FlashPostHandlerEntry *best;
+  gsize best_len;
+  gsize len;
+  GList *l;
+
+  best = NULL;
+  best_len = 0;
+  for (l = library->post_handlers; l; l = l->next)
+  {
+    entry = l->data;
+    len = strlen (entry->prefix);
+    if (len >= best_len && strncmp (url, entry->prefix, len) == 0)
+    {
+      best = entry;
+      best_len = len;
+    }
+  }
+  if (!best)
+    return FALSE;
+  *handler = best->handler;
+  *user_data = best->user_data;
+  return TRUE;
+}
+
+/* Both the structure and its buffer come from NPN_MemAlloc, i.e. g_malloc */
+void
+flash_library_free_saved_data (NPSavedData *saved)
+{
+  if (saved->buf)
+    g_free (saved->buf);
+  g_free (saved);
+}
+
+void
+flash_library_get_stream_stats (FlashLibrary *library,
+                                FlashStreamStats *stats)
+{
+  *stats = library->stream_stats;
+}
+
+void
+flash_library_add_stream_stats (FlashLibrary *library,
+                                const FlashStreamStats *stats)
+{
+  flash_stream_stats_add (&library->stream_stats, stats);
+}
+
+/* Drops the least recently stored data until no more than budget bytes
+ * are left */
+static void
+flash_library_trim_saved_data (FlashLibrary *library, gsize budget)
+{
+  GList *last;
+  gchar *url;
+
+  while (library->saved_size > budget)
+  {
+    last = g_list_last (library->saved_lru);
+    url = g_strdup (last->data);
+    flash_library_free_saved_data (flash_library_take_saved_data (library,
+                                                                  url));
+    g_free (url);
+  }
 }
 
 static void
 flash_library_class_init (FlashLibraryClass *klass)
 {
   GParamSpec *description_param;
+  GParamSpec *saved_data_budget_param;
+  GParamSpec *http_cache_size_param;
   GObjectClass *object_class;
 
   object_class = G_OBJECT_CLASS (klass);
@@ -233,12 +463,26 @@ flash_library_class_init (FlashLibraryClass *klass)
                                            "description (name, version) of the Flash library",
                                            NULL,
                                            G_PARAM_READABLE);
+  saved_data_budget_param = g_param_spec_uint ("saved-data-budget",
+                                               "saved data budget",
+                                               "bytes of NPSavedData kept for re-instantiating files",
+                                               0, G_MAXUINT,
+                                               FLASH_LIBRARY_SAVED_DATA_BUDGET,
+                                               G_PARAM_READWRITE);
+  http_cache_size_param = g_param_spec_uint ("http-cache-size",
+                                             "HTTP cache size",
+                                             "bytes of disk used to cache http:// responses, 0 for none",
+                                             0, G_MAXUINT,
+                                             FLASH_LIBRARY_HTTP_CACHE_SIZE,
+                                             G_PARAM_READWRITE);
   
   object_class->set_property = flash_library_set_property;
   object_class->get_property = flash_library_get_property;
   object_class->finalize = flash_library_finalize;
 
   g_object_class_install_property (object_class, PROPERTY_DESCRIPTION, description_param);
+  g_object_class_install_property (object_class, PROPERTY_SAVED_DATA_BUDGET, saved_data_budget_param);
+  g_object_class_install_property (object_class, PROPERTY_HTTP_CACHE_SIZE, http_cache_size_param);
 }
 
 static void
@@ -248,6 +492,19 @@ flash_library_init (FlashLibrary *lib)
   lib->exports = NULL;
   lib->path = NULL;
   lib->initialized = FALSE;
+  lib->symbols = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, NULL);
+  lib->saved_data = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, NULL);
+  lib->saved_lru = NULL;
+  lib->saved_size = 0;
+  lib->saved_budget = FLASH_LIBRARY_SAVED_DATA_BUDGET;
+  memset (&lib->stream_stats, 0, sizeof(lib->stream_stats));
+  lib->post_handlers = NULL;
+  lib->http_pool = NULL;
+  lib->http_cache = NULL;
+  lib->http_cache_opened = FALSE;
+  lib->http_cache_budget = FLASH_LIBRARY_HTTP_CACHE_SIZE;
 
   lib->description = NULL;
 }
@@ -275,10 +532,31 @@ flash_library_finalize (GObject *object)
   if (library->description)
     g_free (library->description);
 
+  if (library->symbols)
+    g_hash_table_destroy (library->symbols);
+
+  if (library->saved_data)
+  {
+    flash_library_trim_saved_data (library, 0);
+    g_hash_table_destroy (library->saved_data);
+  }
+
+  if (library->http_pool)
+    flash_http_pool_free (library->http_pool);
+
+  if (library->http_cache)
+    flash_cache_free (library->http_cache);
+
+  while (library->post_handlers)
+    flash_library_remove_post_handler (library,
+      ((FlashPostHandlerEntry *) library->post_handlers->data)->prefix);
+
   library->module = NULL;
   library->exports = NULL;
   library->path = NULL;
   library->description = NULL;
+  library->symbols = NULL;
+  library->saved_data = NULL;
 }
 
 static void
@@ -292,6 +570,16 @@ flash_library_set_property (GObject *object,
   library = FLASH_LIBRARY (object);
   switch (param_id)
   {
+    case PROPERTY_SAVED_DATA_BUDGET:
+      library->saved_budget = g_value_get_uint (value);
+      flash_library_trim_saved_data (library, library->saved_budget);
+      break;
+    case PROPERTY_HTTP_CACHE_SIZE:
+      library->http_cache_budget = g_value_get_uint (value);
+      if (library->http_cache)
+        flash_cache_set_budget (library->http_cache,
+                                library->http_cache_budget);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
       break;
@@ -312,6 +600,12 @@ flash_library_get_property (GObject *object,
     case PROPERTY_DESCRIPTION:
       g_value_set_string (value, library->description);
       break;
+    case PROPERTY_SAVED_DATA_BUDGET:
+      g_value_set_uint (value, library->saved_budget);
+      break;
+    case PROPERTY_HTTP_CACHE_SIZE:
+      g_value_set_uint (value, library->http_cache_budget);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, param_id, pspec);
       break;
@@ -331,8 +625,10 @@ static NPError
 flash_npapi_posturl (NPP instance, const char *url, const char *window, uint32 len,
                      const char *buf, NPBool file)
 {
-  DEBUG("NPN_PostURL: UNIMPLEMENTED");
-  return NPERR_GENERIC_ERROR;
+  DEBUG("NPN_PostURL: url='%s' window='%s' len=%u file=%d", url,
+        window ? window : "NULL", len, file);
+  return flash_npapi_posturlnotify (instance, url, window, len, buf, file,
+                                    NULL);
 }
 
 static NPError
@@ -345,22 +641,31 @@ flash_npapi_requestread (NPStream *stream, NPByteRange *range)
 static NPError
 flash_npapi_newstream (NPP instance, NPMIMEType type, const char *window, NPStream **stream)
 {
-  DEBUG("NPN_NewStream: UNIMPLEMENTED");
-  return NPERR_GENERIC_ERROR;
+  DEBUG("NPN_NewStream: type='%s' window='%s'", type, window ? window : "NULL");
+  if (!instance || !instance->ndata)
+    return NPERR_INVALID_INSTANCE_ERROR;
+  return flash_file_new_sink_stream ((FlashFile *)instance->ndata, type,
+                                     window, stream);
 }
 
 static int32
 flash_npapi_write (NPP instance, NPStream *stream, int32 len, void *buffer)
 {
-  DEBUG("NPN_Write: UNIMPLEMENTED");
-  return 0;
+  DEBUG("NPN_Write: stream=%p len=%d", stream, len);
+  if (!instance || !instance->ndata)
+    return -1;
+  return flash_file_write_sink_stream ((FlashFile *)instance->ndata, stream,
+                                       len, buffer);
 }
 
 static NPError
 flash_npapi_destroystream (NPP instance, NPStream *stream, NPReason reason)
 {
-  DEBUG("NPN_DestroyStream: UNIMPLEMENTED");
-  return NPERR_GENERIC_ERROR;
+  DEBUG("NPN_DestroyStream: stream=%p reason=%d", stream, reason);
+  if (!instance || !instance->ndata)
+    return NPERR_INVALID_INSTANCE_ERROR;
+  return flash_file_destroy_sink_stream ((FlashFile *)instance->ndata,
+                                         stream, reason);
 }
 
 static void
@@ -425,6 +730,9 @@ flash_npapi_geturlnotify (NPP instance, const char *url, const char *window,
                           void *user_data)
 {
   DEBUG("NPN_GetURLNotify: url='%s' window='%s' notifyData=%p", url, window ? window : "NULL", user_data);
+  if (!window && instance && instance->ndata &&
+      flash_file_serves_url ((FlashFile *)instance->ndata, url))
+    return flash_file_get_url ((FlashFile *)instance->ndata, url, user_data);
   if (user_data)
     flash_file_set_notify ((FlashFile *)instance->ndata, url, user_data);
   return NPERR_NO_ERROR;
@@ -434,8 +742,12 @@ static NPError
 flash_npapi_posturlnotify (NPP instance, const char *url, const char *target, uint32 len,
                            const char *buf, NPBool file, void *notifyData)
 {
-  DEBUG("NPN_PostURLNotify: UNIMPLEMENTED");
-  return NPERR_NO_ERROR;
+  DEBUG("NPN_PostURLNotify: url='%s' target='%s' len=%u file=%d notifyData=%p",
+        url, target ? target : "NULL", len, file, notifyData);
+  if (!instance || !instance->ndata)
+    return NPERR_INVALID_INSTANCE_ERROR;
+  return flash_file_post_url ((FlashFile *)instance->ndata, url, target, len,
+                              buf, file, notifyData);
 }
 
 static NPError
@@ -15,6 +15,29 @@ G_BEGIN_DECLS
 typedef struct _FlashLibrary      FlashLibrary;
 typedef struct _FlashLibraryClass FlashLibraryClass;
 
+/* Delivery figures for host to plugin streams, summed over streams. Times
+ * are in seconds; divide by streams for averages. */
+typedef struct {
+  guint streams;
+  guint64 bytes;
+  guint writes;           /* NPP_Write calls */
+  gdouble blocked;        /* time NPP_WriteReady said 0 */
+  gdouble plugin_write;   /* time spent inside NPP_Write */
+  gdouble first_byte;     /* from NPP_NewStream to the first byte taken */
+  gdouble latency;        /* from NPP_NewStream to NPP_DestroyStream */
+} FlashStreamStats;
+
+/* Answers a POST from the plugin (NPN_PostURL). body is the request body,
+ * without the headers the plugin may put in front of it, and content_type
+ * is NULL if it sent none. Append the response to response and return
+ * TRUE, or return FALSE to fail the request with a network error. Handlers
+ * are always called from the main loop, even with flash_set_event_thread(),
+ * and should be added and removed from it too. */
+typedef gboolean (*FlashPostHandler) (FlashLibrary *library, const gchar *url,
+                                      const gchar *content_type,
+                                      const guint8 *body, gsize length,
+                                      GString *response, gpointer user_data);
+
 #define FLASH_TYPE_LIBRARY \
   (flash_library_get_type())
 
@@ -37,6 +60,23 @@ GType flash_library_get_type (void);
 
 FlashLibrary *flash_library_new (const gchar *path, GError **error);
 
+/* Totals over every stream to every file played with this library */
+void flash_library_get_stream_stats (FlashLibrary *library,
+                                     FlashStreamStats *stats);
+
+/* POSTs go to the handler with the longest prefix of the URL. Those that
+ * match none are answered by a stand-in for a local web server, which
+ * accepts anything with an empty response, so that content waiting on an
+ * answer doesn't keep retrying. Adding a prefix again replaces its
+ * handler. */
+void flash_library_add_post_handler    (FlashLibrary *library,
+                                        const gchar *prefix,
+                                        FlashPostHandler handler,
+                                        gpointer user_data,
+                                        GDestroyNotify destroy);
+void flash_library_remove_post_handler (FlashLibrary *library,
+                                        const gchar *prefix);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,1332 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "flash-common.h"
+#include "flash-pixel.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define FLASH_PIXEL_X86 1
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* NEON is only built when the compiler targets it anyway (always the case
+ * on aarch64), so no runtime check is needed */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FLASH_PIXEL_NEON_BUILT 1
+#include <arm_neon.h>
+#endif
+
+/* BT.601, limited range, 8 bit fixed point. All kernels use exactly these
+ * formulas; the vector versions rely on every intermediate fitting in 16
+ * bits (|66R + 129G + 25B + 128| < 65536, the chroma sums < 32768). */
+#define RGB_Y(r, g, b) ((( 66 * (r) + 129 * (g) +  25 * (b) + 128) >> 8) + 16)
+#define RGB_U(r, g, b) (((-38 * (r) -  74 * (g) + 112 * (b) + 128) >> 8) + 128)
+#define RGB_V(r, g, b) (((112 * (r) -  94 * (g) -  18 * (b) + 128) >> 8) + 128)
+
+/* x * y / 255, rounded, exact for all 8 bit x and y. The vector versions
+ * compute the same thing in 16 bit lanes. */
+#define DIV255_ROUND(t) ((((t) + 128) + (((t) + 128) >> 8)) >> 8)
+#define MUL_DIV255(x, y) DIV255_ROUND ((x) * (y))
+
+typedef void (*LumaRowFunc)   (const guint8 *src, guint8 *y, gint width);
+typedef void (*ChromaRowFunc) (const guint8 *src0, const guint8 *src1,
+                               guint8 *u, guint8 *v, gint width);
+typedef void (*ChromaNV12RowFunc) (const guint8 *src0, const guint8 *src1,
+                                   guint8 *uv, gint width);
+
+typedef void (*InPlaceRowFunc) (guint8 *pixels, gint n);
+typedef void (*SwizzleRowFunc) (const guint8 *src, guint8 *dst, gint n,
+                                gboolean opaque);
+typedef void (*OverRowFunc)    (const guint8 *src, guint8 *dst, gint n);
+typedef void (*BoxSumRowFunc)  (const guint8 *src, gint stride, gint rows,
+                                guint16 *sum, gint n);
+
+typedef struct {
+  LumaRowFunc       luma_row;
+  ChromaRowFunc     chroma_row;
+  ChromaNV12RowFunc chroma_nv12_row;
+  InPlaceRowFunc    premultiply_row;
+  InPlaceRowFunc    unpremultiply_row;
+  SwizzleRowFunc    swizzle_row;
+  OverRowFunc       over_row;
+  BoxSumRowFunc     box_sum_row;
+} PixelKernels;
+
+static FlashPixelKernel kernel = FLASH_PIXEL_SCALAR;
+static const PixelKernels *kernels = NULL;
+
+/* ceil (2^24 / a): (n * recip[a]) >> 24 == n / a for every n < 2^16, which
+ * saves unpremultiply a division per channel */
+static guint32 unpremultiply_recip[256];
+
+/* The vector kernels use (n + 0.5f) * (1.0f / a) instead, which rounds
+ * down to the same quotient for every byte value of c and a, where
+ * n = c * 255 + a / 2. inv[0] is 0, which zeroes transparent pixels. */
+static gfloat unpremultiply_inv[256];
+
+/* --- Scalar --- */
+
+static void
+luma_row_scalar (const guint8 *src, guint8 *y, gint width)
+{
+  gint i;
+
+  for (i = 0; i < width; i++, src += 4)
+    y[i] = RGB_Y (src[2], src[1], src[0]);
+}
+
+/* Averages the 2x2 block at column i of both rows */
+#define AVERAGE_2X2(s0, s1, c) \
+  (((s0)[c] + (s0)[4 + (c)] + (s1)[c] + (s1)[4 + (c)] + 2) >> 2)
+
+static void
+chroma_row_scalar (const guint8 *src0, const guint8 *src1, guint8 *u,
+                   guint8 *v, gint width)
+{
+  gint i;
+  gint r, g, b;
+
+  for (i = 0; i < width / 2; i++, src0 += 8, src1 += 8)
+  {
+    b = AVERAGE_2X2 (src0, src1, 0);
+    g = AVERAGE_2X2 (src0, src1, 1);
+    r = AVERAGE_2X2 (src0, src1, 2);
+    u[i] = RGB_U (r, g, b);
+    v[i] = RGB_V (r, g, b);
+  }
+}
+
+static void
+chroma_nv12_row_scalar (const guint8 *src0, const guint8 *src1, guint8 *uv,
+                        gint width)
+{
+  gint i;
+  gint r, g, b;
+
+  for (i = 0; i < width / 2; i++, src0 += 8, src1 += 8)
+  {
+    b = AVERAGE_2X2 (src0, src1, 0);
+    g = AVERAGE_2X2 (src0, src1, 1);
+    r = AVERAGE_2X2 (src0, src1, 2);
+    uv[2 * i] = RGB_U (r, g, b);
+    uv[2 * i + 1] = RGB_V (r, g, b);
+  }
+}
+
+static void
+premultiply_row_scalar (guint8 *p, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++, p += 4)
+  {
+    p[0] = MUL_DIV255 (p[0], p[3]);
+    p[1] = MUL_DIV255 (p[1], p[3]);
+    p[2] = MUL_DIV255 (p[2], p[3]);
+  }
+}
+
+static void
+unpremultiply_row_scalar (guint8 *p, gint n)
+{
+  guint32 r;
+  gint i;
+  gint a;
+
+  for (i = 0; i < n; i++, p += 4)
+  {
+    a = p[3];
+    if (a == 255)
+      continue;
+    if (a == 0)
+    {
+      p[0] = p[1] = p[2] = 0;
+      continue;
+    }
+    r = unpremultiply_recip[a];
+    p[0] = MIN (255, ((guint64) (p[0] * 255 + a / 2) * r) >> 24);
+    p[1] = MIN (255, ((guint64) (p[1] * 255 + a / 2) * r) >> 24);
+    p[2] = MIN (255, ((guint64) (p[2] * 255 + a / 2) * r) >> 24);
+  }
+}
+
+static void
+swizzle_row_scalar (const guint8 *src, guint8 *dst, gint n, gboolean opaque)
+{
+  guint8 t;
+  gint i;
+
+  for (i = 0; i < n; i++, src += 4, dst += 4)
+  {
+    t = src[0];
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = t;
+    dst[3] = opaque ? 0xff : src[3];
+  }
+}
+
+static void
+over_row_scalar (const guint8 *src, guint8 *dst, gint n)
+{
+  gint ia;
+  gint i;
+  gint c;
+
+  for (i = 0; i < n; i++, src += 4, dst += 4)
+  {
+    ia = 255 - src[3];
+    for (c = 0; c < 4; c++)
+      dst[c] = MIN (255, src[c] + MUL_DIV255 (dst[c], ia));
+  }
+}
+
+/* Column sums of n bytes over rows rows, the vertical half of the box
+ * filter */
+static void
+box_sum_row_scalar (const guint8 *src, gint stride, gint rows, guint16 *sum,
+                    gint n)
+{
+  gint i;
+  gint r;
+
+  for (i = 0; i < n; i++)
+  {
+    sum[i] = 0;
+    for (r = 0; r < rows; r++)
+      sum[i] += src[r * stride + i];
+  }
+}
+
+static const PixelKernels scalar_kernels = {
+  luma_row_scalar,
+  chroma_row_scalar,
+  chroma_nv12_row_scalar,
+  premultiply_row_scalar,
+  unpremultiply_row_scalar,
+  swizzle_row_scalar,
+  over_row_scalar,
+  box_sum_row_scalar
+};
+
+#ifdef FLASH_PIXEL_X86
+
+/* --- SSE2: 16 pixels per iteration --- */
+
+/* Splits 8 BGRA pixels into 16 bit B, G and R vectors */
+TARGET("sse2") static inline void
+split_sse2 (const guint8 *src, __m128i *b, __m128i *g, __m128i *r)
+{
+  const __m128i mask = _mm_set1_epi32 (0xff);
+  __m128i p0, p1;
+
+  p0 = _mm_loadu_si128 ((const __m128i *) src);
+  p1 = _mm_loadu_si128 ((const __m128i *) (src + 16));
+  *b = _mm_packs_epi32 (_mm_and_si128 (p0, mask), _mm_and_si128 (p1, mask));
+  *g = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (p0, 8), mask),
+                        _mm_and_si128 (_mm_srli_epi32 (p1, 8), mask));
+  *r = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (p0, 16), mask),
+                        _mm_and_si128 (_mm_srli_epi32 (p1, 16), mask));
+}
+
+TARGET("sse2") static inline __m128i
+luma8_sse2 (const guint8 *src)
+{
+  __m128i b, g, r, y;
+
+  split_sse2 (src, &b, &g, &r);
+  /* The sum can exceed 32767, so it's treated as unsigned throughout */
+  y = _mm_add_epi16 (_mm_mullo_epi16 (r, _mm_set1_epi16 (66)),
+                     _mm_mullo_epi16 (g, _mm_set1_epi16 (129)));
+  y = _mm_add_epi16 (y, _mm_mullo_epi16 (b, _mm_set1_epi16 (25)));
+  y = _mm_srli_epi16 (_mm_add_epi16 (y, _mm_set1_epi16 (128)), 8);
+  return _mm_add_epi16 (y, _mm_set1_epi16 (16));
+}
+
+TARGET("sse2") static void
+luma_row_sse2 (const guint8 *src, guint8 *y, gint width)
+{
+  gint i;
+
+  for (i = 0; i + 16 <= width; i += 16)
+    _mm_storeu_si128 ((__m128i *) (y + i),
+                      _mm_packus_epi16 (luma8_sse2 (src + 4 * i),
+                                        luma8_sse2 (src + 4 * i + 32)));
+  luma_row_scalar (src + 4 * i, y + i, width - i);
+}
+
+/* 2x2 averages of B, G and R for 8 chroma samples (16 pixels, 2 rows) */
+TARGET("sse2") static inline void
+average16_sse2 (const guint8 *src0, const guint8 *src1,
+                __m128i *b, __m128i *g, __m128i *r)
+{
+  const __m128i ones = _mm_set1_epi16 (1);
+  const __m128i two = _mm_set1_epi16 (2);
+  __m128i b0, g0, r0, b1, g1, r1, t;
+  __m128i sb[2], sg[2], sr[2];
+  gint half;
+
+  for (half = 0; half < 2; half++)
+  {
+    split_sse2 (src0 + 32 * half, &b0, &g0, &r0);
+    split_sse2 (src1 + 32 * half, &b1, &g1, &r1);
+    /* vertical sums, then horizontal pairs into 32 bit lanes */
+    sb[half] = _mm_madd_epi16 (_mm_add_epi16 (b0, b1), ones);
+    sg[half] = _mm_madd_epi16 (_mm_add_epi16 (g0, g1), ones);
+    sr[half] = _mm_madd_epi16 (_mm_add_epi16 (r0, r1), ones);
+  }
+  t = _mm_packs_epi32 (sb[0], sb[1]);
+  *b = _mm_srli_epi16 (_mm_add_epi16 (t, two), 2);
+  t = _mm_packs_epi32 (sg[0], sg[1]);
+  *g = _mm_srli_epi16 (_mm_add_epi16 (t, two), 2);
+  t = _mm_packs_epi32 (sr[0], sr[1]);
+  *r = _mm_srli_epi16 (_mm_add_epi16 (t, two), 2);
+}
+
+/* Returns U in the low and V in the high 8 bytes */
+TARGET("sse2") static inline __m128i
+chroma8_sse2 (const guint8 *src0, const guint8 *src1)
+{
+  __m128i b, g, r, u, v;
+
+  average16_sse2 (src0, src1, &b, &g, &r);
+  u = _mm_add_epi16 (_mm_mullo_epi16 (r, _mm_set1_epi16 (-38)),
+                     _mm_mullo_epi16 (g, _mm_set1_epi16 (-74)));
+  u = _mm_add_epi16 (u, _mm_mullo_epi16 (b, _mm_set1_epi16 (112)));
+  u = _mm_srai_epi16 (_mm_add_epi16 (u, _mm_set1_epi16 (128)), 8);
+  u = _mm_add_epi16 (u, _mm_set1_epi16 (128));
+  v = _mm_add_epi16 (_mm_mullo_epi16 (r, _mm_set1_epi16 (112)),
+                     _mm_mullo_epi16 (g, _mm_set1_epi16 (-94)));
+  v = _mm_add_epi16 (v, _mm_mullo_epi16 (b, _mm_set1_epi16 (-18)));
+  v = _mm_srai_epi16 (_mm_add_epi16 (v, _mm_set1_epi16 (128)), 8);
+  v = _mm_add_epi16 (v, _mm_set1_epi16 (128));
+  return _mm_packus_epi16 (u, v);
+}
+
+TARGET("sse2") static void
+chroma_row_sse2 (const guint8 *src0, const guint8 *src1, guint8 *u,
+                 guint8 *v, gint width)
+{
+  __m128i uv;
+  gint i;
+
+  for (i = 0; i + 16 <= width; i += 16)
+  {
+    uv = chroma8_sse2 (src0 + 4 * i, src1 + 4 * i);
+    _mm_storel_epi64 ((__m128i *) (u + i / 2), uv);
+    _mm_storel_epi64 ((__m128i *) (v + i / 2), _mm_srli_si128 (uv, 8));
+  }
+  chroma_row_scalar (src0 + 4 * i, src1 + 4 * i, u + i / 2, v + i / 2,
+                     width - i);
+}
+
+TARGET("sse2") static void
+chroma_nv12_row_sse2 (const guint8 *src0, const guint8 *src1, guint8 *uv,
+                      gint width)
+{
+  __m128i c;
+  gint i;
+
+  for (i = 0; i + 16 <= width; i += 16)
+  {
+    c = chroma8_sse2 (src0 + 4 * i, src1 + 4 * i);
+    _mm_storeu_si128 ((__m128i *) (uv + i),
+                      _mm_unpacklo_epi8 (c, _mm_srli_si128 (c, 8)));
+  }
+  chroma_nv12_row_scalar (src0 + 4 * i, src1 + 4 * i, uv + i, width - i);
+}
+
+/* Rounded x / 255 for 16 bit lanes holding products of two bytes */
+TARGET("sse2") static inline __m128i
+div255_sse2 (__m128i t)
+{
+  t = _mm_add_epi16 (t, _mm_set1_epi16 (128));
+  return _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+}
+
+/* Each pixel's alpha in all four of its 16 bit lanes */
+TARGET("sse2") static inline __m128i
+alpha16_sse2 (__m128i p)
+{
+  return _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (p, 0xff), 0xff);
+}
+
+TARGET("sse2") static inline __m128i
+premultiply16_sse2 (__m128i p)
+{
+  const __m128i alpha_mask = _mm_set_epi16 (-1, 0, 0, 0, -1, 0, 0, 0);
+  __m128i m;
+
+  m = div255_sse2 (_mm_mullo_epi16 (p, alpha16_sse2 (p)));
+  /* keep alpha itself */
+  return _mm_or_si128 (_mm_and_si128 (alpha_mask, p),
+                       _mm_andnot_si128 (alpha_mask, m));
+}
+
+TARGET("sse2") static void
+premultiply_row_sse2 (guint8 *p, gint n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i x;
+  gint i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    x = _mm_loadu_si128 ((const __m128i *) (p + 4 * i));
+    x = _mm_packus_epi16 (premultiply16_sse2 (_mm_unpacklo_epi8 (x, zero)),
+                          premultiply16_sse2 (_mm_unpackhi_epi8 (x, zero)));
+    _mm_storeu_si128 ((__m128i *) (p + 4 * i), x);
+  }
+  premultiply_row_scalar (p + 4 * i, n - i);
+}
+
+/* One channel of four pixels, in 32 bit lanes, through the float form of
+ * the scalar division */
+TARGET("sse2") static inline __m128i
+unpremultiply_channel_sse2 (__m128i c, __m128i half, __m128 inv)
+{
+  __m128 n;
+
+  n = _mm_cvtepi32_ps (_mm_add_epi32 (_mm_mullo_epi16 (c, _mm_set1_epi32 (255)),
+                                      half));
+  return _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (n, _mm_set1_ps (0.5f)),
+                                       inv));
+}
+
+/* Opaque and fully transparent blocks, by far the most common, are
+ * skipped or cleared; the rest go through unpremultiply_inv */
+TARGET("sse2") static void
+unpremultiply_row_sse2 (guint8 *p, gint n)
+{
+  const __m128i alpha = _mm_set1_epi32 (0xff000000);
+  const __m128i mask = _mm_set1_epi32 (0xff);
+  __m128i x, a, b, g, r, t;
+  __m128 inv;
+  guint8 *q;
+  gint i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    x = _mm_loadu_si128 ((const __m128i *) (p + 4 * i));
+    a = _mm_and_si128 (x, alpha);
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (a, alpha)) == 0xffff)
+      continue;
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (a, _mm_setzero_si128 ())) == 0xffff)
+    {
+      _mm_storeu_si128 ((__m128i *) (p + 4 * i), _mm_setzero_si128 ());
+      continue;
+    }
+
+    q = p + 4 * i;
+    inv = _mm_set_ps (unpremultiply_inv[q[15]], unpremultiply_inv[q[11]],
+                      unpremultiply_inv[q[7]], unpremultiply_inv[q[3]]);
+    a = _mm_srli_epi32 (x, 24);
+    t = _mm_srli_epi32 (a, 1);
+    b = unpremultiply_channel_sse2 (_mm_and_si128 (x, mask), t, inv);
+    g = unpremultiply_channel_sse2 (_mm_and_si128 (_mm_srli_epi32 (x, 8), mask),
+                                    t, inv);
+    r = unpremultiply_channel_sse2 (_mm_and_si128 (_mm_srli_epi32 (x, 16),
+                                                   mask), t, inv);
+    /* saturate to bytes as [b0-3 r0-3 g0-3 a0-3], then interleave */
+    t = _mm_packus_epi16 (_mm_packs_epi32 (b, r), _mm_packs_epi32 (g, a));
+    t = _mm_unpacklo_epi8 (t, _mm_srli_si128 (t, 8));
+    t = _mm_unpacklo_epi16 (t, _mm_srli_si128 (t, 8));
+    _mm_storeu_si128 ((__m128i *) q, t);
+  }
+  unpremultiply_row_scalar (p + 4 * i, n - i);
+}
+
+TARGET("sse2") static void
+swizzle_row_sse2 (const guint8 *src, guint8 *dst, gint n, gboolean opaque)
+{
+  const __m128i ga = _mm_set1_epi32 (0xff00ff00);
+  const __m128i ch = _mm_set1_epi32 (0xff);
+  const __m128i fill = _mm_set1_epi32 (opaque ? 0xff000000 : 0);
+  __m128i x;
+  gint i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    x = _mm_loadu_si128 ((const __m128i *) (src + 4 * i));
+    x = _mm_or_si128 (_mm_and_si128 (x, ga),
+                      _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (x, 16), ch),
+                                    _mm_slli_epi32 (_mm_and_si128 (x, ch), 16)));
+    _mm_storeu_si128 ((__m128i *) (dst + 4 * i), _mm_or_si128 (x, fill));
+  }
+  swizzle_row_scalar (src + 4 * i, dst + 4 * i, n - i, opaque);
+}
+
+TARGET("sse2") static inline __m128i
+over16_sse2 (__m128i s, __m128i d)
+{
+  __m128i ia;
+
+  ia = _mm_sub_epi16 (_mm_set1_epi16 (255), alpha16_sse2 (s));
+  return div255_sse2 (_mm_mullo_epi16 (d, ia));
+}
+
+TARGET("sse2") static void
+over_row_sse2 (const guint8 *src, guint8 *dst, gint n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i s, d;
+  gint i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+  {
+    s = _mm_loadu_si128 ((const __m128i *) (src + 4 * i));
+    d = _mm_loadu_si128 ((const __m128i *) (dst + 4 * i));
+    d = _mm_packus_epi16 (over16_sse2 (_mm_unpacklo_epi8 (s, zero),
+                                       _mm_unpacklo_epi8 (d, zero)),
+                          over16_sse2 (_mm_unpackhi_epi8 (s, zero),
+                                       _mm_unpackhi_epi8 (d, zero)));
+    _mm_storeu_si128 ((__m128i *) (dst + 4 * i), _mm_adds_epu8 (s, d));
+  }
+  over_row_scalar (src + 4 * i, dst + 4 * i, n - i);
+}
+
+TARGET("sse2") static void
+box_sum_row_sse2 (const guint8 *src, gint stride, gint rows, guint16 *sum,
+                  gint n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i x, lo, hi;
+  gint i;
+  gint r;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    lo = hi = zero;
+    for (r = 0; r < rows; r++)
+    {
+      x = _mm_loadu_si128 ((const __m128i *) (src + r * stride + i));
+      lo = _mm_add_epi16 (lo, _mm_unpacklo_epi8 (x, zero));
+      hi = _mm_add_epi16 (hi, _mm_unpackhi_epi8 (x, zero));
+    }
+    _mm_storeu_si128 ((__m128i *) (sum + i), lo);
+    _mm_storeu_si128 ((__m128i *) (sum + i + 8), hi);
+  }
+  box_sum_row_scalar (src + i, stride, rows, sum + i, n - i);
+}
+
+static const PixelKernels sse2_kernels = {
+  luma_row_sse2,
+  chroma_row_sse2,
+  chroma_nv12_row_sse2,
+  premultiply_row_sse2,
+  unpremultiply_row_sse2,
+  swizzle_row_sse2,
+  over_row_sse2,
+  box_sum_row_sse2
+};
+
+/* --- AVX2: 32 pixels per iteration --- */
+
+/* The 256 bit pack instructions work per 128 bit lane; this puts the four
+ * 64 bit quarters back in order after packing two sequential vectors */
+#define AVX2_UNINTERLEAVE(x) _mm256_permute4x64_epi64 ((x), 0xd8)
+
+/* Splits 16 BGRA pixels into sequential 16 bit B, G and R vectors */
+TARGET("avx2") static inline void
+split_avx2 (const guint8 *src, __m256i *b, __m256i *g, __m256i *r)
+{
+  const __m256i mask = _mm256_set1_epi32 (0xff);
+  __m256i p0, p1;
+
+  p0 = _mm256_loadu_si256 ((const __m256i *) src);
+  p1 = _mm256_loadu_si256 ((const __m256i *) (src + 32));
+  *b = _mm256_packs_epi32 (_mm256_and_si256 (p0, mask),
+                           _mm256_and_si256 (p1, mask));
+  *g = _mm256_packs_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (p0, 8), mask),
+                           _mm256_and_si256 (_mm256_srli_epi32 (p1, 8), mask));
+  *r = _mm256_packs_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (p0, 16), mask),
+                           _mm256_and_si256 (_mm256_srli_epi32 (p1, 16), mask));
+  *b = AVX2_UNINTERLEAVE (*b);
+  *g = AVX2_UNINTERLEAVE (*g);
+  *r = AVX2_UNINTERLEAVE (*r);
+}
+
+TARGET("avx2") static inline __m256i
+luma16_avx2 (const guint8 *src)
+{
+  __m256i b, g, r, y;
+
+  split_avx2 (src, &b, &g, &r);
+  y = _mm256_add_epi16 (_mm256_mullo_epi16 (r, _mm256_set1_epi16 (66)),
+                        _mm256_mullo_epi16 (g, _mm256_set1_epi16 (129)));
+  y = _mm256_add_epi16 (y, _mm256_mullo_epi16 (b, _mm256_set1_epi16 (25)));
+  y = _mm256_srli_epi16 (_mm256_add_epi16 (y, _mm256_set1_epi16 (128)), 8);
+  return _mm256_add_epi16 (y, _mm256_set1_epi16 (16));
+}
+
+TARGET("avx2") static void
+luma_row_avx2 (const guint8 *src, guint8 *y, gint width)
+{
+  __m256i l;
+  gint i;
+
+  for (i = 0; i + 32 <= width; i += 32)
+  {
+    l = _mm256_packus_epi16 (luma16_avx2 (src + 4 * i),
+                             luma16_avx2 (src + 4 * i + 64));
+    _mm256_storeu_si256 ((__m256i *) (y + i), AVX2_UNINTERLEAVE (l));
+  }
+  luma_row_sse2 (src + 4 * i, y + i, width - i);
+}
+
+TARGET("avx2") static inline void
+average32_avx2 (const guint8 *src0, const guint8 *src1,
+                __m256i *b, __m256i *g, __m256i *r)
+{
+  const __m256i ones = _mm256_set1_epi16 (1);
+  const __m256i two = _mm256_set1_epi16 (2);
+  __m256i b0, g0, r0, b1, g1, r1, t;
+  __m256i sb[2], sg[2], sr[2];
+  gint half;
+
+  for (half = 0; half < 2; half++)
+  {
+    split_avx2 (src0 + 64 * half, &b0, &g0, &r0);
+    split_avx2 (src1 + 64 * half, &b1, &g1, &r1);
+    sb[half] = _mm256_madd_epi16 (_mm256_add_epi16 (b0, b1), ones);
+    sg[half] = _mm256_madd_epi16 (_mm256_add_epi16 (g0, g1), ones);
+    sr[half] = _mm256_madd_epi16 (_mm256_add_epi16 (r0, r1), ones);
+  }
+  t = AVX2_UNINTERLEAVE (_mm256_packs_epi32 (sb[0], sb[1]));
+  *b = _mm256_srli_epi16 (_mm256_add_epi16 (t, two), 2);
+  t = AVX2_UNINTERLEAVE (_mm256_packs_epi32 (sg[0], sg[1]));
+  *g = _mm256_srli_epi16 (_mm256_add_epi16 (t, two), 2);
+  t = AVX2_UNINTERLEAVE (_mm256_packs_epi32 (sr[0], sr[1]));
+  *r = _mm256_srli_epi16 (_mm256_add_epi16 (t, two), 2);
+}
+
+/* Returns 16 U samples in the low and 16 V samples in the high lane */
+TARGET("avx2") static inline __m256i
+chroma16_avx2 (const guint8 *src0, const guint8 *src1)
+{
+  __m256i b, g, r, u, v;
+
+  average32_avx2 (src0, src1, &b, &g, &r);
+  u = _mm256_add_epi16 (_mm256_mullo_epi16 (r, _mm256_set1_epi16 (-38)),
+                        _mm256_mullo_epi16 (g, _mm256_set1_epi16 (-74)));
+  u = _mm256_add_epi16 (u, _mm256_mullo_epi16 (b, _mm256_set1_epi16 (112)));
+  u = _mm256_srai_epi16 (_mm256_add_epi16 (u, _mm256_set1_epi16 (128)), 8);
+  u = _mm256_add_epi16 (u, _mm256_set1_epi16 (128));
+  v = _mm256_add_epi16 (_mm256_mullo_epi16 (r, _mm256_set1_epi16 (112)),
+                        _mm256_mullo_epi16 (g, _mm256_set1_epi16 (-94)));
+  v = _mm256_add_epi16 (v, _mm256_mullo_epi16 (b, _mm256_set1_epi16 (-18)));
+  v = _mm256_srai_epi16 (_mm256_add_epi16 (v, _mm256_set1_epi16 (128)), 8);
+  v = _mm256_add_epi16 (v, _mm256_set1_epi16 (128));
+  return AVX2_UNINTERLEAVE (_mm256_packus_epi16 (u, v));
+}
+
+TARGET("avx2") static void
+chroma_row_avx2 (const guint8 *src0, const guint8 *src1, guint8 *u,
+                 guint8 *v, gint width)
+{
+  __m256i uv;
+  gint i;
+
+  for (i = 0; i + 32 <= width; i += 32)
+  {
+    uv = chroma16_avx2 (src0 + 4 * i, src1 + 4 * i);
+    _mm_storeu_si128 ((__m128i *) (u + i / 2), _mm256_castsi256_si128 (uv));
+    _mm_storeu_si128 ((__m128i *) (v + i / 2),
+                      _mm256_extracti128_si256 (uv, 1));
+  }
+  chroma_row_sse2 (src0 + 4 * i, src1 + 4 * i, u + i / 2, v + i / 2,
+                   width - i);
+}
+
+TARGET("avx2") static void
+chroma_nv12_row_avx2 (const guint8 *src0, const guint8 *src1, guint8 *uv,
+                      gint width)
+{
+  __m256i c;
+  __m128i u, v;
+  gint i;
+
+  for (i = 0; i + 32 <= width; i += 32)
+  {
+    c = chroma16_avx2 (src0 + 4 * i, src1 + 4 * i);
+    u = _mm256_castsi256_si128 (c);
+    v = _mm256_extracti128_si256 (c, 1);
+    _mm_storeu_si128 ((__m128i *) (uv + i), _mm_unpacklo_epi8 (u, v));
+    _mm_storeu_si128 ((__m128i *) (uv + i + 16), _mm_unpackhi_epi8 (u, v));
+  }
+  chroma_nv12_row_sse2 (src0 + 4 * i, src1 + 4 * i, uv + i, width - i);
+}
+
+TARGET("avx2") static inline __m256i
+div255_avx2 (__m256i t)
+{
+  t = _mm256_add_epi16 (t, _mm256_set1_epi16 (128));
+  return _mm256_srli_epi16 (_mm256_add_epi16 (t, _mm256_srli_epi16 (t, 8)), 8);
+}
+
+TARGET("avx2") static inline __m256i
+alpha16_avx2 (__m256i p)
+{
+  return _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (p, 0xff), 0xff);
+}
+
+TARGET("avx2") static inline __m256i
+premultiply16_avx2 (__m256i p)
+{
+  const __m256i alpha_mask = _mm256_set1_epi64x (0xffff000000000000LL);
+  __m256i m;
+
+  m = div255_avx2 (_mm256_mullo_epi16 (p, alpha16_avx2 (p)));
+  return _mm256_blendv_epi8 (m, p, alpha_mask);
+}
+
+/* unpack and pack both work within 128 bit lanes, so the pixel order
+ * survives the round trip without any permutes */
+TARGET("avx2") static void
+premultiply_row_avx2 (guint8 *p, gint n)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  __m256i x;
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    x = _mm256_loadu_si256 ((const __m256i *) (p + 4 * i));
+    x = _mm256_packus_epi16 (premultiply16_avx2 (_mm256_unpacklo_epi8 (x, zero)),
+                             premultiply16_avx2 (_mm256_unpackhi_epi8 (x, zero)));
+    _mm256_storeu_si256 ((__m256i *) (p + 4 * i), x);
+  }
+  premultiply_row_sse2 (p + 4 * i, n - i);
+}
+
+TARGET("avx2") static inline __m256i
+unpremultiply_channel_avx2 (__m256i c, __m256i half, __m256 inv)
+{
+  __m256 n;
+
+  n = _mm256_cvtepi32_ps (
+        _mm256_add_epi32 (_mm256_mullo_epi32 (c, _mm256_set1_epi32 (255)),
+                          half));
+  n = _mm256_add_ps (n, _mm256_set1_ps (0.5f));
+  return _mm256_cvttps_epi32 (_mm256_mul_ps (n, inv));
+}
+
+/* As the SSE2 version, with the reciprocals gathered; the packs and
+ * shuffles all stay within 128 bit lanes */
+TARGET("avx2") static void
+unpremultiply_row_avx2 (guint8 *p, gint n)
+{
+  const __m256i alpha = _mm256_set1_epi32 (0xff000000);
+  const __m256i mask = _mm256_set1_epi32 (0xff);
+  __m256i x, a, b, g, r, t;
+  __m256 inv;
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    x = _mm256_loadu_si256 ((const __m256i *) (p + 4 * i));
+    a = _mm256_and_si256 (x, alpha);
+    if (_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (a, alpha)) == -1)
+      continue;
+    if (_mm256_testz_si256 (a, a))
+    {
+      _mm256_storeu_si256 ((__m256i *) (p + 4 * i), _mm256_setzero_si256 ());
+      continue;
+    }
+
+    a = _mm256_srli_epi32 (x, 24);
+    inv = _mm256_i32gather_ps (unpremultiply_inv, a, 4);
+    t = _mm256_srli_epi32 (a, 1);
+    b = unpremultiply_channel_avx2 (_mm256_and_si256 (x, mask), t, inv);
+    g = unpremultiply_channel_avx2 (_mm256_and_si256 (_mm256_srli_epi32 (x, 8),
+                                                      mask), t, inv);
+    r = unpremultiply_channel_avx2 (_mm256_and_si256 (_mm256_srli_epi32 (x, 16),
+                                                      mask), t, inv);
+    t = _mm256_packus_epi16 (_mm256_packs_epi32 (b, r),
+                             _mm256_packs_epi32 (g, a));
+    t = _mm256_unpacklo_epi8 (t, _mm256_srli_si256 (t, 8));
+    t = _mm256_unpacklo_epi16 (t, _mm256_srli_si256 (t, 8));
+    _mm256_storeu_si256 ((__m256i *) (p + 4 * i), t);
+  }
+  unpremultiply_row_sse2 (p + 4 * i, n - i);
+}
+
+TARGET("avx2") static void
+swizzle_row_avx2 (const guint8 *src, guint8 *dst, gint n, gboolean opaque)
+{
+  const __m256i order = _mm256_setr_epi8 (2, 1, 0, 3, 6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15,
+                                          2, 1, 0, 3, 6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15);
+  const __m256i fill = _mm256_set1_epi32 (opaque ? 0xff000000 : 0);
+  __m256i x;
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    x = _mm256_loadu_si256 ((const __m256i *) (src + 4 * i));
+    x = _mm256_or_si256 (_mm256_shuffle_epi8 (x, order), fill);
+    _mm256_storeu_si256 ((__m256i *) (dst + 4 * i), x);
+  }
+  swizzle_row_sse2 (src + 4 * i, dst + 4 * i, n - i, opaque);
+}
+
+TARGET("avx2") static inline __m256i
+over16_avx2 (__m256i s, __m256i d)
+{
+  __m256i ia;
+
+  ia = _mm256_sub_epi16 (_mm256_set1_epi16 (255), alpha16_avx2 (s));
+  return div255_avx2 (_mm256_mullo_epi16 (d, ia));
+}
+
+TARGET("avx2") static void
+over_row_avx2 (const guint8 *src, guint8 *dst, gint n)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  __m256i s, d;
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+  {
+    s = _mm256_loadu_si256 ((const __m256i *) (src + 4 * i));
+    d = _mm256_loadu_si256 ((const __m256i *) (dst + 4 * i));
+    d = _mm256_packus_epi16 (over16_avx2 (_mm256_unpacklo_epi8 (s, zero),
+                                          _mm256_unpacklo_epi8 (d, zero)),
+                             over16_avx2 (_mm256_unpackhi_epi8 (s, zero),
+                                          _mm256_unpackhi_epi8 (d, zero)));
+    _mm256_storeu_si256 ((__m256i *) (dst + 4 * i), _mm256_adds_epu8 (s, d));
+  }
+  over_row_sse2 (src + 4 * i, dst + 4 * i, n - i);
+}
+
+/* Widening 16 bytes at a time keeps the sums in pixel order, which the
+ * in-lane unpacks wouldn't */
+TARGET("avx2") static void
+box_sum_row_avx2 (const guint8 *src, gint stride, gint rows, guint16 *sum,
+                  gint n)
+{
+  __m256i lo, hi;
+  const guint8 *p;
+  gint i;
+  gint r;
+
+  for (i = 0; i + 32 <= n; i += 32)
+  {
+    lo = hi = _mm256_setzero_si256 ();
+    for (r = 0; r < rows; r++)
+    {
+      p = src + r * stride + i;
+      lo = _mm256_add_epi16 (lo, _mm256_cvtepu8_epi16 (
+                                   _mm_loadu_si128 ((const __m128i *) p)));
+      hi = _mm256_add_epi16 (hi, _mm256_cvtepu8_epi16 (
+                                   _mm_loadu_si128 ((const __m128i *) (p + 16))));
+    }
+    _mm256_storeu_si256 ((__m256i *) (sum + i), lo);
+    _mm256_storeu_si256 ((__m256i *) (sum + i + 16), hi);
+  }
+  box_sum_row_sse2 (src + i, stride, rows, sum + i, n - i);
+}
+
+static const PixelKernels avx2_kernels = {
+  luma_row_avx2,
+  chroma_row_avx2,
+  chroma_nv12_row_avx2,
+  premultiply_row_avx2,
+  unpremultiply_row_avx2,
+  swizzle_row_avx2,
+  over_row_avx2,
+  box_sum_row_avx2
+};
+
+#endif /* FLASH_PIXEL_X86 */
+
+#ifdef FLASH_PIXEL_NEON_BUILT
+
+/* --- NEON: 16 pixels per iteration, channels deinterleaved on load --- */
+
+static inline uint8x16_t
+mul_div255_neon (uint8x16_t x, uint8x16_t y)
+{
+  uint16x8_t lo, hi;
+
+  lo = vaddq_u16 (vmull_u8 (vget_low_u8 (x), vget_low_u8 (y)),
+                  vdupq_n_u16 (128));
+  hi = vaddq_u16 (vmull_u8 (vget_high_u8 (x), vget_high_u8 (y)),
+                  vdupq_n_u16 (128));
+  return vcombine_u8 (vshrn_n_u16 (vaddq_u16 (lo, vshrq_n_u16 (lo, 8)), 8),
+                      vshrn_n_u16 (vaddq_u16 (hi, vshrq_n_u16 (hi, 8)), 8));
+}
+
+static void
+premultiply_row_neon (guint8 *p, gint n)
+{
+  uint8x16x4_t x;
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    x = vld4q_u8 (p + 4 * i);
+    x.val[0] = mul_div255_neon (x.val[0], x.val[3]);
+    x.val[1] = mul_div255_neon (x.val[1], x.val[3]);
+    x.val[2] = mul_div255_neon (x.val[2], x.val[3]);
+    vst4q_u8 (p + 4 * i, x);
+  }
+  premultiply_row_scalar (p + 4 * i, n - i);
+}
+
+/* TRUE if all 16 bytes of x are equal to v */
+static inline gboolean
+all_equal_neon (uint8x16_t x, guint8 v)
+{
+  uint64x2_t m;
+
+  m = vreinterpretq_u64_u8 (vceqq_u8 (x, vdupq_n_u8 (v)));
+  return (vgetq_lane_u64 (m, 0) & vgetq_lane_u64 (m, 1)) == ~(guint64) 0;
+}
+
+static void
+unpremultiply_row_neon (guint8 *p, gint n)
+{
+  uint8x16x4_t x;
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    x = vld4q_u8 (p + 4 * i);
+    if (all_equal_neon (x.val[3], 255))
+      continue;
+    if (all_equal_neon (x.val[3], 0))
+    {
+      memset (p + 4 * i, 0, 64);
+      continue;
+    }
+    unpremultiply_row_scalar (p + 4 * i, 16);
+  }
+  unpremultiply_row_scalar (p + 4 * i, n - i);
+}
+
+static void
+swizzle_row_neon (const guint8 *src, guint8 *dst, gint n, gboolean opaque)
+{
+  uint8x16x4_t x;
+  uint8x16_t t;
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    x = vld4q_u8 (src + 4 * i);
+    t = x.val[0];
+    x.val[0] = x.val[2];
+    x.val[2] = t;
+    if (opaque)
+      x.val[3] = vdupq_n_u8 (0xff);
+    vst4q_u8 (dst + 4 * i, x);
+  }
+  swizzle_row_scalar (src + 4 * i, dst + 4 * i, n - i, opaque);
+}
+
+static void
+over_row_neon (const guint8 *src, guint8 *dst, gint n)
+{
+  uint8x16x4_t s, d;
+  uint8x16_t ia;
+  gint i;
+  gint c;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    s = vld4q_u8 (src + 4 * i);
+    d = vld4q_u8 (dst + 4 * i);
+    ia = vmvnq_u8 (s.val[3]);
+    for (c = 0; c < 4; c++)
+      d.val[c] = vqaddq_u8 (s.val[c], mul_div255_neon (d.val[c], ia));
+    vst4q_u8 (dst + 4 * i, d);
+  }
+  over_row_scalar (src + 4 * i, dst + 4 * i, n - i);
+}
+
+static void
+box_sum_row_neon (const guint8 *src, gint stride, gint rows, guint16 *sum,
+                  gint n)
+{
+  uint16x8_t lo, hi;
+  uint8x16_t x;
+  gint i;
+  gint r;
+
+  for (i = 0; i + 16 <= n; i += 16)
+  {
+    lo = hi = vdupq_n_u16 (0);
+    for (r = 0; r < rows; r++)
+    {
+      x = vld1q_u8 (src + r * stride + i);
+      lo = vaddw_u8 (lo, vget_low_u8 (x));
+      hi = vaddw_u8 (hi, vget_high_u8 (x));
+    }
+    vst1q_u16 (sum + i, lo);
+    vst1q_u16 (sum + i + 8, hi);
+  }
+  box_sum_row_scalar (src + i, stride, rows, sum + i, n - i);
+}
+
+/* The YUV conversion has no NEON version yet */
+static const PixelKernels neon_kernels = {
+  luma_row_scalar,
+  chroma_row_scalar,
+  chroma_nv12_row_scalar,
+  premultiply_row_neon,
+  unpremultiply_row_neon,
+  swizzle_row_neon,
+  over_row_neon,
+  box_sum_row_neon
+};
+
+#endif /* FLASH_PIXEL_NEON_BUILT */
+
+static const PixelKernels *
+flash_pixel_kernels_for (FlashPixelKernel k)
+{
+#ifdef FLASH_PIXEL_X86
+  if (k == FLASH_PIXEL_AVX2)
+    return &avx2_kernels;
+  if (k == FLASH_PIXEL_SSE2)
+    return &sse2_kernels;
+#endif
+#ifdef FLASH_PIXEL_NEON_BUILT
+  if (k == FLASH_PIXEL_NEON)
+    return &neon_kernels;
+#endif
+  return &scalar_kernels;
+}
+
+static void
+flash_pixel_init (void)
+{
+  const gchar *forced;
+  FlashPixelKernel k;
+
+  if (kernels)
+    return;
+
+  for (k = 1; k < 256; k++)
+  {
+    unpremultiply_recip[k] = ((1 << 24) + k - 1) / k;
+    unpremultiply_inv[k] = 1.0f / k;
+  }
+
+  kernel = FLASH_PIXEL_SCALAR;
+  if (flash_pixel_kernel_supported (FLASH_PIXEL_AVX2))
+    kernel = FLASH_PIXEL_AVX2;
+  else if (flash_pixel_kernel_supported (FLASH_PIXEL_SSE2))
+    kernel = FLASH_PIXEL_SSE2;
+  else if (flash_pixel_kernel_supported (FLASH_PIXEL_NEON))
+    kernel = FLASH_PIXEL_NEON;
+
+  forced = g_getenv ("FLASH_PIXEL_KERNEL");
+  if (forced)
+  {
+    for (k = FLASH_PIXEL_SCALAR; k <= FLASH_PIXEL_LAST; k++)
+    {
+      if (strcmp (forced, flash_pixel_kernel_name (k)) == 0 &&
+          flash_pixel_kernel_supported (k))
+        kernel = k;
+    }
+  }
+  kernels = flash_pixel_kernels_for (kernel);
+  DEBUG ("pixel kernels: %s", flash_pixel_kernel_name (kernel));
+}
+
+FlashPixelKernel
+flash_pixel_get_kernel (void)
+{
+  flash_pixel_init ();
+  return kernel;
+}
+
+const gchar *
+flash_pixel_kernel_name (FlashPixelKernel k)
+{
+  switch (k)
+  {
+    case FLASH_PIXEL_SSE2:
+      return "sse2";
+    case FLASH_PIXEL_AVX2:
+      return "avx2";
+    case FLASH_PIXEL_NEON:
+      return "neon";
+    default:
+      return "scalar";
+  }
+}
+
+gboolean
+flash_pixel_kernel_supported (FlashPixelKernel k)
+{
+  switch (k)
+  {
+    case FLASH_PIXEL_SCALAR:
+      return TRUE;
+#ifdef FLASH_PIXEL_X86
+    case FLASH_PIXEL_SSE2:
+      return __builtin_cpu_supports ("sse2");
+    case FLASH_PIXEL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+#ifdef FLASH_PIXEL_NEON_BUILT
+    case FLASH_PIXEL_NEON:
+      return TRUE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+void
+flash_pixel_set_kernel (FlashPixelKernel k)
+{
+  g_return_if_fail (flash_pixel_kernel_supported (k));
+
+  flash_pixel_init ();
+  kernel = k;
+  kernels = flash_pixel_kernels_for (k);
+}
+
+void
+flash_pixel_bgra_to_i420 (const guint8 *src, gint src_stride,
+                          gint width, gint height,
+                          guint8 *y, gint y_stride,
+                          guint8 *u, gint u_stride,
+                          guint8 *v, gint v_stride)
+{
+  gint row;
+
+  g_return_if_fail (width % 2 == 0 && height % 2 == 0);
+
+  flash_pixel_init ();
+  for (row = 0; row < height; row += 2)
+  {
+    kernels->luma_row (src, y, width);
+    kernels->luma_row (src + src_stride, y + y_stride, width);
+    kernels->chroma_row (src, src + src_stride, u, v, width);
+    src += 2 * src_stride;
+    y += 2 * y_stride;
+    u += u_stride;
+    v += v_stride;
+  }
+}
+
+void
+flash_pixel_bgra_to_nv12 (const guint8 *src, gint src_stride,
+                          gint width, gint height,
+                          guint8 *y, gint y_stride,
+                          guint8 *uv, gint uv_stride)
+{
+  gint row;
+
+  g_return_if_fail (width % 2 == 0 && height % 2 == 0);
+
+  flash_pixel_init ();
+  for (row = 0; row < height; row += 2)
+  {
+    kernels->luma_row (src, y, width);
+    kernels->luma_row (src + src_stride, y + y_stride, width);
+    kernels->chroma_nv12_row (src, src + src_stride, uv, width);
+    src += 2 * src_stride;
+    y += 2 * y_stride;
+    uv += uv_stride;
+  }
+}
+
+void
+flash_pixel_premultiply (guint8 *pixels, gint n)
+{
+  flash_pixel_init ();
+  kernels->premultiply_row (pixels, n);
+}
+
+void
+flash_pixel_unpremultiply (guint8 *pixels, gint n)
+{
+  flash_pixel_init ();
+  kernels->unpremultiply_row (pixels, n);
+}
+
+void
+flash_pixel_swizzle (const guint8 *src, guint8 *dst, gint n,
+                     gboolean opaque)
+{
+  flash_pixel_init ();
+  kernels->swizzle_row (src, dst, n, opaque);
+}
+
+void
+flash_pixel_over (const guint8 *src, guint8 *dst, gint n)
+{
+  flash_pixel_init ();
+  kernels->over_row (src, dst, n);
+}
+
+void
+flash_pixel_downscale_box (const guint8 *src, gint src_stride,
+                           gint width, gint height, gint factor,
+                           guint8 *dst, gint dst_stride)
+{
+  const guint16 *s;
+  guint16 *sum;
+  guint8 *d;
+  gint t[4];
+  gint dst_width;
+  gint dst_height;
+  gint area;
+  gint shift;
+  gint x, y, c, i;
+
+  g_return_if_fail (factor >= 1 && factor <= 256);
+
+  flash_pixel_init ();
+  dst_width = width / factor;
+  dst_height = height / factor;
+  area = factor * factor;
+  /* Power of two factors (the usual case) divide with a shift */
+  for (shift = 0; (1 << shift) < area; shift++)
+    ;
+  if ((1 << shift) != area)
+    shift = -1;
+  sum = g_new (guint16, dst_width * factor * 4);
+  for (y = 0; y < dst_height; y++)
+  {
+    kernels->box_sum_row (src + y * factor * src_stride, src_stride, factor,
+                          sum, dst_width * factor * 4);
+    /* The horizontal half only sees 1 / factor of the data */
+    s = sum;
+    d = dst + y * dst_stride;
+    for (x = 0; x < dst_width; x++, d += 4)
+    {
+      t[0] = t[1] = t[2] = t[3] = area / 2;
+      for (i = 0; i < factor; i++, s += 4)
+      {
+        t[0] += s[0];
+        t[1] += s[1];
+        t[2] += s[2];
+        t[3] += s[3];
+      }
+      for (c = 0; c < 4; c++)
+        d[c] = shift != -1 ? t[c] >> shift : t[c] / area;
+    }
+  }
+  g_free (sum);
+}
+
+/* An odd width exercises the scalar tails of the vector kernels */
+#define TEST_WIDTH  (2 * 157)
+#define TEST_HEIGHT 18
+
+gboolean
+flash_pixel_self_test (void)
+{
+  guint8 *src;
+  guint8 *ref;
+  guint8 *out;
+  gsize plane;
+  guint32 seed;
+  FlashPixelKernel saved;
+  FlashPixelKernel k;
+  gboolean ok;
+  gint pass;
+  gint i;
+  static const gchar *passes[] = {
+    "I420", "NV12", "premultiply", "unpremultiply", "swizzle",
+    "opaque swizzle", "over", "box downscale"
+  };
+
+  plane = TEST_WIDTH * TEST_HEIGHT;
+  src = g_malloc (plane * 4);
+  ref = g_malloc (plane * 4);
+  out = g_malloc (plane * 4);
+
+  /* Noise, plus the extremes the fixed point math has to survive */
+  seed = 1;
+  for (i = 0; i < (gint) plane * 4; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    src[i] = seed >> 16;
+  }
+  memset (src, 0xff, TEST_WIDTH * 4);
+  memset (src + TEST_WIDTH * 4, 0, TEST_WIDTH * 4);
+  /* and runs of opaque and transparent pixels for unpremultiply */
+  for (i = 2 * TEST_WIDTH; i < 4 * TEST_WIDTH; i++)
+    src[4 * i + 3] = i < 3 * TEST_WIDTH ? 0xff : 0;
+
+  flash_pixel_init ();
+  saved = kernel;
+  ok = TRUE;
+  for (pass = 0; pass < (gint) G_N_ELEMENTS (passes); pass++)
+  {
+    for (k = FLASH_PIXEL_SCALAR; k <= FLASH_PIXEL_LAST; k++)
+    {
+      if (!flash_pixel_kernel_supported (k))
+        continue;
+      flash_pixel_set_kernel (k);
+      switch (pass)
+      {
+        case 0:
+          flash_pixel_bgra_to_i420 (src, TEST_WIDTH * 4, TEST_WIDTH,
+                                    TEST_HEIGHT, out, TEST_WIDTH,
+                                    out + plane, TEST_WIDTH / 2,
+                                    out + plane * 5 / 4, TEST_WIDTH / 2);
+          break;
+        case 1:
+          flash_pixel_bgra_to_nv12 (src, TEST_WIDTH * 4, TEST_WIDTH,
+                                    TEST_HEIGHT, out, TEST_WIDTH,
+                                    out + plane, TEST_WIDTH);
+          break;
+        case 2:
+          memcpy (out, src, plane * 4);
+          flash_pixel_premultiply (out, plane);
+          break;
+        case 3:
+          /* only valid premultiplied data can be unpremultiplied */
+          memcpy (out, src, plane * 4);
+          scalar_kernels.premultiply_row (out, plane);
+          flash_pixel_unpremultiply (out, plane);
+          break;
+        case 4:
+        case 5:
+          flash_pixel_swizzle (src, out, plane, pass == 5);
+          break;
+        case 6:
+          /* the test image over its mirror image */
+          for (i = 0; i < (gint) plane * 4; i++)
+            out[i] = src[plane * 4 - 1 - i];
+          flash_pixel_over (src, out, plane);
+          break;
+        case 7:
+          memset (out, 0, plane * 4);
+          flash_pixel_downscale_box (src, TEST_WIDTH * 4, TEST_WIDTH,
+                                     TEST_HEIGHT, 3, out, TEST_WIDTH * 4);
+          break;
+      }
+      if (k == FLASH_PIXEL_SCALAR)
+        memcpy (ref, out, plane * 4);
+      else if (memcmp (ref, out, pass < 2 ? plane * 3 / 2 : plane * 4) != 0)
+      {
+        g_warning ("%s %s output differs from scalar",
+                   flash_pixel_kernel_name (k), passes[pass]);
+        ok = FALSE;
+      }
+    }
+  }
+  flash_pixel_set_kernel (saved);
+
+  g_free (src);
+  g_free (ref);
+  g_free (out);
+  return ok;
+}
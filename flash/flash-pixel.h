@@ -0,0 +1,72 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_PIXEL_H__
+#define __FLASH_PIXEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Pixel conversion kernels. Every kernel has a plain C version; where the
+ * CPU supports it an SSE2, AVX2 or NEON version is used instead, which must
+ * give bit for bit the same output. The FLASH_PIXEL_KERNEL environment
+ * variable ("scalar", "sse2", "avx2" or "neon") overrides the choice.
+ *
+ * BGRA is 32 bits per pixel, blue first in memory (what a 24/32 bit X
+ * server hands out on little endian machines). YUV output is BT.601
+ * limited range, with chroma averaged over each 2x2 block; width and
+ * height must be even. */
+
+typedef enum
+{
+  FLASH_PIXEL_SCALAR,
+  FLASH_PIXEL_SSE2,
+  FLASH_PIXEL_AVX2,
+  FLASH_PIXEL_NEON,
+  FLASH_PIXEL_LAST = FLASH_PIXEL_NEON
+} FlashPixelKernel;
+
+FlashPixelKernel flash_pixel_get_kernel     (void);
+const gchar     *flash_pixel_kernel_name    (FlashPixelKernel kernel);
+gboolean         flash_pixel_kernel_supported (FlashPixelKernel kernel);
+void             flash_pixel_set_kernel     (FlashPixelKernel kernel);
+
+void flash_pixel_bgra_to_i420 (const guint8 *src, gint src_stride,
+                               gint width, gint height,
+                               guint8 *y, gint y_stride,
+                               guint8 *u, gint u_stride,
+                               guint8 *v, gint v_stride);
+void flash_pixel_bgra_to_nv12 (const guint8 *src, gint src_stride,
+                               gint width, gint height,
+                               guint8 *y, gint y_stride,
+                               guint8 *uv, gint uv_stride);
+
+/* Compositing kernels, on rows of n 32 bit pixels with alpha in the last
+ * byte; they work the same on BGRA and RGBA. "over" expects premultiplied
+ * pixels and composites src onto dst. swizzle swaps BGRA and RGBA (src and
+ * dst may be the same), and with opaque set fills in alpha as 0xff, for
+ * X images whose fourth byte is undefined. */
+void flash_pixel_premultiply   (guint8 *pixels, gint n);
+void flash_pixel_unpremultiply (guint8 *pixels, gint n);
+void flash_pixel_swizzle       (const guint8 *src, guint8 *dst, gint n,
+                                gboolean opaque);
+void flash_pixel_over          (const guint8 *src, guint8 *dst, gint n);
+
+/* Box filters a 32 bit image down to (width / factor) x (height / factor),
+ * each output pixel the rounded average of a factor x factor block.
+ * factor is 1 to 256; leftover columns and rows are dropped. */
+void flash_pixel_downscale_box (const guint8 *src, gint src_stride,
+                                gint width, gint height, gint factor,
+                                guint8 *dst, gint dst_stride);
+
+/* Converts a test pattern with every supported kernel and compares it to
+ * the scalar output */
+gboolean flash_pixel_self_test (void);
+
+G_END_DECLS
+
+#endif
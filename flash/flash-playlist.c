@@ -0,0 +1,498 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "flash-common.h"
+#include "flash-file.h"
+#include "flash-playlist.h"
+#include "flash-prepare.h"
+
+/* What the background check found out about an item */
+enum {
+  ITEM_UNCHECKED,
+  ITEM_VALID,
+  ITEM_INVALID
+};
+
+struct _FlashPlaylist {
+  GObject parent;
+
+  FlashLibrary *library;
+  GtkWindow *window;
+  GPtrArray *paths;
+  FlashFileIoPolicy io_policy;
+
+  /* Every item is checked in the background when playback starts, so
+   * broken ones are skipped without stalling the list */
+  GByteArray *checked;
+  FlashPrepare *check;
+
+  gint position;
+  FlashFile *current;
+
+  /* Look-ahead: the item after the current one, paused in a hidden
+   * staging window until it's its turn */
+  FlashFile *next;
+  gint next_position;
+  GtkWidget *staging;
+  guint prepare_id;
+
+  FlashPlaylistEventCallback callback;
+  gpointer callback_data;
+};
+
+struct _FlashPlaylistClass {
+  GObjectClass parent;
+};
+
+static void     flash_playlist_class_init    (FlashPlaylistClass *);
+static void     flash_playlist_init          (FlashPlaylist *);
+static void     flash_playlist_finalize      (GObject *);
+static gboolean flash_playlist_advance       (FlashPlaylist *playlist);
+static gboolean flash_playlist_swap_next     (FlashPlaylist *playlist,
+                                              gint position);
+static gboolean flash_playlist_start         (FlashPlaylist *playlist,
+                                              gint position,
+                                              GError **error);
+static gboolean flash_playlist_prepare       (gpointer data);
+static void     flash_playlist_discard_next  (FlashPlaylist *playlist);
+static gint     flash_playlist_skip_invalid  (FlashPlaylist *playlist,
+                                              gint position,
+                                              gboolean report);
+static void     flash_playlist_check_item    (FlashPrepare *prepare,
+                                              gint index,
+                                              const FlashPrepareResult *result,
+                                              gpointer data);
+static void     flash_playlist_check_done    (FlashPrepare *prepare,
+                                              gpointer data);
+static void     flash_playlist_emit          (FlashPlaylist *playlist,
+                                              FlashPlaylistEvent event,
+                                              gint position);
+static void     flash_playlist_file_event    (FlashFile *file,
+                                              FlashFileEvent event,
+                                              gpointer data);
+
+GType
+flash_playlist_get_type (void)
+{
+  static GType type = 0;
+
+  if (!type) {
+    static const GTypeInfo info = {
+      sizeof (FlashPlaylistClass),
+      NULL,
+      NULL,
+      (GClassInitFunc) flash_playlist_class_init,
+      NULL,
+      NULL,
+      sizeof (FlashPlaylist),
+      0,
+      (GInstanceInitFunc) flash_playlist_init,
+      NULL
+    };
+
+    type = g_type_register_static (G_TYPE_OBJECT, "FlashPlaylist", &info, 0);
+  }
+
+  return type;
+}
+
+FlashPlaylist *
+flash_playlist_new (FlashLibrary *library, GtkWindow *window,
+                    FlashPlaylistEventCallback callback,
+                    gpointer callback_user_data)
+{
+  FlashPlaylist *playlist;
+
+  playlist = g_object_new (FLASH_TYPE_PLAYLIST, NULL);
+  playlist->library = g_object_ref (library);
+  playlist->window = g_object_ref (window);
+  playlist->callback = callback;
+  playlist->callback_data = callback_user_data;
+  return playlist;
+}
+
+void
+flash_playlist_append (FlashPlaylist *playlist, const gchar *path)
+{
+  guint8 state;
+
+  g_ptr_array_add (playlist->paths, g_strdup (path));
+  state = ITEM_UNCHECKED;
+  g_byte_array_append (playlist->checked, &state, 1);
+
+  /* Appending to the end of a running list may give us something to
+   * preload that wasn't there before */
+  if (playlist->position != -1 && !playlist->next && !playlist->prepare_id)
+    playlist->prepare_id = g_idle_add (flash_playlist_prepare, playlist);
+}
+
+gint
+flash_playlist_get_length (FlashPlaylist *playlist)
+{
+  return playlist->paths->len;
+}
+
+gint
+flash_playlist_get_position (FlashPlaylist *playlist)
+{
+  return playlist->position;
+}
+
+void
+flash_playlist_set_io_policy (FlashPlaylist *playlist,
+                              FlashFileIoPolicy policy)
+{
+  playlist->io_policy = policy;
+}
+
+gboolean
+flash_playlist_play (FlashPlaylist *playlist, GError **error)
+{
+  gchar **paths;
+
+  flash_playlist_stop (playlist);
+
+  if (playlist->paths->len == 0)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Playlist is empty");
+    return FALSE;
+  }
+
+  /* The first item is started without waiting for its check */
+  memset (playlist->checked->data, ITEM_UNCHECKED, playlist->checked->len);
+  paths = g_new (gchar *, playlist->paths->len + 1);
+  memcpy (paths, playlist->paths->pdata, playlist->paths->len *
+          sizeof(gchar *));
+  paths[playlist->paths->len] = NULL;
+  playlist->check = flash_prepare_new (paths, 0, flash_playlist_check_item,
+                                       flash_playlist_check_done, playlist);
+  g_free (paths);
+  if (!flash_playlist_advance (playlist))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "None of the playlist items could be played");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void
+flash_playlist_stop (FlashPlaylist *playlist)
+{
+  if (playlist->check)
+  {
+    flash_prepare_cancel (playlist->check);
+    playlist->check = NULL;
+  }
+  if (playlist->prepare_id)
+  {
+    g_source_remove (playlist->prepare_id);
+    playlist->prepare_id = 0;
+  }
+  flash_playlist_discard_next (playlist);
+  if (playlist->current)
+  {
+    flash_file_stop (playlist->current);
+    g_object_unref (playlist->current);
+    playlist->current = NULL;
+  }
+  playlist->position = -1;
+}
+
+static void
+flash_playlist_class_init (FlashPlaylistClass *klass)
+{
+  GObjectClass *gobject_class;
+
+  gobject_class = G_OBJECT_CLASS (klass);
+  gobject_class->finalize = flash_playlist_finalize;
+}
+
+static void
+flash_playlist_init (FlashPlaylist *playlist)
+{
+  playlist->library = NULL;
+  playlist->window = NULL;
+  playlist->paths = g_ptr_array_new ();
+  playlist->io_policy = FLASH_FILE_IO_READAHEAD;
+  playlist->checked = g_byte_array_new ();
+  playlist->check = NULL;
+
+  playlist->position = -1;
+  playlist->current = NULL;
+
+  playlist->next = NULL;
+  playlist->next_position = -1;
+  playlist->staging = NULL;
+  playlist->prepare_id = 0;
+
+  playlist->callback = NULL;
+  playlist->callback_data = NULL;
+}
+
+static void
+flash_playlist_finalize (GObject *object)
+{
+  FlashPlaylist *playlist;
+  guint i;
+
+  playlist = FLASH_PLAYLIST (object);
+
+  flash_playlist_stop (playlist);
+
+  for (i = 0; i < playlist->paths->len; i++)
+    g_free (g_ptr_array_index (playlist->paths, i));
+  g_ptr_array_free (playlist->paths, TRUE);
+  playlist->paths = NULL;
+  g_byte_array_free (playlist->checked, TRUE);
+  playlist->checked = NULL;
+
+  if (playlist->window)
+    g_object_unref (playlist->window);
+  if (playlist->library)
+    g_object_unref (playlist->library);
+  playlist->window = NULL;
+  playlist->library = NULL;
+}
+
+/* Retires the current item and starts the one after it, skipping any
+ * that fail. Returns FALSE when the end of the list has been reached. */
+static gboolean
+flash_playlist_advance (FlashPlaylist *playlist)
+{
+  GError *error;
+  gint position;
+
+  if (playlist->current)
+  {
+    flash_file_stop (playlist->current);
+    g_object_unref (playlist->current);
+    playlist->current = NULL;
+  }
+
+  position = flash_playlist_skip_invalid (playlist, playlist->position + 1,
+                                          TRUE);
+  if (!flash_playlist_swap_next (playlist, position))
+  {
+    /* Nothing preloaded (yet), start cold */
+    flash_playlist_discard_next (playlist);
+    for (; position < (gint) playlist->paths->len; position++)
+    {
+      position = flash_playlist_skip_invalid (playlist, position, TRUE);
+      if (position >= (gint) playlist->paths->len)
+        break;
+      error = NULL;
+      if (flash_playlist_start (playlist, position, &error))
+        break;
+      DEBUG ("playlist item %d failed: %s", position, error->message);
+      g_error_free (error);
+      flash_playlist_emit (playlist, FLASH_PLAYLIST_ITEM_FAILED, position);
+    }
+  }
+
+  if (!playlist->current)
+  {
+    playlist->position = -1;
+    flash_playlist_emit (playlist, FLASH_PLAYLIST_FINISHED, -1);
+    return FALSE;
+  }
+
+  playlist->position = position;
+  if (!playlist->prepare_id)
+    playlist->prepare_id = g_idle_add (flash_playlist_prepare, playlist);
+  flash_playlist_emit (playlist, FLASH_PLAYLIST_ITEM_STARTED, position);
+  return TRUE;
+}
+
+static gboolean
+flash_playlist_swap_next (FlashPlaylist *playlist, gint position)
+{
+  GError *error;
+  gint width;
+  gint height;
+
+  if (!playlist->next || playlist->next_position != position)
+    return FALSE;
+
+  /* The window has been emptied by stopping the previous item, so this
+   * is a single X reparent; the plugin keeps running throughout */
+  error = NULL;
+  if (!flash_file_reparent (playlist->next, playlist->window, &error))
+  {
+    DEBUG ("failed to swap in preloaded item %d: %s", position,
+           error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+  playlist->current = playlist->next;
+  playlist->next = NULL;
+  playlist->next_position = -1;
+
+  /* The window may have changed size since the item was staged */
+  gdk_window_get_geometry (GTK_WIDGET (playlist->window)->window, NULL, NULL,
+                           &width, &height, NULL);
+  flash_file_resize (playlist->current, width, height, NULL);
+  flash_file_resume (playlist->current);
+
+  gtk_widget_destroy (playlist->staging);
+  playlist->staging = NULL;
+  return TRUE;
+}
+
+static gboolean
+flash_playlist_start (FlashPlaylist *playlist, gint position, GError **error)
+{
+  FlashFile *file;
+
+  file = flash_file_new (playlist->library,
+                         g_ptr_array_index (playlist->paths, position),
+                         flash_playlist_file_event, playlist, error);
+  if (!file)
+    return FALSE;
+  flash_file_set_io_policy (file, playlist->io_policy);
+  if (!flash_file_play (file, playlist->window, FALSE, error))
+  {
+    g_object_unref (file);
+    return FALSE;
+  }
+  playlist->current = file;
+  return TRUE;
+}
+
+static gboolean
+flash_playlist_prepare (gpointer data)
+{
+  FlashPlaylist *playlist;
+  FlashFile *file;
+  GError *error;
+  gint position;
+  gint width;
+  gint height;
+
+  playlist = FLASH_PLAYLIST (data);
+  playlist->prepare_id = 0;
+
+  position = flash_playlist_skip_invalid (playlist, playlist->position + 1,
+                                          FALSE);
+  if (playlist->position == -1 || playlist->next ||
+      position >= (gint) playlist->paths->len)
+    return FALSE;
+
+  /* Stage the item off screen, at the size it'll be shown at */
+  gdk_window_get_geometry (GTK_WIDGET (playlist->window)->window, NULL, NULL,
+                           &width, &height, NULL);
+  playlist->staging = gtk_window_new (GTK_WINDOW_POPUP);
+  gtk_window_set_default_size (GTK_WINDOW (playlist->staging), width, height);
+  gtk_window_move (GTK_WINDOW (playlist->staging), -width - 100,
+                   -height - 100);
+  gtk_widget_show (playlist->staging);
+  gdk_flush ();
+
+  /* This loads, instantiates and streams the whole file */
+  error = NULL;
+  file = flash_file_new (playlist->library,
+                         g_ptr_array_index (playlist->paths, position),
+                         flash_playlist_file_event, playlist, &error);
+  if (file)
+    flash_file_set_io_policy (file, playlist->io_policy);
+  if (file && flash_file_play (file, GTK_WINDOW (playlist->staging), FALSE,
+                               &error))
+  {
+    if (flash_file_pause (file))
+    {
+      playlist->next = file;
+      playlist->next_position = position;
+      return FALSE;
+    }
+    g_set_error (&error, FLASH_ERROR, FLASH_ERROR_FILE_PLAY, "%s",
+                 "Plugin can't be paused");
+    flash_file_stop (file);
+  }
+
+  /* Leave failures to be reported when the item is started for real */
+  DEBUG ("failed to preload playlist item %d: %s", position, error->message);
+  g_error_free (error);
+  if (file)
+    g_object_unref (file);
+  gtk_widget_destroy (playlist->staging);
+  playlist->staging = NULL;
+  return FALSE;
+}
+
+static void
+flash_playlist_discard_next (FlashPlaylist *playlist)
+{
+  if (playlist->next)
+  {
+    flash_file_stop (playlist->next);
+    g_object_unref (playlist->next);
+    playlist->next = NULL;
+    playlist->next_position = -1;
+  }
+  if (playlist->staging)
+  {
+    gtk_widget_destroy (playlist->staging);
+    playlist->staging = NULL;
+  }
+}
+
+/* Returns the first item from position on that hasn't been found to be
+ * unplayable, reporting the ones passed over if asked to */
+static gint
+flash_playlist_skip_invalid (FlashPlaylist *playlist, gint position,
+                             gboolean report)
+{
+  for (; position < (gint) playlist->checked->len; position++)
+  {
+    if (playlist->checked->data[position] != ITEM_INVALID)
+      break;
+    if (report)
+      flash_playlist_emit (playlist, FLASH_PLAYLIST_ITEM_FAILED, position);
+  }
+  return position;
+}
+
+static void
+flash_playlist_check_item (FlashPrepare *prepare, gint index,
+                           const FlashPrepareResult *result, gpointer data)
+{
+  FlashPlaylist *playlist;
+
+  playlist = FLASH_PLAYLIST (data);
+  if (result->error)
+    DEBUG ("playlist item %d can't be played: %s", index,
+           result->error->message);
+  playlist->checked->data[index] = result->error ? ITEM_INVALID : ITEM_VALID;
+}
+
+static void
+flash_playlist_check_done (FlashPrepare *prepare, gpointer data)
+{
+  FLASH_PLAYLIST (data)->check = NULL;
+}
+
+static void
+flash_playlist_emit (FlashPlaylist *playlist, FlashPlaylistEvent event,
+                     gint position)
+{
+  if (playlist->callback)
+    playlist->callback (playlist, event, position, playlist->callback_data);
+}
+
+static void
+flash_playlist_file_event (FlashFile *file, FlashFileEvent event,
+                           gpointer data)
+{
+  FlashPlaylist *playlist;
+
+  playlist = FLASH_PLAYLIST (data);
+  if (file != playlist->current || event != FLASH_FILE_PLAYBACK_STOPPED)
+    return;
+  flash_playlist_advance (playlist);
+}
@@ -0,0 +1,74 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_PLAYLIST_H__
+#define __FLASH_PLAYLIST_H__
+
+#include <glib-object.h>
+#include <gtk/gtk.h>
+#include <flash/flash-library.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FlashPlaylist      FlashPlaylist;
+typedef struct _FlashPlaylistClass FlashPlaylistClass;
+
+typedef enum
+{
+  FLASH_PLAYLIST_ITEM_STARTED,
+  FLASH_PLAYLIST_ITEM_FAILED,
+  FLASH_PLAYLIST_FINISHED
+} FlashPlaylistEvent;
+
+/* position is the index of the item the event is about, or -1 */
+typedef void (*FlashPlaylistEventCallback)(FlashPlaylist *playlist,
+                                           FlashPlaylistEvent event,
+                                           gint position,
+                                           gpointer user_data);
+
+#define FLASH_TYPE_PLAYLIST \
+  (flash_playlist_get_type())
+
+#define FLASH_PLAYLIST(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), FLASH_TYPE_PLAYLIST, FlashPlaylist))
+
+#define FLASH_PLAYLIST_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass), FLASH_TYPE_PLAYLIST, FlashPlaylistClass))
+
+#define FLASH_IS_PLAYLIST(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj), FLASH_TYPE_PLAYLIST))
+
+#define FLASH_IS_PLAYLIST_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass), FLASH_TYPE_PLAYLIST))
+
+#define FLASH_PLAYLIST_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj), FLASH_TYPE_PLAYLIST, FlashPlaylistClass))
+
+GType flash_playlist_get_type (void);
+
+/* Plays files back to back in window. While one item plays, the next one
+ * is loaded, instantiated and paused in a hidden window, and moved into
+ * place as soon as the current one stops. */
+FlashPlaylist *flash_playlist_new          (FlashLibrary *library,
+                                            GtkWindow *window,
+                                            FlashPlaylistEventCallback callback,
+                                            gpointer callback_user_data);
+void           flash_playlist_append       (FlashPlaylist *playlist,
+                                            const gchar *path);
+gint           flash_playlist_get_length   (FlashPlaylist *playlist);
+gint           flash_playlist_get_position (FlashPlaylist *playlist);
+/* How items are loaded (see FlashFileIoPolicy), from the next one
+   created; FLASH_FILE_IO_LOCK keeps the preloaded item from being evicted
+   while it waits its turn */
+void           flash_playlist_set_io_policy (FlashPlaylist *playlist,
+                                             FlashFileIoPolicy policy);
+gboolean       flash_playlist_play         (FlashPlaylist *playlist,
+                                            GError **error);
+void           flash_playlist_stop         (FlashPlaylist *playlist);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,382 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "flash-common.h"
+#include "flash-post.h"
+#include "flash-stream.h"
+#include "flash-library-internal.h"
+#include "gtk2xtbin.h"
+
+/* Most of the response handed to the plugin per main loop iteration, and
+ * how long to wait when it says it can't take any more */
+#define POST_DISPATCH_BYTES (64 * 1024)
+#define POST_RETRY_MS       10
+
+struct _FlashPost {
+  FlashLibrary *library;
+  NPP instance;
+  gchar *url;
+  gboolean to_window;
+  void *notify_data;
+
+  /* The request, either mapped from the plugin's file or copied from its
+   * buffer; body and length leave out any headers */
+  void *map;
+  gsize map_size;
+  guint8 *copy;
+  const guint8 *body;
+  gsize length;
+  gchar *content_type;
+
+  GString *response;
+  gsize offset;
+  FlashStream *stream;
+  FlashStreamStats *totals;
+  guint source_id;
+
+  FlashPostDoneFunc done;
+  gpointer done_data;
+};
+
+static gboolean flash_post_dispatch (gpointer data);
+
+/* The plugin may put "Name: value" lines and a blank line in front of the
+ * body; anything else is taken to be all body */
+static void
+flash_post_parse_headers (FlashPost *post, const guint8 *data, gsize size)
+{
+  const guint8 *end;
+  const guint8 *p;
+  const guint8 *eol;
+  const guint8 *colon;
+  const guint8 *q;
+  gsize line_len;
+  gsize content_length;
+  gboolean have_length;
+  gint headers;
+
+  post->body = data;
+  post->length = size;
+
+  end = data + size;
+  p = data;
+  headers = 0;
+  have_length = FALSE;
+  content_length = 0;
+  while (p < end)
+  {
+    eol = memchr (p, '\n', end - p);
+    if (!eol)
+      goto not_headers;
+    line_len = eol - p;
+    if (line_len > 0 && p[line_len - 1] == '\r')
+      line_len--;
+
+    if (line_len == 0)
+    {
+      if (headers == 0)
+        goto not_headers;
+      post->body = eol + 1;
+      post->length = end - post->body;
+      if (have_length && content_length < post->length)
+        post->length = content_length;
+      return;
+    }
+
+    colon = memchr (p, ':', line_len);
+    if (!colon || colon == p)
+      goto not_headers;
+    for (q = p; q < colon; q++)
+      if (!g_ascii_isalnum (*q) && *q != '-')
+        goto not_headers;
+
+    q = colon + 1;
+    while (q < p + line_len && (*q == ' ' || *q == '\t'))
+      q++;
+    if (colon - p == 12 && g_ascii_strncasecmp ((const gchar *) p,
+                                                "Content-type", 12) == 0)
+    {
+      g_free (post->content_type);
+      post->content_type = g_strndup ((const gchar *) q, p + line_len - q);
+    }
+    else if (colon - p == 14 && g_ascii_strncasecmp ((const gchar *) p,
+                                                     "Content-length", 14) == 0)
+    {
+      content_length = strtoul ((const gchar *) q, NULL, 10);
+      have_length = TRUE;
+    }
+    headers++;
+    p = eol + 1;
+  }
+
+not_headers:
+  g_free (post->content_type);
+  post->content_type = NULL;
+}
+
+static gboolean
+flash_post_map_file (FlashPost *post, const char *buf, uint32 len)
+{
+  gchar *path;
+  const gchar *name;
+  struct stat sb;
+  int fd;
+  gboolean ret;
+
+  ret = FALSE;
+  fd = -1;
+  path = g_strndup (buf, len);
+  name = path;
+  if (strncmp (name, "file://", 7) == 0)
+    name += 7;
+  else if (strncmp (name, "file:", 5) == 0)
+    name += 5;
+
+  fd = open (name, O_RDONLY);
+  if (fd == -1 || fstat (fd, &sb) == -1)
+  {
+    DEBUG ("failed to open POST file '%s': %s", name, strerror (errno));
+    goto out;
+  }
+  if (sb.st_size > 0)
+  {
+    post->map = mmap (0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (post->map == MAP_FAILED)
+    {
+      DEBUG ("failed to mmap() POST file '%s': %s", name, strerror (errno));
+      post->map = NULL;
+      goto out;
+    }
+    post->map_size = sb.st_size;
+  }
+  ret = TRUE;
+
+out:
+  if (fd != -1)
+    close (fd);
+  g_free (path);
+  return ret;
+}
+
+static void
+flash_post_release_body (FlashPost *post)
+{
+  if (post->map)
+    munmap (post->map, post->map_size);
+  if (post->copy)
+    g_free (post->copy);
+  post->map = NULL;
+  post->map_size = 0;
+  post->copy = NULL;
+  post->body = NULL;
+  post->length = 0;
+}
+
+FlashPost *
+flash_post_new (FlashLibrary *library, NPP instance, const gchar *url,
+                const gchar *target, uint32 len, const char *buf,
+                NPBool file, void *notify_data, FlashStreamStats *totals,
+                FlashPostDoneFunc done, gpointer done_data, NPError *nperr)
+{
+  FlashPost *post;
+
+  post = g_new0 (FlashPost, 1);
+  post->library = library;
+  post->instance = instance;
+  post->url = g_strdup (url);
+  post->to_window = target != NULL;
+  post->notify_data = notify_data;
+  post->totals = totals;
+  post->done = done;
+  post->done_data = done_data;
+
+  if (file)
+  {
+    if (!flash_post_map_file (post, buf, len))
+    {
+      g_free (post->url);
+      g_free (post);
+      *nperr = NPERR_FILE_NOT_FOUND;
+      return NULL;
+    }
+    flash_post_parse_headers (post, post->map, post->map_size);
+  }
+  else
+  {
+    /* The plugin's buffer is only good for the duration of the call */
+    if (len > 0)
+      post->copy = g_memdup (buf, len);
+    flash_post_parse_headers (post, post->copy, len);
+  }
+
+  DEBUG ("POST '%s': %lu bytes of %s%s", url, (gulong) post->length,
+         post->content_type ? post->content_type : "(no type)",
+         file ? ", mapped" : "");
+
+  post->source_id = g_idle_add (flash_post_dispatch, post);
+  *nperr = NPERR_NO_ERROR;
+  return post;
+}
+
+/* Answers POSTs that no handler wants, the way a local web server that
+ * accepts them would: with nothing */
+static gboolean
+flash_post_stand_in (FlashPost *post)
+{
+  DEBUG ("POST '%s': no handler, answering with an empty response",
+         post->url);
+  return TRUE;
+}
+
+static gboolean
+flash_post_answer (FlashPost *post)
+{
+  FlashPostHandler handler;
+  gpointer user_data;
+  gboolean ret;
+
+  post->response = g_string_new (NULL);
+  if (flash_library_find_post_handler (post->library, post->url, &handler,
+                                       &user_data))
+  {
+    ret = handler (post->library, post->url, post->content_type,
+                   post->body, post->length, post->response, user_data);
+  }
+  else
+    ret = flash_post_stand_in (post);
+  flash_post_release_body (post);
+  return ret;
+}
+
+static void
+flash_post_free (FlashPost *post)
+{
+  if (post->source_id)
+    g_source_remove (post->source_id);
+  flash_post_release_body (post);
+  if (post->response)
+    g_string_free (post->response, TRUE);
+  g_free (post->content_type);
+  g_free (post->url);
+  g_free (post);
+}
+
+/* Closes the response stream, if there is one, and tells the plugin how
+ * the request went if it asked to know */
+static void
+flash_post_end (FlashPost *post, NPReason reason)
+{
+  gtk_xtbin_plugin_lock ();
+  if (post->stream)
+  {
+    flash_stream_close (post->stream, reason);
+    post->stream = NULL;
+  }
+  if (post->notify_data)
+    PLUGIN_CALL (post, urlnotify, post->instance, post->url, reason,
+                 post->notify_data);
+  gtk_xtbin_plugin_unlock ();
+}
+
+static void
+flash_post_finish (FlashPost *post, NPReason reason)
+{
+  flash_post_end (post, reason);
+  if (post->done)
+    post->done (post, post->done_data);
+  flash_post_free (post);
+}
+
+static gboolean
+flash_post_dispatch (gpointer data)
+{
+  FlashPost *post;
+  NPError nperr;
+  uint16 stype;
+  gsize budget;
+  int32 nwritten;
+  gboolean blocked;
+
+  post = data;
+  post->source_id = 0;
+
+  if (!post->response && !flash_post_answer (post))
+  {
+    flash_post_finish (post, NPRES_NETWORK_ERR);
+    return FALSE;
+  }
+  /* There is no browser window to show the response in */
+  if (post->to_window)
+  {
+    flash_post_finish (post, NPRES_DONE);
+    return FALSE;
+  }
+
+  gtk_xtbin_plugin_lock ();
+  if (!post->stream)
+  {
+    stype = NP_NORMAL;
+    post->stream = flash_stream_open (post->library, post->instance,
+                                      post->url, "text/plain",
+                                      post->response->len, &stype,
+                                      post->notify_data, post->totals,
+                                      &nperr);
+    if (!post->stream)
+    {
+      gtk_xtbin_plugin_unlock ();
+      flash_post_finish (post, NPRES_NETWORK_ERR);
+      return FALSE;
+    }
+  }
+
+  blocked = FALSE;
+  budget = POST_DISPATCH_BYTES;
+  while (post->offset < post->response->len && budget > 0)
+  {
+    nwritten = flash_stream_write (post->stream,
+                                   post->response->str + post->offset,
+                                   MIN (post->response->len - post->offset,
+                                        budget));
+    if (nwritten < 0)
+    {
+      gtk_xtbin_plugin_unlock ();
+      flash_post_finish (post, NPRES_NETWORK_ERR);
+      return FALSE;
+    }
+    if (nwritten == 0)
+    {
+      blocked = TRUE;
+      break;
+    }
+    post->offset += nwritten;
+    budget -= MIN ((gsize) nwritten, budget);
+  }
+  gtk_xtbin_plugin_unlock ();
+
+  if (post->offset >= post->response->len)
+    flash_post_finish (post, NPRES_DONE);
+  else if (blocked)
+    post->source_id = g_timeout_add (POST_RETRY_MS, flash_post_dispatch, post);
+  else
+    post->source_id = g_idle_add (flash_post_dispatch, post);
+  return FALSE;
+}
+
+void
+flash_post_cancel (FlashPost *post)
+{
+  flash_post_end (post, NPRES_USER_BREAK);
+  flash_post_free (post);
+}
@@ -0,0 +1,39 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_POST_H__
+#define __FLASH_POST_H__
+
+#include <glib.h>
+#include "flash-npapi.h"
+#include "flash-library.h"
+
+G_BEGIN_DECLS
+
+/* A POST from the plugin. The handler is run from the main loop and its
+ * response streamed back to the plugin a piece at a time, followed by
+ * NPP_URLNotify if the plugin asked for it. */
+typedef struct _FlashPost FlashPost;
+
+/* Called once the post has been answered, just before it is freed */
+typedef void (*FlashPostDoneFunc) (FlashPost *post, gpointer user_data);
+
+/* buf and len are as given to NPN_PostURL; with file set, buf is the name
+ * of a file holding the request, which is mapped rather than read. Returns
+ * NULL, with *nperr set, if the request can't be read. */
+FlashPost *flash_post_new    (FlashLibrary *library, NPP instance,
+                              const gchar *url, const gchar *target,
+                              uint32 len, const char *buf, NPBool file,
+                              void *notify_data, FlashStreamStats *totals,
+                              FlashPostDoneFunc done, gpointer done_data,
+                              NPError *nperr);
+/* Breaks off the response (with NPRES_USER_BREAK) and frees the post,
+ * without calling its done function. The instance must still exist. */
+void       flash_post_cancel (FlashPost *post);
+
+G_END_DECLS
+
+#endif
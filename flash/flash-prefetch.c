@@ -0,0 +1,457 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash-common.h"
+#include "flash-cache.h"
+#include "flash-http.h"
+#include "flash-npapi.h"
+#include "flash-prefetch.h"
+#include "flash-swf.h"
+#include "flash-library-internal.h"
+
+/* Most URLs taken from one movie, and most fetched at once; the plugin's
+ * own requests share the connection pool */
+#define PREFETCH_MAX_URLS    32
+#define PREFETCH_MAX_RUNNING 4
+
+typedef struct {
+  FlashPrefetch *prefetch;
+  gchar *url;
+  FlashHttpRequest *request;
+  FlashCacheWriter *writer;
+  /* Someone else wants the response too */
+  FlashPrefetchWaitFunc wait;
+  gpointer wait_data;
+} PrefetchRequest;
+
+struct _FlashPrefetch {
+  FlashLibrary *library;
+  FlashCache *cache;
+  /* URLs waiting for a request, and the PrefetchRequests running */
+  GList *pending;
+  GList *running;
+
+  /* The movie is scanned on a thread of its own, and the URLs picked up
+   * from an idle once it's done; scanned, refs and scan_error are only
+   * looked at from the main loop after the thread has been joined */
+  gchar *base_url;
+  const guint8 *data;
+  gsize size;
+  GThread *scan_thread;
+  gboolean scanned;
+  gchar **refs;
+  GError *scan_error;
+
+  FlashPrefetchDoneFunc done;
+  gpointer done_data;
+};
+
+static void flash_prefetch_start (FlashPrefetch *prefetch);
+
+static void
+flash_prefetch_free (FlashPrefetch *prefetch)
+{
+  GList *l;
+
+  for (l = prefetch->pending; l; l = l->next)
+    g_free (l->data);
+  g_list_free (prefetch->pending);
+  g_strfreev (prefetch->refs);
+  if (prefetch->scan_error)
+    g_error_free (prefetch->scan_error);
+  g_free (prefetch->base_url);
+  g_free (prefetch);
+}
+
+static gboolean
+flash_prefetch_headers (FlashHttpRequest *request, gint status,
+                        const gchar *content_type, gint64 length,
+                        gpointer user_data)
+{
+  PrefetchRequest *pr;
+
+  pr = user_data;
+  if (status == 304)
+  {
+    flash_cache_revalidated (pr->prefetch->cache, pr->url, request);
+    return TRUE;
+  }
+  if (status < 200 || status >= 300)
+    return FALSE;
+  /* No point reading what won't be kept */
+  pr->writer = flash_cache_begin (pr->prefetch->cache, pr->url, request);
+  return pr->writer != NULL;
+}
+
+static gssize
+flash_prefetch_body (FlashHttpRequest *request, const guint8 *data,
+                     gsize len, gpointer user_data)
+{
+  PrefetchRequest *pr;
+
+  pr = user_data;
+  if (!flash_cache_write (pr->writer, data, len))
+    return -1;
+  return len;
+}
+
+static void
+flash_prefetch_done (FlashHttpRequest *request, const GError *error,
+                     gpointer user_data)
+{
+  FlashPrefetch *prefetch;
+  PrefetchRequest *pr;
+
+  pr = user_data;
+  prefetch = pr->prefetch;
+  if (error)
+    DEBUG ("prefetch of '%s' failed: %s", pr->url, error->message);
+  if (pr->writer)
+  {
+    if (error)
+      flash_cache_abort (pr->writer);
+    else
+      flash_cache_commit (pr->writer);
+  }
+  prefetch->running = g_list_remove (prefetch->running, pr);
+  if (pr->wait)
+    pr->wait (pr->url, pr->wait_data);
+  g_free (pr->url);
+  g_free (pr);
+
+  flash_prefetch_start (prefetch);
+  if (!prefetch->running && !prefetch->pending)
+  {
+    if (prefetch->done)
+      prefetch->done (prefetch, prefetch->done_data);
+    flash_prefetch_free (prefetch);
+  }
+}
+
+/* Starts requests for pending URLs, up to the limit */
+static void
+flash_prefetch_start (FlashPrefetch *prefetch)
+{
+  FlashCacheEntry *entry;
+  PrefetchRequest *pr;
+  GError *error;
+  gchar *headers;
+  gchar *url;
+
+  while (prefetch->pending &&
+         g_list_length (prefetch->running) < PREFETCH_MAX_RUNNING)
+  {
+    url = prefetch->pending->data;
+    prefetch->pending = g_list_delete_link (prefetch->pending,
+                                            prefetch->pending);
+
+    /* The plugin may have got there first */
+    headers = NULL;
+    entry = flash_cache_lookup (prefetch->cache, url);
+    if (entry && flash_cache_is_fresh (entry))
+    {
+      g_free (url);
+      continue;
+    }
+    if (entry)
+      headers = flash_cache_conditional_headers (entry);
+
+    pr = g_new0 (PrefetchRequest, 1);
+    pr->prefetch = prefetch;
+    pr->url = url;
+    error = NULL;
+    pr->request = flash_http_get (flash_library_get_http_pool (prefetch->library),
+                                  url, headers, flash_prefetch_headers,
+                                  flash_prefetch_body, flash_prefetch_done,
+                                  pr, &error);
+    if (pr->request)
+    {
+      DEBUG ("prefetching '%s'", url);
+      prefetch->running = g_list_prepend (prefetch->running, pr);
+    }
+    else
+    {
+      DEBUG ("can't prefetch '%s': %s", url, error->message);
+      g_error_free (error);
+      g_free (pr->url);
+      g_free (pr);
+    }
+    g_free (headers);
+  }
+}
+
+/* Asks the kernel to start reading a local file in */
+static void
+flash_prefetch_read_ahead (const gchar *url)
+{
+  const gchar *path;
+  int fd;
+
+  path = url + 5;
+  if (strncmp (path, "//", 2) == 0)
+  {
+    path = strchr (path + 2, '/');
+    if (!path)
+      return;
+  }
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+    return;
+  DEBUG ("reading ahead '%s'", path);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+  close (fd);
+}
+
+static void
+flash_prefetch_scan (FlashPrefetch *prefetch)
+{
+  prefetch->refs = flash_swf_find_urls (prefetch->data, prefetch->size,
+                                        &prefetch->scan_error);
+  prefetch->scanned = TRUE;
+}
+
+static gboolean
+flash_prefetch_scanned (gpointer data)
+{
+  FlashPrefetch *prefetch;
+  gchar *url;
+  gint i;
+
+  prefetch = data;
+  if (prefetch->scan_thread)
+  {
+    g_thread_join (prefetch->scan_thread);
+    prefetch->scan_thread = NULL;
+  }
+  if (!prefetch->scanned)
+    flash_prefetch_scan (prefetch);
+
+  if (!prefetch->refs)
+    DEBUG ("not prefetching for '%s': %s", prefetch->base_url,
+           prefetch->scan_error->message);
+  for (i = 0; prefetch->refs && prefetch->refs[i] && i < PREFETCH_MAX_URLS;
+       i++)
+  {
+    url = flash_prefetch_resolve_url (prefetch->base_url, prefetch->refs[i]);
+    if (g_ascii_strncasecmp (url, "file:", 5) == 0)
+      flash_prefetch_read_ahead (url);
+    else if (g_ascii_strncasecmp (url, "http://", 7) == 0 && prefetch->cache)
+    {
+      prefetch->pending = g_list_prepend (prefetch->pending, url);
+      continue;
+    }
+    g_free (url);
+  }
+
+  prefetch->pending = g_list_reverse (prefetch->pending);
+  flash_prefetch_start (prefetch);
+  if (!prefetch->running)
+  {
+    if (prefetch->done)
+      prefetch->done (prefetch, prefetch->done_data);
+    flash_prefetch_free (prefetch);
+  }
+  return FALSE;
+}
+
+static gpointer
+flash_prefetch_scan_thread (gpointer data)
+{
+  flash_prefetch_scan (data);
+  g_idle_add (flash_prefetch_scanned, data);
+  return NULL;
+}
+
+FlashPrefetch *
+flash_prefetch_new (FlashLibrary *library, const gchar *base_url,
+                    const guint8 *data, gsize size,
+                    FlashPrefetchDoneFunc done, gpointer done_data)
+{
+  FlashPrefetch *prefetch;
+
+  prefetch = g_new0 (FlashPrefetch, 1);
+  prefetch->library = library;
+  prefetch->cache = flash_library_get_http_cache (library);
+  prefetch->done = done;
+  prefetch->done_data = done_data;
+  prefetch->base_url = g_strdup (base_url);
+  prefetch->data = data;
+  prefetch->size = size;
+
+  /* Inflating a compressed movie can take a while */
+  if (g_thread_supported ())
+    prefetch->scan_thread = g_thread_create (flash_prefetch_scan_thread,
+                                             prefetch, TRUE, NULL);
+  if (!prefetch->scan_thread)
+    g_idle_add (flash_prefetch_scanned, prefetch);
+  return prefetch;
+}
+
+gboolean
+flash_prefetch_wait (FlashPrefetch *prefetch, const gchar *url,
+                     FlashPrefetchWaitFunc func, gpointer user_data)
+{
+  PrefetchRequest *pr;
+  GList *l;
+
+  for (l = prefetch->running; l; l = l->next)
+  {
+    pr = l->data;
+    if (strcmp (pr->url, url) == 0)
+    {
+      pr->wait = func;
+      pr->wait_data = user_data;
+      return TRUE;
+    }
+  }
+  for (l = prefetch->pending; l; l = l->next)
+  {
+    if (strcmp (l->data, url) == 0)
+    {
+      g_free (l->data);
+      prefetch->pending = g_list_delete_link (prefetch->pending, l);
+      break;
+    }
+  }
+  return FALSE;
+}
+
+void
+flash_prefetch_cancel (FlashPrefetch *prefetch)
+{
+  PrefetchRequest *pr;
+
+  /* The scan can't be stopped part way, but it's bounded */
+  if (prefetch->scan_thread)
+    g_thread_join (prefetch->scan_thread);
+  g_idle_remove_by_data (prefetch);
+
+  while (prefetch->running)
+  {
+    pr = prefetch->running->data;
+    flash_http_cancel (pr->request);
+    if (pr->writer)
+      flash_cache_abort (pr->writer);
+    g_free (pr->url);
+    g_free (pr);
+    prefetch->running = g_list_delete_link (prefetch->running,
+                                            prefetch->running);
+  }
+  flash_prefetch_free (prefetch);
+}
+
+/* --- URL resolution --- */
+
+static gboolean
+flash_prefetch_has_scheme (const gchar *url)
+{
+  const gchar *p;
+
+  if (!g_ascii_isalpha (*url))
+    return FALSE;
+  for (p = url + 1; g_ascii_isalnum (*p) || *p == '+' || *p == '-' ||
+       *p == '.'; p++)
+    ;
+  return *p == ':';
+}
+
+/* Drops "." and ".." segments from path, which starts with a '/' */
+static gchar *
+flash_prefetch_remove_dots (const gchar *path)
+{
+  GString *out;
+  gchar **segments;
+  gint i;
+  gchar *slash;
+  gboolean last;
+
+  out = g_string_new (NULL);
+  segments = g_strsplit (path + 1, "/", -1);
+  for (i = 0; segments[i]; i++)
+  {
+    last = segments[i + 1] == NULL;
+    if (strcmp (segments[i], "..") == 0)
+    {
+      slash = strrchr (out->str, '/');
+      g_string_truncate (out, slash ? slash - out->str : 0);
+      if (last)
+        g_string_append_c (out, '/');
+    }
+    else if (strcmp (segments[i], ".") == 0)
+    {
+      if (last)
+        g_string_append_c (out, '/');
+    }
+    else
+    {
+      g_string_append_c (out, '/');
+      g_string_append (out, segments[i]);
+    }
+  }
+  g_strfreev (segments);
+  if (out->len == 0)
+    g_string_append_c (out, '/');
+  return g_string_free (out, FALSE);
+}
+
+gchar *
+flash_prefetch_resolve_url (const gchar *base, const gchar *ref)
+{
+  const gchar *colon;
+  const gchar *path;
+  const gchar *path_end;
+  const gchar *query;
+  gchar *prefix;
+  gchar *merged;
+  gchar *dir;
+  gchar *clean;
+  gchar *url;
+  gsize dir_len;
+
+  colon = strchr (base, ':');
+  if (flash_prefetch_has_scheme (ref) || !colon)
+    return g_strdup (ref);
+  if (strncmp (ref, "//", 2) == 0)
+    return g_strdup_printf ("%.*s%s", (int) (colon - base + 1), base, ref);
+
+  /* scheme:[//authority] */
+  path = colon + 1;
+  if (strncmp (path, "//", 2) == 0)
+    path += 2 + strcspn (path + 2, "/?#");
+  prefix = g_strndup (base, path - base);
+  path_end = path + strcspn (path, "?#");
+
+  if (*ref == '/')
+    merged = g_strdup (ref);
+  else if (*ref == '?' || *ref == '#' || *ref == '\0')
+    merged = g_strdup_printf ("%s%.*s%s", *path == '/' ? "" : "/",
+                              (int) (path_end - path), path, ref);
+  else
+  {
+    /* Everything up to the last '/' of the base's path */
+    for (dir_len = path_end - path; dir_len > 0 && path[dir_len - 1] != '/';
+         dir_len--)
+      ;
+    merged = g_strdup_printf ("%s%.*s%s", *path == '/' ? "" : "/",
+                              (int) dir_len, path, ref);
+  }
+
+  query = merged + strcspn (merged, "?#");
+  dir = g_strndup (merged, query - merged);
+  clean = flash_prefetch_remove_dots (dir);
+  url = g_strconcat (prefix, clean, query, NULL);
+
+  g_free (dir);
+  g_free (clean);
+  g_free (merged);
+  g_free (prefix);
+  return url;
+}
@@ -0,0 +1,58 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_PREFETCH_H__
+#define __FLASH_PREFETCH_H__
+
+#include <glib.h>
+#include "flash-library.h"
+
+G_BEGIN_DECLS
+
+/* Warms the caches with what a movie's scripts are likely to load, so
+ * the plugin doesn't wait on each one in turn. The URLs come from a
+ * static scan of the SWF data (flash_swf_find_urls()), made on a thread
+ * of its own while the movie streams to the plugin, and are resolved
+ * against the movie's URL. http:// URLs are fetched into the library's
+ * HTTP cache, a few at a time, and local files are read ahead into the
+ * page cache. */
+typedef struct _FlashPrefetch FlashPrefetch;
+
+/* Called once every URL has been dealt with, just before the prefetch is
+ * freed */
+typedef void (*FlashPrefetchDoneFunc) (FlashPrefetch *prefetch,
+                                       gpointer user_data);
+
+/* Called from the main loop once the prefetch of url is over, its
+ * response in the cache if it could be kept */
+typedef void (*FlashPrefetchWaitFunc) (const gchar *url, gpointer user_data);
+
+/* data must stay mapped until the done function is called or the
+ * prefetch is cancelled */
+FlashPrefetch *flash_prefetch_new    (FlashLibrary *library,
+                                      const gchar *base_url,
+                                      const guint8 *data, gsize size,
+                                      FlashPrefetchDoneFunc done,
+                                      gpointer done_data);
+/* For a request of url made elsewhere. Returns TRUE, and calls func
+ * later, if url is being fetched right now; one waiting its turn is
+ * dropped, leaving it to the caller to fetch, and FALSE returned. */
+gboolean       flash_prefetch_wait   (FlashPrefetch *prefetch,
+                                      const gchar *url,
+                                      FlashPrefetchWaitFunc func,
+                                      gpointer user_data);
+/* Drops the requests still running, without calling the done or wait
+ * functions; waits for the scan if it's still going */
+void           flash_prefetch_cancel (FlashPrefetch *prefetch);
+
+/* Resolves ref against base, as a browser would for a link. Only URLs
+ * of the form scheme:[//authority]/path are understood as a base. */
+gchar         *flash_prefetch_resolve_url (const gchar *base,
+                                           const gchar *ref);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,257 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash-common.h"
+#include "flash-prepare.h"
+#include "flash-swf.h"
+
+/* Most files looked at at once; enough to keep a disk's queue full */
+#define PREPARE_MAX_THREADS 8
+/* Read from the start of each file, plenty for a compressed header */
+#define PREPARE_HEADER_SIZE 256
+
+typedef struct {
+  gchar *path;
+  gchar *canon_path;
+  GError *error;
+  gsize size;
+  FlashSwfHeader header;
+} PrepareItem;
+
+struct _FlashPrepare {
+  FlashPrepareFlags flags;
+  PrepareItem *items;
+  gint n_items;
+  gint n_done;
+
+  GThreadPool *pool;
+  /* Items the workers have finished, and the idle that hands them back;
+   * idle_id is guarded by the queue's lock */
+  GAsyncQueue *finished;
+  guint idle_id;
+
+  /* Set while the callbacks run, so they can cancel */
+  gboolean dispatching;
+  gboolean cancelled;
+
+  FlashPrepareItemFunc item;
+  FlashPrepareDoneFunc done;
+  gpointer user_data;
+};
+
+static void
+flash_prepare_check (PrepareItem *item, FlashPrepareFlags flags)
+{
+  const gchar *exts[] = { ".swf", NULL };
+  guint8 buf[PREPARE_HEADER_SIZE];
+  struct stat sb;
+  ssize_t n;
+  int fd;
+
+  item->canon_path = flash_canonicalize_path (item->path);
+  if (!item->canon_path)
+  {
+    g_set_error (&item->error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS, "%s",
+                 "Invalid Flash file");
+    return;
+  }
+  if (!flash_is_valid_file (item->canon_path, exts, &item->error))
+    return;
+
+  fd = open (item->canon_path, O_RDONLY);
+  if (fd == -1 || fstat (fd, &sb) == -1)
+  {
+    g_set_error (&item->error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "%s", strerror (errno));
+    goto out;
+  }
+  item->size = sb.st_size;
+
+  n = pread (fd, buf, sizeof(buf), 0);
+  if (n == -1)
+  {
+    g_set_error (&item->error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "%s", strerror (errno));
+    goto out;
+  }
+  if (!flash_swf_parse_header (buf, n, &item->header, &item->error))
+    goto out;
+
+  if (flags & FLASH_PREPARE_WARM)
+    posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+
+out:
+  if (fd != -1)
+    close (fd);
+}
+
+static void
+flash_prepare_free (FlashPrepare *prepare)
+{
+  gint i;
+
+  while (g_async_queue_try_pop (prepare->finished))
+    ;
+  g_async_queue_unref (prepare->finished);
+  for (i = 0; i < prepare->n_items; i++)
+  {
+    g_free (prepare->items[i].path);
+    g_free (prepare->items[i].canon_path);
+    if (prepare->items[i].error)
+      g_error_free (prepare->items[i].error);
+  }
+  g_free (prepare->items);
+  g_free (prepare);
+}
+
+/* Stops the workers, waiting for any busy with a file, and the idle */
+static void
+flash_prepare_shutdown (FlashPrepare *prepare)
+{
+  if (prepare->pool)
+  {
+    g_thread_pool_free (prepare->pool, TRUE, TRUE);
+    prepare->pool = NULL;
+  }
+  g_async_queue_lock (prepare->finished);
+  if (prepare->idle_id)
+  {
+    g_source_remove (prepare->idle_id);
+    prepare->idle_id = 0;
+  }
+  g_async_queue_unlock (prepare->finished);
+}
+
+static gboolean
+flash_prepare_dispatch (gpointer data)
+{
+  FlashPrepare *prepare;
+  FlashPrepareResult result;
+  PrepareItem *item;
+  GList *items;
+  GList *l;
+
+  prepare = data;
+
+  g_async_queue_lock (prepare->finished);
+  prepare->idle_id = 0;
+  items = NULL;
+  while ((item = g_async_queue_try_pop_unlocked (prepare->finished)))
+    items = g_list_prepend (items, item);
+  g_async_queue_unlock (prepare->finished);
+  items = g_list_reverse (items);
+
+  prepare->dispatching = TRUE;
+  for (l = items; l && !prepare->cancelled; l = l->next)
+  {
+    item = l->data;
+    memset (&result, 0, sizeof(result));
+    result.path = item->path;
+    result.canon_path = item->canon_path;
+    result.error = item->error;
+    if (!item->error)
+    {
+      result.size = item->size;
+      result.version = item->header.version;
+      result.width = item->header.width;
+      result.height = item->header.height;
+      result.frame_rate = item->header.frame_rate;
+      result.frame_count = item->header.frame_count;
+    }
+    prepare->n_done++;
+    if (prepare->item)
+      prepare->item (prepare, item - prepare->items, &result,
+                     prepare->user_data);
+  }
+  g_list_free (items);
+
+  if (!prepare->cancelled && prepare->n_done == prepare->n_items)
+  {
+    if (prepare->done)
+      prepare->done (prepare, prepare->user_data);
+    prepare->cancelled = TRUE;
+  }
+  prepare->dispatching = FALSE;
+
+  if (prepare->cancelled)
+  {
+    flash_prepare_shutdown (prepare);
+    flash_prepare_free (prepare);
+  }
+  return FALSE;
+}
+
+/* Runs on a worker thread; only the item is touched until it's queued */
+static void
+flash_prepare_worker (gpointer data, gpointer user_data)
+{
+  FlashPrepare *prepare;
+  PrepareItem *item;
+
+  item = data;
+  prepare = user_data;
+  flash_prepare_check (item, prepare->flags);
+
+  g_async_queue_lock (prepare->finished);
+  g_async_queue_push_unlocked (prepare->finished, item);
+  if (!prepare->idle_id)
+    prepare->idle_id = g_idle_add (flash_prepare_dispatch, prepare);
+  g_async_queue_unlock (prepare->finished);
+}
+
+FlashPrepare *
+flash_prepare_new (gchar **paths, FlashPrepareFlags flags,
+                   FlashPrepareItemFunc item, FlashPrepareDoneFunc done,
+                   gpointer user_data)
+{
+  FlashPrepare *prepare;
+  gint i;
+
+  g_return_val_if_fail (g_thread_supported (), NULL);
+
+  if (!paths || !paths[0])
+    return NULL;
+
+  prepare = g_new0 (FlashPrepare, 1);
+  prepare->flags = flags;
+  prepare->item = item;
+  prepare->done = done;
+  prepare->user_data = user_data;
+
+  for (prepare->n_items = 0; paths[prepare->n_items]; prepare->n_items++)
+    ;
+  prepare->items = g_new0 (PrepareItem, prepare->n_items);
+  for (i = 0; i < prepare->n_items; i++)
+    prepare->items[i].path = g_strdup (paths[i]);
+
+  prepare->finished = g_async_queue_new ();
+  prepare->pool = g_thread_pool_new (flash_prepare_worker, prepare,
+                                     MIN (prepare->n_items,
+                                          PREPARE_MAX_THREADS),
+                                     FALSE, NULL);
+  DEBUG ("preparing %d files", prepare->n_items);
+  for (i = 0; i < prepare->n_items; i++)
+    g_thread_pool_push (prepare->pool, &prepare->items[i], NULL);
+  return prepare;
+}
+
+void
+flash_prepare_cancel (FlashPrepare *prepare)
+{
+  prepare->cancelled = TRUE;
+  /* Left for flash_prepare_dispatch() to finish */
+  if (prepare->dispatching)
+    return;
+  flash_prepare_shutdown (prepare);
+  flash_prepare_free (prepare);
+}
@@ -0,0 +1,62 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_PREPARE_H__
+#define __FLASH_PREPARE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Checks a batch of files at once, so a long playlist doesn't wait on
+ * each one's disk seeks in turn: every path is canonicalized, checked with
+ * flash_is_valid_file() and has its SWF header read, on a pool of worker
+ * threads. Results are handed back in the main loop, in the order they
+ * finish. flash_init() must have been called. */
+typedef struct _FlashPrepare FlashPrepare;
+
+typedef enum
+{
+  /* Also ask the kernel to read each valid file into the page cache */
+  FLASH_PREPARE_WARM = 1 << 0
+} FlashPrepareFlags;
+
+typedef struct {
+  const gchar *path;        /* as given */
+  const gchar *canon_path;  /* NULL if the path doesn't resolve */
+  const GError *error;      /* why the file can't be played, or NULL */
+
+  /* The rest only when error is NULL */
+  gsize size;
+  guint version;
+  gint width;
+  gint height;
+  gdouble frame_rate;
+  guint frame_count;
+} FlashPrepareResult;
+
+/* index is the path's position in the array given to flash_prepare_new();
+ * result only lasts for the call */
+typedef void (*FlashPrepareItemFunc) (FlashPrepare *prepare, gint index,
+                                      const FlashPrepareResult *result,
+                                      gpointer user_data);
+/* Called once every path has been dealt with, just before the prepare is
+ * freed */
+typedef void (*FlashPrepareDoneFunc) (FlashPrepare *prepare,
+                                      gpointer user_data);
+
+/* paths is NULL terminated, and copied. Returns NULL if it's empty. */
+FlashPrepare *flash_prepare_new    (gchar **paths, FlashPrepareFlags flags,
+                                    FlashPrepareItemFunc item,
+                                    FlashPrepareDoneFunc done,
+                                    gpointer user_data);
+/* Waits for the files being looked at to finish, then drops the rest
+ * without calling either function again */
+void          flash_prepare_cancel (FlashPrepare *prepare);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,24 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_SINK_INTERNAL_H__
+#define __FLASH_SINK_INTERNAL_H__
+
+#include <glib.h>
+#include "flash-npapi.h"
+#include "flash-sink.h"
+
+G_BEGIN_DECLS
+
+/* The NPN_NewStream/Write/DestroyStream side of a sink */
+void  flash_sink_open  (FlashSink *sink, const gchar *mime_type);
+/* Returns how many bytes were taken, or -1 on error or over budget */
+int32 flash_sink_write (FlashSink *sink, const void *buf, int32 len);
+void  flash_sink_close (FlashSink *sink, NPReason reason);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,344 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "flash-common.h"
+#include "flash-sink.h"
+#include "flash-sink-internal.h"
+#include "gtk2xtbin.h"
+
+/* With an Xt event thread the plugin writes into sinks from that thread,
+ * holding the plugin lock, so the entry points used from the main loop
+ * take it too */
+
+/* File and callback sinks pass data on in pieces of at least this much,
+ * or when the last stream ends */
+#define SINK_COALESCE_BYTES (16 * 1024)
+
+typedef enum
+{
+  SINK_BUFFER,
+  SINK_FILE,
+  SINK_CALLBACK
+} SinkType;
+
+struct _FlashSink {
+  gint ref_count;
+  SinkType type;
+  gsize budget;
+
+  /* Buffer sinks keep everything from offset on here; the others stage
+   * writes here until there is enough to pass on */
+  GByteArray *data;
+  gsize offset;
+
+  int fd;
+  gchar *path;
+  FlashSinkWriteFunc func;
+  gpointer func_data;
+
+  FlashSinkNotify notify;
+  gpointer notify_data;
+  guint notify_id;
+
+  gchar *mime_type;
+  guint64 total;
+  gint streams;
+  gboolean opened;
+  gboolean failed;
+};
+
+static FlashSink *
+flash_sink_new (SinkType type, gsize budget)
+{
+  FlashSink *sink;
+
+  sink = g_new0 (FlashSink, 1);
+  sink->ref_count = 1;
+  sink->type = type;
+  sink->budget = budget;
+  sink->data = g_byte_array_new ();
+  sink->fd = -1;
+  return sink;
+}
+
+FlashSink *
+flash_sink_new_buffer (gsize budget)
+{
+  return flash_sink_new (SINK_BUFFER, budget);
+}
+
+FlashSink *
+flash_sink_new_file (const gchar *path, gsize budget, GError **error)
+{
+  FlashSink *sink;
+  int fd;
+
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_ACCESS,
+                 "Failed to open() '%s': %s", path, strerror(errno));
+    return NULL;
+  }
+  sink = flash_sink_new (SINK_FILE, budget);
+  sink->fd = fd;
+  sink->path = g_strdup (path);
+  return sink;
+}
+
+FlashSink *
+flash_sink_new_callback (FlashSinkWriteFunc func, gpointer user_data,
+                         gsize budget)
+{
+  FlashSink *sink;
+
+  g_return_val_if_fail (func != NULL, NULL);
+
+  sink = flash_sink_new (SINK_CALLBACK, budget);
+  sink->func = func;
+  sink->func_data = user_data;
+  return sink;
+}
+
+/* Passes staged data on to the file or callback */
+static gboolean
+flash_sink_flush (FlashSink *sink)
+{
+  const guint8 *p;
+  gsize remaining;
+  ssize_t n;
+
+  if (sink->type == SINK_BUFFER || sink->data->len == 0)
+    return !sink->failed;
+
+  if (!sink->failed && sink->type == SINK_FILE)
+  {
+    p = sink->data->data;
+    remaining = sink->data->len;
+    while (remaining > 0)
+    {
+      n = write (sink->fd, p, remaining);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+      {
+        DEBUG ("failed to write() '%s': %s", sink->path, strerror(errno));
+        sink->failed = TRUE;
+        break;
+      }
+      p += n;
+      remaining -= n;
+    }
+  }
+  else if (!sink->failed && sink->type == SINK_CALLBACK)
+  {
+    if (!sink->func (sink, sink->data->data, sink->data->len,
+                     sink->func_data))
+      sink->failed = TRUE;
+  }
+  g_byte_array_set_size (sink->data, 0);
+  return !sink->failed;
+}
+
+FlashSink *
+flash_sink_ref (FlashSink *sink)
+{
+  gtk_xtbin_plugin_lock ();
+  sink->ref_count++;
+  gtk_xtbin_plugin_unlock ();
+  return sink;
+}
+
+void
+flash_sink_unref (FlashSink *sink)
+{
+  gtk_xtbin_plugin_lock ();
+  if (--sink->ref_count > 0)
+  {
+    gtk_xtbin_plugin_unlock ();
+    return;
+  }
+  flash_sink_flush (sink);
+  gtk_xtbin_plugin_unlock ();
+
+  if (sink->fd != -1)
+    close (sink->fd);
+  g_byte_array_free (sink->data, TRUE);
+  g_free (sink->path);
+  g_free (sink->mime_type);
+  g_free (sink);
+}
+
+static gboolean
+flash_sink_notify_idle (gpointer data)
+{
+  FlashSink *sink;
+
+  sink = data;
+  gtk_xtbin_plugin_lock ();
+  sink->notify_id = 0;
+  if (sink->notify)
+    sink->notify (sink, sink->notify_data);
+  flash_sink_unref (sink);
+  gtk_xtbin_plugin_unlock ();
+  return FALSE;
+}
+
+/* Coalesces notifications to one per main loop iteration; the pending
+ * idle holds a reference */
+static void
+flash_sink_queue_notify (FlashSink *sink)
+{
+  if (!sink->notify || sink->notify_id)
+    return;
+  flash_sink_ref (sink);
+  sink->notify_id = g_idle_add (flash_sink_notify_idle, sink);
+}
+
+void
+flash_sink_set_notify (FlashSink *sink, FlashSinkNotify notify,
+                       gpointer user_data)
+{
+  gtk_xtbin_plugin_lock ();
+  sink->notify = notify;
+  sink->notify_data = user_data;
+  gtk_xtbin_plugin_unlock ();
+}
+
+gsize
+flash_sink_read (FlashSink *sink, guint8 *buf, gsize len)
+{
+  gsize n;
+
+  g_return_val_if_fail (sink->type == SINK_BUFFER, 0);
+
+  gtk_xtbin_plugin_lock ();
+  n = MIN (len, sink->data->len - sink->offset);
+  memcpy (buf, sink->data->data + sink->offset, n);
+  sink->offset += n;
+  if (sink->offset == sink->data->len)
+  {
+    g_byte_array_set_size (sink->data, 0);
+    sink->offset = 0;
+  }
+  gtk_xtbin_plugin_unlock ();
+  return n;
+}
+
+gsize
+flash_sink_get_available (FlashSink *sink)
+{
+  gsize n;
+
+  if (sink->type != SINK_BUFFER)
+    return 0;
+  gtk_xtbin_plugin_lock ();
+  n = sink->data->len - sink->offset;
+  gtk_xtbin_plugin_unlock ();
+  return n;
+}
+
+guint64
+flash_sink_get_total (FlashSink *sink)
+{
+  guint64 total;
+
+  gtk_xtbin_plugin_lock ();
+  total = sink->total;
+  gtk_xtbin_plugin_unlock ();
+  return total;
+}
+
+const gchar *
+flash_sink_get_mime_type (FlashSink *sink)
+{
+  return sink->mime_type;
+}
+
+gboolean
+flash_sink_is_closed (FlashSink *sink, gboolean *failed)
+{
+  gboolean closed;
+
+  gtk_xtbin_plugin_lock ();
+  if (failed)
+    *failed = sink->failed;
+  closed = sink->opened && sink->streams == 0;
+  gtk_xtbin_plugin_unlock ();
+  return closed;
+}
+
+void
+flash_sink_open (FlashSink *sink, const gchar *mime_type)
+{
+  g_free (sink->mime_type);
+  sink->mime_type = g_strdup (mime_type);
+  sink->opened = TRUE;
+  sink->streams++;
+}
+
+int32
+flash_sink_write (FlashSink *sink, const void *buf, int32 len)
+{
+  gsize used;
+  gsize room;
+  gsize unread;
+
+  if (sink->failed || len < 0)
+    return -1;
+
+  if (sink->budget)
+  {
+    if (sink->type == SINK_BUFFER)
+      used = sink->data->len - sink->offset;
+    else
+      used = sink->total;
+    room = used < sink->budget ? sink->budget - used : 0;
+    if (room == 0 && len > 0)
+    {
+      DEBUG ("sink over its budget of %lu bytes", (gulong) sink->budget);
+      sink->failed = TRUE;
+      return -1;
+    }
+    if ((gsize) len > room)
+      len = room;
+  }
+
+  /* Drop what has been read rather than growing the buffer */
+  if (sink->offset > 0 && sink->offset >= sink->data->len / 2)
+  {
+    unread = sink->data->len - sink->offset;
+    memmove (sink->data->data, sink->data->data + sink->offset, unread);
+    g_byte_array_set_size (sink->data, unread);
+    sink->offset = 0;
+  }
+
+  g_byte_array_append (sink->data, buf, len);
+  sink->total += len;
+  if (sink->data->len >= SINK_COALESCE_BYTES && !flash_sink_flush (sink))
+    return -1;
+  flash_sink_queue_notify (sink);
+  return len;
+}
+
+void
+flash_sink_close (FlashSink *sink, NPReason reason)
+{
+  if (reason != NPRES_DONE)
+    sink->failed = TRUE;
+  if (sink->streams > 0)
+    sink->streams--;
+  if (sink->streams == 0)
+    flash_sink_flush (sink);
+  flash_sink_queue_notify (sink);
+}
@@ -0,0 +1,59 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_SINK_H__
+#define __FLASH_SINK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Where a stream the plugin sends to the host (NPN_NewStream) ends up.
+ * Small writes from the plugin are coalesced before they reach a file or
+ * callback. A budget other than 0 caps what a sink takes: for buffer
+ * sinks the bytes not read yet, for the others everything written; a
+ * write past it fails, which makes the plugin give up on the stream.
+ * Several streams may share a sink, one after another or at once. */
+typedef struct _FlashSink FlashSink;
+
+/* Return FALSE to fail the plugin's write. With flash_set_event_thread()
+ * on, called from the Xt event thread with the plugin lock held, like the
+ * rest of a sink's work on the plugin's side; the functions below take
+ * that lock, so may be used from the main loop meanwhile. */
+typedef gboolean (*FlashSinkWriteFunc) (FlashSink *sink, const guint8 *data,
+                                        gsize len, gpointer user_data);
+
+/* Called from the main loop once new data has arrived (at most once per
+ * iteration), and when the last stream into the sink has ended */
+typedef void (*FlashSinkNotify) (FlashSink *sink, gpointer user_data);
+
+FlashSink *flash_sink_new_buffer   (gsize budget);
+FlashSink *flash_sink_new_file     (const gchar *path, gsize budget,
+                                    GError **error);
+FlashSink *flash_sink_new_callback (FlashSinkWriteFunc func,
+                                    gpointer user_data, gsize budget);
+FlashSink *flash_sink_ref          (FlashSink *sink);
+void       flash_sink_unref        (FlashSink *sink);
+
+void       flash_sink_set_notify   (FlashSink *sink, FlashSinkNotify notify,
+                                    gpointer user_data);
+
+/* Takes up to len bytes out of a buffer sink; returns how many */
+gsize      flash_sink_read         (FlashSink *sink, guint8 *buf, gsize len);
+/* Bytes a buffer sink holds that haven't been read */
+gsize      flash_sink_get_available (FlashSink *sink);
+/* Bytes taken from the plugin so far */
+guint64    flash_sink_get_total    (FlashSink *sink);
+/* The MIME type of the last stream opened into the sink, if any; a new
+ * stream can replace it, so copy it inside the notify function */
+const gchar *flash_sink_get_mime_type (FlashSink *sink);
+/* TRUE once a stream has been opened and every stream has ended; failed
+ * is set if any ended in error, was aborted, or went over the budget */
+gboolean   flash_sink_is_closed    (FlashSink *sink, gboolean *failed);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,129 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <string.h>
+
+#include "flash-common.h"
+#include "flash-stream.h"
+#include "flash-library-internal.h"
+
+FlashStream *
+flash_stream_open (FlashLibrary *library, NPP instance, const gchar *url,
+                   const gchar *mime_type, guint64 length, uint16 *stype,
+                   void *notify_data, FlashStreamStats *totals,
+                   NPError *nperr)
+{
+  FlashStream *stream;
+
+  stream = g_new0 (FlashStream, 1);
+  stream->npstream.ndata = stream;
+  stream->npstream.url = g_strdup (url);
+  /* end is only 32 bits wide; longer streams go out as being of unknown
+   * length, as browsers send them */
+  stream->npstream.end = length <= G_MAXUINT32 ? (uint32) length : 0;
+  stream->npstream.pdata = NULL;
+  stream->npstream.lastmodified = 0;
+  stream->npstream.notifyData = notify_data;
+  stream->library = library;
+  stream->instance = instance;
+  stream->totals = totals;
+  stream->stats.streams = 1;
+  stream->blocked_since = -1;
+  stream->timer = g_timer_new ();
+
+  *nperr = PLUGIN_CALL (stream, newstream, instance, (char *) mime_type,
+                        &stream->npstream,
+                        0, /* default to non-seekable for all */
+                        stype);
+  if (*nperr != NPERR_NO_ERROR)
+  {
+    g_timer_destroy (stream->timer);
+    g_free ((gchar *) stream->npstream.url);
+    g_free (stream);
+    return NULL;
+  }
+  return stream;
+}
+
+int32
+flash_stream_write (FlashStream *stream, const void *buf, int32 len)
+{
+  int32 maxwrite;
+  int32 nwritten;
+  gdouble start;
+
+  start = g_timer_elapsed (stream->timer, NULL);
+  maxwrite = PLUGIN_CALL (stream, writeready, stream->instance,
+                          &stream->npstream);
+  if (maxwrite <= 0)
+  {
+    if (stream->blocked_since < 0)
+      stream->blocked_since = start;
+    return 0;
+  }
+  if (stream->blocked_since >= 0)
+  {
+    stream->stats.blocked += start - stream->blocked_since;
+    stream->blocked_since = -1;
+  }
+
+  if (len > maxwrite)
+    len = maxwrite;
+  /* The offset wraps past 2 GB; the plugin can't be told any better */
+  nwritten = PLUGIN_CALL (stream, write, stream->instance, &stream->npstream,
+                          (int32) stream->stats.bytes, len, (void *) buf);
+  stream->stats.plugin_write += g_timer_elapsed (stream->timer, NULL) - start;
+  stream->stats.writes++;
+  if (nwritten < 0)
+    return -1;
+
+  if (stream->stats.bytes == 0 && nwritten > 0)
+    stream->stats.first_byte = g_timer_elapsed (stream->timer, NULL);
+  stream->stats.bytes += nwritten;
+  return nwritten;
+}
+
+void
+flash_stream_close (FlashStream *stream, NPReason reason)
+{
+  gdouble now;
+
+  PLUGIN_CALL (stream, destroystream, stream->instance, &stream->npstream,
+               reason);
+
+  now = g_timer_elapsed (stream->timer, NULL);
+  if (stream->blocked_since >= 0)
+    stream->stats.blocked += now - stream->blocked_since;
+  stream->stats.latency = now;
+
+  DEBUG ("%s: %lu bytes in %u writes, %.1f ms to first byte, "
+         "%.1f ms blocked, %.1f ms in plugin, %.1f ms total",
+         stream->npstream.url, (gulong) stream->stats.bytes,
+         stream->stats.writes, stream->stats.first_byte * 1000,
+         stream->stats.blocked * 1000, stream->stats.plugin_write * 1000,
+         stream->stats.latency * 1000);
+
+  if (stream->totals)
+    flash_stream_stats_add (stream->totals, &stream->stats);
+  flash_library_add_stream_stats (stream->library, &stream->stats);
+
+  g_timer_destroy (stream->timer);
+  g_free ((gchar *) stream->npstream.url);
+  g_free (stream);
+}
+
+void
+flash_stream_stats_add (FlashStreamStats *totals,
+                        const FlashStreamStats *stats)
+{
+  totals->streams += stats->streams;
+  totals->bytes += stats->bytes;
+  totals->writes += stats->writes;
+  totals->blocked += stats->blocked;
+  totals->plugin_write += stats->plugin_write;
+  totals->first_byte += stats->first_byte;
+  totals->latency += stats->latency;
+}
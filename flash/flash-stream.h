@@ -0,0 +1,53 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_STREAM_H__
+#define __FLASH_STREAM_H__
+
+#include <glib.h>
+#include "flash-npapi.h"
+#include "flash-library.h"
+
+G_BEGIN_DECLS
+
+/* A host to plugin stream. The NPStream handed to the plugin is embedded,
+ * so the NPN_* callbacks can get back to the FlashStream from it. */
+typedef struct {
+  NPStream npstream;
+  FlashLibrary *library;
+  NPP instance;
+
+  /* Where the stats end up when the stream is closed, besides the
+   * library's totals */
+  FlashStreamStats *totals;
+  FlashStreamStats stats;
+  GTimer *timer;
+  gdouble blocked_since;
+} FlashStream;
+
+/* Sends NPP_NewStream. length is the stream's size in bytes, 0 if it
+ * isn't known. Returns NULL, with *nperr set, if the plugin refuses the
+ * stream. */
+FlashStream *flash_stream_open  (FlashLibrary *library, NPP instance,
+                                 const gchar *url, const gchar *mime_type,
+                                 guint64 length, uint16 *stype,
+                                 void *notify_data,
+                                 FlashStreamStats *totals, NPError *nperr);
+/* Offers up to len bytes at the stream's current offset; returns how many
+ * the plugin took, which is 0 while it isn't ready, or -1 if it wants the
+ * stream aborted */
+int32        flash_stream_write (FlashStream *stream, const void *buf,
+                                 int32 len);
+/* Sends NPP_DestroyStream and frees the stream */
+void         flash_stream_close (FlashStream *stream, NPReason reason);
+
+/* Adds one stream's figures to a running total */
+void         flash_stream_stats_add (FlashStreamStats *totals,
+                                     const FlashStreamStats *stats);
+
+G_END_DECLS
+
+#endif
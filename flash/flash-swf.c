@@ -0,0 +1,481 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#include <string.h>
+#include <zlib.h>
+
+#include "flash-common.h"
+#include "flash-swf.h"
+
+/* Signature, version and length */
+#define SWF_PREFIX_SIZE 8
+/* The largest possible stage RECT (5 + 4 * 31 bits), frame rate and count */
+#define SWF_HEADER_MAX  (17 + 2 + 2)
+/* Movies bigger than this uncompressed aren't scanned for URLs */
+#define SWF_SCAN_MAX    (64 * 1024 * 1024)
+#define SWF_URL_MAX     1024
+
+#define SWF_TAG_END             0
+#define SWF_TAG_DO_ACTION       12
+#define SWF_TAG_DEFINE_SPRITE   39
+#define SWF_TAG_DO_INIT_ACTION  59
+#define SWF_TAG_DO_ABC_1        72
+#define SWF_TAG_DO_ABC          82
+
+#define SWF_ACTION_GET_URL       0x83
+#define SWF_ACTION_CONSTANT_POOL 0x88
+#define SWF_ACTION_PUSH          0x96
+
+#define GET_UINT16(p) ((p)[0] | ((p)[1] << 8))
+#define GET_UINT32(p) \
+  ((guint32) (p)[0] | ((guint32) (p)[1] << 8) | \
+   ((guint32) (p)[2] << 16) | ((guint32) (p)[3] << 24))
+
+typedef struct {
+  GPtrArray *urls;
+  GHashTable *seen;
+} SwfScan;
+
+static gint flash_swf_read_bits (const guint8 *data, gsize *bit, gint nbits,
+                                 gboolean is_signed);
+static void flash_swf_scan_tags (SwfScan *scan, const guint8 *p,
+                                 const guint8 *end, gboolean in_sprite);
+
+gboolean
+flash_swf_parse_header (const guint8 *data, gsize size,
+                        FlashSwfHeader *header, GError **error)
+{
+  guint8 buf[SWF_HEADER_MAX];
+  const guint8 *rest;
+  gsize rest_size;
+  gsize bit;
+  gint nbits;
+  gint xmin, xmax, ymin, ymax;
+  z_stream zs;
+  int zret;
+
+  if (size < SWF_PREFIX_SIZE ||
+      (memcmp (data, "FWS", 3) != 0 && memcmp (data, "CWS", 3) != 0))
+  {
+    g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT, "%s",
+                 "Not an SWF file, or an unsupported compression");
+    return FALSE;
+  }
+
+  memset (header, 0, sizeof(FlashSwfHeader));
+  header->compressed = data[0] == 'C';
+  header->version = data[3];
+  header->length = GET_UINT32 (data + 4);
+
+  if (header->compressed)
+  {
+    /* Only the start of the stream is needed */
+    memset (&zs, 0, sizeof(zs));
+    if (inflateInit (&zs) != Z_OK)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT, "%s",
+                   "Failed to initialize zlib");
+      return FALSE;
+    }
+    zs.next_in = (Bytef *) data + SWF_PREFIX_SIZE;
+    zs.avail_in = size - SWF_PREFIX_SIZE;
+    zs.next_out = buf;
+    zs.avail_out = sizeof(buf);
+    zret = inflate (&zs, Z_SYNC_FLUSH);
+    rest_size = sizeof(buf) - zs.avail_out;
+    inflateEnd (&zs);
+    if (zret != Z_OK && zret != Z_STREAM_END)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                   "Corrupt compressed SWF header: %s",
+                   zs.msg ? zs.msg : "unknown error");
+      return FALSE;
+    }
+    rest = buf;
+  }
+  else
+  {
+    rest = data + SWF_PREFIX_SIZE;
+    rest_size = size - SWF_PREFIX_SIZE;
+  }
+
+  if (rest_size < 1)
+    goto truncated;
+  nbits = rest[0] >> 3;
+  /* RECT, padded to a byte, then the frame rate and count */
+  if (rest_size < (5 + 4 * (gsize) nbits + 7) / 8 + 4)
+    goto truncated;
+
+  bit = 5;
+  xmin = flash_swf_read_bits (rest, &bit, nbits, TRUE);
+  xmax = flash_swf_read_bits (rest, &bit, nbits, TRUE);
+  ymin = flash_swf_read_bits (rest, &bit, nbits, TRUE);
+  ymax = flash_swf_read_bits (rest, &bit, nbits, TRUE);
+  rest += (bit + 7) / 8;
+
+  /* Twips are 1/20th of a pixel, the frame rate is 8.8 fixed point */
+  header->width = (xmax - xmin) / 20;
+  header->height = (ymax - ymin) / 20;
+  header->frame_rate = GET_UINT16 (rest) / 256.0;
+  header->frame_count = GET_UINT16 (rest + 2);
+  return TRUE;
+
+truncated:
+  g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT, "%s",
+               "Truncated SWF header");
+  return FALSE;
+}
+
+/* Reads nbits bits MSB first, starting at bit offset *bit */
+static gint
+flash_swf_read_bits (const guint8 *data, gsize *bit, gint nbits,
+                     gboolean is_signed)
+{
+  guint32 value;
+  gint i;
+
+  value = 0;
+  for (i = 0; i < nbits; i++, (*bit)++)
+    value = (value << 1) | ((data[*bit / 8] >> (7 - *bit % 8)) & 1);
+  if (is_signed && nbits > 0 && nbits < 32 && (value & (1U << (nbits - 1))))
+    value |= ~0U << nbits;
+  return (gint) value;
+}
+
+/* --- URL scan --- */
+
+/* Absolute http(s) URLs, and relative references to the kinds of file a
+ * movie loads. Anything else with a scheme (javascript:, FSCommand:,
+ * mailto:, ...) is left alone. */
+static gboolean
+flash_swf_is_url (const gchar *s, gsize len)
+{
+  static const gchar *exts[] = {
+    ".swf", ".flv", ".mp3", ".xml", ".jpg", ".jpeg", ".png", ".gif",
+    ".txt", NULL
+  };
+  gsize path_len;
+  gsize ext_len;
+  gsize i;
+
+  if (len < 5 || len > SWF_URL_MAX)
+    return FALSE;
+  for (i = 0; i < len; i++)
+  {
+    if ((guchar) s[i] <= ' ' || s[i] == '"' || s[i] == '\'' ||
+        s[i] == '<' || s[i] == '>' || s[i] == '\\')
+      return FALSE;
+  }
+  if (g_ascii_strncasecmp (s, "http://", 7) == 0 ||
+      g_ascii_strncasecmp (s, "https://", 8) == 0)
+    return TRUE;
+
+  for (i = 0; i < len && s[i] != '/' && s[i] != '?'; i++)
+  {
+    if (s[i] == ':')
+      return FALSE;
+  }
+  for (path_len = 0; path_len < len && s[path_len] != '?' &&
+       s[path_len] != '#'; path_len++)
+    ;
+  for (i = 0; exts[i]; i++)
+  {
+    ext_len = strlen (exts[i]);
+    if (path_len > ext_len &&
+        g_ascii_strncasecmp (s + path_len - ext_len, exts[i], ext_len) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static void
+flash_swf_add_string (SwfScan *scan, const guint8 *s, gsize len)
+{
+  gchar *url;
+
+  if (!flash_swf_is_url ((const gchar *) s, len))
+    return;
+  url = g_strndup ((const gchar *) s, len);
+  if (g_hash_table_lookup (scan->seen, url))
+  {
+    g_free (url);
+    return;
+  }
+  g_hash_table_insert (scan->seen, url, url);
+  g_ptr_array_add (scan->urls, url);
+}
+
+/* Adds the NUL terminated string at *p, and moves past it. FALSE if it
+ * runs off the end. */
+static gboolean
+flash_swf_scan_string (SwfScan *scan, const guint8 **p, const guint8 *end)
+{
+  const guint8 *nul;
+
+  nul = memchr (*p, '\0', end - *p);
+  if (!nul)
+    return FALSE;
+  flash_swf_add_string (scan, *p, nul - *p);
+  *p = nul + 1;
+  return TRUE;
+}
+
+static void
+flash_swf_scan_push (SwfScan *scan, const guint8 *p, const guint8 *end)
+{
+  /* Sizes of the value types after the string (type 0) */
+  static const gint sizes[] = { -1, 4, 0, 0, 1, 1, 8, 4, 1, 2 };
+  guint type;
+
+  while (p < end)
+  {
+    type = *p++;
+    if (type == 0)
+    {
+      if (!flash_swf_scan_string (scan, &p, end))
+        return;
+    }
+    else if (type < G_N_ELEMENTS (sizes) && end - p >= sizes[type])
+      p += sizes[type];
+    else
+      return;
+  }
+}
+
+/* Function bodies follow their DefineFunction records inline, so a
+ * straight walk over the records sees every action */
+static void
+flash_swf_scan_actions (SwfScan *scan, const guint8 *p, const guint8 *end)
+{
+  const guint8 *q;
+  const guint8 *record_end;
+  guint code;
+  guint count;
+
+  while (p < end)
+  {
+    code = *p++;
+    if (code == 0)
+      break;
+    if (code < 0x80)
+      continue;
+    if (end - p < 2)
+      break;
+    record_end = p + 2 + GET_UINT16 (p);
+    if (record_end > end)
+      break;
+    q = p + 2;
+    switch (code)
+    {
+      case SWF_ACTION_CONSTANT_POOL:
+        if (record_end - q < 2)
+          break;
+        count = GET_UINT16 (q);
+        q += 2;
+        while (count-- > 0 && flash_swf_scan_string (scan, &q, record_end))
+          ;
+        break;
+      case SWF_ACTION_GET_URL:
+        flash_swf_scan_string (scan, &q, record_end);
+        break;
+      case SWF_ACTION_PUSH:
+        flash_swf_scan_push (scan, q, record_end);
+        break;
+    }
+    p = record_end;
+  }
+}
+
+static gboolean
+flash_swf_read_u30 (const guint8 **p, const guint8 *end, guint32 *value)
+{
+  gint shift;
+
+  *value = 0;
+  for (shift = 0; shift < 35; shift += 7)
+  {
+    if (*p >= end)
+      return FALSE;
+    *value |= (guint32) (**p & 0x7f) << shift;
+    if (!(*(*p)++ & 0x80))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Only the string table of the constant pool is looked at; the integer
+ * tables before it are walked over */
+static void
+flash_swf_scan_abc (SwfScan *scan, const guint8 *p, const guint8 *end)
+{
+  guint32 count;
+  guint32 value;
+  guint32 len;
+  gint table;
+
+  /* minor_version, major_version */
+  if (end - p < 4)
+    return;
+  p += 4;
+
+  /* int and uint */
+  for (table = 0; table < 2; table++)
+  {
+    if (!flash_swf_read_u30 (&p, end, &count))
+      return;
+    while (count-- > 1)
+    {
+      if (!flash_swf_read_u30 (&p, end, &value))
+        return;
+    }
+  }
+  /* double */
+  if (!flash_swf_read_u30 (&p, end, &count))
+    return;
+  if (count > 1)
+  {
+    if ((gsize) (end - p) / 8 < count - 1)
+      return;
+    p += 8 * (count - 1);
+  }
+  /* string */
+  if (!flash_swf_read_u30 (&p, end, &count))
+    return;
+  while (count-- > 1)
+  {
+    if (!flash_swf_read_u30 (&p, end, &len) || len > (gsize) (end - p))
+      return;
+    flash_swf_add_string (scan, p, len);
+    p += len;
+  }
+}
+
+/* Sprites can't be nested, so a DefineSprite inside one is skipped
+ * rather than followed, however deep a crafted file goes */
+static void
+flash_swf_scan_tags (SwfScan *scan, const guint8 *p, const guint8 *end,
+                     gboolean in_sprite)
+{
+  const guint8 *q;
+  guint code;
+  guint32 len;
+
+  while (end - p >= 2)
+  {
+    code = GET_UINT16 (p) >> 6;
+    len = GET_UINT16 (p) & 0x3f;
+    p += 2;
+    if (len == 0x3f)
+    {
+      if (end - p < 4)
+        break;
+      len = GET_UINT32 (p);
+      p += 4;
+    }
+    if (code == SWF_TAG_END || len > (gsize) (end - p))
+      break;
+
+    switch (code)
+    {
+      case SWF_TAG_DO_ACTION:
+        flash_swf_scan_actions (scan, p, p + len);
+        break;
+      case SWF_TAG_DO_INIT_ACTION:
+        /* Sprite ID */
+        if (len > 2)
+          flash_swf_scan_actions (scan, p + 2, p + len);
+        break;
+      case SWF_TAG_DEFINE_SPRITE:
+        /* Sprite ID and frame count */
+        if (len > 4 && !in_sprite)
+          flash_swf_scan_tags (scan, p + 4, p + len, TRUE);
+        break;
+      case SWF_TAG_DO_ABC:
+        /* Flags, then a name */
+        q = len > 4 ? memchr (p + 4, '\0', len - 4) : NULL;
+        if (q)
+          flash_swf_scan_abc (scan, q + 1, p + len);
+        break;
+      case SWF_TAG_DO_ABC_1:
+        flash_swf_scan_abc (scan, p, p + len);
+        break;
+    }
+    p += len;
+  }
+}
+
+gchar **
+flash_swf_find_urls (const guint8 *data, gsize size, GError **error)
+{
+  FlashSwfHeader header;
+  SwfScan scan;
+  guint8 *inflated;
+  const guint8 *body;
+  gsize body_size;
+  gsize rect_size;
+  z_stream zs;
+  int zret;
+
+  if (!flash_swf_parse_header (data, size, &header, error))
+    return NULL;
+
+  inflated = NULL;
+  if (header.compressed)
+  {
+    if (header.length > SWF_SCAN_MAX)
+    {
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                   "SWF file too large to scan (%u bytes)", header.length);
+      return NULL;
+    }
+    inflated = g_malloc (MAX (header.length, SWF_PREFIX_SIZE) -
+                         SWF_PREFIX_SIZE + 1);
+    memset (&zs, 0, sizeof(zs));
+    if (inflateInit (&zs) != Z_OK)
+    {
+      g_free (inflated);
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT, "%s",
+                   "Failed to initialize zlib");
+      return NULL;
+    }
+    zs.next_in = (Bytef *) data + SWF_PREFIX_SIZE;
+    zs.avail_in = size - SWF_PREFIX_SIZE;
+    zs.next_out = inflated;
+    zs.avail_out = MAX (header.length, SWF_PREFIX_SIZE) - SWF_PREFIX_SIZE;
+    zret = inflate (&zs, Z_FINISH);
+    body_size = zs.total_out;
+    inflateEnd (&zs);
+    /* A truncated stream still gives the tags before the damage */
+    if (zret != Z_STREAM_END && zret != Z_BUF_ERROR && zret != Z_OK)
+    {
+      g_free (inflated);
+      g_set_error (error, FLASH_ERROR, FLASH_ERROR_FILE_FORMAT,
+                   "Corrupt compressed SWF: %s",
+                   zs.msg ? zs.msg : "unknown error");
+      return NULL;
+    }
+    body = inflated;
+  }
+  else
+  {
+    body = data + SWF_PREFIX_SIZE;
+    body_size = size - SWF_PREFIX_SIZE;
+  }
+
+  scan.urls = g_ptr_array_new ();
+  scan.seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* Stage RECT, frame rate and count */
+  rect_size = body_size > 0 ? (5 + 4 * (gsize) (body[0] >> 3) + 7) / 8 : 0;
+  if (body_size > rect_size + 4)
+    flash_swf_scan_tags (&scan, body + rect_size + 4, body + body_size,
+                         FALSE);
+
+  g_hash_table_destroy (scan.seen);
+  g_free (inflated);
+  g_ptr_array_add (scan.urls, NULL);
+  return (gchar **) g_ptr_array_free (scan.urls, FALSE);
+}
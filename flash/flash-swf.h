@@ -0,0 +1,41 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+#ifndef __FLASH_SWF_H__
+#define __FLASH_SWF_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* What the SWF header says about a movie */
+typedef struct {
+  gboolean compressed;   /* "CWS", zlib compressed after the first 8 bytes */
+  guint version;
+  guint32 length;        /* uncompressed length of the whole file */
+  gint width;            /* stage size, in pixels */
+  gint height;
+  gdouble frame_rate;    /* nominal frames per second */
+  guint frame_count;
+} FlashSwfHeader;
+
+/* Parses the header at the start of an SWF file. Only the first few dozen
+ * bytes are looked at, so data needn't be the whole file. LZMA ("ZWS")
+ * files aren't supported. */
+gboolean flash_swf_parse_header (const guint8 *data, gsize size,
+                                 FlashSwfHeader *header, GError **error);
+
+/* Finds string literals in the movie's ActionScript that look like URLs:
+ * constant pools, pushed strings and GetURL targets in DoAction and
+ * DoInitAction tags (sprites included), and DoABC string tables. Returns
+ * a NULL terminated array of distinct strings, in the order found, to be
+ * freed with g_strfreev(). */
+gchar  **flash_swf_find_urls    (const guint8 *data, gsize size,
+                                 GError **error);
+
+G_END_DECLS
+
+#endif
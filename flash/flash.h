@@ -7,8 +7,14 @@
 #ifndef __FLASH_H__
 #define __FLASH_H__
 
+#include <flash/flash-bundle.h>
 #include <flash/flash-common.h>
+#include <flash/flash-export.h>
 #include <flash/flash-file.h>
+#include <flash/flash-host.h>
 #include <flash/flash-library.h>
+#include <flash/flash-playlist.h>
+#include <flash/flash-prepare.h>
+#include <flash/flash-sink.h>
 
 #endif
@@ -0,0 +1,158 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+/* flash-bundle: packs files into a bundle for flash_file_new_from_bundle(),
+ * or lists what a bundle holds.
+ *
+ *   flash-bundle [-C dir] -o out.bundle path...
+ *   flash-bundle -l in.bundle
+ *
+ * Directories are added recursively. Files are named by their path
+ * relative to dir (the current directory by default), which is also
+ * where relative paths are looked up.
+ */
+
+#include <glib.h>
+#include <flash/flash.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+static void
+add_path (const char *dir, const char *name, GPtrArray *names,
+          GPtrArray *sources)
+{
+  const gchar *child;
+  gchar *source;
+  gchar *child_name;
+  struct stat sb;
+  GDir *d;
+
+  source = g_build_filename (dir, name, NULL);
+  if (stat (source, &sb) == -1)
+  {
+    fprintf (stderr, "flash-bundle: %s: %s\n", source, strerror (errno));
+    exit (1);
+  }
+
+  if (S_ISDIR (sb.st_mode))
+  {
+    d = g_dir_open (source, 0, NULL);
+    if (!d)
+    {
+      fprintf (stderr, "flash-bundle: can't read %s\n", source);
+      exit (1);
+    }
+    while ((child = g_dir_read_name (d)))
+    {
+      child_name = strcmp (name, ".") == 0 ? g_strdup (child)
+                   : g_build_filename (name, child, NULL);
+      add_path (dir, child_name, names, sources);
+      g_free (child_name);
+    }
+    g_dir_close (d);
+    g_free (source);
+    return;
+  }
+
+  g_ptr_array_add (names, g_strdup (name));
+  g_ptr_array_add (sources, source);
+}
+
+static int
+list (const char *path)
+{
+  FlashBundle *bundle;
+  const guint8 *data;
+  GError *error;
+  gsize size;
+  guint i;
+
+  error = NULL;
+  bundle = flash_bundle_open (path, &error);
+  if (!bundle)
+  {
+    fprintf (stderr, "flash-bundle: %s\n", error->message);
+    g_error_free (error);
+    return 1;
+  }
+  for (i = 0; i < flash_bundle_get_n_files (bundle); i++)
+  {
+    flash_bundle_lookup (bundle, flash_bundle_get_name (bundle, i), &data,
+                         &size);
+    printf ("%10lu %s\n", (gulong) size, flash_bundle_get_name (bundle, i));
+  }
+  flash_bundle_unref (bundle);
+  return 0;
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-C dir] -o out.bundle path...\n"
+           "       %s -l in.bundle\n", prog, prog);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  GPtrArray *names;
+  GPtrArray *sources;
+  const char *dir;
+  const char *output;
+  GError *error;
+  gboolean ok;
+  int opt;
+
+  dir = ".";
+  output = NULL;
+  while ((opt = getopt (argc, argv, "C:o:l:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'C':
+        dir = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'l':
+        return list (optarg);
+      default:
+        usage (argv[0]);
+    }
+  }
+  if (!output || optind >= argc)
+    usage (argv[0]);
+
+  names = g_ptr_array_new ();
+  sources = g_ptr_array_new ();
+  for (; optind < argc; optind++)
+    add_path (dir, argv[optind], names, sources);
+  g_ptr_array_add (names, NULL);
+  g_ptr_array_add (sources, NULL);
+
+  error = NULL;
+  ok = flash_bundle_write (output, (gchar **) names->pdata,
+                           (gchar **) sources->pdata, &error);
+  if (!ok)
+  {
+    fprintf (stderr, "flash-bundle: %s\n", error->message);
+    g_error_free (error);
+  }
+  else
+    printf ("%u files\n", names->len - 1);
+
+  g_strfreev ((gchar **) g_ptr_array_free (names, FALSE));
+  g_strfreev ((gchar **) g_ptr_array_free (sources, FALSE));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,416 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+/* flash-farm: renders SWF files to PNG stills using a pool of worker
+ * processes, each with its own Xvfb display and Flash library instance.
+ *
+ * Jobs are read from stdin, one per line:
+ *
+ *   input.swf output.png delay-ms
+ *
+ * and one result line per job is written to stdout:
+ *
+ *   ok|failed input.swf output.png total-ms play-ms capture-ms message
+ */
+
+#define _GNU_SOURCE
+#include <glib.h>
+#include <glib-object.h>
+#include <gtk/gtk.h>
+#include <flash/flash.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#define MAX_WORKERS 256
+#define MAX_LINE    4096
+
+typedef struct {
+  pid_t pid;
+  FILE *jobs;        /* supervisor -> worker */
+  FILE *results;     /* worker -> supervisor */
+  int results_fd;
+  gboolean busy;
+} Worker;
+
+static Worker workers[MAX_WORKERS];
+static int num_workers = 4;
+static int display_base = 99;
+static int screen_width = 640;
+static int screen_height = 480;
+static gboolean pin_cpus = FALSE;
+static gboolean event_thread = FALSE;
+static const char *plugin_path = "./libflashplayer.so";
+
+static double
+now_ms (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static gboolean
+on_render_timeout (gpointer data)
+{
+  gtk_main_quit ();
+  return FALSE;
+}
+
+static void
+worker_render (FlashLibrary *library, const char *input, const char *output,
+               int delay_ms, FILE *out)
+{
+  FlashFile *file;
+  GtkWidget *window;
+  GdkPixbuf *pixbuf;
+  GError *error;
+  double start, played, captured;
+
+  start = now_ms ();
+  played = captured = start;
+  window = NULL;
+  pixbuf = NULL;
+
+  error = NULL;
+  file = flash_file_new (library, input, NULL, NULL, &error);
+  if (!file)
+    goto out;
+
+  window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size (GTK_WINDOW (window), screen_width,
+                               screen_height);
+  gtk_widget_show (window);
+  gdk_flush ();
+
+  if (!flash_file_play (file, GTK_WINDOW (window), FALSE, &error))
+    goto out;
+
+  g_timeout_add (delay_ms, on_render_timeout, NULL);
+  gtk_main ();
+  played = now_ms ();
+
+  pixbuf = flash_file_capture (file, &error);
+  if (pixbuf)
+    gdk_pixbuf_save (pixbuf, output, "png", &error, NULL);
+  captured = now_ms ();
+
+out:
+  fprintf (out, "%s %s %s %.1f %.1f %.1f %s\n",
+           error ? "failed" : "ok", input, output,
+           now_ms () - start, played - start, captured - played,
+           error ? error->message : "-");
+  fflush (out);
+
+  if (error)
+    g_error_free (error);
+  if (pixbuf)
+    g_object_unref (pixbuf);
+  if (file)
+  {
+    flash_file_stop (file);
+    g_object_unref (file);
+  }
+  if (window)
+    gtk_widget_destroy (window);
+}
+
+static pid_t
+worker_start_xvfb (int display)
+{
+  char display_str[16];
+  char screen_str[32];
+  gchar *socket_path;
+  pid_t pid;
+  int i;
+
+  snprintf (display_str, sizeof(display_str), ":%d", display);
+  snprintf (screen_str, sizeof(screen_str), "%dx%dx24", screen_width,
+            screen_height);
+
+  pid = fork ();
+  if (pid == -1)
+    return -1;
+  if (pid == 0)
+  {
+    execlp ("Xvfb", "Xvfb", display_str, "-screen", "0", screen_str,
+            "-nolisten", "tcp", (char *)NULL);
+    _exit (127);
+  }
+
+  /* Wait up to five seconds for the server socket to show up */
+  socket_path = g_strdup_printf ("/tmp/.X11-unix/X%d", display);
+  for (i = 0; i < 100; i++)
+  {
+    if (g_file_test (socket_path, G_FILE_TEST_EXISTS))
+      break;
+    if (waitpid (pid, NULL, WNOHANG) == pid)
+    {
+      pid = -1;
+      break;
+    }
+    usleep (50000);
+  }
+  g_free (socket_path);
+  setenv ("DISPLAY", display_str, 1);
+  return pid;
+}
+
+static void
+worker_exit (pid_t xvfb_pid, int status)
+{
+  kill (xvfb_pid, SIGTERM);
+  waitpid (xvfb_pid, NULL, 0);
+  _exit (status);
+}
+
+static void
+worker_main (int index, pid_t xvfb_pid, FILE *jobs, FILE *results)
+{
+  FlashLibrary *library;
+  GError *error;
+  char line[MAX_LINE];
+  char input[MAX_LINE];
+  char output[MAX_LINE];
+  int delay_ms;
+  int argc;
+  char **argv;
+  char *args[] = { "flash-farm", NULL };
+  cpu_set_t cpus;
+
+  if (pin_cpus)
+  {
+    CPU_ZERO (&cpus);
+    CPU_SET (index % sysconf (_SC_NPROCESSORS_ONLN), &cpus);
+    sched_setaffinity (0, sizeof(cpus), &cpus);
+  }
+
+  /* GTK must only be initialized once DISPLAY points at our own server */
+  argc = 1;
+  argv = args;
+  if (!flash_init (&argc, &argv))
+  {
+    fprintf (stderr, "flash-farm: worker %d: failed to initialize\n", index);
+    worker_exit (xvfb_pid, 1);
+  }
+  flash_set_event_thread (event_thread);
+
+  error = NULL;
+  library = flash_library_new (plugin_path, &error);
+  if (!library)
+  {
+    fprintf (stderr, "flash-farm: worker %d: %s\n", index, error->message);
+    worker_exit (xvfb_pid, 1);
+  }
+
+  while (fgets (line, sizeof(line), jobs))
+  {
+    if (sscanf (line, "%s %s %d", input, output, &delay_ms) != 3)
+    {
+      fprintf (results, "failed - - 0 0 0 malformed job\n");
+      fflush (results);
+      continue;
+    }
+    worker_render (library, input, output, delay_ms, results);
+  }
+
+  g_object_unref (library);
+  worker_exit (xvfb_pid, 0);
+}
+
+static gboolean
+worker_spawn (int index)
+{
+  int job_pipe[2];
+  int result_pipe[2];
+  Worker *worker;
+  pid_t pid;
+  int i;
+
+  if (pipe (job_pipe) == -1 || pipe (result_pipe) == -1)
+    return FALSE;
+
+  worker = &workers[index];
+  pid = fork ();
+  if (pid == -1)
+    return FALSE;
+
+  if (pid == 0)
+  {
+    pid_t xvfb_pid;
+
+    close (job_pipe[1]);
+    close (result_pipe[0]);
+    /* Don't hold on to the other workers' pipes */
+    for (i = 0; i < index; i++)
+    {
+      fclose (workers[i].jobs);
+      fclose (workers[i].results);
+    }
+    xvfb_pid = worker_start_xvfb (display_base + index);
+    if (xvfb_pid == -1)
+    {
+      fprintf (stderr, "flash-farm: worker %d: failed to start Xvfb\n",
+               index);
+      _exit (1);
+    }
+    worker_main (index, xvfb_pid, fdopen (job_pipe[0], "r"),
+                 fdopen (result_pipe[1], "w"));
+  }
+
+  close (job_pipe[0]);
+  close (result_pipe[1]);
+  worker->pid = pid;
+  worker->jobs = fdopen (job_pipe[1], "w");
+  worker->results = fdopen (result_pipe[0], "r");
+  worker->results_fd = result_pipe[0];
+  worker->busy = FALSE;
+  return TRUE;
+}
+
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+           "usage: %s [-j workers] [-d display-base] [-s WxH] [-a] [-t] "
+           "[plugin.so] < jobs\n", prog);
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  struct pollfd fds[MAX_WORKERS];
+  char line[MAX_LINE];
+  gboolean input_done;
+  int workers_alive;
+  int jobs_submitted;
+  int jobs_done;
+  int jobs_failed;
+  double start;
+  int opt;
+  int i;
+
+  while ((opt = getopt (argc, argv, "j:d:s:at")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        num_workers = CLAMP (atoi (optarg), 1, MAX_WORKERS);
+        break;
+      case 'd':
+        display_base = atoi (optarg);
+        break;
+      case 's':
+        if (sscanf (optarg, "%dx%d", &screen_width, &screen_height) != 2)
+          usage (argv[0]);
+        break;
+      case 'a':
+        pin_cpus = TRUE;
+        break;
+      case 't':
+        event_thread = TRUE;
+        break;
+      default:
+        usage (argv[0]);
+    }
+  }
+  if (optind < argc)
+    plugin_path = argv[optind];
+
+  signal (SIGPIPE, SIG_IGN);
+  for (i = 0; i < num_workers; i++)
+  {
+    if (!worker_spawn (i))
+    {
+      fprintf (stderr, "flash-farm: failed to start worker %d\n", i);
+      return 1;
+    }
+  }
+
+  start = now_ms ();
+  input_done = FALSE;
+  workers_alive = num_workers;
+  jobs_submitted = jobs_done = jobs_failed = 0;
+  for (;;)
+  {
+    /* Hand out jobs to every idle worker */
+    for (i = 0; i < num_workers && !input_done; i++)
+    {
+      if (workers[i].busy || !workers[i].jobs)
+        continue;
+      if (!fgets (line, sizeof(line), stdin))
+      {
+        input_done = TRUE;
+        break;
+      }
+      if (line[0] == '\n' || line[0] == '#')
+      {
+        i--;
+        continue;
+      }
+      fputs (line, workers[i].jobs);
+      fflush (workers[i].jobs);
+      workers[i].busy = TRUE;
+      jobs_submitted++;
+    }
+
+    if ((input_done || workers_alive == 0) && jobs_done == jobs_submitted)
+      break;
+
+    for (i = 0; i < num_workers; i++)
+    {
+      fds[i].fd = workers[i].busy ? workers[i].results_fd : -1;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+    if (poll (fds, num_workers, -1) == -1 && errno != EINTR)
+      break;
+
+    for (i = 0; i < num_workers; i++)
+    {
+      if (!(fds[i].revents & (POLLIN | POLLHUP)))
+        continue;
+      workers[i].busy = FALSE;
+      jobs_done++;
+      if (!fgets (line, sizeof(line), workers[i].results))
+      {
+        /* Worker died, don't give it any more work */
+        fprintf (stdout, "failed - - 0 0 0 worker %d exited\n", i);
+        fclose (workers[i].jobs);
+        workers[i].jobs = NULL;
+        workers_alive--;
+        jobs_failed++;
+        continue;
+      }
+      if (strncmp (line, "ok ", 3) != 0)
+        jobs_failed++;
+      fputs (line, stdout);
+      fflush (stdout);
+    }
+  }
+
+  fprintf (stderr, "flash-farm: %d jobs (%d failed) in %.1f ms on %d workers, "
+           "%.2f jobs/s\n", jobs_done, jobs_failed, now_ms () - start,
+           num_workers, jobs_done * 1000.0 / MAX (now_ms () - start, 1.0));
+
+  for (i = 0; i < num_workers; i++)
+  {
+    if (workers[i].jobs)
+      fclose (workers[i].jobs);
+    waitpid (workers[i].pid, NULL, 0);
+  }
+  return jobs_failed ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+/* flash-host: runs the Flash library on behalf of a FlashHost in another
+ * process. The plugin window is embedded back into the client through a
+ * GtkPlug, commands arrive on the Unix socket passed as the first
+ * argument. */
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gtk/gtk.h>
+#include <flash/flash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "flash-host-internal.h"
+
+static FlashLibrary *library = NULL;
+static FlashFile *file = NULL;
+static GtkWidget *plug = NULL;
+static int sock = -1;
+
+static void
+send_reply (gboolean result, GError *error)
+{
+  FlashHostMessage reply;
+
+  memset (&reply, 0, sizeof(reply));
+  reply.type = FLASH_HOST_REPLY;
+  reply.args[0] = result;
+  if (error)
+    g_strlcpy (reply.text, error->message, sizeof(reply.text));
+  flash_host_message_send (sock, &reply, -1);
+}
+
+static void
+on_flash_event (FlashFile *file, FlashFileEvent event, gpointer data)
+{
+  FlashHostMessage msg;
+
+  /* The protocol only knows about playback stopping */
+  if (event != FLASH_FILE_PLAYBACK_STOPPED)
+    return;
+
+  memset (&msg, 0, sizeof(msg));
+  msg.type = FLASH_HOST_EVENT;
+  msg.args[0] = event;
+  flash_host_message_send (sock, &msg, -1);
+}
+
+static void
+host_stop (void)
+{
+  if (file)
+  {
+    flash_file_stop (file);
+    g_object_unref (file);
+    file = NULL;
+  }
+  if (plug)
+  {
+    gtk_widget_destroy (plug);
+    plug = NULL;
+  }
+}
+
+static gboolean
+host_play (FlashHostMessage *msg, int fd, GError **error)
+{
+  host_stop ();
+
+  file = flash_file_new_from_fd (library, fd, msg->text, on_flash_event,
+                                 NULL, error);
+  if (!file)
+    return FALSE;
+
+  plug = gtk_plug_new ((GdkNativeWindow) msg->args[0]);
+  gtk_window_set_default_size (GTK_WINDOW (plug), msg->args[1], msg->args[2]);
+  gtk_widget_show (plug);
+  gdk_flush ();
+
+  if (!flash_file_play (file, GTK_WINDOW (plug), msg->args[3], error))
+  {
+    host_stop ();
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+on_command (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  FlashHostMessage msg;
+  GError *error;
+  gboolean result;
+  int fd;
+
+  if (!(condition & G_IO_IN) || !flash_host_message_recv (sock, &msg, &fd))
+  {
+    /* Client went away */
+    gtk_main_quit ();
+    return FALSE;
+  }
+
+  error = NULL;
+  result = FALSE;
+  switch (msg.type)
+  {
+    case FLASH_HOST_CMD_PLAY:
+      if (fd != -1)
+        result = host_play (&msg, fd, &error);
+      break;
+    case FLASH_HOST_CMD_STOP:
+      result = file != NULL;
+      host_stop ();
+      break;
+    case FLASH_HOST_CMD_PAUSE:
+      result = file && flash_file_pause (file);
+      break;
+    case FLASH_HOST_CMD_RESUME:
+      result = file && flash_file_resume (file);
+      break;
+    case FLASH_HOST_CMD_IS_PLAYING:
+      result = file && flash_file_is_playing (file);
+      break;
+    default:
+      fprintf (stderr, "flash-host: ignoring unknown command %d\n", msg.type);
+      break;
+  }
+
+  send_reply (result, error);
+  if (error)
+    g_error_free (error);
+  if (fd != -1)
+    close (fd);
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GError *error;
+  GIOChannel *channel;
+  const char *plugin_path;
+
+  if (argc < 3)
+  {
+    fprintf (stderr, "usage: %s socket-fd plugin.so\n", argv[0]);
+    return 1;
+  }
+  sock = atoi (argv[1]);
+  plugin_path = argv[2];
+
+  if (!flash_init (&argc, &argv))
+  {
+    fprintf (stderr, "flash-host: failed to initialize Flash library\n");
+    return 1;
+  }
+
+  error = NULL;
+  library = flash_library_new (plugin_path, &error);
+  send_reply (library != NULL, error);
+  if (error != NULL)
+  {
+    g_error_free (error);
+    return 1;
+  }
+
+  channel = g_io_channel_unix_new (sock);
+  g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR, on_command, NULL);
+  gtk_main ();
+
+  host_stop ();
+  g_io_channel_unref (channel);
+  g_object_unref (library);
+  close (sock);
+  return 0;
+}
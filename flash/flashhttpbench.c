@@ -0,0 +1,325 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+/* flash-http-bench: fetches from a stand-in HTTP server running in a child
+ * process, and reports requests/s with and without keep-alive, for length
+ * delimited and chunked bodies, and with a consumer that only takes part
+ * of what it is offered. Every response is checked for its size. */
+
+#include <glib.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash-http.h"
+
+typedef struct {
+  GMainLoop *loop;
+  FlashHttpPool *pool;
+  const gchar *url;
+  gint requests;
+  gint started;
+  gint running;
+  gsize size;
+  gsize received;
+  gboolean slow;
+  gint slow_calls;
+  gint failures;
+} Bench;
+
+/* --- The server --- */
+
+/* Writes all of buf, or fails */
+static gboolean
+write_all (int fd, const void *buf, gsize len)
+{
+  const gchar *p = buf;
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = write (fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    p += n;
+    len -= n;
+  }
+  return TRUE;
+}
+
+static void
+serve_connection (int fd)
+{
+  gchar req[4096];
+  gchar head[256];
+  gchar body[4096];
+  gsize have;
+  gsize size;
+  gsize sent;
+  gsize n;
+  gchar *end;
+  gchar *path;
+  gboolean chunked;
+  gboolean close_after;
+  ssize_t r;
+
+  memset (body, 'x', sizeof(body));
+  have = 0;
+  while (TRUE)
+  {
+    while (!(end = g_strstr_len (req, have, "\r\n\r\n")))
+    {
+      r = read (fd, req + have, sizeof(req) - have - 1);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return;
+      have += r;
+    }
+    req[have] = '\0';
+    path = strchr (req, ' ') + 1;
+    chunked = strncmp (path, "/chunked/", 9) == 0;
+    size = strtoul (strchr (path + 1, '/') + 1, NULL, 10);
+    close_after = strstr (path, "?close") != NULL;
+
+    if (chunked)
+      snprintf (head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Transfer-Encoding: chunked\r\n%s\r\n",
+                close_after ? "Connection: close\r\n" : "");
+    else
+      snprintf (head, sizeof(head), "HTTP/1.1 200 OK\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Content-Length: %lu\r\n%s\r\n", (gulong) size,
+                close_after ? "Connection: close\r\n" : "");
+    if (!write_all (fd, head, strlen (head)))
+      return;
+    for (sent = 0; sent < size; sent += n)
+    {
+      n = MIN (size - sent, sizeof(body));
+      if (chunked)
+      {
+        snprintf (head, sizeof(head), "%lx\r\n", (gulong) n);
+        if (!write_all (fd, head, strlen (head)))
+          return;
+      }
+      if (!write_all (fd, body, n))
+        return;
+      if (chunked && !write_all (fd, "\r\n", 2))
+        return;
+    }
+    if (chunked && !write_all (fd, "0\r\n\r\n", 5))
+      return;
+    if (close_after)
+      return;
+
+    end += 4;
+    have -= end - req;
+    memmove (req, end, have);
+  }
+}
+
+static pid_t
+start_server (gint *port)
+{
+  struct sockaddr_in addr;
+  socklen_t len;
+  pid_t pid;
+  int listen_fd;
+  int fd;
+  int one;
+
+  listen_fd = socket (AF_INET, SOCK_STREAM, 0);
+  one = 1;
+  setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset (&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      listen (listen_fd, 128) == -1)
+  {
+    perror ("flash-http-bench: bind");
+    exit (1);
+  }
+  len = sizeof(addr);
+  getsockname (listen_fd, (struct sockaddr *) &addr, &len);
+  *port = ntohs (addr.sin_port);
+
+  pid = fork ();
+  if (pid != 0)
+  {
+    close (listen_fd);
+    return pid;
+  }
+
+  signal (SIGCHLD, SIG_IGN);
+  while ((fd = accept (listen_fd, NULL, NULL)) != -1)
+  {
+    /* Headers and body go out in separate writes */
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (fork () == 0)
+    {
+      close (listen_fd);
+      serve_connection (fd);
+      _exit (0);
+    }
+    close (fd);
+  }
+  _exit (0);
+}
+
+/* --- The client --- */
+
+static gboolean
+on_headers (FlashHttpRequest *request, gint status, const gchar *content_type,
+            gint64 length, gpointer user_data)
+{
+  return status == 200;
+}
+
+static gssize
+on_body (FlashHttpRequest *request, const guint8 *data, gsize len,
+         gpointer user_data)
+{
+  Bench *bench;
+
+  bench = user_data;
+  /* Takes at most 1KB, and nothing every third time */
+  if (bench->slow)
+  {
+    if (++bench->slow_calls % 3 == 0)
+      return 0;
+    len = MIN (len, 1024);
+  }
+  bench->received += len;
+  return len;
+}
+
+static void start_requests (Bench *bench);
+
+static void
+on_done (FlashHttpRequest *request, const GError *error, gpointer user_data)
+{
+  Bench *bench;
+
+  bench = user_data;
+  if (error)
+  {
+    fprintf (stderr, "flash-http-bench: %s\n", error->message);
+    bench->failures++;
+  }
+  bench->running--;
+  start_requests (bench);
+}
+
+static void
+start_requests (Bench *bench)
+{
+  GError *error;
+
+  while (bench->started < bench->requests && bench->running < 8)
+  {
+    error = NULL;
+    bench->started++;
+    bench->running++;
+    if (!flash_http_get (bench->pool, bench->url, NULL, on_headers, on_body,
+                         on_done, bench, &error))
+    {
+      fprintf (stderr, "flash-http-bench: %s\n", error->message);
+      g_error_free (error);
+      bench->failures++;
+      bench->running--;
+    }
+  }
+  if (bench->running == 0)
+    g_main_loop_quit (bench->loop);
+}
+
+static gboolean
+run (const gchar *name, gint port, const gchar *kind, gsize size,
+     gint requests, gboolean keep_alive, gboolean slow)
+{
+  FlashHttpStats stats;
+  GTimer *timer;
+  Bench bench;
+  gchar *url;
+  gdouble elapsed;
+  gboolean ok;
+
+  url = g_strdup_printf ("http://127.0.0.1:%d/%s/%lu%s", port, kind,
+                         (gulong) size, keep_alive ? "" : "?close");
+  memset (&bench, 0, sizeof(bench));
+  bench.loop = g_main_loop_new (NULL, FALSE);
+  bench.pool = flash_http_pool_new ("flash-http-bench", keep_alive ? 8 : 0,
+                                    10000);
+  bench.url = url;
+  bench.requests = requests;
+  bench.size = size;
+  bench.slow = slow;
+
+  timer = g_timer_new ();
+  start_requests (&bench);
+  if (bench.running)
+    g_main_loop_run (bench.loop);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  flash_http_pool_get_stats (bench.pool, &stats);
+  ok = bench.failures == 0 && bench.received == size * requests;
+  printf ("%-24s: %8.0f requests/s %8.1f MB/s, %u connections%s\n", name,
+          requests / elapsed, bench.received / elapsed / (1024 * 1024),
+          stats.connections, ok ? "" : " FAILED");
+
+  g_timer_destroy (timer);
+  flash_http_pool_free (bench.pool);
+  g_main_loop_unref (bench.loop);
+  g_free (url);
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  gint requests;
+  gsize size;
+  pid_t server;
+  gint port;
+  gboolean ok;
+
+  requests = argc > 1 ? atoi (argv[1]) : 2000;
+  size = argc > 2 ? strtoul (argv[2], NULL, 10) : 16384;
+  if (requests <= 0)
+  {
+    fprintf (stderr, "usage: %s [requests [body size]]\n", argv[0]);
+    return 1;
+  }
+
+  server = start_server (&port);
+  printf ("%d requests of %lu bytes, 8 at a time\n", requests, (gulong) size);
+
+  ok = run ("keep-alive", port, "len", size, requests, TRUE, FALSE);
+  ok &= run ("new connections", port, "len", size, requests, FALSE, FALSE);
+  ok &= run ("keep-alive, chunked", port, "chunked", size, requests, TRUE,
+             FALSE);
+  ok &= run ("keep-alive, slow reader", port, "len", size, requests / 10 + 1,
+             TRUE, TRUE);
+
+  kill (server, SIGTERM);
+  waitpid (server, NULL, 0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/* Flash Plugin Wrapper Library
+ * (C) Copyright 2004-2005 Leon Breedt
+ *
+ * Licensed under the terms of the MIT license.
+ */
+
+/* flash-pixel-bench: checks that the vector pixel kernels match the scalar
+ * ones bit for bit, and reports frames/s for each of them. The compositing
+ * kernels are timed in ms per frame, over whole frames of random pixels. */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash-pixel.h"
+
+#define ITERATIONS 100
+
+enum
+{
+  BENCH_PREMULTIPLY,
+  BENCH_UNPREMULTIPLY,
+  BENCH_SWIZZLE,
+  BENCH_OVER,
+  BENCH_DOWNSCALE,
+  BENCH_LAST
+};
+
+static const gchar *bench_names[] = {
+  "premultiply", "unpremultiply", "swizzle", "over", "box 2:1"
+};
+
+static void
+bench_compositing (FlashPixelKernel k, GTimer *timer, guint8 *src,
+                   guint8 *dst, gint width, gint height)
+{
+  gsize n = width * height;
+  gint op;
+  gint i;
+
+  for (op = 0; op < BENCH_LAST; op++)
+  {
+    g_timer_start (timer);
+    for (i = 0; i < ITERATIONS; i++)
+    {
+      switch (op)
+      {
+        case BENCH_PREMULTIPLY:
+          flash_pixel_premultiply (dst, n);
+          break;
+        case BENCH_UNPREMULTIPLY:
+          flash_pixel_unpremultiply (dst, n);
+          break;
+        case BENCH_SWIZZLE:
+          flash_pixel_swizzle (src, dst, n, TRUE);
+          break;
+        case BENCH_OVER:
+          flash_pixel_over (src, dst, n);
+          break;
+        case BENCH_DOWNSCALE:
+          flash_pixel_downscale_box (src, width * 4, width, height, 2,
+                                     dst, width * 2);
+          break;
+      }
+    }
+    printf ("%-6s %-13s: %8.2f ms/frame\n", flash_pixel_kernel_name (k),
+            bench_names[op],
+            g_timer_elapsed (timer, NULL) * 1000 / ITERATIONS);
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  FlashPixelKernel k;
+  GTimer *timer;
+  guint8 *src;
+  guint8 *out;
+  gsize plane;
+  gint width;
+  gint height;
+  gint i;
+
+  width = 1920;
+  height = 1080;
+  if (argc > 1 && sscanf (argv[1], "%dx%d", &width, &height) != 2)
+  {
+    fprintf (stderr, "usage: %s [WxH]\n", argv[0]);
+    return 1;
+  }
+  width &= ~1;
+  height &= ~1;
+
+  if (!flash_pixel_self_test ())
+  {
+    fprintf (stderr, "flash-pixel-bench: kernels are not bit exact\n");
+    return 1;
+  }
+  printf ("self test passed, default kernel %s\n",
+          flash_pixel_kernel_name (flash_pixel_get_kernel ()));
+
+  plane = width * height;
+  src = g_malloc (plane * 4);
+  out = g_malloc (plane * 4);
+  for (i = 0; i < (gint) plane * 4; i++)
+    src[i] = rand ();
+
+  timer = g_timer_new ();
+  for (k = FLASH_PIXEL_SCALAR; k <= FLASH_PIXEL_LAST; k++)
+  {
+    if (!flash_pixel_kernel_supported (k))
+      continue;
+    flash_pixel_set_kernel (k);
+
+    g_timer_start (timer);
+    for (i = 0; i < ITERATIONS; i++)
+      flash_pixel_bgra_to_i420 (src, width * 4, width, height,
+                                out, width, out + plane, width / 2,
+                                out + plane * 5 / 4, width / 2);
+    printf ("%-6s BGRA->I420 %dx%d: %8.1f frames/s\n",
+            flash_pixel_kernel_name (k), width, height,
+            ITERATIONS / g_timer_elapsed (timer, NULL));
+
+    g_timer_start (timer);
+    for (i = 0; i < ITERATIONS; i++)
+      flash_pixel_bgra_to_nv12 (src, width * 4, width, height,
+                                out, width, out + plane, width);
+    printf ("%-6s BGRA->NV12 %dx%d: %8.1f frames/s\n",
+            flash_pixel_kernel_name (k), width, height,
+            ITERATIONS / g_timer_elapsed (timer, NULL));
+
+    memcpy (out, src, plane * 4);
+    bench_compositing (k, timer, src, out, width, height);
+  }
+
+  g_timer_destroy (timer);
+  g_free (src);
+  g_free (out);
+  return 0;
+}
@@ -48,8 +48,10 @@
 #include <assert.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 /* Xlib/Xt stuff */
@@ -65,6 +67,9 @@
 
 #define XTBIN_MAX_EVENTS 30
 
+/* how often (ms) the event pump thread wakes up to run Xt timers */
+#define XTBIN_PUMP_INTERVAL 10
+
 static void            gtk_xtbin_class_init (GtkXtBinClass *klass);
 static void            gtk_xtbin_init       (GtkXtBin      *xtbin);
 static void            gtk_xtbin_realize    (GtkWidget      *widget);
@@ -72,8 +77,15 @@ static void            gtk_xtbin_unrealize    (GtkWidget      *widget);
 static void            gtk_xtbin_destroy    (GtkObject      *object);
 //static void            gtk_xtbin_shutdown   (GtkObject      *object);
 
+/* Per-display Xt connections */
+static XtDisplayContext *xt_display_context_ref   (GdkWindow *parent_window);
+static void              xt_display_context_unref (XtDisplayContext *context);
+static void              xt_event_pump_start      (XtDisplayContext *context);
+static void              xt_event_pump_stop       (XtDisplayContext *context);
+
 /* Xt aware XEmbed */
 static void       xt_client_init      (XtClient * xtclient, 
+                                       XtDisplayContext *context,
                                        Visual *xtvisual, 
                                        Colormap xtcolormap, 
                                        int xtdepth);
@@ -113,23 +125,58 @@ static int        trapped_error_code = 0;
 
 static GtkWidgetClass *parent_class = NULL;
 
-static Display         *xtdisplay = NULL;
+/* In event thread mode a display's Xt connection is pumped by its own
+ * thread instead of the GTK main loop. The plugin isn't thread safe, so
+ * a pump only dispatches while holding the plugin lock, and everything
+ * else that calls into the plugin or its Xt connections takes the lock
+ * as well. Each pump owns its XtEventPump and frees it on exit, so it can
+ * be stopped without joining (the caller may hold the plugin lock). */
+typedef struct {
+  XtDisplayContext *context;
+  gboolean          running;
+  int               wake_pipe[2];
+} XtEventPump;
+
+/* Every X display and screen the widgets live on gets its own Xt
+ * application context and display connection, each hooked into the main
+ * loop with its own event source, poll fd and timer. This way a burst of
+ * traffic on one screen is never processed on behalf of another. */
+struct _XtDisplayContext {
+  gchar        *name;             /* "display/screen" lookup key */
+  XtAppContext  app_context;
+  Display      *xtdisplay;
+  int           xtscreen;
+
+  GSource      *source;
+  XtEventPump  *pump;
+  guint         tag;
+  GPollFD       poll_fd;
+  gint          polling_timer_id;
+  gint          num_widgets;
+};
+
+typedef struct {
+  GSource           source;
+  XtDisplayContext *context;
+} XtEventSource;
+
 static String          *fallback = NULL;
 static gboolean         xt_is_initialized = FALSE;
-static gint             num_widgets = 0;
-
-static GPollFD          xt_event_poll_fd;
-static gint             xt_polling_timer_id = 0;
-static guint            tag = 0;
+static GSList          *xt_contexts = NULL;
+static gboolean         xt_event_thread = FALSE;
+static GStaticRecMutex  xt_plugin_mutex = G_STATIC_REC_MUTEX_INIT;
+/* Set on the Xt event threads */
+static GStaticPrivate   xt_pump_thread = G_STATIC_PRIVATE_INIT;
 
 static gboolean
 xt_event_prepare (GSource*  source_data,
                    gint     *timeout)
 {   
+  XtDisplayContext *context = ((XtEventSource *)source_data)->context;
   int mask;
 
   GDK_THREADS_ENTER();
-  mask = XPending(xtdisplay);
+  mask = XPending(context->xtdisplay);
   GDK_THREADS_LEAVE();
 
   return (gboolean)mask;
@@ -138,11 +185,13 @@ xt_event_prepare (GSource*  source_data,
 static gboolean
 xt_event_check (GSource*  source_data)
 {
+  XtDisplayContext *context = ((XtEventSource *)source_data)->context;
+
   GDK_THREADS_ENTER ();
 
-  if (xt_event_poll_fd.revents & G_IO_IN) {
+  if (context->poll_fd.revents & G_IO_IN) {
     int mask;
-    mask = XPending(xtdisplay);
+    mask = XPending(context->xtdisplay);
     GDK_THREADS_LEAVE ();
     return (gboolean)mask;
   }
@@ -156,10 +205,11 @@ xt_event_dispatch (GSource*  source_data,
                     GSourceFunc call_back,
                     gpointer  user_data)
 {
+  XtDisplayContext *context = ((XtEventSource *)source_data)->context;
   XtAppContext ac;
   int i = 0;
 
-  ac = XtDisplayToApplicationContext(xtdisplay);
+  ac = context->app_context;
 
   GDK_THREADS_ENTER ();
 
@@ -168,7 +218,7 @@ xt_event_dispatch (GSource*  source_data,
    * XtAppProcessEvent so that it will look for X events.  There's no
    * timer processing here since we already have a timer callback that
    * does it.  */
-  for (i=0; i < XTBIN_MAX_EVENTS && XPending(xtdisplay); i++) {
+  for (i=0; i < XTBIN_MAX_EVENTS && XPending(context->xtdisplay); i++) {
     XtAppProcessEvent(ac, XtIMXEvent);
   }
 
@@ -181,7 +231,7 @@ static GSourceFuncs xt_event_funcs = {
   xt_event_prepare,
   xt_event_check,
   xt_event_dispatch,
-  (void (*)(GSource *))g_free,
+  NULL,
   (GSourceFunc)NULL,
   (GSourceDummyMarshal)NULL
 };
@@ -189,11 +239,11 @@ static GSourceFuncs xt_event_funcs = {
 static gboolean
 xt_event_polling_timer_callback(gpointer user_data)
 {
-  Display * display;
+  XtDisplayContext *context;
   XtAppContext ac;
 
-  display = (Display *)user_data;
-  ac = XtDisplayToApplicationContext(display);
+  context = (XtDisplayContext *)user_data;
+  ac = context->app_context;
 
   /* don't starve the primary event queue - just process one event */
   if (XtAppPending(ac))
@@ -201,6 +251,109 @@ xt_event_polling_timer_callback(gpointer user_data)
   return TRUE;
 }
 
+static gpointer
+xt_event_pump_thread (gpointer data)
+{
+  XtEventPump *pump;
+  XtAppContext ac;
+  struct pollfd fds[2];
+  gboolean running;
+  char buf[16];
+  int i;
+
+  pump = (XtEventPump *)data;
+  ac = pump->context->app_context;
+  g_static_private_set(&xt_pump_thread, GINT_TO_POINTER(1), NULL);
+
+  fds[0].fd = ConnectionNumber(pump->context->xtdisplay);
+  fds[0].events = POLLIN;
+  fds[1].fd = pump->wake_pipe[0];
+  fds[1].events = POLLIN;
+
+  do {
+    fds[0].revents = fds[1].revents = 0;
+    poll(fds, 2, XTBIN_PUMP_INTERVAL);
+    if (fds[1].revents & POLLIN)
+      read(pump->wake_pipe[0], buf, sizeof(buf));
+
+    gtk_xtbin_plugin_lock();
+    running = pump->running;
+    if (running) {
+      /* Same limit as xt_event_dispatch, then any Xt timers (this is
+         what drives the plugin's frame ticks) that have come due */
+      for (i=0; i < XTBIN_MAX_EVENTS && XPending(pump->context->xtdisplay); i++)
+        XtAppProcessEvent(ac, XtIMXEvent);
+      for (i=0; i < XTBIN_MAX_EVENTS && (XtAppPending(ac) & XtIMTimer); i++)
+        XtAppProcessEvent(ac, XtIMTimer);
+    }
+    gtk_xtbin_plugin_unlock();
+  } while (running);
+
+  close(pump->wake_pipe[0]);
+  close(pump->wake_pipe[1]);
+  g_free(pump);
+  return NULL;
+}
+
+static void
+xt_event_pump_start (XtDisplayContext *context)
+{
+  XtEventPump *pump;
+
+  pump = g_new0(XtEventPump, 1);
+  pump->context = context;
+  pump->running = TRUE;
+  if (pipe(pump->wake_pipe) == -1 ||
+      !g_thread_create(xt_event_pump_thread, pump, FALSE, NULL)) {
+    g_warning("Failed to start Xt event thread, using the main loop");
+    g_free(pump);
+    return;
+  }
+  context->pump = pump;
+}
+
+static void
+xt_event_pump_stop (XtDisplayContext *context)
+{
+  gtk_xtbin_plugin_lock();
+  context->pump->running = FALSE;
+  write(context->pump->wake_pipe[1], "", 1);
+  context->pump = NULL;
+  gtk_xtbin_plugin_unlock();
+}
+
+void
+gtk_xtbin_set_event_thread (gboolean enabled)
+{
+  GSList *l;
+
+  for (l = xt_contexts; l; l = l->next)
+    g_return_if_fail(((XtDisplayContext *)l->data)->num_widgets == 0);
+  if (enabled && !g_thread_supported())
+    g_thread_init(NULL);
+  xt_event_thread = enabled;
+}
+
+void
+gtk_xtbin_plugin_lock (void)
+{
+  if (xt_event_thread)
+    g_static_rec_mutex_lock(&xt_plugin_mutex);
+}
+
+void
+gtk_xtbin_plugin_unlock (void)
+{
+  if (xt_event_thread)
+    g_static_rec_mutex_unlock(&xt_plugin_mutex);
+}
+
+gboolean
+gtk_xtbin_in_event_thread (void)
+{
+  return xt_event_thread && g_static_private_get(&xt_pump_thread) != NULL;
+}
+
 GtkType
 gtk_xtbin_get_type (void)
 {
@@ -243,6 +396,7 @@ static void
 gtk_xtbin_init (GtkXtBin *xtbin)
 {
   xtbin->xtdisplay = NULL;
+  xtbin->context = NULL;
   xtbin->parent_window = NULL;
   xtbin->xtwindow = 0;
   xtbin->x = 0;
@@ -281,11 +435,13 @@ gtk_xtbin_realize (GtkWidget *widget)
   (*GTK_WIDGET_CLASS(parent_class)->realize)(widget);
 
   /* create the Xt client widget */
+  gtk_xtbin_plugin_lock();
   xt_client_create(&(xtbin->xtclient), 
        gtk_socket_get_id(GTK_SOCKET(xtbin)), 
        xtbin->height, 
        xtbin->width);
   xtbin->xtwindow = XtWindow(xtbin->xtclient.child_widget);
+  gtk_xtbin_plugin_unlock();
 
   gdk_flush();
 
@@ -310,15 +466,14 @@ gtk_xtbin_new (GdkWindow *parent_window, String * f)
   if (f)
     fallback = f;
 
-  /* Initialize the Xt toolkit */
+  /* Initialize the Xt toolkit, and hook the Xt connection for this
+     display into the mainloop if this is the first widget on it */
   xtbin->parent_window = parent_window;
+  gtk_xtbin_plugin_lock();
+  xtbin->context = xt_display_context_ref(parent_window);
+  gtk_xtbin_plugin_unlock();
 
-  xt_client_init(&(xtbin->xtclient), 
-      GDK_VISUAL_XVISUAL(gdk_window_get_visual(parent_window )),
-      GDK_COLORMAP_XCOLORMAP(gdk_window_get_colormap(parent_window)),
-      gdk_window_get_visual(parent_window )->depth);
-
-  if (!xtbin->xtclient.xtdisplay) {
+  if (!xtbin->context) {
     /* If XtOpenDisplay failed, we can't go any further.
      *  Bail out.
      */
@@ -329,44 +484,11 @@ gtk_xtbin_new (GdkWindow *parent_window, String * f)
     return (GtkWidget *)NULL;
   }
 
-  /* If this is the first running widget, hook this display into the
-     mainloop */
-  if (0 == num_widgets) {
-    int           cnumber;
-    /*
-     * hook Xt event loop into the glib event loop.
-     */
-
-    /* the assumption is that gtk_init has already been called */
-    GSource* gs = g_source_new(&xt_event_funcs, sizeof(GSource));
-      if (!gs) {
-       return NULL;
-      }
-    
-    g_source_set_priority(gs, GDK_PRIORITY_EVENTS);
-    g_source_set_can_recurse(gs, TRUE);
-    tag = g_source_attach(gs, (GMainContext*)NULL);
-#ifdef VMS
-    cnumber = XConnectionNumber(xtdisplay);
-#else
-    cnumber = ConnectionNumber(xtdisplay);
-#endif
-    xt_event_poll_fd.fd = cnumber;
-    xt_event_poll_fd.events = G_IO_IN; 
-    xt_event_poll_fd.revents = 0;    /* hmm... is this correct? */
-
-    g_main_context_add_poll ((GMainContext*)NULL, 
-                             &xt_event_poll_fd, 
-                             G_PRIORITY_LOW);
-    /* add a timer so that we can poll and process Xt timers */
-    xt_polling_timer_id =
-      gtk_timeout_add(25,
-                      (GtkFunction)xt_event_polling_timer_callback,
-                      xtdisplay);
-  }
-
-  /* Bump up our usage count */
-  num_widgets++;
+  xt_client_init(&(xtbin->xtclient), 
+      xtbin->context,
+      GDK_VISUAL_XVISUAL(gdk_window_get_visual(parent_window )),
+      GDK_COLORMAP_XCOLORMAP(gdk_window_get_colormap(parent_window)),
+      gdk_window_get_visual(parent_window )->depth);
 
   /* Build the hierachy */
   xtbin->xtdisplay = xtbin->xtclient.xtdisplay;
@@ -390,12 +512,37 @@ gtk_xtbin_set_position (GtkXtBin *xtbin,
     gdk_window_move (GTK_WIDGET (xtbin)->window, x, y);
 }
 
+void
+gtk_xtbin_reparent (GtkWidget *widget,
+                    GdkWindow *parent_window)
+{
+  GtkXtBin *xtbin = GTK_XTBIN (widget);
+  gpointer user_data;
+
+  /* the Xt side is per screen, so we can't move between screens */
+  g_return_if_fail(gdk_drawable_get_screen(parent_window) ==
+                   gdk_drawable_get_screen(xtbin->parent_window));
+  gdk_window_get_user_data(parent_window, &user_data);
+  g_return_if_fail(user_data != NULL);
+
+#ifdef DEBUG_XTBIN
+  printf("gtk_xtbin_reparent %p %p\n", (void *)widget, (void *)parent_window);
+#endif
+
+  /* gtk_widget_reparent() keeps the widget realized and just reparents
+     the socket window, the embedded Xt shell comes along with it */
+  xtbin->parent_window = parent_window;
+  gtk_widget_set_parent_window(widget, parent_window);
+  gtk_widget_reparent(widget, GTK_WIDGET(user_data));
+}
+
 void
 gtk_xtbin_resize (GtkWidget *widget,
                   gint       width,
                   gint       height)
 {
   Arg args[2];
+  GtkAllocation allocation;
   GtkXtBin *xtbin = GTK_XTBIN (widget);
 
 #ifdef DEBUG_XTBIN
@@ -404,9 +551,19 @@ gtk_xtbin_resize (GtkWidget *widget,
 
   XtSetArg(args[0], XtNheight, height);
   XtSetArg(args[1], XtNwidth,  width);
+  gtk_xtbin_plugin_lock();
   XtSetValues(xtbin->xtclient.top_widget, args, 2);
+  gtk_xtbin_plugin_unlock();
   xtbin->height = height;
   xtbin->width  = width;
+
+  /* the socket window has to follow, and tell the embedded shell about
+     its new size */
+  allocation.x = widget->allocation.x;
+  allocation.y = widget->allocation.y;
+  allocation.width = width;
+  allocation.height = height;
+  gtk_widget_size_allocate(widget, &allocation);
 }
 
 static void
@@ -426,7 +583,9 @@ gtk_xtbin_unrealize (GtkWidget *object)
 
   GTK_WIDGET_UNSET_FLAGS (widget, GTK_VISIBLE);
   if (GTK_WIDGET_REALIZED (widget)) {
+    gtk_xtbin_plugin_lock();
     xt_client_unrealize(&(xtbin->xtclient));
+    gtk_xtbin_plugin_unlock();
   }
 
   (*GTK_WIDGET_CLASS (parent_class)->unrealize)(widget);
@@ -446,28 +605,152 @@ gtk_xtbin_destroy (GtkObject *object)
 
   xtbin = GTK_XTBIN (object);
 
+  gtk_xtbin_plugin_lock();
   if(xtbin->xtwindow) {
     /* remove the event handler */
     xt_client_destroy(&(xtbin->xtclient));
     xtbin->xtwindow = 0;
+  }
+
+  if(xtbin->context) {
+    /* reduce the usage count of our display */
+    xt_display_context_unref(xtbin->context);
+    xtbin->context = NULL;
+  }
+  gtk_xtbin_plugin_unlock();
+
+  GTK_OBJECT_CLASS(parent_class)->destroy(object);
+}
+
+/*
+* Per-display Xt connection management
+*/
+
+/* Find the Xt connection for the display and screen parent_window is on,
+   opening one if this is the first widget there */
+static XtDisplayContext *
+xt_display_context_ref (GdkWindow *parent_window)
+{
+  XtDisplayContext *context;
+  GdkScreen    *screen;
+  const gchar  *display_name;
+  gchar        *name;
+  GSList       *l;
+  char         *mArgv[1];
+  int           mArgc = 0;
+  int           cnumber;
 
-    num_widgets--; /* reduce our usage count */
+  screen = gdk_drawable_get_screen(parent_window);
+  display_name = gdk_display_get_name(gdk_screen_get_display(screen));
+  name = g_strdup_printf("%s/%d", display_name, gdk_screen_get_number(screen));
 
-    /* If this is the last running widget, remove the Xt display
-       connection from the mainloop */
-    if (0 == num_widgets) {
+  context = NULL;
+  for (l = xt_contexts; l; l = l->next) {
+    if (strcmp(((XtDisplayContext *)l->data)->name, name) == 0) {
+      context = (XtDisplayContext *)l->data;
+      break;
+    }
+  }
+
+  if (!context) {
+    if (!xt_is_initialized) {
 #ifdef DEBUG_XTBIN
-      printf("removing the Xt connection from the main loop\n");
+      printf("starting up Xt stuff\n");
 #endif
-      g_main_context_remove_poll((GMainContext*)NULL, &xt_event_poll_fd);
-      g_source_remove(tag);
+      XtToolkitInitialize();
+      xt_is_initialized = TRUE;
+    }
 
-      gtk_timeout_remove(xt_polling_timer_id);
-      xt_polling_timer_id = 0;
+#ifdef DEBUG_XTBIN
+    printf("opening Xt connection for %s\n", name);
+#endif
+    context = g_new0(XtDisplayContext, 1);
+    context->app_context = XtCreateApplicationContext();
+    if (fallback)
+      XtAppSetFallbackResources(context->app_context, fallback);
+
+    context->xtdisplay = XtOpenDisplay(context->app_context, display_name,
+                                       NULL, "Wrapper", NULL, 0,
+                                       &mArgc, mArgv);
+    if (!context->xtdisplay) {
+      XtDestroyApplicationContext(context->app_context);
+      g_free(context);
+      g_free(name);
+      return NULL;
     }
+    context->xtscreen = gdk_screen_get_number(screen);
+    context->name = name;
+    xt_contexts = g_slist_prepend(xt_contexts, context);
+  } else {
+    g_free(name);
   }
 
-  GTK_OBJECT_CLASS(parent_class)->destroy(object);
+  if (0 == context->num_widgets && xt_event_thread)
+    xt_event_pump_start(context);
+
+  if (0 == context->num_widgets && !context->pump) {
+    /*
+     * hook Xt event loop into the glib event loop.
+     */
+
+    /* the assumption is that gtk_init has already been called */
+    context->source = g_source_new(&xt_event_funcs, sizeof(XtEventSource));
+    ((XtEventSource *)context->source)->context = context;
+    
+    g_source_set_priority(context->source, GDK_PRIORITY_EVENTS);
+    g_source_set_can_recurse(context->source, TRUE);
+    context->tag = g_source_attach(context->source, (GMainContext*)NULL);
+#ifdef VMS
+    cnumber = XConnectionNumber(context->xtdisplay);
+#else
+    cnumber = ConnectionNumber(context->xtdisplay);
+#endif
+    context->poll_fd.fd = cnumber;
+    context->poll_fd.events = G_IO_IN; 
+    context->poll_fd.revents = 0;
+
+    g_main_context_add_poll ((GMainContext*)NULL, 
+                             &context->poll_fd, 
+                             G_PRIORITY_LOW);
+    /* add a timer so that we can poll and process Xt timers */
+    context->polling_timer_id =
+      gtk_timeout_add(25,
+                      (GtkFunction)xt_event_polling_timer_callback,
+                      context);
+  }
+
+  /* Bump up our usage count */
+  context->num_widgets++;
+  return context;
+}
+
+static void
+xt_display_context_unref (XtDisplayContext *context)
+{
+  context->num_widgets--;
+
+  if (0 == context->num_widgets && context->pump) {
+    xt_event_pump_stop(context);
+    return;
+  }
+
+  /* If this is the last running widget, remove the Xt display
+     connection from the mainloop. The connection itself stays open, the
+     plugin may well hang on to the Display. */
+  if (0 == context->num_widgets) {
+#ifdef DEBUG_XTBIN
+    printf("removing the Xt connection for %s from the main loop\n",
+           context->name);
+#endif
+    g_main_context_remove_poll((GMainContext*)NULL, &context->poll_fd);
+    g_source_destroy(context->source);
+    g_source_unref(context->source);
+    context->source = NULL;
+    context->tag = 0;
+
+    gtk_timeout_remove(context->polling_timer_id);
+    context->polling_timer_id = 0;
+  }
 }
 
 /*
@@ -477,14 +760,11 @@ gtk_xtbin_destroy (GtkObject *object)
 /* Initial Xt plugin */
 static void
 xt_client_init( XtClient * xtclient, 
+                XtDisplayContext *context,
                 Visual *xtvisual, 
                 Colormap xtcolormap,
                 int xtdepth)
 {
-  XtAppContext  app_context;
-  char         *mArgv[1];
-  int           mArgc = 0;
-
   /*
    * Initialize Xt stuff
    */
@@ -495,21 +775,8 @@ xt_client_init( XtClient * xtclient,
   xtclient->xtcolormap = 0;
   xtclient->xtdepth = 0;
 
-  if (!xt_is_initialized) {
-#ifdef DEBUG_XTBIN
-    printf("starting up Xt stuff\n");
-#endif
-    XtToolkitInitialize();
-    app_context = XtCreateApplicationContext();
-    if (fallback)
-      XtAppSetFallbackResources(app_context, fallback);
-
-    xtdisplay = XtOpenDisplay(app_context, gdk_get_display(), NULL, 
-                            "Wrapper", NULL, 0, &mArgc, mArgv);
-    if (xtdisplay)
-      xt_is_initialized = TRUE;
-  }
-  xtclient->xtdisplay  = xtdisplay;
+  xtclient->xtdisplay  = context->xtdisplay;
+  xtclient->xtscreen   = context->xtscreen;
   xtclient->xtvisual   = xtvisual;
   xtclient->xtcolormap = xtcolormap;
   xtclient->xtdepth    = xtdepth;
@@ -531,10 +798,13 @@ xt_client_create ( XtClient* xtclient ,
 #ifdef DEBUG_XTBIN
   printf("xt_client_create() \n");
 #endif
+  n = 0;
+  XtSetArg(args[n], XtNscreen,
+           ScreenOfDisplay(xtclient->xtdisplay, xtclient->xtscreen)); n++;
   top_widget = XtAppCreateShell("drawingArea", "Wrapper", 
                                 applicationShellWidgetClass, 
                                 xtclient->xtdisplay, 
-                                NULL, 0);
+                                args, n);
   xtclient->top_widget = top_widget;
 
   /* set size of Xt window */
@@ -59,9 +59,11 @@ typedef struct _GtkXtBinClass GtkXtBinClass;
 #define GTK_IS_XTBIN_CLASS(klass)       (GTK_CHECK_CLASS_TYPE ((klass), \
                                          GTK_TYPE_XTBIN))
 typedef struct _XtClient XtClient;
+typedef struct _XtDisplayContext XtDisplayContext;
 
 struct _XtClient {
   Display	*xtdisplay;
+  int		xtscreen;
   Widget	top_widget;    /* The toplevel widget */
   Widget	child_widget;  /* The embeded widget */
   Visual	*xtvisual;
@@ -75,6 +77,7 @@ struct _GtkXtBin
   GtkSocket      gsocket;
   GdkWindow     *parent_window;
   Display       *xtdisplay;        /* Xt Toolkit Display */
+  XtDisplayContext *context;       /* Xt connection for our display */
 
   Window         xtwindow;         /* Xt Toolkit XWindow */
   gint           x, y;
@@ -95,6 +98,20 @@ void       gtk_xtbin_set_position (GtkXtBin *xtbin,
 void       gtk_xtbin_resize (GtkWidget *widget,
                              gint       width,
                              gint       height);
+void       gtk_xtbin_reparent (GtkWidget *widget,
+                               GdkWindow *parent_window);
+
+/* Pump each display's Xt connection from its own thread rather than the
+   GTK main loop. Must be set before the first GtkXtBin is created. While
+   enabled, all calls into the plugin have to be bracketed by
+   gtk_xtbin_plugin_lock()/gtk_xtbin_plugin_unlock(); both are no-ops
+   otherwise. */
+void       gtk_xtbin_set_event_thread (gboolean enabled);
+void       gtk_xtbin_plugin_lock      (void);
+void       gtk_xtbin_plugin_unlock    (void);
+/* Whether the caller is one of the Xt event threads, i.e. the plugin was
+   called from there rather than from the main loop */
+gboolean   gtk_xtbin_in_event_thread  (void);
 
 typedef struct _XtTMRec {
     XtTranslations  translations;       /* private to Translation Manager    */
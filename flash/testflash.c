@@ -18,16 +18,31 @@ static FlashFile *file = NULL;
 static void
 on_flash_event (FlashFile *file, FlashFileEvent event, gpointer data)
 {
+	FlashFileFrameStats stats;
+
 	switch (event) {
 		case FLASH_FILE_PLAYBACK_STOPPED:
 			fprintf (stderr, "Playback of Flash file %p has stopped\n", file);
 			gtk_main_quit ();
 			break;
+		case FLASH_FILE_FRAME_STATS:
+			flash_file_get_frame_stats (file, &stats);
+			fprintf (stderr, "%.1f fps (nominal %.1f), %u frames, %u dropped\n",
+			         stats.frame_rate, stats.nominal_frame_rate,
+			         stats.presented, stats.dropped);
+			break;
 		default:
 			fprintf (stderr, "Ignoring unhandled Flash event %d", event);
 	}
 }
 
+static gboolean
+on_configure_event (GtkWidget *widget, GdkEventConfigure *event, gpointer data)
+{
+  flash_file_resize (file, event->width, event->height, NULL);
+  return FALSE;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -97,8 +112,10 @@ main(int argc, char **argv)
   }
 
   printf ("File '%s' started (playing=%d)\n", swf_path, flash_file_is_playing (file));
+  g_object_set (file, "metrics-interval", 5000, NULL);
 
   g_signal_connect (window, "delete-event", (void (*)(void))gtk_main_quit, NULL);
+  g_signal_connect (window, "configure-event", G_CALLBACK (on_configure_event), NULL);
   signal (2, (void (*)(int))gtk_main_quit);
   gtk_main ();
 